@@ -1,7 +1,34 @@
 dnl * I/O loop function
 AC_DEFUN([DOVECOT_IOLOOP], [
   have_ioloop=no
-  
+  have_ioloop_uring=no
+
+  AS_IF([test "$ioloop" = "uring"], [
+    AC_CACHE_CHECK([whether we can use io_uring],i_cv_io_uring_works,[
+      AC_COMPILE_IFELSE([AC_LANG_PROGRAM([[
+        #include <linux/io_uring.h>
+        #include <sys/syscall.h>
+      ]], [[
+        struct io_uring_getevents_arg arg;
+        return __NR_io_uring_setup + __NR_io_uring_enter +
+          IORING_OP_POLL_REMOVE + IORING_ENTER_EXT_ARG +
+          IORING_FEAT_EXT_ARG + sizeof(arg);
+      ]])],[
+        i_cv_io_uring_works=yes
+      ], [
+        i_cv_io_uring_works=no
+      ])
+    ])
+    AS_IF([test $i_cv_io_uring_works = yes], [
+      AC_DEFINE(IOLOOP_URING,, [Implement I/O loop with Linux io_uring (with epoll fallback)])
+      have_ioloop_uring=yes
+      dnl epoll is needed as the fallback for kernels without io_uring
+      ioloop=epoll
+    ], [
+      AC_MSG_ERROR([io_uring ioloop requested but linux/io_uring.h is not available])
+    ])
+  ])
+
   AS_IF([test "$ioloop" = "best" || test "$ioloop" = "epoll"], [
     AC_CACHE_CHECK([whether we can use epoll],i_cv_epoll_works,[
       AC_RUN_IFELSE([AC_LANG_PROGRAM([[
@@ -51,4 +78,11 @@ AC_DEFUN([DOVECOT_IOLOOP], [
     AC_DEFINE(IOLOOP_SELECT,, [Implement I/O loop with select()])
     ioloop="select"
   ])
+
+  AS_IF([test "$have_ioloop_uring" = "yes"], [
+    AS_IF([test "$ioloop" != "epoll"], [
+      AC_MSG_ERROR([io_uring ioloop requires epoll as a fallback])
+    ])
+    ioloop=uring
+  ])
 ])
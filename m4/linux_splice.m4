@@ -0,0 +1,19 @@
+dnl * Linux compatible splice()
+AC_DEFUN([DOVECOT_LINUX_SPLICE], [
+  AC_CACHE_CHECK([Linux compatible splice()],i_cv_have_linux_splice,[
+    AC_LINK_IFELSE([AC_LANG_PROGRAM([[
+      #define _GNU_SOURCE
+      #include <fcntl.h>
+    ]], [[
+      splice(0, (void *) 0, 1, (void *) 0, 1,
+             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    ]])],[
+      i_cv_have_linux_splice=yes
+    ], [
+      i_cv_have_linux_splice=no
+    ])
+  ])
+  AS_IF([test $i_cv_have_linux_splice = yes], [
+    AC_DEFINE(HAVE_LINUX_SPLICE,, [Define if you have Linux-compatible splice()])
+  ])
+])
@@ -98,6 +98,7 @@ AC_DEFUN([DOVECOT_SSL], [
     AC_DEFINE(HAVE_SSL_NEW_MEM_FUNCS,, [Define if CRYPTO_set_mem_functions has new style parameters])
   ])
 
+  DOVECOT_CHECK_SSL_FUNC([BIO_get_ktls_send])
   DOVECOT_CHECK_SSL_FUNC([ECDSA_SIG_get0])
   DOVECOT_CHECK_SSL_FUNC([ECDSA_SIG_set0])
   DOVECOT_CHECK_SSL_FUNC([EC_GROUP_order_bits])
@@ -49,6 +49,9 @@ struct anvil_connection {
 	struct ostream *cmd_output;
 	struct io *cmd_io;
 
+	/* CONNECT-DUMP in progress. Input is halted until it finishes. */
+	struct connect_limit_dump *connect_dump;
+
 	char *service;
 	bool master:1;
 	bool fifo:1;
@@ -90,6 +93,7 @@ static unsigned int anvil_max_kick_connections;
 
 static void anvil_connection_destroy(struct connection *_conn);
 static bool kick_user_iter_more(struct anvil_cmd_kick *kick);
+static int anvil_connection_connect_dump_flush(struct anvil_connection *conn);
 
 static void anvil_connection_unref(struct anvil_connection **_conn)
 {
@@ -463,7 +467,20 @@ anvil_connection_request(struct anvil_connection *conn,
 		connect_limit_disconnect(connect_limit, pid, &key, conn_guid);
 	} else if (strcmp(cmd, "CONNECT-DUMP") == 0) {
 		anvil_global_connect_dump_count++;
-		connect_limit_dump(connect_limit, conn->conn.output);
+		i_assert(conn->connect_dump == NULL);
+		conn->connect_dump =
+			connect_limit_dump_begin(connect_limit, conn->conn.output);
+		if (connect_limit_dump_more(conn->connect_dump) != 0)
+			connect_limit_dump_deinit(&conn->connect_dump);
+		else {
+			/* Continue when the output buffer has been flushed.
+			   Don't process further commands until the dump is
+			   finished, so their replies don't get mixed in. */
+			connection_input_halt(&conn->conn);
+			o_stream_set_flush_callback(conn->conn.output,
+				anvil_connection_connect_dump_flush, conn);
+			o_stream_set_flush_pending(conn->conn.output, TRUE);
+		}
 	} else if (strcmp(cmd, "KICK-USER") == 0) {
 		if (args[0] == NULL) {
 			*error_r = "KICK-USER: Not enough parameters";
@@ -629,6 +646,23 @@ anvil_connection_handshake(struct anvil_connection *conn,
 	return 0;
 }
 
+static int anvil_connection_connect_dump_flush(struct anvil_connection *conn)
+{
+	int ret;
+
+	if ((ret = o_stream_flush(conn->conn.output)) <= 0)
+		return ret;
+
+	/* On output error stop dumping. The disconnection is noticed
+	   when reading the input. */
+	if ((ret = connect_limit_dump_more(conn->connect_dump)) == 0)
+		return 0;
+	connect_limit_dump_deinit(&conn->connect_dump);
+	o_stream_unset_flush_callback(conn->conn.output);
+	connection_input_resume(&conn->conn);
+	return ret;
+}
+
 static int
 anvil_connection_input_line(struct connection *_conn, const char *line)
 {
@@ -671,7 +705,7 @@ anvil_connection_input_line(struct connection *_conn, const char *line)
 			error, line);
 		return -1;
 	}
-	return 1;
+	return conn->connect_dump == NULL ? 1 : 0;
 }
 
 void anvil_connection_create(int fd, bool master, bool fifo)
@@ -704,6 +738,7 @@ static void anvil_connection_destroy(struct connection *_conn)
 			connection_disconnect_reason(_conn));
 	}
 	array_free(&conn->commands);
+	connect_limit_dump_deinit(&conn->connect_dump);
 	connection_deinit(&conn->conn);
 
 	if (conn->added_to_hash) {
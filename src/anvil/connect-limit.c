@@ -11,6 +11,11 @@
 #include "ostream.h"
 #include "connect-limit.h"
 
+/* Maximum number of sessions to dump in one connect_limit_dump_more() call */
+#define CONNECT_LIMIT_DUMP_BATCH_COUNT 1000
+/* Stop dumping until the output buffer has been flushed below this size */
+#define CONNECT_LIMIT_DUMP_MAX_BUFFER_SIZE (128*1024)
+
 struct process {
 	pid_t pid;
 	enum kick_type kick_type;
@@ -37,6 +42,8 @@ HASH_TABLE_DEFINE_TYPE(session_alt_username, char *,
 		       struct session_alt_username *);
 
 struct session {
+	/* connect_limit.sessions linked list */
+	struct session *prev, *next;
 	/* process->sessions linked list */
 	struct session *process_prev, *process_next;
 	/* user_hash sessions linked list */
@@ -68,8 +75,19 @@ struct alt_username_field {
 	((session)->dest_ip.family == 0)
 
 struct connect_limit {
+	/* Sessions, userips, processes and their usernames are allocated
+	   from this slab pool. They're small, long-lived and freed in random
+	   order. */
+	pool_t pool;
 	struct str_table *strings;
 
+	/* All sessions in the order they were connected. This is used for
+	   dumping, because unlike hash tables it can be safely iterated while
+	   sessions are added and removed. */
+	struct session *sessions, *sessions_tail;
+	/* Dumps that are still in progress */
+	struct connect_limit_dump *dumps;
+
 	/* username => struct session linked list */
 	HASH_TABLE(char *, struct session *) user_hash;
 	/* userip => unsigned int refcount. Only track for sessions where
@@ -89,6 +107,18 @@ struct connect_limit {
 	HASH_TABLE_TYPE(session_alt_username) *alt_username_hashes;
 };
 
+struct connect_limit_dump {
+	struct connect_limit_dump *prev, *next;
+	struct connect_limit *limit;
+	struct ostream *output;
+
+	/* Next session to dump. This is updated if the session is freed. */
+	struct session *next_session;
+	/* Number of alt username fields sent in the header */
+	unsigned int alt_fields_count;
+	bool finished;
+};
+
 struct connect_limit_iter {
 	pool_t pool;
 	struct connect_limit *limit;
@@ -122,6 +152,7 @@ struct connect_limit *connect_limit_init(void)
 	struct connect_limit *limit;
 
 	limit = i_new(struct connect_limit, 1);
+	limit->pool = pool_slab_create("connect limit", 0);
 	limit->strings = str_table_init();
 	i_array_init(&limit->alt_username_fields, 8);
 	hash_table_create(&limit->user_hash, default_pool, 0,
@@ -155,8 +186,10 @@ void connect_limit_deinit(struct connect_limit **_limit)
 
 	*_limit = NULL;
 
+	i_assert(limit->dumps == NULL);
 	connect_limit_destroy_all_processes(limit);
 
+	i_assert(limit->sessions == NULL);
 	i_assert(hash_table_count(limit->user_hash) == 0);
 	i_assert(hash_table_count(limit->userip_hash) == 0);
 	i_assert(hash_table_count(limit->session_hash) == 0);
@@ -175,6 +208,7 @@ void connect_limit_deinit(struct connect_limit **_limit)
 	i_free(limit->alt_username_hashes);
 	array_free(&limit->alt_username_fields);
 	str_table_deinit(&limit->strings);
+	pool_unref(&limit->pool);
 	i_free(limit);
 }
 
@@ -205,7 +239,7 @@ session_link_process(struct connect_limit *limit, struct session *session,
 
 	process = process_lookup(limit, pid);
 	if (process == NULL) {
-		process = i_new(struct process, 1);
+		process = p_new(limit->pool, struct process, 1);
 		process->pid = pid;
 		hash_table_insert(limit->process_hash,
 				  POINTER_CAST(pid), process);
@@ -230,7 +264,7 @@ session_unlink_process(struct connect_limit *limit, struct session *session)
 	if (process->sessions == NULL) {
 		hash_table_remove(limit->process_hash,
 				  POINTER_CAST(process->pid));
-		i_free(process);
+		p_free(limit->pool, process);
 	}
 }
 
@@ -247,7 +281,10 @@ alt_username_field_find(struct connect_limit *limit, const char *name,
 			*idx_r = i;
 			return TRUE;
 		}
-		if (fields[i].refcount == 0 && first_empty_idx == UINT_MAX)
+		/* Don't reuse fields while dumping, because the dump header
+		   already contains the old field names. */
+		if (fields[i].refcount == 0 && first_empty_idx == UINT_MAX &&
+		    limit->dumps == NULL)
 			first_empty_idx = i;
 	}
 	*idx_r = first_empty_idx;
@@ -306,7 +343,7 @@ alt_username_value_link(struct connect_limit *limit,
 
 	if (!hash_table_lookup_full(limit->alt_username_hashes[alt_idx],
 				    alt_username, &orig_key, &first_alt)) {
-		orig_key = i_strdup(alt_username);
+		orig_key = p_strdup(limit->pool, alt_username);
 		alt->alt_username = orig_key;
 		hash_table_insert(limit->alt_username_hashes[alt_idx],
 				  orig_key, alt);
@@ -335,7 +372,7 @@ session_set_alt_usernames(struct connect_limit *limit, struct session *session,
 
 	session->alt_usernames_count = max_alt_idx + 1;
 	session->alt_usernames =
-		i_new(struct session_alt_username,
+		p_new(limit->pool, struct session_alt_username,
 		      session->alt_usernames_count);
 	for (unsigned int i = 0; i < count; i++) {
 		unsigned int alt_idx = alt_indexes[i];
@@ -368,14 +405,14 @@ session_unset_alt_usernames(struct connect_limit *limit,
 		if (first_alt == NULL) {
 			hash_table_remove(limit->alt_username_hashes[alt_idx],
 					  orig_key);
-			i_free(orig_key);
+			p_free(limit->pool, orig_key);
 		} else if (hash_update) {
 			hash_table_update(limit->alt_username_hashes[alt_idx],
 					  orig_key, first_alt);
 		}
 		alt_username_field_unref(limit, alt_idx);
 	}
-	i_free(session->alt_usernames);
+	p_free(limit->pool, session->alt_usernames);
 }
 
 void connect_limit_connect(struct connect_limit *limit, pid_t pid,
@@ -406,11 +443,11 @@ void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 
 	if (!hash_table_lookup_full(limit->user_hash, key->username,
 				    &username, &first_user_session)) {
-		username = i_strdup(key->username);
+		username = p_strdup(limit->pool, key->username);
 		first_user_session = NULL;
 	}
 
-	session = i_new(struct session, 1);
+	session = p_new(limit->pool, struct session, 1);
 	guid_128_copy(session->conn_guid, conn_guid);
 	session->service = str_table_ref(limit->strings, key->service);
 	if (dest_ip != NULL)
@@ -428,7 +465,7 @@ void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 	if (!SESSION_TRACK_USERIP(session) ||
 	    !hash_table_lookup_full(limit->userip_hash, &userip_lookup,
 				    &userip, &value)) {
-		userip = i_new(struct userip, 1);
+		userip = p_new(limit->pool, struct userip, 1);
 		userip->username = username;
 		userip->protocol = str_table_ref(limit->strings,
 						 userip_lookup.protocol);
@@ -448,12 +485,13 @@ void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 	DLLIST_PREPEND_FULL(&first_user_session, session,
 			    user_prev, user_next);
 	hash_table_update(limit->user_hash, username, session);
+	DLLIST2_APPEND(&limit->sessions, &limit->sessions_tail, session);
 }
 
 static void userip_free(struct connect_limit *limit, struct userip *userip)
 {
 	str_table_unref(limit->strings, &userip->protocol);
-	i_free(userip);
+	p_free(limit->pool, userip);
 }
 
 static void
@@ -483,6 +521,13 @@ session_free(struct connect_limit *limit, struct session *session)
 	struct session *first_user_session;
 	char *orig_username;
 	const char *username = session->userip->username;
+	struct connect_limit_dump *dump;
+
+	for (dump = limit->dumps; dump != NULL; dump = dump->next) {
+		if (dump->next_session == session)
+			dump->next_session = session->next;
+	}
+	DLLIST2_REMOVE(&limit->sessions, &limit->sessions_tail, session);
 
 	if (SESSION_TRACK_USERIP(session))
 		userip_hash_unref(limit, session);
@@ -497,15 +542,15 @@ session_free(struct connect_limit *limit, struct session *session)
 	DLLIST_REMOVE_FULL(&first_user_session, session, user_prev, user_next);
 	if (first_user_session == NULL) {
 		hash_table_remove(limit->user_hash, orig_username);
-		i_free(orig_username);
+		p_free(limit->pool, orig_username);
 	} else if (hash_update) {
 		hash_table_update(limit->user_hash, orig_username,
 				  first_user_session);
 	}
 	session_unset_alt_usernames(limit, session);
 	str_table_unref(limit->strings, &session->service);
-	i_free(session->alt_usernames);
-	i_free(session);
+	p_free(limit->pool, session->alt_usernames);
+	p_free(limit->pool, session);
 }
 
 void connect_limit_disconnect(struct connect_limit *limit, pid_t pid,
@@ -550,7 +595,7 @@ connect_limit_process_free(struct connect_limit *limit, struct process *process)
 		session_free(limit, session);
 	}
 	hash_table_remove(limit->process_hash, POINTER_CAST(process->pid));
-	i_free(process);
+	p_free(limit->pool, process);
 }
 
 void connect_limit_disconnect_pid(struct connect_limit *limit, pid_t pid)
@@ -562,17 +607,23 @@ void connect_limit_disconnect_pid(struct connect_limit *limit, pid_t pid)
 		connect_limit_process_free(limit, process);
 }
 
-void connect_limit_dump(struct connect_limit *limit, struct ostream *output)
+struct connect_limit_dump *
+connect_limit_dump_begin(struct connect_limit *limit, struct ostream *output)
 {
-	struct hash_iterate_context *iter;
-	struct session *session;
-	const uint8_t *conn_guid;
+	struct connect_limit_dump *dump;
 	const struct alt_username_field *alt_field;
-	unsigned int alt_idx;
-	string_t *str = str_new(default_pool, 256);
-	ssize_t ret = 0;
+	string_t *str;
+
+	dump = i_new(struct connect_limit_dump, 1);
+	dump->limit = limit;
+	dump->output = output;
+	o_stream_ref(output);
+	dump->next_session = limit->sessions;
+	dump->alt_fields_count = array_count(&limit->alt_username_fields);
+	DLLIST_PREPEND(&limit->dumps, dump);
 
 	/* Send list of alt usernames in the header */
+	str = str_new(default_pool, 128);
 	array_foreach(&limit->alt_username_fields, alt_field) {
 		if (str_len(str) > 0)
 			str_append_c(str, '\t');
@@ -580,38 +631,101 @@ void connect_limit_dump(struct connect_limit *limit, struct ostream *output)
 	}
 	str_append_c(str, '\n');
 	o_stream_nsend(output, str_data(str), str_len(str));
+	str_free(&str);
+	return dump;
+}
 
-	/* Send all sessions */
-	iter = hash_table_iterate_init(limit->session_hash);
-	while (ret >= 0 &&
-	       hash_table_iterate(iter, limit->session_hash,
-				  &conn_guid, &session)) T_BEGIN {
-		str_truncate(str, 0);
-		str_printfa(str, "%lu\t", (unsigned long)session->process->pid);
-		str_append_tabescaped(str, session->userip->username);
-		str_append_c(str, '\t');
-		str_append_tabescaped(str, session->service);
-		str_append_c(str, '\t');
-		if (session->userip->ip.family != 0)
-			str_append(str, net_ip2addr(&session->userip->ip));
-		str_append_c(str, '\t');
-		str_append_tabescaped(str, guid_128_to_string(session->conn_guid));
+static void
+connect_limit_dump_session(struct connect_limit_dump *dump,
+			   const struct session *session, string_t *str)
+{
+	unsigned int alt_idx, alt_count;
+
+	str_printfa(str, "%lu\t", (unsigned long)session->process->pid);
+	str_append_tabescaped(str, session->userip->username);
+	str_append_c(str, '\t');
+	str_append_tabescaped(str, session->service);
+	str_append_c(str, '\t');
+	if (session->userip->ip.family != 0)
+		str_append(str, net_ip2addr(&session->userip->ip));
+	str_append_c(str, '\t');
+	str_append_tabescaped(str, guid_128_to_string(session->conn_guid));
+	str_append_c(str, '\t');
+	if (session->dest_ip.family != 0)
+		str_append(str, net_ip2addr(&session->dest_ip));
+	alt_count = I_MIN(session->alt_usernames_count, dump->alt_fields_count);
+	for (alt_idx = 0; alt_idx < alt_count; alt_idx++) {
 		str_append_c(str, '\t');
-		if (session->dest_ip.family != 0)
-			str_append(str, net_ip2addr(&session->dest_ip));
-		for (alt_idx = 0; alt_idx < session->alt_usernames_count; alt_idx++) {
-			str_append_c(str, '\t');
-			if (session->alt_usernames[alt_idx].alt_username != NULL) {
-				str_append_tabescaped(str,
-					session->alt_usernames[alt_idx].alt_username);
-			}
+		if (session->alt_usernames[alt_idx].alt_username != NULL) {
+			str_append_tabescaped(str,
+				session->alt_usernames[alt_idx].alt_username);
 		}
-		str_append_c(str, '\n');
-		ret = o_stream_send(output, str_data(str), str_len(str));
+	}
+	str_append_c(str, '\n');
+}
+
+static int
+connect_limit_dump_more_int(struct connect_limit_dump *dump,
+			    bool limit_buffer)
+{
+	string_t *str;
+	unsigned int count = 0;
+
+	if (dump->finished)
+		return 1;
+
+	str = t_str_new(256);
+	while (dump->next_session != NULL) {
+		if (dump->output->stream_errno != 0)
+			return -1;
+		if (limit_buffer &&
+		    (count++ == CONNECT_LIMIT_DUMP_BATCH_COUNT ||
+		     o_stream_get_buffer_used_size(dump->output) >=
+		     CONNECT_LIMIT_DUMP_MAX_BUFFER_SIZE))
+			return 0;
+
+		str_truncate(str, 0);
+		connect_limit_dump_session(dump, dump->next_session, str);
+		dump->next_session = dump->next_session->next;
+		o_stream_nsend(dump->output, str_data(str), str_len(str));
+	}
+	o_stream_nsend(dump->output, "\n", 1);
+	dump->finished = TRUE;
+	return 1;
+}
+
+int connect_limit_dump_more(struct connect_limit_dump *dump)
+{
+	int ret;
+
+	T_BEGIN {
+		ret = connect_limit_dump_more_int(dump, TRUE);
 	} T_END;
-	hash_table_iterate_deinit(&iter);
-	o_stream_nsend(output, "\n", 1);
-	str_free(&str);
+	return ret;
+}
+
+void connect_limit_dump_deinit(struct connect_limit_dump **_dump)
+{
+	struct connect_limit_dump *dump = *_dump;
+
+	if (dump == NULL)
+		return;
+	*_dump = NULL;
+
+	DLLIST_REMOVE(&dump->limit->dumps, dump);
+	o_stream_unref(&dump->output);
+	i_free(dump);
+}
+
+void connect_limit_dump(struct connect_limit *limit, struct ostream *output)
+{
+	struct connect_limit_dump *dump;
+
+	dump = connect_limit_dump_begin(limit, output);
+	T_BEGIN {
+		(void)connect_limit_dump_more_int(dump, FALSE);
+	} T_END;
+	connect_limit_dump_deinit(&dump);
 }
 
 static int
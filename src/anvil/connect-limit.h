@@ -58,7 +58,18 @@ void connect_limit_disconnect(struct connect_limit *limit, pid_t pid,
 			      const struct connect_limit_key *key,
 			      const guid_128_t conn_guid);
 void connect_limit_disconnect_pid(struct connect_limit *limit, pid_t pid);
+/* Dump all sessions to output. */
 void connect_limit_dump(struct connect_limit *limit, struct ostream *output);
+/* Dump all sessions to output incrementally. The connect-limit may be
+   modified between connect_limit_dump_more() calls: Sessions disconnected
+   before they were dumped are skipped, and newly connected sessions are
+   added to the end of the dump. */
+struct connect_limit_dump *
+connect_limit_dump_begin(struct connect_limit *limit, struct ostream *output);
+/* Dump more sessions. Returns 1 if the dump is finished, 0 if more needs to
+   be dumped after output is flushed, -1 on output error. */
+int connect_limit_dump_more(struct connect_limit_dump *dump);
+void connect_limit_dump_deinit(struct connect_limit_dump **dump);
 
 /* Iterate through sessions of the username. The connect-limit shouldn't be
    modified while the iterator exists. The results are sorted by pid.
@@ -218,10 +218,122 @@ static void test_connect_limit(void)
 	test_end();
 }
 
+#define TEST_DUMP_SESSION_COUNT 2500
+
+static void test_dump_guid(unsigned int i, guid_128_t guid_r)
+{
+	guid_128_empty(guid_r);
+	guid_r[0] = i >> 8;
+	guid_r[1] = i & 0xff;
+	guid_r[15] = 1;
+}
+
+static void
+test_dump_connect(struct connect_limit *limit, unsigned int i,
+		  const char *const *alt_usernames)
+{
+	struct connect_limit_key key = {
+		.username = t_strdup_printf("user%u", i % 10),
+		.service = "service1",
+	};
+	struct ip_addr dest_ip;
+	guid_128_t guid;
+
+	i_zero(&dest_ip);
+	test_dump_guid(i, guid);
+	connect_limit_connect(limit, 100 + i / 1000, &key, guid,
+			      KICK_TYPE_NONE, &dest_ip, alt_usernames);
+}
+
+static void
+test_dump_disconnect(struct connect_limit *limit, unsigned int i)
+{
+	struct connect_limit_key key = {
+		.username = t_strdup_printf("user%u", i % 10),
+		.service = "service1",
+	};
+	guid_128_t guid;
+
+	test_dump_guid(i, guid);
+	connect_limit_disconnect(limit, 100 + i / 1000, &key, guid);
+}
+
+static void test_connect_limit_dump_incremental(void)
+{
+	struct connect_limit *limit;
+	struct connect_limit_dump *dump;
+	const char *const alt_usernames[] = {
+		"altkey1", "altvalueA",
+		NULL
+	};
+	guid_128_t guid;
+	unsigned int i;
+	int ret;
+
+	test_begin("connect limit dump incremental");
+	limit = connect_limit_init();
+	for (i = 0; i < TEST_DUMP_SESSION_COUNT; i++) T_BEGIN {
+		test_dump_connect(limit, i, NULL);
+	} T_END;
+
+	/* Buffer ostream's whole buffer counts as unflushed data. Move the
+	   output to full_str to emulate flushing. */
+	string_t *full_str = str_new(default_pool, 1024);
+	string_t *str = str_new(default_pool, 1024);
+	struct ostream *output = o_stream_create_buffer(str);
+	dump = connect_limit_dump_begin(limit, output);
+	test_assert(connect_limit_dump_more(dump) == 0);
+	str_append_str(full_str, str);
+	str_truncate(str, 0);
+
+	/* disconnect an already dumped session, the next session to be
+	   dumped and a session later on */
+	test_dump_disconnect(limit, 0);
+	test_dump_disconnect(limit, 1000);
+	test_dump_disconnect(limit, 1500);
+	/* new sessions are appended to the dump, but the alt username fields
+	   added after the header was sent are not. */
+	test_dump_connect(limit, TEST_DUMP_SESSION_COUNT, alt_usernames);
+
+	while ((ret = connect_limit_dump_more(dump)) == 0) {
+		str_append_str(full_str, str);
+		str_truncate(str, 0);
+	}
+	test_assert(ret == 1);
+	str_append_str(full_str, str);
+	connect_limit_dump_deinit(&dump);
+
+	/* empty header line, sessions and the final empty line(s) */
+	const char *const *lines = t_strsplit(str_c(full_str), "\n");
+	test_assert(str_array_length(lines) == TEST_DUMP_SESSION_COUNT + 2);
+	test_assert_strcmp(lines[0], "");
+	for (i = 0; i <= TEST_DUMP_SESSION_COUNT; i++) {
+		if (i == 1000 || i == 1500)
+			continue;
+		test_dump_guid(i, guid);
+		const char *expected = t_strdup_printf(
+			"%u\tuser%u\tservice1\t\t%s\t", 100 + i / 1000,
+			i % 10, guid_128_to_string(guid));
+		test_assert_strcmp_idx(*++lines, expected, i);
+	}
+	test_assert_strcmp(lines[1], "");
+	test_assert_strcmp(lines[2], "");
+	test_assert(lines[3] == NULL);
+
+	o_stream_destroy(&output);
+	str_free(&str);
+	str_free(&full_str);
+	for (i = 0; i <= TEST_DUMP_SESSION_COUNT / 1000; i++)
+		connect_limit_disconnect_pid(limit, 100 + i);
+	connect_limit_deinit(&limit);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_connect_limit,
+		test_connect_limit_dump_incremental,
 		NULL
 	};
 	return test_run(test_functions);
@@ -584,6 +584,18 @@ static void dump_cache(struct mail_cache_view *cache_view, unsigned int seq)
 
 		str_truncate(str, 0);
 		str_printfa(str, "    - %s: ", field->name);
+		if (iter_field.compressed) {
+			buffer_t *buf = t_buffer_create(size * 2);
+
+			if (mail_cache_field_decompress(cache_view->cache,
+							&iter_field, buf) < 0) {
+				ret = -1;
+				break;
+			}
+			str_printfa(str, "(compressed %u bytes) ", size);
+			data = buf->data;
+			size = buf->used;
+		}
 		switch (field->type) {
 		case MAIL_CACHE_FIELD_FIXED_SIZE:
 			if (size == sizeof(uint32_t)) {
@@ -14,12 +14,16 @@
 #include "base64.h"
 #include "str.h"
 #include "strescape.h"
+#include "str-table.h"
 #include "time-util.h"
+#include "timer-wheel.h"
 #include "var-expand.h"
 #include "master-service.h"
 #include "master-service-settings.h"
+#include "compression.h"
 #include "imap-keepalive.h"
 #include "imap-master-connection.h"
+#include "imap-hibernate-settings.h"
 #include "imap-client.h"
 
 #include <unistd.h>
@@ -39,6 +43,12 @@
 
 /* How often to try to unhibernate clients. */
 #define IMAP_UNHIBERNATE_RETRY_MSECS 100
+/* Maximum number of clients moved back to an imap process at once. */
+#define IMAP_CLIENT_MOVE_BACK_MAX_BATCH 16
+
+/* Compress the imap process state if it's at least this large. */
+#define IMAP_CLIENT_STATE_COMPRESS_MIN_SIZE 256
+#define IMAP_CLIENT_STATE_COMPRESSION "deflate"
 
 #define IMAP_CLIENT_BUFFER_FULL_ERROR "Client output buffer is full"
 #define IMAP_CLIENT_UNHIBERNATE_ERROR "Failed to unhibernate client"
@@ -56,24 +66,40 @@ struct imap_client_notify {
 	struct io *io;
 };
 
+struct imap_client_move_back_batch {
+	struct imap_master_connection *master_conn;
+	/* Clients in the order their requests were sent. Clients destroyed
+	   while waiting for the reply are set to NULL. */
+	ARRAY(struct imap_client *) clients;
+	unsigned int replies_received;
+};
+
 struct imap_client {
 	struct priorityq_item item;
 
 	struct imap_client *prev, *next;
 	pool_t pool;
+	/* Created only when it's needed for logging. Hibernated clients
+	   are mostly just waiting, and an event with its fields takes more
+	   memory than the rest of the client. */
 	struct event *event;
+	struct timeval created;
 	struct imap_client_state state;
 	ARRAY(struct imap_client_notify) notifys;
+	/* If non-zero, state.state is compressed and this is its original
+	   size. */
+	size_t state_uncompressed_size;
 
 	time_t move_back_start;
-	struct timeout *to_move_back;
+
+	/* Item in keepalive_wheel. The wheel's ticks are seconds. */
+	struct timer_wheel_item keepalive_item;
 
 	int fd;
 	struct io *io;
 	struct istream *input;
 	struct ostream *output;
-	struct timeout *to_keepalive;
-	struct imap_master_connection *master_conn;
+	struct imap_client_move_back_batch *move_back_batch;
 	struct ioloop_context *ioloop_ctx;
 	const char *log_prefix;
 	unsigned int next_read_threshold;
@@ -83,11 +109,23 @@ struct imap_client {
 	bool shutdown_fd_on_destroy;
 };
 
+static const struct imap_hibernate_settings *imap_hibernate_set;
 static struct imap_client *imap_clients;
 static struct priorityq *unhibernate_queue;
 static struct timeout *to_unhibernate;
+static unsigned int imap_clients_unhibernating_count;
 static const char imap_still_here_text[] = "* OK Still here\r\n";
 
+/* Strings that are commonly the same for multiple clients of the same user */
+static struct str_table *imap_client_strings;
+static const struct compression_handler *imap_client_state_compression;
+
+/* Keepalives of all clients are kept in a timer wheel with one second
+   ticks. A single timeout runs the wheel once per second while it has
+   clients. */
+static struct timer_wheel *keepalive_wheel;
+static struct timeout *to_keepalive;
+
 static struct event_category event_category_imap = {
 	.name = "imap",
 };
@@ -99,9 +137,36 @@ static struct event_category event_category_imap_hibernate = {
 static void imap_client_stop(struct imap_client *client);
 void imap_client_destroy(struct imap_client **_client, const char *reason);
 static void imap_client_add_idle_keepalive_timeout(struct imap_client *client);
+static void imap_client_remove_idle_keepalive(struct imap_client *client);
+static void imap_clients_keepalive(void *context);
 static void imap_clients_unhibernate(void *context);
+static void imap_clients_unhibernate_schedule(unsigned int msecs);
 static void imap_client_stop_notify_listening(struct imap_client *client);
 
+static struct event *imap_client_get_event(struct imap_client *client)
+{
+	const struct imap_client_state *state = &client->state;
+
+	if (client->event != NULL)
+		return client->event;
+
+	client->event = event_create(NULL);
+	event_add_category(client->event, &event_category_imap_hibernate);
+	event_add_str(client->event, "user", state->username);
+	event_add_str(client->event, "session", state->session_id);
+	if (state->mailbox_vname != NULL)
+		event_add_str(client->event, "mailbox", state->mailbox_vname);
+	if (state->local_ip.family != 0)
+		event_add_ip(client->event, "local_ip", &state->local_ip);
+	if (state->local_port != 0)
+		event_add_int(client->event, "local_port", state->local_port);
+	if (state->remote_ip.family != 0)
+		event_add_ip(client->event, "remote_ip", &state->remote_ip);
+	if (state->remote_port != 0)
+		event_add_int(client->event, "remote_port", state->remote_port);
+	return client->event;
+}
+
 static void imap_client_disconnected(struct imap_client **_client)
 {
 	struct imap_client *client = *_client;
@@ -115,14 +180,11 @@ static void
 imap_client_unhibernate_failed(struct imap_client **_client, const char *error)
 {
 	struct imap_client *client = *_client;
-	struct timeval created;
-	event_get_create_time(client->event, &created);
-
 	struct event_passthrough *e =
-		event_create_passthrough(client->event)->
+		event_create_passthrough(imap_client_get_event(client))->
 		set_name("imap_client_unhibernated")->
 		add_int("hibernation_usecs",
-			timeval_diff_usecs(&ioloop_timeval, &created))->
+			timeval_diff_usecs(&ioloop_timeval, &client->created))->
 		add_str("error", error);
 	e_error(e->event(), IMAP_CLIENT_UNHIBERNATE_ERROR": %s", error);
 	imap_client_destroy(_client, IMAP_CLIENT_UNHIBERNATE_ERROR);
@@ -147,21 +209,53 @@ imap_client_parse_userdb_fields(struct imap_client *client,
 	}
 }
 
-static void
-imap_client_move_back_send_callback(void *context, struct ostream *output)
+static int
+imap_client_state_decompress(struct imap_client *client, buffer_t *dest,
+			     const char **error_r)
+{
+	struct istream *input, *decompress_input;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	input = i_stream_create_from_data(client->state.state,
+					  client->state.state_size);
+	decompress_input =
+		imap_client_state_compression->create_istream(input);
+	while ((ret = i_stream_read_more(decompress_input, &data, &size)) > 0) {
+		buffer_append(dest, data, size);
+		i_stream_skip(decompress_input, size);
+	}
+	i_assert(ret == -1);
+	if (decompress_input->stream_errno != 0) {
+		*error_r = t_strdup_printf("Failed to decompress state: %s",
+			i_stream_get_error(decompress_input));
+		ret = -1;
+	} else if (dest->used != client->state_uncompressed_size) {
+		*error_r = t_strdup_printf(
+			"Decompressed state has wrong size: %zu != %zu",
+			dest->used, client->state_uncompressed_size);
+		ret = -1;
+	} else {
+		ret = 0;
+	}
+	i_stream_unref(&decompress_input);
+	i_stream_unref(&input);
+	return ret;
+}
+
+static int
+imap_client_move_back_append(struct imap_client *client, string_t *str,
+			     const char **error_r)
 {
-	struct imap_client *client = context;
 	const struct imap_client_state *state = &client->state;
-	string_t *str = t_str_new(256);
-	struct timeval created;
 	const unsigned char *input_data;
 	size_t input_size;
-	ssize_t ret;
 
 	str_append_tabescaped(str, state->username);
-	event_get_create_time(client->event, &created);
 	str_printfa(str, "\thibernation_started=%"PRIdTIME_T".%06u",
-		    created.tv_sec, (unsigned int)created.tv_usec);
+		    client->created.tv_sec,
+		    (unsigned int)client->created.tv_usec);
 
 	if (state->session_id != NULL) {
 		str_append(str, "\tsession=");
@@ -192,7 +286,13 @@ imap_client_move_back_send_callback(void *context, struct ostream *output)
 	}
 	if (state->peer_ino != 0)
 		str_printfa(str, "\tpeer_ino=%llu", (unsigned long long)state->peer_ino);
-	if (state->state_size > 0) {
+	if (client->state_uncompressed_size > 0) {
+		buffer_t *buf = t_buffer_create(client->state_uncompressed_size);
+		if (imap_client_state_decompress(client, buf, error_r) < 0)
+			return -1;
+		str_append(str, "\tstate=");
+		base64_encode(buf->data, buf->used, str);
+	} else if (state->state_size > 0) {
 		str_append(str, "\tstate=");
 		base64_encode(state->state, state->state_size, str);
 	}
@@ -210,27 +310,156 @@ imap_client_move_back_send_callback(void *context, struct ostream *output)
 		str_append(str, "\tidle-continue");
 	}
 	str_append_c(str, '\n');
+	return 0;
+}
+
+static void
+imap_client_move_back_batch_add(struct imap_client_move_back_batch *batch,
+				struct imap_client *client)
+{
+	i_assert(client->move_back_batch == NULL);
+
+	array_push_back(&batch->clients, &client);
+	client->move_back_batch = batch;
+}
+
+static void imap_client_move_back_batch_detach(struct imap_client *client)
+{
+	struct imap_client **clientp;
+
+	array_foreach_modifiable(&client->move_back_batch->clients, clientp) {
+		if (*clientp == client) {
+			*clientp = NULL;
+			client->move_back_batch = NULL;
+			return;
+		}
+	}
+	i_unreached();
+}
+
+static bool
+imap_client_move_back_batch_is_empty(struct imap_client_move_back_batch *batch)
+{
+	struct imap_client *client;
+
+	array_foreach_elem(&batch->clients, client) {
+		if (client != NULL)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+imap_client_move_back_batch_fail_all(struct imap_client_move_back_batch *batch,
+				     const char *error)
+{
+	struct imap_client *client;
+
+	array_foreach_elem(&batch->clients, client) {
+		if (client != NULL) {
+			imap_client_move_back_batch_detach(client);
+			imap_client_unhibernate_failed(&client, error);
+		}
+	}
+}
+
+static void
+imap_client_move_back_batch_fill(struct imap_client_move_back_batch *batch,
+				 unsigned int max_count)
+{
+	struct priorityq_item *item;
+
+	/* the imap process can take more clients - move back also the next
+	   clients in the queue */
+	while (array_count(&batch->clients) < max_count &&
+	       (item = priorityq_peek(unhibernate_queue)) != NULL) {
+		struct imap_client *client = (struct imap_client *)item;
+
+		if (o_stream_get_buffer_used_size(client->output) > 0) {
+			/* there is data buffered, so we have to disconnect
+			   you */
+			imap_client_destroy(&client,
+					    IMAP_CLIENT_BUFFER_FULL_ERROR);
+			continue;
+		}
+		imap_client_stop(client);
+		imap_client_move_back_batch_add(batch, client);
+	}
+}
+
+static unsigned int
+imap_client_move_back_send_callback(void *context, struct ostream *output,
+				    unsigned int max_requests)
+{
+	struct imap_client_move_back_batch *batch = context;
+	struct imap_client *client, **clients;
+	int fds[IMAP_CLIENT_MOVE_BACK_MAX_BATCH];
+	string_t *str = t_str_new(1024);
+	const char *error;
+	unsigned int i, count, fds_count = 0;
+	size_t pos;
+	ssize_t ret;
+
+	imap_client_move_back_batch_fill(batch,
+		I_MIN(max_requests, IMAP_CLIENT_MOVE_BACK_MAX_BATCH));
+
+	array_foreach_elem(&batch->clients, client) {
+		if (client == NULL)
+			continue;
+		pos = str_len(str);
+		if (imap_client_move_back_append(client, str, &error) < 0) {
+			str_truncate(str, pos);
+			imap_client_move_back_batch_detach(client);
+			imap_client_unhibernate_failed(&client, error);
+		} else {
+			fds[fds_count++] = client->fd;
+		}
+	}
 
-	/* send the fd first */
-	ret = fd_send(o_stream_get_fd(output), client->fd, str_data(str), 1);
+	/* drop the clients that were already destroyed, so the rest are in
+	   the same order as the requests */
+	clients = array_get_modifiable(&batch->clients, &count);
+	for (i = fds_count = 0; i < count; i++) {
+		if (clients[i] != NULL)
+			clients[fds_count++] = clients[i];
+	}
+	array_delete(&batch->clients, fds_count, count - fds_count);
+	if (fds_count == 0)
+		return 0;
+
+	/* send the fds first */
+	ret = fd_send_multi(o_stream_get_fd(output), fds, fds_count,
+			    str_data(str), 1);
 	if (ret < 0) {
-		const char *error = t_strdup_printf(
-			"fd_send(%s) failed: %m", o_stream_get_name(output));
-		imap_client_unhibernate_failed(&client, error);
-		return;
+		error = t_strdup_printf("fd_send(%s) failed: %m",
+					o_stream_get_name(output));
+		imap_client_move_back_batch_fail_all(batch, error);
+		return 0;
 	}
 	/* If unhibernation fails after this, shutdown() the fd to make sure
 	   the imap process won't later on finish unhibernation after all and
 	   cause confusion. */
-	client->shutdown_fd_on_destroy = TRUE;
+	array_foreach_elem(&batch->clients, client)
+		client->shutdown_fd_on_destroy = TRUE;
 	i_assert(ret > 0);
 	o_stream_nsend(output, str_data(str) + 1, str_len(str) - 1);
+	return fds_count;
 }
 
 static void
 imap_client_move_back_read_callback(void *context, const char *line)
 {
-	struct imap_client *client = context;
+	struct imap_client_move_back_batch *batch = context;
+	struct imap_client *client;
+
+	if (batch->replies_received >= array_count(&batch->clients))
+		return;
+	client = array_idx_elem(&batch->clients, batch->replies_received++);
+	if (client == NULL) {
+		/* already destroyed */
+		return;
+	}
+	imap_client_move_back_batch_detach(client);
 
 	if (line[0] != '+') {
 		/* failed - FIXME: retry later? */
@@ -241,6 +470,22 @@ imap_client_move_back_read_callback(void *context, const char *line)
 	}
 }
 
+static void imap_client_move_back_finish_callback(void *context)
+{
+	struct imap_client_move_back_batch *batch = context;
+
+	imap_client_move_back_batch_fail_all(batch,
+		"imap process didn't reply");
+	array_free(&batch->clients);
+	i_free(batch);
+
+	i_assert(imap_clients_unhibernating_count > 0);
+	imap_clients_unhibernating_count--;
+	/* continue unhibernating the queued clients */
+	if (priorityq_count(unhibernate_queue) > 0)
+		imap_clients_unhibernate_schedule(0);
+}
+
 static bool imap_move_has_reached_timeout(struct imap_client *client)
 {
 	int max_secs = client->input_pending ?
@@ -250,9 +495,20 @@ static bool imap_move_has_reached_timeout(struct imap_client *client)
 		ioloop_time - client->move_back_start > max_secs;
 }
 
+static bool imap_clients_unhibernate_limit_reached(void)
+{
+	/* The rest of the clients are queued, so a change notification
+	   waking up a lot of clients at once doesn't cause a spike of imap
+	   process creations. */
+	return imap_hibernate_set->imap_hibernate_unhibernate_concurrency != 0 &&
+		imap_clients_unhibernating_count >=
+		imap_hibernate_set->imap_hibernate_unhibernate_concurrency;
+}
+
 static bool imap_client_try_move_back(struct imap_client *client)
 {
 	const struct master_service_settings *master_set;
+	struct imap_client_move_back_batch *batch;
 	const char *path, *error;
 	int ret;
 
@@ -265,50 +521,72 @@ static bool imap_client_try_move_back(struct imap_client *client)
 	master_set = master_service_settings_get(master_service);
 	path = t_strconcat(master_set->base_dir,
 			   "/"IMAP_MASTER_SOCKET_NAME, NULL);
+	batch = i_new(struct imap_client_move_back_batch, 1);
+	i_array_init(&batch->clients, 4);
 	ret = imap_master_connection_init(path,
 					  imap_client_move_back_send_callback,
 					  imap_client_move_back_read_callback,
-					  client, &client->master_conn, &error);
+					  imap_client_move_back_finish_callback,
+					  batch, &batch->master_conn, &error);
 	if (ret > 0) {
 		/* success */
+		imap_clients_unhibernating_count++;
 		imap_client_stop(client);
+		imap_client_move_back_batch_add(batch, client);
 		return TRUE;
-	} else if (ret < 0 || imap_move_has_reached_timeout(client)) {
+	}
+	array_free(&batch->clients);
+	i_free(batch);
+
+	if (ret < 0 || imap_move_has_reached_timeout(client)) {
 		/* failed to connect to the imap-master socket */
 		imap_client_unhibernate_failed(&client, error);
 		return TRUE;
 	}
 
-	e_debug(event_create_passthrough(client->event)->
+	e_debug(event_create_passthrough(imap_client_get_event(client))->
 		set_name("imap_client_unhibernate_retried")->
 		add_str("error", error)->event(),
 		"Unhibernation failed: %s - retrying", error);
+	return FALSE;
+}
+
+static void imap_client_unhibernate_queue(struct imap_client *client)
+{
 	/* Stop listening for client's IOs while waiting for the next
-	   reconnection attempt. However if we got here because of an external
+	   unhibernation attempt. However if we got here because of an external
 	   notification keep waiting to see if client sends any IO, since that
-	   will cause the unhibernation to be aborted earlier. */
+	   will cause the unhibernation to be prioritized and aborted earlier. */
 	if (client->input_pending)
 		io_remove(&client->io);
 	imap_client_stop_notify_listening(client);
-	return FALSE;
+
+	if (client->unhibernate_queued) {
+		/* input_pending may have changed the priority */
+		priorityq_remove(unhibernate_queue, &client->item);
+	}
+	client->unhibernate_queued = TRUE;
+	priorityq_add(unhibernate_queue, &client->item);
 }
 
 static void imap_client_move_back(struct imap_client *client)
 {
+	if (client->move_back_start == 0)
+		client->move_back_start = ioloop_time;
+
+	if (imap_clients_unhibernate_limit_reached()) {
+		/* Wait until some of the clients have finished
+		   unhibernating. */
+		imap_client_unhibernate_queue(client);
+		return;
+	}
 	if (imap_client_try_move_back(client))
 		return;
 
 	/* imap-master socket is busy. retry in a while. */
-	if (client->move_back_start == 0)
-		client->move_back_start = ioloop_time;
-	if (!client->unhibernate_queued) {
-		client->unhibernate_queued = TRUE;
-		priorityq_add(unhibernate_queue, &client->item);
-	}
-	if (to_unhibernate == NULL) {
-		to_unhibernate = timeout_add_short(IMAP_UNHIBERNATE_RETRY_MSECS,
-						   imap_clients_unhibernate, NULL);
-	}
+	imap_client_unhibernate_queue(client);
+	if (to_unhibernate == NULL)
+		imap_clients_unhibernate_schedule(IMAP_UNHIBERNATE_RETRY_MSECS);
 }
 
 static enum imap_client_input_state
@@ -475,9 +753,30 @@ static void keepalive_timeout(struct imap_client *client)
 	imap_client_add_idle_keepalive_timeout(client);
 }
 
+static void imap_clients_keepalive(void *context ATTR_UNUSED)
+{
+	struct timer_wheel_item *item;
+	struct imap_client *client;
+
+	while ((item = timer_wheel_pop(keepalive_wheel, ioloop_time)) != NULL) {
+		client = container_of(item, struct imap_client, keepalive_item);
+		keepalive_timeout(client);
+	}
+	if (timer_wheel_count(keepalive_wheel) == 0)
+		timeout_remove(&to_keepalive);
+}
+
+static void imap_client_remove_idle_keepalive(struct imap_client *client)
+{
+	timer_wheel_remove(keepalive_wheel, &client->keepalive_item);
+	if (timer_wheel_count(keepalive_wheel) == 0)
+		timeout_remove(&to_keepalive);
+}
+
 static void imap_client_add_idle_keepalive_timeout(struct imap_client *client)
 {
 	unsigned int interval = client->state.imap_idle_notify_interval;
+	uint64_t now;
 
 	if (interval == 0)
 		return;
@@ -486,8 +785,17 @@ static void imap_client_add_idle_keepalive_timeout(struct imap_client *client)
 						 &client->state.remote_ip,
 						 interval);
 
-	timeout_remove(&client->to_keepalive);
-	client->to_keepalive = timeout_add(interval, keepalive_timeout, client);
+	imap_client_remove_idle_keepalive(client);
+	/* If the clock moved backwards, the wheel may be ahead of
+	   ioloop_time. Always expire at least one tick after the wheel's
+	   current time, so timer_wheel_pop() in imap_clients_keepalive()
+	   won't return the same client again. */
+	now = I_MAX((uint64_t)ioloop_time,
+		    timer_wheel_get_now(keepalive_wheel));
+	timer_wheel_add(keepalive_wheel, &client->keepalive_item,
+			now + I_MAX(interval / 1000, 1U));
+	if (to_keepalive == NULL)
+		to_keepalive = timeout_add(1000, imap_clients_keepalive, NULL);
 }
 
 static const struct var_expand_table *
@@ -559,6 +867,57 @@ imap_client_var_expand_func_userdb(const char *data, void *context,
 	return 1;
 }
 
+static void
+imap_client_state_compress(struct imap_client *client,
+			   const struct imap_client_state *state)
+{
+	const struct compression_handler *handler =
+		imap_client_state_compression;
+	struct ostream *output, *compress_output;
+	buffer_t *buf;
+
+	buf = t_buffer_create(state->state_size);
+	output = o_stream_create_buffer(buf);
+	compress_output =
+		handler->create_ostream(output, handler->get_default_level());
+	o_stream_nsend(compress_output, state->state, state->state_size);
+	if (o_stream_finish(compress_output) < 0) {
+		e_error(imap_client_get_event(client),
+			"Failed to compress state: %s",
+			o_stream_get_error(compress_output));
+		buffer_set_used_size(buf, 0);
+	}
+	o_stream_destroy(&compress_output);
+	o_stream_destroy(&output);
+
+	if (buf->used == 0 || buf->used >= state->state_size) {
+		/* compression didn't help - keep it uncompressed */
+		client->state.state = p_memdup(client->pool, state->state,
+					       state->state_size);
+	} else {
+		client->state.state = p_memdup(client->pool, buf->data,
+					       buf->used);
+		client->state.state_size = buf->used;
+		client->state_uncompressed_size = state->state_size;
+	}
+}
+
+static size_t imap_client_pool_size(const struct imap_client_state *state)
+{
+	/* Size the pool so that everything allocated from it fits into the
+	   first block. A compressed state is smaller than the original. */
+	return sizeof(struct imap_client) +
+		(state->session_id == NULL ? 0 : strlen(state->session_id) + 1) +
+		(state->mailbox_vname == NULL ? 0 :
+		 strlen(state->mailbox_vname) + 1) +
+		(state->stats == NULL ? 0 : strlen(state->stats) + 1) +
+		state->state_size +
+		/* notifys array */
+		sizeof(struct imap_client_notify) * 2 + 128 +
+		/* alignment */
+		MEM_ALIGN_SIZE * 16;
+}
+
 static void imap_client_io_activate_user(struct imap_client *client)
 {
 	i_set_failure_prefix("%s", client->log_prefix);
@@ -577,8 +936,7 @@ imap_client_create(int fd, const struct imap_client_state *state)
 		{ NULL, NULL }
 	};
 	struct imap_client *client;
-	pool_t pool = pool_alloconly_create("imap client", 256);
-	void *statebuf;
+	pool_t pool;
 	const char *error;
 
 	i_assert(state->username != NULL);
@@ -586,37 +944,38 @@ imap_client_create(int fd, const struct imap_client_state *state)
 
 	fd_set_nonblock(fd, TRUE); /* it should already be, but be sure */
 
+	pool = pool_alloconly_create("imap client",
+				     imap_client_pool_size(state));
 	client = p_new(pool, struct imap_client, 1);
 	client->pool = pool;
 	client->fd = fd;
+	client->created = ioloop_timeval;
+	timer_wheel_item_init(&client->keepalive_item);
 	client->input = i_stream_create_fd(fd, IMAP_MAX_INBUF);
 	client->output = o_stream_create_fd(fd, IMAP_MAX_OUTBUF);
 	o_stream_set_no_error_handling(client->output, TRUE);
 	client->state = *state;
-	client->state.username = p_strdup(pool, state->username);
+	client->state.username =
+		str_table_ref(imap_client_strings, state->username);
 	client->state.session_id = p_strdup(pool, state->session_id);
-	client->state.userdb_fields = p_strdup(pool, state->userdb_fields);
+	client->state.mailbox_vname = p_strdup(pool, state->mailbox_vname);
+	/* only used while creating the client */
+	client->state.mail_log_prefix = NULL;
+	if (state->userdb_fields != NULL) {
+		client->state.userdb_fields =
+			str_table_ref(imap_client_strings,
+				      state->userdb_fields);
+	}
 	client->state.stats = p_strdup(pool, state->stats);
 
-	client->event = event_create(NULL);
-	event_add_category(client->event, &event_category_imap_hibernate);
-	event_add_str(client->event, "user", state->username);
-	event_add_str(client->event, "session", state->session_id);
-	if (state->mailbox_vname != NULL)
-		event_add_str(client->event, "mailbox", state->mailbox_vname);
-	if (state->local_ip.family != 0)
-		event_add_ip(client->event, "local_ip", &state->local_ip);
-	if (state->local_port != 0)
-		event_add_int(client->event, "local_port", state->local_port);
-	if (state->remote_ip.family != 0)
-		event_add_ip(client->event, "remote_ip", &state->remote_ip);
-	if (state->remote_port != 0)
-		event_add_int(client->event, "remote_port", state->remote_port);
-
-	if (state->state_size > 0) {
-		client->state.state = statebuf = p_malloc(pool, state->state_size);
-		memcpy(statebuf, state->state, state->state_size);
-		client->state.state_size = state->state_size;
+	if (state->state_size >= IMAP_CLIENT_STATE_COMPRESS_MIN_SIZE &&
+	    imap_client_state_compression != NULL) {
+		T_BEGIN {
+			imap_client_state_compress(client, state);
+		} T_END;
+	} else if (state->state_size > 0) {
+		client->state.state = p_memdup(pool, state->state,
+					       state->state_size);
 	}
 	T_BEGIN {
 		string_t *str;
@@ -626,11 +985,12 @@ imap_client_create(int fd, const struct imap_client_state *state)
 		if (var_expand_with_funcs(str, state->mail_log_prefix,
 					  imap_client_get_var_expand_table(client),
 					  funcs, fields, &error) <= 0) {
-			e_error(client->event,
+			e_error(imap_client_get_event(client),
 				"Failed to expand mail_log_prefix=%s: %s",
 				state->mail_log_prefix, error);
 		}
-		client->log_prefix = p_strdup(pool, str_c(str));
+		client->log_prefix =
+			str_table_ref(imap_client_strings, str_c(str));
 	} T_END;
 
 	struct master_service_anvil_session anvil_session = {
@@ -664,7 +1024,7 @@ static void imap_client_stop(struct imap_client *client)
 		client->unhibernate_queued = FALSE;
 	}
 	io_remove(&client->io);
-	timeout_remove(&client->to_keepalive);
+	imap_client_remove_idle_keepalive(client);
 	imap_client_stop_notify_listening(client);
 }
 
@@ -677,7 +1037,7 @@ void imap_client_destroy(struct imap_client **_client, const char *reason)
 	if (reason != NULL) {
 		/* the client input/output bytes don't count the DONE+IDLE by
 		   imap-hibernate, but that shouldn't matter much. */
-		e_info(client->event, "Disconnected: %s %s",
+		e_info(imap_client_get_event(client), "Disconnected: %s %s",
 		       reason, client->state.stats);
 	}
 
@@ -691,8 +1051,15 @@ void imap_client_destroy(struct imap_client **_client, const char *reason)
 						client->state.anvil_conn_guid);
 	}
 
-	if (client->master_conn != NULL)
-		imap_master_connection_free(&client->master_conn);
+	if (client->move_back_batch != NULL) {
+		struct imap_client_move_back_batch *batch =
+			client->move_back_batch;
+
+		imap_client_move_back_batch_detach(client);
+		/* abort the unhibernation if none of its clients are left */
+		if (imap_client_move_back_batch_is_empty(batch))
+			imap_master_connection_deinit(&batch->master_conn);
+	}
 	if (client->ioloop_ctx != NULL) {
 		io_loop_context_remove_callbacks(client->ioloop_ctx,
 						 imap_client_io_activate_user,
@@ -706,7 +1073,8 @@ void imap_client_destroy(struct imap_client **_client, const char *reason)
 
 	if (client->shutdown_fd_on_destroy) {
 		if (shutdown(client->fd, SHUT_RDWR) < 0)
-			e_error(client->event, "shutdown() failed: %m");
+			e_error(imap_client_get_event(client),
+				"shutdown() failed: %m");
 	}
 
 	DLLIST_REMOVE(&imap_clients, client);
@@ -715,6 +1083,12 @@ void imap_client_destroy(struct imap_client **_client, const char *reason)
 	o_stream_destroy(&client->output);
 	i_close_fd(&client->fd);
 	event_unref(&client->event);
+	str_table_unref(imap_client_strings, &client->state.username);
+	if (client->state.userdb_fields != NULL) {
+		str_table_unref(imap_client_strings,
+				&client->state.userdb_fields);
+	}
+	str_table_unref(imap_client_strings, &client->log_prefix);
 	pool_unref(&client->pool);
 
 	master_service_client_connection_destroyed(master_service);
@@ -758,6 +1132,11 @@ static int client_unhibernate_cmp(const void *p1, const void *p2)
 	const struct imap_client *c1 = p1, *c2 = p2;
 	time_t t1, t2;
 
+	/* Clients with pending input first, since the user is actively
+	   waiting for them. Otherwise use the unhibernation deadline. */
+	if (c1->input_pending != c2->input_pending)
+		return c1->input_pending ? -1 : 1;
+
 	t1 = c1->move_back_start +
 		(c1->input_pending ?
 		 IMAP_CLIENT_MOVE_BACK_WITH_INPUT_TIMEOUT_SECS :
@@ -777,13 +1156,26 @@ static void imap_clients_unhibernate(void *context ATTR_UNUSED)
 {
 	struct priorityq_item *item;
 
-	while ((item = priorityq_peek(unhibernate_queue)) != NULL) {
+	while (!imap_clients_unhibernate_limit_reached() &&
+	       (item = priorityq_peek(unhibernate_queue)) != NULL) {
 		struct imap_client *client = (struct imap_client *)item;
 
-		if (!imap_client_try_move_back(client))
+		if (!imap_client_try_move_back(client)) {
+			imap_clients_unhibernate_schedule(
+				IMAP_UNHIBERNATE_RETRY_MSECS);
 			return;
+		}
 	}
+	/* Either the queue is empty or the rest of the clients are continued
+	   after unhibernations finish. */
+	timeout_remove(&to_unhibernate);
+}
+
+static void imap_clients_unhibernate_schedule(unsigned int msecs)
+{
 	timeout_remove(&to_unhibernate);
+	to_unhibernate = timeout_add_short(msecs, imap_clients_unhibernate,
+					   NULL);
 }
 
 static void imap_client_kick(struct imap_client *client)
@@ -809,9 +1201,15 @@ unsigned int imap_clients_kick(const char *user, const guid_128_t conn_guid)
 	return count;
 }
 
-void imap_clients_init(void)
+void imap_clients_init(const struct imap_hibernate_settings *set)
 {
+	imap_hibernate_set = set;
 	unhibernate_queue = priorityq_init(client_unhibernate_cmp, 64);
+	imap_client_strings = str_table_init();
+	keepalive_wheel = timer_wheel_init(ioloop_time);
+	if (compression_lookup_handler(IMAP_CLIENT_STATE_COMPRESSION,
+				       &imap_client_state_compression) <= 0)
+		imap_client_state_compression = NULL;
 }
 
 void imap_clients_deinit(void)
@@ -820,5 +1218,8 @@ void imap_clients_deinit(void)
 		imap_client_kick(imap_clients);
 
 	timeout_remove(&to_unhibernate);
+	timeout_remove(&to_keepalive);
+	timer_wheel_deinit(&keepalive_wheel);
 	priorityq_deinit(&unhibernate_queue);
+	str_table_deinit(&imap_client_strings);
 }
@@ -3,6 +3,8 @@
 
 #include "net.h"
 
+struct imap_hibernate_settings;
+
 struct imap_client_state {
 	/* required: */
 	const char *username, *mail_log_prefix;
@@ -37,7 +39,7 @@ void imap_client_destroy(struct imap_client **_client, const char *reason);
 
 unsigned int imap_clients_kick(const char *user, const guid_128_t conn_guid);
 
-void imap_clients_init(void);
+void imap_clients_init(const struct imap_hibernate_settings *set);
 void imap_clients_deinit(void);
 
 #endif
@@ -4,6 +4,7 @@
 #include "buffer.h"
 #include "settings-parser.h"
 #include "service-settings.h"
+#include "imap-hibernate-settings.h"
 
 #include <stddef.h>
 #include <unistd.h>
@@ -58,3 +59,28 @@ struct service_settings imap_hibernate_service_settings = {
 	.fifo_listeners = ARRAY_INIT,
 	.inet_listeners = ARRAY_INIT
 };
+
+#undef DEF
+#define DEF(type, name) \
+	SETTING_DEFINE_STRUCT_##type(#name, name, struct imap_hibernate_settings)
+
+static const struct setting_define imap_hibernate_setting_defines[] = {
+	DEF(UINT, imap_hibernate_unhibernate_concurrency),
+
+	SETTING_DEFINE_LIST_END
+};
+
+const struct imap_hibernate_settings imap_hibernate_default_settings = {
+	.imap_hibernate_unhibernate_concurrency = 32,
+};
+
+const struct setting_parser_info imap_hibernate_setting_parser_info = {
+	.module_name = "imap-hibernate",
+	.defines = imap_hibernate_setting_defines,
+	.defaults = &imap_hibernate_default_settings,
+
+	.type_offset = SIZE_MAX,
+	.struct_size = sizeof(struct imap_hibernate_settings),
+
+	.parent_offset = SIZE_MAX
+};
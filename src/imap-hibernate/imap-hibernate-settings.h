@@ -0,0 +1,13 @@
+#ifndef IMAP_HIBERNATE_SETTINGS_H
+#define IMAP_HIBERNATE_SETTINGS_H
+
+struct imap_hibernate_settings {
+	/* Maximum number of imap-master connections moving clients back to
+	   imap processes at the same time. Each connection may move multiple
+	   clients, if the imap process can take them. 0 = unlimited. */
+	unsigned int imap_hibernate_unhibernate_concurrency;
+};
+
+extern const struct setting_parser_info imap_hibernate_setting_parser_info;
+
+#endif
@@ -13,7 +13,14 @@ struct imap_master_connection {
 
 	imap_master_connection_send_callback_t *send_callback;
 	imap_master_connection_read_callback_t *read_callback;
+	imap_master_connection_finish_callback_t *finish_callback;
 	void *context;
+
+	/* Number of requests still waiting for a reply */
+	unsigned int replies_pending;
+	/* imap process supports batches - waiting for its LIMIT line */
+	bool limit_pending;
+	bool requests_sent;
 };
 
 static struct connection_list *master_clients;
@@ -29,6 +36,7 @@ static void imap_master_connection_timeout(struct imap_master_connection *conn)
 int imap_master_connection_init(const char *path,
 				imap_master_connection_send_callback_t *send_callback,
 				imap_master_connection_read_callback_t *read_callback,
+				imap_master_connection_finish_callback_t *finish_callback,
 				void *context,
 				struct imap_master_connection **conn_r,
 				const char **error_r)
@@ -38,6 +46,7 @@ int imap_master_connection_init(const char *path,
 	conn = i_new(struct imap_master_connection, 1);
 	conn->send_callback = send_callback;
 	conn->read_callback = read_callback;
+	conn->finish_callback = finish_callback;
 	conn->context = context;
 	connection_init_client_unix(master_clients, &conn->conn, path);
 	if (connection_client_connect(&conn->conn) < 0) {
@@ -55,35 +64,29 @@ int imap_master_connection_init(const char *path,
 	return 1;
 }
 
-static void
-imap_master_read_callback(struct imap_master_connection **_conn,
-			  const char *line)
+static void imap_master_connection_finish(struct imap_master_connection *conn)
 {
-	struct imap_master_connection *conn = *_conn;
-	imap_master_connection_read_callback_t *read_callback =
-		conn->read_callback;
+	conn->finish_callback(conn->context);
 
-	*_conn = NULL;
-	conn->read_callback = NULL;
-	read_callback(conn->context, line);
-	/* connection is destroyed now */
+	timeout_remove(&conn->to);
+	connection_deinit(&conn->conn);
+	i_free(conn);
 }
 
 void imap_master_connection_deinit(struct imap_master_connection **_conn)
-{
-	imap_master_read_callback(_conn, t_strdup_printf(
-		"-%s", connection_disconnect_reason(&(*_conn)->conn)));
-}
-
-void imap_master_connection_free(struct imap_master_connection **_conn)
 {
 	struct imap_master_connection *conn = *_conn;
+	const char *reply;
 
 	*_conn = NULL;
 
-	timeout_remove(&conn->to);
-	connection_deinit(&conn->conn);
-	i_free(conn);
+	reply = t_strdup_printf("-%s",
+		connection_disconnect_reason(&conn->conn));
+	if (!conn->requests_sent)
+		conn->read_callback(conn->context, reply);
+	for (; conn->replies_pending > 0; conn->replies_pending--)
+		conn->read_callback(conn->context, reply);
+	imap_master_connection_finish(conn);
 }
 
 static void imap_master_client_destroy(struct connection *_conn)
@@ -94,30 +97,66 @@ static void imap_master_client_destroy(struct connection *_conn)
 	imap_master_connection_deinit(&conn);
 }
 
+static int
+imap_master_connection_send(struct imap_master_connection *conn,
+			    unsigned int max_requests)
+{
+	conn->requests_sent = TRUE;
+	conn->replies_pending =
+		conn->send_callback(conn->context, conn->conn.output,
+				    max_requests);
+	i_assert(conn->replies_pending <= max_requests);
+	if (conn->replies_pending == 0) {
+		/* nothing to send after all */
+		imap_master_connection_finish(conn);
+		return -1;
+	}
+	return 1;
+}
+
 static int
 imap_master_client_input_line(struct connection *_conn, const char *line)
 {
 	struct imap_master_connection *conn =
 		(struct imap_master_connection *)_conn;
+	const char *value;
+	unsigned int limit;
 
 	if (!_conn->version_received) {
 		if (connection_input_line_default(_conn, line) < 0)
 			return -1;
 
-		conn->send_callback(conn->context, _conn->output);
-		return 1;
-	} else {
-		imap_master_read_callback(&conn, line);
-		/* we're finished now with this connection - disconnect it */
-		return -1;
+		if (_conn->minor_version >= 1) {
+			/* wait for the number of clients we can send */
+			conn->limit_pending = TRUE;
+			return 1;
+		}
+		return imap_master_connection_send(conn, 1);
+	} else if (conn->limit_pending) {
+		if (!str_begins(line, "LIMIT\t", &value) ||
+		    str_to_uint(value, &limit) < 0 || limit == 0) {
+			e_error(_conn->event, "Invalid LIMIT line: %s", line);
+			return -1;
+		}
+		conn->limit_pending = FALSE;
+		return imap_master_connection_send(conn, limit);
 	}
+
+	i_assert(conn->replies_pending > 0);
+	conn->replies_pending--;
+	conn->read_callback(conn->context, line);
+	if (conn->replies_pending > 0)
+		return 1;
+	/* we're finished now with this connection - disconnect it */
+	imap_master_connection_finish(conn);
+	return -1;
 }
 
 static struct connection_settings client_set = {
 	.service_name_in = "imap-master",
 	.service_name_out = "imap-master",
 	.major_version = 1,
-	.minor_version = 0,
+	.minor_version = 1,
 
 	.input_max_size = SIZE_MAX,
 	.output_max_size = SIZE_MAX,
@@ -3,20 +3,31 @@
 
 struct imap_master_connection;
 
-typedef void
-imap_master_connection_send_callback_t(void *context, struct ostream *output);
+/* Send up to max_requests requests to the imap process. Returns the number
+   of requests sent. */
+typedef unsigned int
+imap_master_connection_send_callback_t(void *context, struct ostream *output,
+				       unsigned int max_requests);
+/* Called for each reply in the order the requests were sent. If the
+   connection fails, called with "-<reason>" for each request still waiting
+   for a reply, or once if nothing was sent yet. */
 typedef void
 imap_master_connection_read_callback_t(void *context, const char *reply);
+/* Called after all the replies have been read or the connection failed.
+   The connection is freed afterwards. */
+typedef void
+imap_master_connection_finish_callback_t(void *context);
 
 /* Returns 1 = success, 0 = retry later, -1 = error */
 int imap_master_connection_init(const char *path,
 				imap_master_connection_send_callback_t *send_callback,
 				imap_master_connection_read_callback_t *read_callback,
+				imap_master_connection_finish_callback_t *finish_callback,
 				void *context,
 				struct imap_master_connection **conn_r,
 				const char **error_r);
+/* Fail the pending requests and free the connection. */
 void imap_master_connection_deinit(struct imap_master_connection **conn);
-void imap_master_connection_free(struct imap_master_connection **conn);
 
 void imap_master_connections_init(void);
 void imap_master_connections_deinit(void);
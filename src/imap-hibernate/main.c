@@ -5,6 +5,7 @@
 #include "master-service.h"
 #include "master-admin-client.h"
 #include "master-service-settings.h"
+#include "imap-hibernate-settings.h"
 #include "imap-client.h"
 #include "imap-hibernate-client.h"
 #include "imap-master-connection.h"
@@ -23,8 +24,13 @@ static void client_connected(struct master_service_connection *conn)
 
 int main(int argc, char *argv[])
 {
+	const struct setting_parser_info *set_roots[] = {
+		&imap_hibernate_setting_parser_info,
+		NULL
+	};
 	enum master_service_flags service_flags =
 		MASTER_SERVICE_FLAG_UPDATE_PROCTITLE;
+	const struct imap_hibernate_settings *set;
 	const char *error;
 	int c;
 
@@ -40,15 +46,18 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (master_service_settings_read_simple(master_service, NULL, &error) < 0)
+	if (master_service_settings_read_simple(master_service, set_roots,
+						&error) < 0)
 		i_fatal("Error reading configuration: %s", error);
+	set = master_service_settings_get_root_set(master_service,
+				&imap_hibernate_setting_parser_info);
 
 	master_service_init_log(master_service);
 	restrict_access_by_env(RESTRICT_ACCESS_FLAG_ALLOW_ROOT, NULL);
 	restrict_access_allow_coredumps(TRUE);
 
 	master_admin_clients_init(&admin_callbacks);
-	imap_clients_init();
+	imap_clients_init(set);
 	imap_master_connections_init();
 	imap_hibernate_clients_init();
 	master_service_init_finish(master_service);
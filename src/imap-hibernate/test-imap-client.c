@@ -0,0 +1,536 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "fdpass.h"
+#include "ioloop.h"
+#include "net.h"
+#include "write-full.h"
+#include "path-util.h"
+#include "unlink-directory.h"
+#include "master-service.h"
+#include "master-service-settings.h"
+#include "test-common.h"
+#include "imap-hibernate-settings.h"
+#include "imap-master-connection.h"
+#include "imap-client.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#define TEMP_DIRNAME ".test-imap-client"
+
+#define TEST_CLIENT_COUNT 5
+/* Only reached if the test is broken */
+#define TEST_TIMEOUT_MSECS 10000
+
+struct test_master_conn {
+	pool_t pool;
+	int fd;
+	struct io *io;
+	string_t *input;
+	bool version_received;
+	bool replied;
+
+	/* fds and usernames in the order they were received */
+	ARRAY(int) client_fds;
+	ARRAY_TYPE(const_string) usernames;
+	/* Number of reads that received fds */
+	unsigned int fd_reads_count;
+};
+
+struct test_client {
+	int fd;
+	int notify_fd;
+	struct io *io, *notify_io;
+};
+
+static const char *tmpdir;
+static struct ioloop *ioloop;
+static int master_listen_fd;
+static struct io *master_listen_io;
+static ARRAY(struct test_master_conn *) master_conns;
+static unsigned int master_active_count, master_max_active_count;
+/* imap-master protocol minor version, and LIMIT sent automatically after
+   the handshake (0 = the test sends it) */
+static unsigned int master_minor_version, master_limit;
+static bool master_auto_reply;
+
+static struct test_client test_clients[TEST_CLIENT_COUNT];
+/* What has happened so far */
+static unsigned int test_notify_eofs, test_requests, test_clients_finished;
+static unsigned int test_versions_received;
+static unsigned int *test_wait_counter, test_wait_target;
+static bool test_timed_out;
+
+static void test_wait_check(void)
+{
+	if (test_wait_counter != NULL && *test_wait_counter >= test_wait_target)
+		io_loop_stop(ioloop);
+}
+
+static void test_wait_timeout(void *context ATTR_UNUSED)
+{
+	test_timed_out = TRUE;
+	io_loop_stop(ioloop);
+}
+
+/* Run ioloop until the counter reaches the target */
+static void test_wait(unsigned int *counter, unsigned int target)
+{
+	struct timeout *to;
+
+	if (*counter >= target)
+		return;
+
+	test_wait_counter = counter;
+	test_wait_target = target;
+	test_timed_out = FALSE;
+	to = timeout_add(TEST_TIMEOUT_MSECS, test_wait_timeout, NULL);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+	test_wait_counter = NULL;
+	test_assert(!test_timed_out);
+}
+
+static void test_master_conn_close(struct test_master_conn *conn)
+{
+	int fd;
+
+	io_remove(&conn->io);
+	i_close_fd(&conn->fd);
+	array_foreach_elem(&conn->client_fds, fd)
+		i_close_fd(&fd);
+	array_clear(&conn->client_fds);
+}
+
+static void test_master_reply(struct test_master_conn *conn)
+{
+	unsigned int i, count = array_count(&conn->usernames);
+	int fd;
+
+	i_assert(count > 0 && !conn->replied);
+
+	for (i = 0; i < count; i++) {
+		if (write_full(conn->fd, "+\n", 2) < 0)
+			i_fatal("write(master) failed: %m");
+	}
+	conn->replied = TRUE;
+	master_active_count--;
+
+	/* the imap process would now own the client fds */
+	array_foreach_elem(&conn->client_fds, fd)
+		i_close_fd(&fd);
+	array_clear(&conn->client_fds);
+}
+
+static void test_master_input(struct test_master_conn *conn)
+{
+	unsigned char buf[1024];
+	int fds[FDPASS_MAX_FDS];
+	unsigned int fds_count = N_ELEMENTS(fds);
+	const char *data, *p;
+	ssize_t ret;
+
+	ret = fd_read_multi(conn->fd, buf, sizeof(buf), fds, &fds_count);
+	if (ret <= 0) {
+		test_master_conn_close(conn);
+		return;
+	}
+	if (fds_count > 0) {
+		array_append(&conn->client_fds, fds, fds_count);
+		conn->fd_reads_count++;
+	}
+	str_append_data(conn->input, buf, ret);
+
+	/* The first line is imap-hibernate's VERSION handshake, the rest
+	   are the clients' states. */
+	data = str_c(conn->input);
+	while ((p = strchr(data, '\n')) != NULL) {
+		if (!conn->version_received) {
+			test_assert(str_begins_with(data, "VERSION\t"));
+			conn->version_received = TRUE;
+			test_versions_received++;
+		} else {
+			const char *username =
+				p_strdup(conn->pool, t_strcut(data, '\t'));
+			array_push_back(&conn->usernames, &username);
+			test_requests++;
+		}
+		data = p + 1;
+	}
+	str_delete(conn->input, 0, data - str_c(conn->input));
+
+	if (master_auto_reply && !conn->replied &&
+	    array_count(&conn->usernames) > 0 && str_len(conn->input) == 0)
+		test_master_reply(conn);
+	test_wait_check();
+}
+
+static void test_master_accept(void *context ATTR_UNUSED)
+{
+	struct test_master_conn *conn;
+	string_t *str;
+	pool_t pool;
+	int fd;
+
+	fd = net_accept(master_listen_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+	pool = pool_alloconly_create("test master conn", 1024);
+	conn = p_new(pool, struct test_master_conn, 1);
+	conn->pool = pool;
+	conn->fd = fd;
+	conn->input = str_new(pool, 256);
+	p_array_init(&conn->client_fds, pool, 4);
+	p_array_init(&conn->usernames, pool, 4);
+	conn->io = io_add(fd, IO_READ, test_master_input, conn);
+	array_push_back(&master_conns, &conn);
+
+	if (++master_active_count > master_max_active_count)
+		master_max_active_count = master_active_count;
+
+	str = t_str_new(64);
+	str_printfa(str, "VERSION\timap-master\t1\t%u\n", master_minor_version);
+	if (master_limit > 0)
+		str_printfa(str, "LIMIT\t%u\n", master_limit);
+	if (write_full(fd, str_data(str), str_len(str)) < 0)
+		i_fatal("write(master) failed: %m");
+}
+
+static void test_master_send_limit(struct test_master_conn *conn,
+				   unsigned int limit)
+{
+	const char *line = t_strdup_printf("LIMIT\t%u\n", limit);
+
+	if (write_full(conn->fd, line, strlen(line)) < 0)
+		i_fatal("write(master) failed: %m");
+}
+
+static struct test_master_conn *test_master_find(const char *username)
+{
+	struct test_master_conn *conn;
+	const char *name;
+
+	array_foreach_elem(&master_conns, conn) {
+		array_foreach_elem(&conn->usernames, name) {
+			if (strcmp(name, username) == 0)
+				return conn;
+		}
+	}
+	return NULL;
+}
+
+static void test_master_init(unsigned int minor_version, unsigned int limit)
+{
+	const char *path = t_strconcat(tmpdir, "/imap-master", NULL);
+
+	master_listen_fd = net_listen_unix(path, 128);
+	if (master_listen_fd == -1)
+		i_fatal("net_listen_unix(%s) failed: %m", path);
+	master_listen_io = io_add(master_listen_fd, IO_READ,
+				  test_master_accept, NULL);
+	i_array_init(&master_conns, TEST_CLIENT_COUNT);
+	master_active_count = master_max_active_count = 0;
+	master_minor_version = minor_version;
+	master_limit = limit;
+	master_auto_reply = FALSE;
+	test_notify_eofs = test_requests = test_clients_finished = 0;
+	test_versions_received = 0;
+}
+
+static void test_master_deinit(void)
+{
+	struct test_master_conn *conn;
+
+	array_foreach_elem(&master_conns, conn) {
+		test_master_conn_close(conn);
+		pool_unref(&conn->pool);
+	}
+	array_free(&master_conns);
+	io_remove(&master_listen_io);
+	i_close_fd(&master_listen_fd);
+	if (unlink(t_strconcat(tmpdir, "/imap-master", NULL)) < 0)
+		i_error("unlink(imap-master) failed: %m");
+}
+
+static void test_client_input(struct test_client *tclient)
+{
+	char buf[1024];
+	ssize_t ret;
+
+	/* EOF means that both imap-hibernate and the imap process have
+	   closed the client fd */
+	ret = read(tclient->fd, buf, sizeof(buf));
+	if (ret == 0 || (ret < 0 && errno != EAGAIN)) {
+		io_remove(&tclient->io);
+		test_clients_finished++;
+		test_wait_check();
+	}
+}
+
+static void test_client_notify_input(struct test_client *tclient)
+{
+	char buf[1];
+
+	/* imap-hibernate closes the notify fd when it stops waiting for
+	   changes, i.e. when the client is being moved back or queued */
+	if (read(tclient->notify_fd, buf, sizeof(buf)) <= 0) {
+		io_remove(&tclient->notify_io);
+		test_notify_eofs++;
+		test_wait_check();
+	}
+}
+
+static void test_clients_create(void)
+{
+	struct imap_client *client;
+	int client_fds[2], notify_fds[2];
+	unsigned int i;
+
+	for (i = 0; i < TEST_CLIENT_COUNT; i++) {
+		struct test_client *tclient = &test_clients[i];
+		struct imap_client_state state = {
+			.username = t_strdup_printf("user%u", i),
+			.mail_log_prefix = "",
+			.userdb_fields = "",
+		};
+
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, client_fds) < 0 ||
+		    socketpair(AF_UNIX, SOCK_STREAM, 0, notify_fds) < 0)
+			i_fatal("socketpair() failed: %m");
+		tclient->fd = client_fds[1];
+		tclient->notify_fd = notify_fds[1];
+		tclient->io = io_add(tclient->fd, IO_READ,
+				     test_client_input, tclient);
+		tclient->notify_io = io_add(tclient->notify_fd, IO_READ,
+					    test_client_notify_input, tclient);
+
+		master_service_client_connection_created(master_service);
+		client = imap_client_create(client_fds[0], &state);
+		imap_client_add_notify_fd(client, notify_fds[0]);
+		imap_client_create_finish(client);
+	}
+}
+
+static void test_clients_destroy(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < TEST_CLIENT_COUNT; i++) {
+		io_remove(&test_clients[i].io);
+		io_remove(&test_clients[i].notify_io);
+		i_close_fd(&test_clients[i].fd);
+		i_close_fd(&test_clients[i].notify_fd);
+	}
+}
+
+static void test_client_notify(unsigned int idx)
+{
+	if (write(test_clients[idx].notify_fd, "", 1) != 1)
+		i_fatal("write(notify) failed: %m");
+}
+
+static void test_client_send_input(unsigned int idx)
+{
+	if (write(test_clients[idx].fd, "x", 1) != 1)
+		i_fatal("write(client) failed: %m");
+}
+
+static bool
+test_master_conn_has_client(struct test_master_conn *conn, unsigned int idx,
+			    unsigned int client_idx)
+{
+	const char *username = t_strdup_printf("user%u", client_idx);
+	char buf;
+	int fd;
+
+	if (idx >= array_count(&conn->usernames) ||
+	    strcmp(array_idx_elem(&conn->usernames, idx), username) != 0)
+		return FALSE;
+
+	/* make sure the fd sent with the request is the client's socket */
+	fd = *array_idx(&conn->client_fds, idx);
+	if (write(fd, "", 1) != 1)
+		i_fatal("write(client) failed: %m");
+	return recv(test_clients[client_idx].fd, &buf, 1, MSG_DONTWAIT) == 1;
+}
+
+static void test_imap_client_unhibernate_concurrency(void)
+{
+	const struct imap_hibernate_settings set = {
+		.imap_hibernate_unhibernate_concurrency = 2,
+	};
+	struct test_master_conn *const *conns, *conn;
+	unsigned int i, count;
+
+	test_begin("imap client unhibernate concurrency");
+	imap_clients_init(&set);
+	/* old imap process that takes only one client per connection */
+	test_master_init(0, 0);
+	test_clients_create();
+
+	/* change notifications wake up the clients one at a time, so the
+	   queue order is known */
+	for (i = 0; i < TEST_CLIENT_COUNT - 1; i++) {
+		test_client_notify(i);
+		test_wait(&test_notify_eofs, i + 1);
+	}
+	test_wait(&test_requests, 2);
+	test_assert(test_requests == 2);
+	test_assert(master_max_active_count == 2);
+	test_assert(test_master_find("user0") != NULL);
+	test_assert(test_master_find("user1") != NULL);
+
+	/* the last client sends input, which moves it first in the queue */
+	test_client_send_input(TEST_CLIENT_COUNT - 1);
+	test_wait(&test_notify_eofs, TEST_CLIENT_COUNT);
+	test_assert(test_requests == 2);
+
+	/* finishing one unhibernation lets the client with input continue */
+	conns = array_get(&master_conns, &count);
+	test_master_reply(conns[0]);
+	test_wait(&test_requests, 3);
+	test_wait(&test_clients_finished, 1);
+	conns = array_get(&master_conns, &count);
+	test_assert(count == 3);
+	test_assert(test_master_conn_has_client(conns[count-1], 0,
+						TEST_CLIENT_COUNT - 1));
+
+	/* finish the rest */
+	master_auto_reply = TRUE;
+	array_foreach_elem(&master_conns, conn) {
+		if (array_count(&conn->usernames) > 0 && !conn->replied)
+			test_master_reply(conn);
+	}
+	test_wait(&test_clients_finished, TEST_CLIENT_COUNT);
+	test_assert(test_requests == TEST_CLIENT_COUNT);
+	test_assert(array_count(&master_conns) == TEST_CLIENT_COUNT);
+	test_assert(master_max_active_count == 2);
+
+	test_clients_destroy();
+	test_master_deinit();
+	imap_clients_deinit();
+	test_end();
+}
+
+static void test_imap_client_unhibernate_batch(void)
+{
+	const struct imap_hibernate_settings set = {
+		.imap_hibernate_unhibernate_concurrency = 1,
+	};
+	struct test_master_conn *const *conns, *conn;
+	unsigned int i, count;
+
+	test_begin("imap client unhibernate batch");
+	imap_clients_init(&set);
+	/* imap process that takes multiple clients. Hold its LIMIT line
+	   until all the clients are queued. */
+	test_master_init(1, 0);
+	test_clients_create();
+
+	for (i = 0; i < TEST_CLIENT_COUNT - 1; i++) {
+		test_client_notify(i);
+		test_wait(&test_notify_eofs, i + 1);
+	}
+	test_client_send_input(TEST_CLIENT_COUNT - 1);
+	test_wait(&test_notify_eofs, TEST_CLIENT_COUNT);
+	test_wait(&test_versions_received, 1);
+	test_assert(test_requests == 0);
+
+	/* the first client and the next two queued ones are sent in the same
+	   message, the one with input first */
+	conns = array_get(&master_conns, &count);
+	test_assert(count == 1);
+	conn = conns[0];
+	test_master_send_limit(conn, 3);
+	test_wait(&test_requests, 3);
+	test_assert(array_count(&conn->usernames) == 3);
+	test_assert(array_count(&conn->client_fds) == 3);
+	test_assert(conn->fd_reads_count == 1);
+	test_assert(test_master_conn_has_client(conn, 0, 0));
+	test_assert(test_master_conn_has_client(conn, 1,
+						TEST_CLIENT_COUNT - 1));
+
+	/* the next connection gets the rest */
+	master_limit = 3;
+	test_master_reply(conn);
+	test_wait(&test_clients_finished, 3);
+	test_wait(&test_requests, TEST_CLIENT_COUNT);
+	conns = array_get(&master_conns, &count);
+	test_assert(count == 2);
+	conn = conns[count-1];
+	test_assert(array_count(&conn->usernames) == 2);
+	test_assert(array_count(&conn->client_fds) == 2);
+	test_assert(conn->fd_reads_count == 1);
+
+	test_master_reply(conn);
+	test_wait(&test_clients_finished, TEST_CLIENT_COUNT);
+	test_assert(master_max_active_count == 1);
+
+	test_clients_destroy();
+	test_master_deinit();
+	imap_clients_deinit();
+	test_end();
+}
+
+static void test_cleanup(void)
+{
+	const char *error;
+
+	if (unlink_directory(tmpdir, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_error("unlink_directory() failed: %s", error);
+}
+
+static void test_init(void)
+{
+	const char *cwd, *error;
+
+	test_assert(t_get_working_dir(&cwd, &error) == 0);
+	tmpdir = t_strconcat(cwd, "/"TEMP_DIRNAME, NULL);
+
+	test_cleanup();
+	if (mkdir(tmpdir, 0700) < 0)
+		i_fatal("mkdir() failed: %m");
+
+	if (master_service_settings_read_simple(master_service, NULL,
+						&error) < 0)
+		i_fatal("Error reading configuration: %s", error);
+	if (master_service_set(master_service,
+			t_strconcat("base_dir=", tmpdir, NULL)) <= 0)
+		i_fatal("Failed to set base_dir");
+	master_service_set_client_limit(master_service, TEST_CLIENT_COUNT);
+	master_service_set_service_count(master_service, UINT_MAX);
+}
+
+int main(int argc, char *argv[])
+{
+	const enum master_service_flags service_flags =
+		MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+		MASTER_SERVICE_FLAG_STANDALONE |
+		MASTER_SERVICE_FLAG_DONT_SEND_STATS;
+	int ret;
+
+	master_service = master_service_init("test-imap-client",
+					     service_flags, &argc, &argv, "");
+	master_service_init_finish(master_service);
+	test_init();
+
+	ioloop = io_loop_create();
+	imap_master_connections_init();
+
+	static void (*const test_functions[])(void) = {
+		test_imap_client_unhibernate_concurrency,
+		test_imap_client_unhibernate_batch,
+		NULL
+	};
+	ret = test_run(test_functions);
+
+	imap_master_connections_deinit();
+	io_loop_destroy(&ioloop);
+	test_cleanup();
+	master_service_deinit(&master_service);
+	return ret;
+}
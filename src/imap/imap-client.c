@@ -147,8 +147,8 @@ struct client *client_create(int fd_in, int fd_out, bool unhibernated,
 
 	p_array_init(&client->module_contexts, client->pool, 5);
         client->last_input = ioloop_time;
-	client->to_idle = timeout_add(CLIENT_IDLE_TIMEOUT_MSECS,
-				      client_idle_timeout, client);
+	client->to_idle = timeout_add_coarse(CLIENT_IDLE_TIMEOUT_MSECS,
+					     client_idle_timeout, client);
 
 	client->command_pool =
 		pool_alloconly_create(MEMPOOL_GROWING"client command", 1024*2);
@@ -1378,6 +1378,14 @@ bool client_handle_input(struct client *client)
 		} T_END;
 		if (ret)
 			handled_commands = TRUE;
+		if (ret && !remove_io && !client->disconnected &&
+		    client->io != NULL &&
+		    io_loop_is_over_budget(current_ioloop)) {
+			/* handled commands long enough. let the other IOs run
+			   and continue with the pipelined commands later. */
+			i_stream_set_input_pending(client->input, TRUE);
+			break;
+		}
 	} while (ret && !client->disconnected && client->io != NULL);
 	client->handling_input = FALSE;
 
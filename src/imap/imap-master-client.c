@@ -17,9 +17,16 @@
 #include "imap-state.h"
 #include "imap-master-client.h"
 
+/* Maximum number of clients that imap-hibernate may send in one batch */
+#define IMAP_MASTER_CLIENT_MAX_BATCH 16
+
 struct imap_master_client {
 	struct connection conn;
-	bool imap_client_created;
+	/* Number of client connection slots reserved for this connection,
+	   including the connection's own slot */
+	unsigned int clients_limit;
+	unsigned int clients_created;
+	unsigned int requests_count;
 };
 
 struct imap_master_input {
@@ -47,9 +54,15 @@ static struct connection_list *master_clients = NULL;
 static void imap_master_client_destroy(struct connection *conn)
 {
 	struct imap_master_client *client = (struct imap_master_client *)conn;
+	unsigned int unused = client->clients_limit - client->clients_created;
 
-	if (!client->imap_client_created)
+	if (client->clients_created == 0) {
+		/* the connection's own slot wasn't handed over to a client */
 		master_service_client_connection_destroyed(master_service);
+		unused--;
+	}
+	for (; unused > 0; unused--)
+		master_service_client_connection_release(master_service);
 	connection_deinit(conn);
 	i_free(conn);
 }
@@ -211,7 +224,7 @@ static int imap_master_client_verify(const struct imap_master_input *master_inpu
 	return 0;
 }
 
-static int
+static void
 imap_master_client_input_args(struct connection *conn, const char *const *args,
 			      int fd_client, pool_t pool)
 {
@@ -228,14 +241,14 @@ imap_master_client_input_args(struct connection *conn, const char *const *args,
 		o_stream_nsend_str(conn->output, t_strdup_printf(
 			"-Failed to parse client input: %s\n", error));
 		i_close_fd(&fd_client);
-		return -1;
+		return;
 	}
 	if (imap_master_client_verify(&master_input, fd_client, &error) < 0) {
 		e_error(conn->event, "imap-master: Failed to verify client input: %s", error);
 		o_stream_nsend_str(conn->output, t_strdup_printf(
 			"-Failed to verify client input: %s\n", error));
 		i_close_fd(&fd_client);
-		return -1;
+		return;
 	}
 	process_title_set("[unhibernating]");
 
@@ -250,9 +263,9 @@ imap_master_client_input_args(struct connection *conn, const char *const *args,
 		o_stream_nsend_str(conn->output, t_strdup_printf(
 			"-Failed to create client: %s\n", error));
 		i_close_fd(&fd_client);
-		return -1;
+		return;
 	}
-	client->imap_client_created = TRUE;
+	client->clients_created++;
 
 	long long hibernation_usecs =
 		timeval_diff_usecs(&ioloop_timeval,
@@ -295,7 +308,7 @@ imap_master_client_input_args(struct connection *conn, const char *const *args,
 		e_error(event, "imap-master: %s", error);
 		event_unref(&event);
 		client_destroy(imap_client, error);
-		return -1;
+		return;
 	}
 	/* log prefix is set at this point, so we don't need to add the
 	   username anymore to the log messages */
@@ -316,7 +329,7 @@ imap_master_client_input_args(struct connection *conn, const char *const *args,
 		e_error(event, "imap-master: %s", error);
 		event_unref(&event);
 		client_destroy(imap_client, "Client state initialization failed");
-		return -1;
+		return;
 	}
 	if (imap_client->mailbox != NULL) {
 		/* Would be nice to set this earlier, but the previous errors
@@ -342,21 +355,40 @@ imap_master_client_input_args(struct connection *conn, const char *const *args,
 	}
 
 	imap_refresh_proctitle();
-	/* we'll always disconnect the client afterwards */
-	return -1;
+}
+
+static void imap_master_client_reserve(struct imap_master_client *client)
+{
+	unsigned int extra;
+
+	/* Reserve client slots for a batch of clients. imap-hibernate sends
+	   them all in the same message, so the fds are received at once. */
+	extra = I_MIN(master_service_get_available_count(master_service),
+		      IMAP_MASTER_CLIENT_MAX_BATCH - 1);
+	for (unsigned int i = 0; i < extra; i++)
+		master_service_client_connection_created(master_service);
+	client->clients_limit += extra;
+
+	i_stream_unix_set_read_fds(client->conn.input, client->clients_limit);
+	o_stream_nsend_str(client->conn.output, t_strdup_printf(
+		"LIMIT\t%u\n", client->clients_limit));
 }
 
 static int
 imap_master_client_input_line(struct connection *conn, const char *line)
 {
+	struct imap_master_client *client = (struct imap_master_client *)conn;
 	char *const *args;
 	pool_t pool;
-	int fd_client, ret;
+	int fd_client;
 
 	if (!conn->version_received) {
 		if (connection_handshake_args_default(conn, t_strsplit_tabescaped(line)) < 0)
 			return -1;
 		conn->version_received = TRUE;
+		/* imap-hibernate v1.1+ can send multiple clients */
+		if (conn->minor_version >= 1)
+			imap_master_client_reserve(client);
 		return 1;
 	}
 
@@ -371,10 +403,11 @@ imap_master_client_input_line(struct connection *conn, const char *line)
 
 	pool = pool_alloconly_create("imap master client cmd", 1024);
 	args = p_strsplit_tabescaped(pool, line);
-	ret = imap_master_client_input_args(conn, (const void *)args,
-					    fd_client, pool);
+	imap_master_client_input_args(conn, (const void *)args,
+				      fd_client, pool);
 	pool_unref(&pool);
-	return ret;
+	/* disconnect after all the clients have been handled */
+	return ++client->requests_count < client->clients_limit ? 1 : -1;
 }
 
 static void imap_master_client_idle_timeout(struct connection *conn)
@@ -392,6 +425,7 @@ void imap_master_client_create(int fd)
 	struct imap_master_client *client;
 
 	client = i_new(struct imap_master_client, 1);
+	client->clients_limit = 1;
 	client->conn.unix_socket = TRUE;
 	connection_init_server(master_clients, &client->conn,
 			       "imap-master", fd, fd);
@@ -406,7 +440,7 @@ static struct connection_settings client_set = {
 	.service_name_in = "imap-master",
 	.service_name_out = "imap-master",
 	.major_version = 1,
-	.minor_version = 0,
+	.minor_version = 1,
 
 	.input_max_size = SIZE_MAX,
 	.output_max_size = SIZE_MAX,
@@ -0,0 +1,250 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "mail-cache-private.h"
+
+#ifdef HAVE_ZSTD
+#  include "zstd.h"
+#  include "zdict.h"
+#endif
+
+/* The compressed data is:
+
+   uint32_t uncompressed_size;
+   zstd frame compressed with the cache file's dictionary
+
+   The frame has no content size, dictionary ID or checksum, because they
+   would only add overhead to the small fields. */
+
+#define MAIL_CACHE_COMPRESS_LEVEL 3
+
+struct mail_cache_compressor {
+	buffer_t *dict;
+#ifdef HAVE_ZSTD
+	/* created on the first mail_cache_compress() call */
+	ZSTD_CCtx *cctx;
+	ZSTD_CDict *cdict;
+	/* created on the first mail_cache_decompress() call */
+	ZSTD_DCtx *dctx;
+	ZSTD_DDict *ddict;
+#endif
+};
+
+bool mail_cache_compress_is_supported(void)
+{
+#ifdef HAVE_ZSTD
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+struct mail_cache_compressor *
+mail_cache_compressor_init(const void *dict, size_t dict_size)
+{
+	struct mail_cache_compressor *compressor;
+
+	i_assert(dict_size <= MAIL_CACHE_COMPRESS_DICT_MAX_SIZE);
+
+	compressor = i_new(struct mail_cache_compressor, 1);
+	compressor->dict = buffer_create_dynamic(default_pool, dict_size);
+	buffer_append(compressor->dict, dict, dict_size);
+	return compressor;
+}
+
+void mail_cache_compressor_deinit(struct mail_cache_compressor **_compressor)
+{
+	struct mail_cache_compressor *compressor = *_compressor;
+
+	*_compressor = NULL;
+
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(compressor->cctx);
+	ZSTD_freeCDict(compressor->cdict);
+	ZSTD_freeDCtx(compressor->dctx);
+	ZSTD_freeDDict(compressor->ddict);
+#endif
+	buffer_free(&compressor->dict);
+	i_free(compressor);
+}
+
+#ifdef HAVE_ZSTD
+static void
+mail_cache_compressor_init_cctx(struct mail_cache_compressor *compressor)
+{
+	compressor->cctx = ZSTD_createCCtx();
+	if (compressor->cctx == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "ZSTD_createCCtx() failed");
+	if (compressor->dict->used > 0) {
+		compressor->cdict = ZSTD_createCDict(compressor->dict->data,
+						     compressor->dict->used,
+						     MAIL_CACHE_COMPRESS_LEVEL);
+		if (compressor->cdict == NULL) {
+			i_fatal_status(FATAL_OUTOFMEM,
+				       "ZSTD_createCDict() failed");
+		}
+		(void)ZSTD_CCtx_refCDict(compressor->cctx, compressor->cdict);
+	} else {
+		(void)ZSTD_CCtx_setParameter(compressor->cctx,
+					     ZSTD_c_compressionLevel,
+					     MAIL_CACHE_COMPRESS_LEVEL);
+	}
+	(void)ZSTD_CCtx_setParameter(compressor->cctx,
+				     ZSTD_c_contentSizeFlag, 0);
+	(void)ZSTD_CCtx_setParameter(compressor->cctx, ZSTD_c_checksumFlag, 0);
+	(void)ZSTD_CCtx_setParameter(compressor->cctx, ZSTD_c_dictIDFlag, 0);
+}
+
+static void
+mail_cache_compressor_init_dctx(struct mail_cache_compressor *compressor)
+{
+	compressor->dctx = ZSTD_createDCtx();
+	if (compressor->dctx == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "ZSTD_createDCtx() failed");
+	if (compressor->dict->used > 0) {
+		compressor->ddict = ZSTD_createDDict(compressor->dict->data,
+						     compressor->dict->used);
+		if (compressor->ddict == NULL) {
+			i_fatal_status(FATAL_OUTOFMEM,
+				       "ZSTD_createDDict() failed");
+		}
+	}
+}
+
+bool mail_cache_compress(struct mail_cache_compressor *compressor,
+			 const void *data, size_t size, buffer_t *dest)
+{
+	size_t orig_used = dest->used, bound, ret;
+	uint32_t size32 = size;
+	void *out;
+
+	if (size <= sizeof(size32) + 1 || size > UINT32_MAX)
+		return FALSE;
+	if (compressor->cctx == NULL)
+		mail_cache_compressor_init_cctx(compressor);
+
+	buffer_append(dest, &size32, sizeof(size32));
+	bound = ZSTD_compressBound(size);
+	out = buffer_append_space_unsafe(dest, bound);
+	ret = ZSTD_compress2(compressor->cctx, out, bound, data, size);
+	if (ZSTD_isError(ret)) {
+		buffer_set_used_size(dest, orig_used);
+		return FALSE;
+	}
+	buffer_set_used_size(dest, orig_used + sizeof(size32) + ret);
+
+	if (dest->used - orig_used >= size ||
+	    size / MAIL_CACHE_COMPRESS_MAX_RATIO > dest->used - orig_used) {
+		/* didn't compress, or it compressed so well that
+		   decompressing would refuse it */
+		buffer_set_used_size(dest, orig_used);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int mail_cache_decompress(struct mail_cache_compressor *compressor,
+			  const void *data, size_t size, size_t max_size,
+			  buffer_t *dest, const char **error_r)
+{
+	size_t orig_used = dest->used, ret;
+	uint32_t out_size;
+	void *out;
+
+	if (size < sizeof(out_size)) {
+		*error_r = "Compressed data is truncated";
+		return -1;
+	}
+	memcpy(&out_size, data, sizeof(out_size));
+	/* Don't trust the size in the data. Anything compressing better
+	   than MAIL_CACHE_COMPRESS_MAX_RATIO isn't written by
+	   mail_cache_compress(). */
+	if (out_size > max_size ||
+	    out_size / MAIL_CACHE_COMPRESS_MAX_RATIO > size) {
+		*error_r = t_strdup_printf(
+			"Uncompressed size too large (%u > %zu)", out_size,
+			I_MIN(max_size, size * MAIL_CACHE_COMPRESS_MAX_RATIO));
+		return -1;
+	}
+
+	if (compressor->dctx == NULL)
+		mail_cache_compressor_init_dctx(compressor);
+
+	out = buffer_append_space_unsafe(dest, out_size);
+	data = CONST_PTR_OFFSET(data, sizeof(out_size));
+	size -= sizeof(out_size);
+	if (compressor->ddict != NULL) {
+		ret = ZSTD_decompress_usingDDict(compressor->dctx, out,
+						 out_size, data, size,
+						 compressor->ddict);
+	} else {
+		ret = ZSTD_decompressDCtx(compressor->dctx, out, out_size,
+					  data, size);
+	}
+	if (ZSTD_isError(ret)) {
+		buffer_set_used_size(dest, orig_used);
+		*error_r = t_strdup_printf("zstd decompression failed: %s",
+					   ZSTD_getErrorName(ret));
+		return -1;
+	}
+	if (ret != out_size) {
+		buffer_set_used_size(dest, orig_used);
+		*error_r = t_strdup_printf(
+			"Uncompressed size mismatch (%zu != %u)",
+			ret, out_size);
+		return -1;
+	}
+	return 0;
+}
+
+void mail_cache_compress_train_dict(const void *samples,
+				    const size_t *sample_sizes,
+				    unsigned int samples_count,
+				    size_t max_dict_size, buffer_t *dict)
+{
+	size_t orig_used = dict->used, ret;
+	void *out;
+
+	max_dict_size = I_MIN(max_dict_size, MAIL_CACHE_COMPRESS_DICT_MAX_SIZE);
+	if (samples_count == 0)
+		return;
+
+	out = buffer_append_space_unsafe(dict, max_dict_size);
+	ret = ZDICT_trainFromBuffer(out, max_dict_size, samples, sample_sizes,
+				    samples_count);
+	if (ZDICT_isError(ret)) {
+		/* most likely there weren't enough samples */
+		buffer_set_used_size(dict, orig_used);
+		return;
+	}
+	buffer_set_used_size(dict, orig_used + ret);
+}
+
+#else
+
+bool mail_cache_compress(struct mail_cache_compressor *compressor ATTR_UNUSED,
+			 const void *data ATTR_UNUSED, size_t size ATTR_UNUSED,
+			 buffer_t *dest ATTR_UNUSED)
+{
+	return FALSE;
+}
+
+int mail_cache_decompress(struct mail_cache_compressor *compressor ATTR_UNUSED,
+			  const void *data ATTR_UNUSED,
+			  size_t size ATTR_UNUSED, size_t max_size ATTR_UNUSED,
+			  buffer_t *dest ATTR_UNUSED, const char **error_r)
+{
+	*error_r = "zstd support not compiled in";
+	return -1;
+}
+
+void mail_cache_compress_train_dict(const void *samples ATTR_UNUSED,
+				    const size_t *sample_sizes ATTR_UNUSED,
+				    unsigned int samples_count ATTR_UNUSED,
+				    size_t max_dict_size ATTR_UNUSED,
+				    buffer_t *dict ATTR_UNUSED)
+{
+}
+
+#endif
@@ -355,6 +355,34 @@ mail_cache_header_fields_get_offset(struct mail_cache *cache,
 	return 0;
 }
 
+static int
+mail_cache_header_fields_read_dict(struct mail_cache *cache,
+				   const struct mail_cache_header_fields *field_hdr,
+				   const char *names_end)
+{
+	size_t pos = (const char *)names_end - (const char *)field_hdr;
+	uint32_t dict_size;
+
+	mail_cache_compress_dict_clear(cache);
+
+	pos = (pos + sizeof(uint32_t)-1) & ~(sizeof(uint32_t)-1);
+	if (pos + sizeof(dict_size) > field_hdr->size) {
+		/* no dictionary */
+		return 0;
+	}
+	memcpy(&dict_size, CONST_PTR_OFFSET(field_hdr, pos), sizeof(dict_size));
+	pos += sizeof(dict_size);
+	if (dict_size > field_hdr->size - pos ||
+	    dict_size > MAIL_CACHE_COMPRESS_DICT_MAX_SIZE) {
+		mail_cache_set_corrupted(cache,
+			"field header compression dictionary corrupted");
+		return -1;
+	}
+	buffer_append(cache->compress_dict,
+		      CONST_PTR_OFFSET(field_hdr, pos), dict_size);
+	return 0;
+}
+
 int mail_cache_header_fields_read(struct mail_cache *cache)
 {
 	const struct mail_cache_header_fields *field_hdr;
@@ -373,6 +401,7 @@ int mail_cache_header_fields_read(struct mail_cache *cache)
 
 	if (offset == 0) {
 		/* no fields - the file is empty */
+		mail_cache_compress_dict_clear(cache);
 		return 0;
 	}
 
@@ -513,7 +542,7 @@ int mail_cache_header_fields_read(struct mail_cache *cache)
 
                 names = p + 1;
 	}
-	return 0;
+	return mail_cache_header_fields_read_dict(cache, field_hdr, names);
 }
 
 static void copy_to_buf(struct mail_cache *cache, buffer_t *dest, bool add_new,
@@ -638,6 +667,12 @@ int mail_cache_header_fields_update(struct mail_cache *cache)
 }
 
 void mail_cache_header_fields_get(struct mail_cache *cache, buffer_t *dest)
+{
+	mail_cache_header_fields_get_dict(cache, dest, cache->compress_dict);
+}
+
+void mail_cache_header_fields_get_dict(struct mail_cache *cache, buffer_t *dest,
+				       const buffer_t *dict)
 {
 	struct mail_cache_header_fields hdr;
 	unsigned int field;
@@ -679,6 +714,15 @@ void mail_cache_header_fields_get(struct mail_cache *cache, buffer_t *dest)
 		}
 	}
 
+	if (dict->used > 0) {
+		uint32_t dict_size = dict->used;
+
+		if ((dest->used & 3) != 0)
+			buffer_append_zero(dest, 4 - (dest->used & 3));
+		buffer_append(dest, &dict_size, sizeof(dict_size));
+		buffer_append_buf(dest, dict, 0, SIZE_MAX);
+	}
+
 	hdr.size = dest->used;
 	buffer_write(dest, 0, &hdr, sizeof(hdr));
 
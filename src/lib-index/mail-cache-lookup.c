@@ -237,7 +237,7 @@ mail_cache_lookup_iter_next_record(struct mail_cache_lookup_iterate_ctx *ctx)
 
 static int
 mail_cache_lookup_rec_get_field(struct mail_cache_lookup_iterate_ctx *ctx,
-				unsigned int *field_idx_r)
+				unsigned int *field_idx_r, bool *compressed_r)
 {
 	struct mail_cache *cache = ctx->view->cache;
 	uint32_t file_field;
@@ -245,8 +245,11 @@ mail_cache_lookup_rec_get_field(struct mail_cache_lookup_iterate_ctx *ctx,
 	file_field = *((const uint32_t *)CONST_PTR_OFFSET(ctx->rec, ctx->pos));
 	if (ctx->inmemory_field_idx) {
 		*field_idx_r = file_field;
+		*compressed_r = FALSE;
 		return 0;
 	}
+	*compressed_r = (file_field & MAIL_CACHE_FIELD_FLAG_COMPRESSED) != 0;
+	file_field &= ~MAIL_CACHE_FIELD_FLAG_COMPRESSED;
 
 	if (file_field >= cache->file_fields_count) {
 		/* new field, have to re-read fields header to figure
@@ -279,6 +282,7 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 	struct mail_cache *cache = ctx->view->cache;
 	unsigned int field_idx;
 	unsigned int data_size;
+	bool compressed;
 	int ret;
 
 	i_assert(ctx->remap_counter == cache->remap_counter);
@@ -295,7 +299,7 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 	}
 
 	/* return the next field */
-	if (mail_cache_lookup_rec_get_field(ctx, &field_idx) < 0)
+	if (mail_cache_lookup_rec_get_field(ctx, &field_idx, &compressed) < 0)
 		return -1;
 	ctx->pos += sizeof(uint32_t);
 
@@ -306,6 +310,11 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 		data_size = *((const uint32_t *)
 			      CONST_PTR_OFFSET(ctx->rec, ctx->pos));
 		ctx->pos += sizeof(uint32_t);
+	} else if (compressed) {
+		mail_cache_set_corrupted(cache,
+			"fixed size field %s is compressed",
+			cache->fields[field_idx].field.name);
+		return -1;
 	}
 
 	if (ctx->rec->size - ctx->pos < data_size) {
@@ -318,12 +327,38 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 	field_r->data = CONST_PTR_OFFSET(ctx->rec, ctx->pos);
 	field_r->size = data_size;
 	field_r->offset = ctx->offset + ctx->pos;
+	field_r->compressed = compressed;
 
 	/* each record begins from 32bit aligned position */
 	ctx->pos += (data_size + sizeof(uint32_t)-1) & ~(sizeof(uint32_t)-1);
 	return 1;
 }
 
+int mail_cache_field_decompress(struct mail_cache *cache,
+				const struct mail_cache_iterate_field *field,
+				buffer_t *dest)
+{
+	size_t max_size = cache->index->optimization_set.cache.record_max_size;
+	const char *error;
+
+	i_assert(field->compressed);
+
+	if (cache->decompressor == NULL) {
+		cache->decompressor =
+			mail_cache_compressor_init(cache->compress_dict->data,
+						   cache->compress_dict->used);
+	}
+	if (mail_cache_decompress(cache->decompressor,
+				  field->data, field->size, max_size,
+				  dest, &error) < 0) {
+		mail_cache_set_corrupted(cache,
+			"Broken compressed field %s: %s",
+			cache->fields[field->field_idx].field.name, error);
+		return -1;
+	}
+	return 0;
+}
+
 static int mail_cache_seq(struct mail_cache_view *view, uint32_t seq)
 {
 	struct mail_cache_lookup_iterate_ctx iter;
@@ -434,10 +469,14 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 		/* return the first one that's found. if there are multiple
 		   they're all identical. */
 		while ((ret = mail_cache_lookup_iter_next(&iter, &field)) > 0) {
-			if (field.field_idx == field_idx) {
+			if (field.field_idx != field_idx)
+				continue;
+			if (!field.compressed)
 				buffer_append(dest_buf, field.data, field.size);
-				break;
-			}
+			else if (mail_cache_field_decompress(view->cache, &field,
+							     dest_buf) < 0)
+				ret = -1;
+			break;
 		}
 	}
 	/* NOTE: view->cache->fields may have been reallocated by
@@ -459,6 +498,17 @@ struct header_lookup_context {
 	struct mail_cache_view *view;
 	pool_t pool;
 	ARRAY(struct header_lookup_line) lines;
+
+	const unsigned int *field_idxs;
+	unsigned int fields_count;
+	/* field_idx -> HDR_FIELD_STATE_* */
+	uint8_t *field_state;
+	unsigned int max_field;
+};
+
+struct header_lookup_seq_offset {
+	uint32_t seq;
+	uint32_t offset;
 };
 
 enum {
@@ -507,73 +557,86 @@ static int header_lookup_line_cmp(const struct header_lookup_line *l1,
 	return (int)l1->line_num - (int)l2->line_num;
 }
 
+static void
+header_lookup_init(struct header_lookup_context *ctx,
+		   struct mail_cache_view *view,
+		   const unsigned int field_idxs[], unsigned int fields_count)
+{
+	buffer_t *buf;
+	unsigned int i;
+
+	i_zero(ctx);
+	ctx->view = view;
+	ctx->field_idxs = field_idxs;
+	ctx->fields_count = fields_count;
+	ctx->pool = pool_alloconly_create(MEMPOOL_GROWING"mail cache headers", 1024);
+	t_array_init(&ctx->lines, 32);
+
+	for (i = 0; i < fields_count; i++) {
+		if (field_idxs[i] > ctx->max_field)
+			ctx->max_field = field_idxs[i];
+	}
+	buf = t_buffer_create(32);
+	buffer_write_zero(buf, 0, ctx->max_field + 1);
+	ctx->field_state = buffer_get_modifiable_data(buf, NULL);
+}
+
 static int
-mail_cache_lookup_headers_real(struct mail_cache_view *view, string_t *dest,
-			       uint32_t seq, const unsigned int field_idxs[],
-			       unsigned int fields_count, pool_t *pool_r)
+header_lookup_seq(struct header_lookup_context *ctx, uint32_t seq,
+		  string_t *dest)
 {
 	struct mail_cache_lookup_iterate_ctx iter;
 	struct mail_cache_iterate_field field;
-	struct header_lookup_context ctx;
 	struct header_lookup_line *lines;
 	const unsigned char *p, *start, *end;
-	uint8_t *field_state;
-	unsigned int i, count, max_field = 0;
+	unsigned int i, count;
 	size_t hdr_size;
-	uint8_t want = HDR_FIELD_STATE_WANT;
-	buffer_t *buf;
+	buffer_t *decompress_buf = NULL;
 	int ret;
 
-	*pool_r = NULL;
-
-	if (fields_count == 0)
-		return 1;
-
-	/* update the decision state regardless of whether the fields
-	   actually exist or not. */
-	for (i = 0; i < fields_count; i++)
-		mail_cache_decision_state_update(view, seq, field_idxs[i]);
-
 	/* mark all the fields we want to find. */
-	buf = t_buffer_create(32);
-	for (i = 0; i < fields_count; i++) {
-		if (field_idxs[i] > max_field)
-			max_field = field_idxs[i];
-
-		buffer_write(buf, field_idxs[i], &want, 1);
-	}
-	field_state = buffer_get_modifiable_data(buf, NULL);
+	for (i = 0; i < ctx->fields_count; i++)
+		ctx->field_state[ctx->field_idxs[i]] = HDR_FIELD_STATE_WANT;
+	array_clear(&ctx->lines);
 
 	/* lookup the fields */
-	i_zero(&ctx);
-	ctx.view = view;
-	ctx.pool = *pool_r = pool_alloconly_create(MEMPOOL_GROWING"mail cache headers", 1024);
-	t_array_init(&ctx.lines, 32);
-
-	mail_cache_lookup_iter_init(view, seq, &iter);
+	mail_cache_lookup_iter_init(ctx->view, seq, &iter);
 	while ((ret = mail_cache_lookup_iter_next(&iter, &field)) > 0) {
-		if (field.field_idx > max_field ||
-		    field_state[field.field_idx] != HDR_FIELD_STATE_WANT) {
+		if (field.field_idx > ctx->max_field ||
+		    ctx->field_state[field.field_idx] != HDR_FIELD_STATE_WANT) {
 			/* a) don't want it, b) duplicate */
+		} else if (!field.compressed) {
+			ctx->field_state[field.field_idx] = HDR_FIELD_STATE_SEEN;
+			header_lines_save(ctx, &field);
 		} else {
-			field_state[field.field_idx] = HDR_FIELD_STATE_SEEN;
-			header_lines_save(&ctx, &field);
+			ctx->field_state[field.field_idx] = HDR_FIELD_STATE_SEEN;
+			if (decompress_buf == NULL)
+				decompress_buf = t_buffer_create(1024);
+			else
+				buffer_set_used_size(decompress_buf, 0);
+			if (mail_cache_field_decompress(ctx->view->cache, &field,
+							decompress_buf) < 0)
+				return -1;
+			/* header_lines_save() copies the data, so the buffer
+			   can be reused */
+			field.data = decompress_buf->data;
+			field.size = decompress_buf->used;
+			header_lines_save(ctx, &field);
 		}
-
 	}
 	if (ret < 0)
 		return -1;
 
 	/* check that all fields were found */
-	for (i = 0; i <= max_field; i++) {
-		if (field_state[i] == HDR_FIELD_STATE_WANT)
+	for (i = 0; i < ctx->fields_count; i++) {
+		if (ctx->field_state[ctx->field_idxs[i]] == HDR_FIELD_STATE_WANT)
 			return 0;
 	}
 
 	/* we need to return headers in the order they existed originally.
 	   we can do this by sorting the messages by their line numbers. */
-	array_sort(&ctx.lines, header_lookup_line_cmp);
-	lines = array_get_modifiable(&ctx.lines, &count);
+	array_sort(&ctx->lines, header_lookup_line_cmp);
+	lines = array_get_modifiable(&ctx->lines, &count);
 
 	/* then start filling dest buffer from the headers */
 	for (i = 0; i < count; i++) {
@@ -599,6 +662,29 @@ mail_cache_lookup_headers_real(struct mail_cache_view *view, string_t *dest,
 	return 1;
 }
 
+static int
+mail_cache_lookup_headers_real(struct mail_cache_view *view, string_t *dest,
+			       uint32_t seq, const unsigned int field_idxs[],
+			       unsigned int fields_count, pool_t *pool_r)
+{
+	struct header_lookup_context ctx;
+	unsigned int i;
+
+	*pool_r = NULL;
+
+	if (fields_count == 0)
+		return 1;
+
+	/* update the decision state regardless of whether the fields
+	   actually exist or not. */
+	for (i = 0; i < fields_count; i++)
+		mail_cache_decision_state_update(view, seq, field_idxs[i]);
+
+	header_lookup_init(&ctx, view, field_idxs, fields_count);
+	*pool_r = ctx.pool;
+	return header_lookup_seq(&ctx, seq, dest);
+}
+
 int mail_cache_lookup_headers(struct mail_cache_view *view, string_t *dest,
 			      uint32_t seq, const unsigned int field_idxs[],
 			      unsigned int fields_count)
@@ -619,6 +705,96 @@ int mail_cache_lookup_headers(struct mail_cache_view *view, string_t *dest,
 	return ret;
 }
 
+static int
+header_lookup_seq_offset_cmp(const struct header_lookup_seq_offset *s1,
+			     const struct header_lookup_seq_offset *s2)
+{
+	if (s1->offset < s2->offset)
+		return -1;
+	if (s1->offset > s2->offset)
+		return 1;
+	return s1->seq < s2->seq ? -1 : (s1->seq > s2->seq ? 1 : 0);
+}
+
+static int
+mail_cache_lookup_headers_range_real(struct mail_cache_view *view,
+				     uint32_t seq1, uint32_t seq2,
+				     const unsigned int field_idxs[],
+				     unsigned int fields_count, pool_t pool,
+				     struct mail_cache_headers_result *results)
+{
+	struct header_lookup_context ctx;
+	ARRAY(struct header_lookup_seq_offset) seqs;
+	struct header_lookup_seq_offset *seq_offset;
+	struct mail_cache_headers_result *result;
+	uint32_t seq, reset_id;
+	string_t *dest;
+	int ret = 0;
+
+	/* The decision state isn't updated here, because the caller might
+	   not use all the results. See
+	   mail_cache_lookup_headers_range_used(). */
+
+	/* read the records in the order they are in the cache file. The
+	   oldest messages' records are normally in the same order as the
+	   messages, but the newer ones are appended in the order they were
+	   cached. */
+	t_array_init(&seqs, seq2 - seq1 + 1);
+	for (seq = seq1; seq <= seq2; seq++) {
+		seq_offset = array_append_space(&seqs);
+		seq_offset->seq = seq;
+		seq_offset->offset =
+			mail_cache_lookup_cur_offset(view->view, seq, &reset_id);
+	}
+	array_sort(&seqs, header_lookup_seq_offset_cmp);
+
+	header_lookup_init(&ctx, view, field_idxs, fields_count);
+	dest = t_str_new(1024);
+	array_foreach_modifiable(&seqs, seq_offset) {
+		result = &results[seq_offset->seq - seq1];
+		str_truncate(dest, 0);
+		if ((ret = header_lookup_seq(&ctx, seq_offset->seq, dest)) < 0)
+			break;
+		if (ret > 0) {
+			result->found = TRUE;
+			result->size = str_len(dest);
+			result->data = p_memdup(pool, str_data(dest),
+						str_len(dest));
+		}
+		p_clear(ctx.pool);
+	}
+	pool_unref(&ctx.pool);
+	return ret < 0 ? -1 : 0;
+}
+
+int mail_cache_lookup_headers_range(struct mail_cache_view *view,
+				    uint32_t seq1, uint32_t seq2,
+				    const unsigned int field_idxs[],
+				    unsigned int fields_count, pool_t pool,
+				    struct mail_cache_headers_result **results_r)
+{
+	struct mail_cache_headers_result *results;
+	unsigned int i;
+	int ret;
+
+	i_assert(seq1 > 0 && seq1 <= seq2);
+
+	results = p_new(pool, struct mail_cache_headers_result,
+			seq2 - seq1 + 1);
+	*results_r = results;
+	if (fields_count == 0) {
+		for (i = 0; i <= seq2 - seq1; i++)
+			results[i].found = TRUE;
+		return 0;
+	}
+
+	T_BEGIN {
+		ret = mail_cache_lookup_headers_range_real(view, seq1, seq2,
+			field_idxs, fields_count, pool, results);
+	} T_END;
+	return ret;
+}
+
 static uint32_t
 mail_cache_get_highest_seq_with_cache(struct mail_cache_view *view,
 				      uint32_t below_seq, uint32_t *reset_id_r)
@@ -692,3 +868,14 @@ mail_cache_get_missing_reason(struct mail_cache_view *view, uint32_t seq)
 		"Mail not cached, highest cached seq=%u uid=%u: reset_id=%u",
 		seq, uid, reset_id);
 }
+
+void mail_cache_lookup_headers_range_used(struct mail_cache_view *view,
+					  uint32_t seq,
+					  const unsigned int field_idxs[],
+					  unsigned int fields_count)
+{
+	unsigned int i;
+
+	for (i = 0; i < fields_count; i++)
+		mail_cache_decision_state_update(view, seq, field_idxs[i]);
+}
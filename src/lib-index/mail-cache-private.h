@@ -13,6 +13,13 @@
 
 #define MAIL_CACHE_MAX_WRITE_BUFFER (1024*256)
 
+/* Maximum size of the compression dictionary in the fields header */
+#define MAIL_CACHE_COMPRESS_DICT_MAX_SIZE (16*1024)
+/* Fields are compressed only if the uncompressed size is at most this many
+   times the compressed size. Decompression refuses anything larger, so the
+   uncompressed size in the data can't be used to allocate lots of memory. */
+#define MAIL_CACHE_COMPRESS_MAX_RATIO 1024
+
 #define MAIL_CACHE_IS_UNUSABLE(cache) \
 	((cache)->hdr == NULL)
 
@@ -83,6 +90,12 @@ struct mail_cache_header_fields {
 	uint8_t decision[fields_count];
 	/* NUL-separated list of field names */
 	char name[fields_count][];
+
+	/* Optional dictionary used by the compressed fields in this cache
+	   file. It begins from the next 32bit aligned position after the
+	   names and it ends at size. Older versions ignore it. */
+	uint32_t dict_size;
+	unsigned char dict[dict_size];
 #endif
 };
 
@@ -104,6 +117,11 @@ struct mail_cache_record {
 	/* array of { uint32_t field; [ uint32_t size; ] { .. } } */
 };
 
+/* If this bit is set in the record's field, the variable sized field's data
+   is compressed with the cache file's dictionary. The data begins with a
+   32bit uncompressed size. */
+#define MAIL_CACHE_FIELD_FLAG_COMPRESSED 0x80000000U
+
 struct mail_cache_field_private {
 	struct mail_cache_field field;
 
@@ -187,6 +205,12 @@ struct mail_cache {
 	unsigned int *file_field_map;
 	/* Size of file_field_map[] */
 	unsigned int file_fields_count;
+	/* Compression dictionary from the latest fields header. Empty if
+	   the file has no dictionary. Use mail_cache_compress_dict_clear()
+	   to clear it. */
+	buffer_t *compress_dict;
+	/* Created from compress_dict when decompressing the first field */
+	struct mail_cache_compressor *decompressor;
 
 	/* mail_cache_purge_later() sets these values to trigger purging on
 	   the next index sync. need_purge_file_seq is set to the current
@@ -281,6 +305,9 @@ struct mail_cache_iterate_field {
 	const void *data;
 	/* Offset to data in cache file */
 	uoff_t offset;
+	/* The data is compressed. Use mail_cache_field_decompress() to get
+	   the field type-specific data. */
+	bool compressed;
 };
 
 struct mail_cache_lookup_iterate_ctx {
@@ -345,6 +372,10 @@ int mail_cache_append(struct mail_cache *cache, const void *data, size_t size,
 int mail_cache_header_fields_read(struct mail_cache *cache);
 int mail_cache_header_fields_update(struct mail_cache *cache);
 void mail_cache_header_fields_get(struct mail_cache *cache, buffer_t *dest);
+/* Same as mail_cache_header_fields_get(), but add the given compression
+   dictionary instead of the current file's. */
+void mail_cache_header_fields_get_dict(struct mail_cache *cache, buffer_t *dest,
+				       const buffer_t *dict);
 int mail_cache_header_fields_get_next_offset(struct mail_cache *cache,
 					     uint32_t *offset_r);
 void mail_cache_expunge_count(struct mail_cache *cache, unsigned int count);
@@ -368,6 +399,11 @@ void mail_cache_lookup_iter_init(struct mail_cache_view *view, uint32_t seq,
    Note that this may trigger re-reading and reallocating cache fields. */
 int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 				struct mail_cache_iterate_field *field_r);
+/* Append the compressed field's uncompressed data to dest. Returns 0 if ok,
+   -1 if the data is corrupted (and the cache is marked corrupted). */
+int mail_cache_field_decompress(struct mail_cache *cache,
+				const struct mail_cache_iterate_field *field,
+				buffer_t *dest);
 const struct mail_cache_record *
 mail_cache_transaction_lookup_rec(struct mail_cache_transaction_ctx *ctx,
 				  unsigned int seq,
@@ -399,6 +435,34 @@ mail_cache_decision_changed_event(struct mail_cache *cache, struct event *event,
 
 bool mail_cache_headers_check_capped(struct mail_cache *cache);
 
+/* Clear cache->compress_dict and free the decompressor using it. */
+void mail_cache_compress_dict_clear(struct mail_cache *cache);
+
+/* Returns TRUE if Dovecot was built with zstd, which is needed for
+   compressing and decompressing the fields. */
+bool mail_cache_compress_is_supported(void);
+/* Create a compressor using the given preset dictionary. */
+struct mail_cache_compressor *
+mail_cache_compressor_init(const void *dict, size_t dict_size);
+void mail_cache_compressor_deinit(struct mail_cache_compressor **compressor);
+/* Append the compressed data with its uncompressed size to dest. Returns
+   FALSE if the data didn't compress, and nothing was appended. */
+bool mail_cache_compress(struct mail_cache_compressor *compressor,
+			 const void *data, size_t size, buffer_t *dest);
+/* Append the uncompressed data to dest. The uncompressed size may be at
+   most max_size. Returns 0 if ok, -1 if the data is corrupted. */
+int mail_cache_decompress(struct mail_cache_compressor *compressor,
+			  const void *data, size_t size, size_t max_size,
+			  buffer_t *dest, const char **error_r);
+/* Append a compression dictionary of max_dict_size bytes at most to dict,
+   trained from the samples. samples contains samples_count samples one
+   after another, with their sizes in sample_sizes. Nothing is appended if
+   there aren't enough samples. */
+void mail_cache_compress_train_dict(const void *samples,
+				    const size_t *sample_sizes,
+				    unsigned int samples_count,
+				    size_t max_dict_size, buffer_t *dict);
+
 struct mail_cache_purge_drop_ctx {
 	struct mail_cache *cache;
 	time_t max_yes_downgrade_time;
@@ -13,6 +13,10 @@
 #include <stdio.h>
 #include <sys/stat.h>
 
+/* Limits for the data used to train the compression dictionary */
+#define MAIL_CACHE_COMPRESS_SAMPLE_MAX_MESSAGES 1000
+#define MAIL_CACHE_COMPRESS_SAMPLE_MAX_SIZE (1024*1024)
+
 struct mail_cache_copy_context {
 	struct mail_cache *cache;
 	struct event *event;
@@ -22,6 +26,12 @@ struct mail_cache_copy_context {
 	ARRAY(unsigned int) bitmask_pos;
 	uint32_t *field_file_map;
 
+	/* Dictionary for the new file. Empty if it has none. */
+	buffer_t *compress_dict;
+	/* NULL if fields aren't compressed */
+	struct mail_cache_compressor *compressor;
+	buffer_t *compress_buf, *decompress_buf;
+
 	uint8_t field_seen_value;
 	bool new_msg;
 };
@@ -44,9 +54,42 @@ mail_cache_merge_bitmask(struct mail_cache_copy_context *ctx,
 		dest[i] |= ((const unsigned char*)field->data)[i];
 }
 
+static bool
+mail_cache_purge_want_compress(struct mail_cache *cache,
+			       const struct mail_cache_field *cache_field,
+			       size_t size)
+{
+	const struct mail_index_cache_optimization_settings *set =
+		&cache->index->optimization_set.cache;
+
+	/* larger fields couldn't be decompressed */
+	return set->compress_min_size != 0 && size >= set->compress_min_size &&
+		size <= set->record_max_size &&
+		cache_field->field_size == UINT_MAX &&
+		cache_field->type != MAIL_CACHE_FIELD_BITMASK;
+}
+
+static int
+mail_cache_purge_field_get_data(struct mail_cache_copy_context *ctx,
+				struct mail_cache_iterate_field *field)
+{
+	if (!field->compressed)
+		return 0;
+
+	/* the field was compressed with the old file's dictionary */
+	buffer_set_used_size(ctx->decompress_buf, 0);
+	if (mail_cache_field_decompress(ctx->cache, field,
+					ctx->decompress_buf) < 0)
+		return -1;
+	field->data = ctx->decompress_buf->data;
+	field->size = ctx->decompress_buf->used;
+	field->compressed = FALSE;
+	return 0;
+}
+
 static void
 mail_cache_purge_field(struct mail_cache_copy_context *ctx,
-		       const struct mail_cache_iterate_field *field)
+		       struct mail_cache_iterate_field *field)
 {
         struct mail_cache_field *cache_field;
 	enum mail_cache_decision_type dec;
@@ -78,6 +121,20 @@ mail_cache_purge_field(struct mail_cache_copy_context *ctx,
 			return;
 	}
 
+	if (mail_cache_purge_field_get_data(ctx, field) < 0)
+		return;
+	if (ctx->compressor != NULL &&
+	    mail_cache_purge_want_compress(ctx->cache, cache_field,
+					   field->size)) {
+		buffer_set_used_size(ctx->compress_buf, 0);
+		if (mail_cache_compress(ctx->compressor, field->data,
+					field->size, ctx->compress_buf)) {
+			file_field_idx |= MAIL_CACHE_FIELD_FLAG_COMPRESSED;
+			field->data = ctx->compress_buf->data;
+			field->size = ctx->compress_buf->used;
+		}
+	}
+
 	buffer_append(ctx->buffer, &file_field_idx, sizeof(file_field_idx));
 
 	if (cache_field->field_size == UINT_MAX) {
@@ -147,7 +204,60 @@ mail_cache_purge_get_fields(struct mail_cache_copy_context *ctx,
 	i_assert(j == used_fields_count);
 
 	buffer_set_used_size(ctx->buffer, 0);
-	mail_cache_header_fields_get(cache, ctx->buffer);
+	mail_cache_header_fields_get_dict(cache, ctx->buffer,
+					  ctx->compress_dict);
+}
+
+static void
+mail_cache_purge_init_compress(struct mail_cache_copy_context *ctx,
+			       struct mail_cache_view *cache_view,
+			       uint32_t first_seq, uint32_t message_count)
+{
+	struct mail_cache *cache = ctx->cache;
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	const struct mail_cache_field *cache_field;
+	ARRAY(size_t) sample_sizes;
+	const size_t *sizes;
+	unsigned int samples_count;
+	buffer_t *samples;
+	uint32_t seq, step;
+
+	/* Train the dictionary from the fields of evenly spread messages.
+	   The fields of the messages are similar enough that this finds the
+	   common headers, hostnames and such. */
+	samples = buffer_create_dynamic(default_pool, 1024*64);
+	i_array_init(&sample_sizes, 1024);
+	step = I_MAX((message_count - first_seq + 1) /
+		     MAIL_CACHE_COMPRESS_SAMPLE_MAX_MESSAGES, 1);
+	for (seq = first_seq; seq <= message_count &&
+	     samples->used < MAIL_CACHE_COMPRESS_SAMPLE_MAX_SIZE; seq += step) {
+		mail_cache_lookup_iter_init(cache_view, seq, &iter);
+		while (mail_cache_lookup_iter_next(&iter, &field) > 0) {
+			cache_field = &cache->fields[field.field_idx].field;
+			if (ctx->field_file_map[field.field_idx] == (uint32_t)-1)
+				continue;
+			if (mail_cache_purge_field_get_data(ctx, &field) < 0)
+				continue;
+			if (mail_cache_purge_want_compress(cache, cache_field,
+							   field.size)) {
+				size_t sample_size = field.size;
+
+				buffer_append(samples, field.data, field.size);
+				array_push_back(&sample_sizes, &sample_size);
+			}
+		}
+	}
+	sizes = array_get(&sample_sizes, &samples_count);
+	mail_cache_compress_train_dict(samples->data, sizes, samples_count,
+				       MAIL_CACHE_COMPRESS_DICT_MAX_SIZE,
+				       ctx->compress_dict);
+	array_free(&sample_sizes);
+	buffer_free(&samples);
+
+	ctx->compressor = mail_cache_compressor_init(ctx->compress_dict->data,
+						     ctx->compress_dict->used);
+	ctx->compress_buf = buffer_create_dynamic(default_pool, 1024);
 }
 
 static bool
@@ -249,6 +359,8 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 	ctx.field_seen = buffer_create_dynamic(default_pool, 64);
 	ctx.field_seen_value = 0;
 	ctx.field_file_map = t_new(uint32_t, cache->fields_count + 1);
+	ctx.compress_dict = buffer_create_dynamic(default_pool, 0);
+	ctx.decompress_buf = buffer_create_dynamic(default_pool, 1024);
 	t_array_init(&ctx.bitmask_pos, 32);
 
 	/* @UNSAFE: drop unused fields and create a field mapping for
@@ -283,6 +395,16 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 	}
 
 	*ext_first_seq_r = seq;
+	if (cache->index->optimization_set.cache.compress_min_size == 0)
+		;
+	else if (!mail_cache_compress_is_supported()) {
+		e_warning(event, "mail_cache_field_compress_min_size is set, "
+			  "but Dovecot was built without zstd support");
+	} else {
+		mail_cache_purge_init_compress(&ctx, cache_view, seq,
+					       message_count);
+	}
+
 	i_array_init(ext_offsets, message_count); record_count = 0;
 	for (; seq <= message_count; seq++) {
 		if (mail_index_transaction_is_expunged(trans, seq)) {
@@ -334,6 +456,11 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 	hdr.backwards_compat_used_file_size = output->offset;
 	buffer_free(&ctx.buffer);
 	buffer_free(&ctx.field_seen);
+	buffer_free(&ctx.compress_dict);
+	buffer_free(&ctx.decompress_buf);
+	buffer_free(&ctx.compress_buf);
+	if (ctx.compressor != NULL)
+		mail_cache_compressor_deinit(&ctx.compressor);
 
 	*file_size_r = output->offset;
 	(void)o_stream_seek(output, 0);
@@ -635,7 +762,7 @@ int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
 	return ret;
 }
 
-bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r)
+static bool mail_cache_need_purge_any(struct mail_cache *cache)
 {
 	if (cache->need_purge_file_seq == 0)
 		return FALSE; /* delayed purging not requested */
@@ -647,6 +774,18 @@ bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r)
 		   mail access comes before doing any extra work. */
 		return FALSE;
 	}
+	return TRUE;
+}
+
+bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r)
+{
+	if (!mail_cache_need_purge_any(cache))
+		return FALSE;
+	if ((cache->index->flags &
+	     MAIL_INDEX_OPEN_FLAG_CACHE_PURGE_BACKGROUND) != 0) {
+		/* another process is going to do it */
+		return FALSE;
+	}
 
 	i_assert(cache->need_purge_reason != NULL);
 	/* t_strdup() the reason in case it gets freed (or replaced)
@@ -655,6 +794,34 @@ bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r)
 	return TRUE;
 }
 
+bool mail_cache_need_background_purge(struct mail_cache *cache,
+				      uint32_t *file_seq_r)
+{
+	if ((cache->index->flags &
+	     MAIL_INDEX_OPEN_FLAG_CACHE_PURGE_BACKGROUND) == 0 ||
+	    !mail_cache_need_purge_any(cache))
+		return FALSE;
+	*file_seq_r = cache->need_purge_file_seq;
+	return TRUE;
+}
+
+int mail_cache_purge_if_wanted(struct mail_cache *cache)
+{
+	const char *reason;
+
+	/* the need for purging is decided when reading the cache header */
+	if (!cache->opened)
+		(void)mail_cache_open_and_verify(cache);
+	if (!mail_cache_need_purge_any(cache))
+		return 0;
+
+	i_assert(cache->need_purge_reason != NULL);
+	reason = t_strdup(cache->need_purge_reason);
+	if (mail_cache_purge(cache, cache->need_purge_file_seq, reason) < 0)
+		return -1;
+	return 1;
+}
+
 void mail_cache_purge_later(struct mail_cache *cache,
 			    const char *reason_format, ...)
 {
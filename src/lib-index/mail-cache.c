@@ -83,6 +83,13 @@ void mail_cache_set_seq_corrupted_reason(struct mail_cache_view *cache_view,
 	mail_cache_expunge_count(cache, 1);
 }
 
+void mail_cache_compress_dict_clear(struct mail_cache *cache)
+{
+	buffer_set_used_size(cache->compress_dict, 0);
+	if (cache->decompressor != NULL)
+		mail_cache_compressor_deinit(&cache->decompressor);
+}
+
 void mail_cache_file_close(struct mail_cache *cache)
 {
 	if (cache->mmap_base != NULL) {
@@ -94,6 +101,7 @@ void mail_cache_file_close(struct mail_cache *cache)
 		file_cache_set_fd(cache->file_cache, -1);
 	if (cache->read_buf != NULL)
 		buffer_set_used_size(cache->read_buf, 0);
+	mail_cache_compress_dict_clear(cache);
 
 	cache->mmap_base = NULL;
 	cache->hdr = NULL;
@@ -572,6 +580,7 @@ mail_cache_open_or_create_path(struct mail_index *index, const char *path)
 	cache->fd = -1;
 	cache->filepath = i_strdup(path);
 	cache->field_pool = pool_alloconly_create("Cache fields", 2048);
+	cache->compress_dict = buffer_create_dynamic(default_pool, 0);
 	hash_table_create(&cache->field_name_hash, cache->field_pool, 0,
 			  strcase_hash, strcasecmp);
 
@@ -622,6 +631,8 @@ void mail_cache_free(struct mail_cache **_cache)
 	mail_cache_file_close(cache);
 
 	buffer_free(&cache->read_buf);
+	mail_cache_compress_dict_clear(cache);
+	buffer_free(&cache->compress_dict);
 	hash_table_destroy(&cache->field_name_hash);
 	pool_unref(&cache->field_pool);
 	event_unref(&cache->event);
@@ -93,6 +93,16 @@ mail_cache_register_get_list(struct mail_cache *cache, pool_t *pool_r,
 
 /* Returns TRUE if cache should be purged. */
 bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r);
+/* Returns TRUE if cache should be purged, but it's not done by this process
+   because of MAIL_INDEX_OPEN_FLAG_CACHE_PURGE_BACKGROUND. file_seq_r is set
+   to the cache file's file_seq, so the caller can avoid requesting the same
+   purge multiple times. */
+bool mail_cache_need_background_purge(struct mail_cache *cache,
+				      uint32_t *file_seq_r);
+/* Purge the cache file if mail_cache_purge_later() has requested it, even
+   if MAIL_INDEX_OPEN_FLAG_CACHE_PURGE_BACKGROUND is set. Returns 1 if the
+   cache was purged, 0 if it wasn't needed, -1 on error. */
+int mail_cache_purge_if_wanted(struct mail_cache *cache);
 /* Set cache file to be purged later. */
 void mail_cache_purge_later(struct mail_cache *cache,
 			    const char *reason_format, ...) ATTR_FORMAT(2, 3);
@@ -184,6 +194,32 @@ int mail_cache_lookup_headers(struct mail_cache_view *view, string_t *dest,
 			      uint32_t seq, const unsigned int field_idxs[],
 			      unsigned int fields_count);
 
+struct mail_cache_headers_result {
+	/* TRUE if all the fields were found */
+	bool found;
+	/* The headers in the same format as mail_cache_lookup_headers()
+	   returns them. */
+	const unsigned char *data;
+	size_t size;
+};
+/* Look up the specified cached headers for all the messages in seq1..seq2.
+   The fields are resolved once and the cache records are read in the cache
+   file order. results_r[seq - seq1] is set for each message, allocated from
+   the given pool. The caching decisions aren't updated, so call
+   mail_cache_lookup_headers_range_used() for each result that is used.
+   Returns 0 if ok, -1 if error. */
+int mail_cache_lookup_headers_range(struct mail_cache_view *view,
+				    uint32_t seq1, uint32_t seq2,
+				    const unsigned int field_idxs[],
+				    unsigned int fields_count, pool_t pool,
+				    struct mail_cache_headers_result **results_r);
+/* Update the caching decisions for the fields the same way as
+   mail_cache_lookup_headers() would have for the message. */
+void mail_cache_lookup_headers_range_used(struct mail_cache_view *view,
+					  uint32_t seq,
+					  const unsigned int field_idxs[],
+					  unsigned int fields_count);
+
 /* "Error in index cache file %s: ...". */
 void mail_cache_set_corrupted(struct mail_cache *cache, const char *fmt, ...)
 	ATTR_FORMAT(2, 3) ATTR_COLD;
@@ -2,9 +2,12 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "llist.h"
 #include "module-context.h"
 #include "eacces-error.h"
 #include "mail-index-private.h"
+#include "mail-transaction-log-private.h"
+#include "mail-cache-private.h"
 #include "mail-index-alloc-cache.h"
 
 #define MAIL_INDEX_ALLOC_CACHE_CONTEXT(obj) \
@@ -17,7 +20,8 @@
 
 struct mail_index_alloc_cache_list {
 	union mail_index_module_context module_ctx;
-	struct mail_index_alloc_cache_list *next;
+	/* The list is in LRU order: the most recently used index first */
+	struct mail_index_alloc_cache_list *prev, *next;
 
 	struct mail_index *index;
 	char *mailbox_path;
@@ -28,6 +32,8 @@ struct mail_index_alloc_cache_list {
 	ino_t index_dir_ino;
 
 	time_t destroy_time;
+	/* Memory used by the index when it was last unreferenced */
+	uoff_t memory_usage;
 };
 
 static MODULE_CONTEXT_DEFINE_INIT(mail_index_alloc_cache_index_module,
@@ -35,6 +41,38 @@ static MODULE_CONTEXT_DEFINE_INIT(mail_index_alloc_cache_index_module,
 static struct mail_index_alloc_cache_list *indexes = NULL;
 static unsigned int indexes_cache_references_count = 0;
 static struct timeout *to_index = NULL;
+static struct mail_index_alloc_cache_settings cache_set = {
+	.max_count = INDEX_CACHE_MAX,
+	.max_size = 0,
+	.timeout_secs = INDEX_CACHE_TIMEOUT,
+};
+
+static uoff_t mail_index_get_memory_usage(struct mail_index *index)
+{
+	struct mail_transaction_log_file *file;
+	uoff_t size = 0;
+
+	if (index->map != NULL) {
+		struct mail_index_record_map *rec_map = index->map->rec_map;
+
+		if (rec_map->mmap_base != NULL)
+			size += rec_map->mmap_size;
+		else {
+			size += (uoff_t)rec_map->records_count *
+				index->map->hdr.record_size;
+		}
+		size += index->map->hdr_copy_buf->used;
+	}
+	if (index->log != NULL) {
+		for (file = index->log->files; file != NULL; file = file->next) {
+			if (file->buffer != NULL)
+				size += file->buffer->used;
+		}
+	}
+	if (index->cache != NULL)
+		size += index->cache->mmap_length;
+	return size;
+}
 
 static struct mail_index_alloc_cache_list *
 mail_index_alloc_cache_add(struct mail_index *index,
@@ -50,8 +88,7 @@ mail_index_alloc_cache_add(struct mail_index *index,
 	list->index_dir_dev = st->st_dev;
 	list->index_dir_ino = st->st_ino;
 
-	list->next = indexes;
-	indexes = list;
+	DLLIST_PREPEND(&indexes, list);
 
 	MODULE_CONTEXT_SET(index, mail_index_alloc_cache_index_module, list);
 	return list;
@@ -80,18 +117,67 @@ mail_index_alloc_cache_list_free(struct mail_index_alloc_cache_list *list)
 	i_free(list);
 }
 
+static bool
+mail_index_alloc_cache_list_expired(struct mail_index_alloc_cache_list *rec,
+				    unsigned int *keep_count,
+				    uoff_t *keep_size)
+{
+	if (rec->destroy_time <= ioloop_time ||
+	    *keep_count >= cache_set.max_count)
+		return TRUE;
+	if (cache_set.max_size != 0 &&
+	    *keep_size + rec->memory_usage > cache_set.max_size)
+		return TRUE;
+	*keep_count += 1;
+	*keep_size += rec->memory_usage;
+	return FALSE;
+}
+
+static void mail_index_alloc_cache_expire(void)
+{
+	struct mail_index_alloc_cache_list *rec, *next;
+	unsigned int keep_count = 0;
+	uoff_t keep_size = 0;
+
+	for (rec = indexes; rec != NULL; rec = next) {
+		next = rec->next;
+		if (rec->refcount == 0 &&
+		    mail_index_alloc_cache_list_expired(rec, &keep_count,
+							&keep_size)) {
+			DLLIST_REMOVE(&indexes, rec);
+			mail_index_alloc_cache_list_free(rec);
+		}
+	}
+}
+
+static void
+mail_index_alloc_cache_get_unrefed(unsigned int *count_r, uoff_t *size_r)
+{
+	struct mail_index_alloc_cache_list *rec;
+
+	*count_r = 0;
+	*size_r = 0;
+	for (rec = indexes; rec != NULL; rec = rec->next) {
+		if (rec->refcount == 0) {
+			*count_r += 1;
+			*size_r += rec->memory_usage;
+		}
+	}
+}
+
 static struct mail_index_alloc_cache_list *
 mail_index_alloc_cache_find_and_expire(const char *mailbox_path,
 				       const char *index_dir,
 				       const struct stat *index_st)
 {
-	struct mail_index_alloc_cache_list **indexp, *rec, *match;
-	unsigned int destroy_count;
+	struct mail_index_alloc_cache_list *rec, *next, *match;
+	unsigned int keep_count = 0;
+	uoff_t keep_size = 0;
 	struct stat st;
 
-	destroy_count = 0; match = NULL;
-	for (indexp = &indexes; *indexp != NULL;) {
-		rec = *indexp;
+	match = NULL;
+	for (rec = indexes; rec != NULL; rec = next) {
+		next = rec->next;
 
 		if (match != NULL) {
 			/* already found the index. we're just going through
@@ -118,18 +204,12 @@ mail_index_alloc_cache_find_and_expire(const char *mailbox_path,
 				match = rec;
 		}
 
-		if (rec->refcount == 0 && rec != match) {
-			if (rec->destroy_time <= ioloop_time ||
-			    destroy_count >= INDEX_CACHE_MAX) {
-				*indexp = rec->next;
-				mail_index_alloc_cache_list_free(rec);
-				continue;
-			} else {
-				destroy_count++;
-			}
+		if (rec->refcount == 0 && rec != match &&
+		    mail_index_alloc_cache_list_expired(rec, &keep_count,
+							&keep_size)) {
+			DLLIST_REMOVE(&indexes, rec);
+			mail_index_alloc_cache_list_free(rec);
 		}
-
-                indexp = &(*indexp)->next;
 	}
 	return match;
 }
@@ -140,6 +220,8 @@ mail_index_alloc_cache_get(struct event *parent_event, const char *mailbox_path,
 {
 	struct mail_index_alloc_cache_list *match;
 	struct stat st;
+	unsigned int cached_count;
+	uoff_t cached_size;
 
 	/* compare index_dir inodes so we don't break even with symlinks.
 	   if index_dir doesn't exist yet or if using in-memory indexes, just
@@ -160,12 +242,28 @@ mail_index_alloc_cache_get(struct event *parent_event, const char *mailbox_path,
 
 	match = mail_index_alloc_cache_find_and_expire(mailbox_path,
 						       index_dir, &st);
+	mail_index_alloc_cache_get_unrefed(&cached_count, &cached_size);
 	if (match == NULL) {
 		struct mail_index *index =
 			mail_index_alloc(parent_event, index_dir, prefix);
 		match = mail_index_alloc_cache_add(index, mailbox_path, &st);
+		e_debug(event_create_passthrough(index->event)->
+			set_name("mail_index_alloc_cache_miss")->
+			add_int("cached_count", cached_count)->
+			add_int("cached_size", cached_size)->event(),
+			"Index not found from cache");
 	} else {
+		e_debug(event_create_passthrough(match->index->event)->
+			set_name("mail_index_alloc_cache_hit")->
+			add_int("cached_count", cached_count)->
+			add_int("cached_size", cached_size)->
+			add_int("index_size", match->memory_usage)->event(),
+			"Index found from cache");
 		match->refcount++;
+		if (match != indexes) {
+			DLLIST_REMOVE(&indexes, match);
+			DLLIST_PREPEND(&indexes, match);
+		}
 	}
 	i_assert(match->index != NULL);
 	return match->index;
@@ -193,16 +291,19 @@ mail_index_alloc_cache_find(const char *index_dir)
 
 static bool destroy_unrefed(unsigned int min_destroy_count)
 {
-	struct mail_index_alloc_cache_list **list, *rec;
+	struct mail_index_alloc_cache_list *rec, *prev;
 	bool destroyed = FALSE;
 	bool seen_ref0 = FALSE;
 
-	for (list = &indexes; *list != NULL;) {
-		rec = *list;
+	/* go through the list from the tail, so the least recently used
+	   indexes are destroyed first */
+	for (rec = indexes; rec != NULL && rec->next != NULL; rec = rec->next) ;
+	for (; rec != NULL; rec = prev) {
+		prev = rec->prev;
 
 		if (rec->refcount == 0 &&
 		    (min_destroy_count > 0 || rec->destroy_time <= ioloop_time)) {
-			*list = rec->next;
+			DLLIST_REMOVE(&indexes, rec);
 			destroyed = TRUE;
 			mail_index_alloc_cache_list_free(rec);
 			if (min_destroy_count > 0)
@@ -220,7 +321,6 @@ static bool destroy_unrefed(unsigned int min_destroy_count)
 				destroyed = TRUE;
 				mail_index_alloc_cache_list_unref(rec);
 			}
-			list = &(*list)->next;
 		}
 	}
 
@@ -238,36 +338,53 @@ index_removal_timeout(void *context ATTR_UNUSED)
 void mail_index_alloc_cache_unref(struct mail_index **_index)
 {
 	struct mail_index *index = *_index;
-	struct mail_index_alloc_cache_list *list, **listp;
+	struct mail_index_alloc_cache_list *list;
 
 	*_index = NULL;
-	list = NULL;
-	for (listp = &indexes; *listp != NULL; listp = &(*listp)->next) {
-		if ((*listp)->index == index) {
-			list = *listp;
+	for (list = indexes; list != NULL; list = list->next) {
+		if (list->index == index)
 			break;
-		}
 	}
 
 	i_assert(list != NULL);
 	i_assert(list->refcount > 0);
 
 	list->refcount--;
-	list->destroy_time = ioloop_time + INDEX_CACHE_TIMEOUT;
+	list->destroy_time = ioloop_time + cache_set.timeout_secs;
 
 	if (list->refcount == 0 && index->open_count == 0) {
 		/* index was already closed. don't even try to cache it. */
-		*listp = list->next;
+		DLLIST_REMOVE(&indexes, list);
 		mail_index_alloc_cache_list_free(list);
-	} else if (to_index == NULL) {
+		return;
+	}
+	if (list->refcount == 0) {
+		list->memory_usage = mail_index_get_memory_usage(index);
+		if (list != indexes) {
+			DLLIST_REMOVE(&indexes, list);
+			DLLIST_PREPEND(&indexes, list);
+		}
+		/* make sure the cache stays within its limits */
+		mail_index_alloc_cache_expire();
+	}
+	if (to_index == NULL && indexes != NULL) {
 		/* Add to root ioloop in case we got here from an inner
 		   ioloop which gets destroyed too early. */
 		to_index = timeout_add_to(io_loop_get_root(),
-					  INDEX_CACHE_TIMEOUT*1000/2,
+					  I_MAX(cache_set.timeout_secs*1000/2, 1),
 					  index_removal_timeout, NULL);
 	}
 }
 
+void mail_index_alloc_cache_set_settings(
+	const struct mail_index_alloc_cache_settings *set)
+{
+	cache_set.max_count = set->max_count;
+	cache_set.max_size = set->max_size;
+	cache_set.timeout_secs = set->timeout_secs != 0 ?
+		set->timeout_secs : INDEX_CACHE_TIMEOUT;
+}
+
 void mail_index_alloc_cache_destroy_unrefed(void)
 {
 	destroy_unrefed(UINT_MAX);
@@ -302,7 +419,7 @@ void mail_index_alloc_cache_index_closing(struct mail_index *index)
 		/* we're closing our referenced index */
 		return;
 	}
-	while (indexes_cache_references_count > INDEX_CACHE_MAX) {
+	while (indexes_cache_references_count > cache_set.max_count) {
 		if (!destroy_unrefed(1)) {
 			/* our cache is full already, don't keep more */
 			return;
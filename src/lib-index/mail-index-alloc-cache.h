@@ -1,6 +1,19 @@
 #ifndef MAIL_INDEX_ALLOC_CACHE_H
 #define MAIL_INDEX_ALLOC_CACHE_H
 
+struct mail_index_alloc_cache_settings {
+	/* Maximum number of unreferenced indexes to keep open for reuse.
+	   0 = don't keep any, i.e. caching is disabled. */
+	unsigned int max_count;
+	/* Maximum memory usage (index map, transaction log and cache file
+	   sizes) of the unreferenced indexes. The least recently used indexes
+	   are closed first. 0 = unlimited */
+	uoff_t max_size;
+	/* How many seconds to keep an unreferenced index open.
+	   0 = default (10s) */
+	unsigned int timeout_secs;
+};
+
 /* If using in-memory indexes, give index_dir=NULL. */
 struct mail_index * ATTR_NULL(1, 2)
 mail_index_alloc_cache_get(struct event *parent_event, const char *mailbox_path,
@@ -12,6 +25,12 @@ struct mail_index *
 mail_index_alloc_cache_find(const char *index_dir);
 
 void mail_index_alloc_cache_destroy_unrefed(void);
+/* Change the settings for the process-global index cache. The cache is
+   shared by all the users in the process, so this should be called only
+   once at process startup. The defaults are max_count=3, max_size=0 and
+   timeout_secs=10. */
+void mail_index_alloc_cache_set_settings(
+	const struct mail_index_alloc_cache_settings *set);
 
 /* internal: */
 void mail_index_alloc_cache_index_opened(struct mail_index *index);
@@ -0,0 +1,565 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "seq-range-array.h"
+#include "mail-index-bitmap.h"
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+#define BITMAP_CHUNK_SHIFT 16
+#define BITMAP_CHUNK_BITS (1U << BITMAP_CHUNK_SHIFT)
+#define BITMAP_CHUNK_MASK (BITMAP_CHUNK_BITS - 1)
+#define BITMAP_CHUNK_WORDS (BITMAP_CHUNK_BITS / 64)
+/* With this many offsets the array takes as much memory as the bitset.
+   Switch back to the array only once the chunk has become half as full,
+   so a count moving back and forth doesn't keep converting the chunk. */
+#define BITMAP_CHUNK_MAX_OFFSETS (BITMAP_CHUNK_BITS / 16)
+/* Number of words compared at a time while scanning a bitset */
+#define BITMAP_SCAN_WORDS 8
+
+struct mail_index_bitmap_chunk {
+	/* Number of bitmaps using this chunk. A shared chunk is copied
+	   before it's modified. */
+	int refcount;
+	/* number of set bits in the chunk */
+	unsigned int count;
+	/* sorted offsets of the set bits, used while bits is NULL */
+	uint16_t *offsets;
+	unsigned int offsets_alloc;
+	uint64_t *bits;
+};
+
+struct mail_index_bitmap {
+	/* NULL chunks have no bits set */
+	ARRAY(struct mail_index_bitmap_chunk *) chunks;
+	unsigned int count;
+};
+
+struct mail_index_bitmap *mail_index_bitmap_init(void)
+{
+	struct mail_index_bitmap *bitmap;
+
+	bitmap = i_new(struct mail_index_bitmap, 1);
+	i_array_init(&bitmap->chunks, 4);
+	return bitmap;
+}
+
+struct mail_index_bitmap *
+mail_index_bitmap_dup(const struct mail_index_bitmap *bitmap)
+{
+	struct mail_index_bitmap *new_bitmap;
+	struct mail_index_bitmap_chunk *chunk;
+
+	/* share the chunks - they're copied only when modified */
+	new_bitmap = i_new(struct mail_index_bitmap, 1);
+	i_array_init(&new_bitmap->chunks, array_count(&bitmap->chunks) + 1);
+	array_foreach_elem(&bitmap->chunks, chunk) {
+		if (chunk != NULL)
+			chunk->refcount++;
+		array_push_back(&new_bitmap->chunks, &chunk);
+	}
+	new_bitmap->count = bitmap->count;
+	return new_bitmap;
+}
+
+static void bitmap_chunk_unref(struct mail_index_bitmap_chunk **_chunk)
+{
+	struct mail_index_bitmap_chunk *chunk = *_chunk;
+
+	if (chunk == NULL)
+		return;
+	*_chunk = NULL;
+	i_assert(chunk->refcount > 0);
+	if (--chunk->refcount > 0)
+		return;
+	i_free(chunk->offsets);
+	i_free(chunk->bits);
+	i_free(chunk);
+}
+
+static struct mail_index_bitmap_chunk *
+bitmap_chunk_dup(const struct mail_index_bitmap_chunk *chunk)
+{
+	struct mail_index_bitmap_chunk *new_chunk;
+
+	new_chunk = i_new(struct mail_index_bitmap_chunk, 1);
+	new_chunk->refcount = 1;
+	new_chunk->count = chunk->count;
+	if (chunk->bits != NULL) {
+		new_chunk->bits = i_new(uint64_t, BITMAP_CHUNK_WORDS);
+		memcpy(new_chunk->bits, chunk->bits,
+		       sizeof(uint64_t) * BITMAP_CHUNK_WORDS);
+	} else if (chunk->count > 0) {
+		new_chunk->offsets_alloc = chunk->count;
+		new_chunk->offsets = i_new(uint16_t, chunk->count);
+		memcpy(new_chunk->offsets, chunk->offsets,
+		       sizeof(uint16_t) * chunk->count);
+	}
+	return new_chunk;
+}
+
+/* Returns the chunk for modifying it, copying it first if it's shared.
+   If the chunk doesn't exist, it's created if create is TRUE. Otherwise
+   NULL is returned. */
+static struct mail_index_bitmap_chunk *
+bitmap_chunk_modifiable(struct mail_index_bitmap *bitmap,
+			unsigned int chunk_idx, bool create)
+{
+	struct mail_index_bitmap_chunk **chunkp, *new_chunk;
+
+	if (chunk_idx < array_count(&bitmap->chunks))
+		chunkp = array_idx_modifiable(&bitmap->chunks, chunk_idx);
+	else if (!create)
+		return NULL;
+	else
+		chunkp = array_idx_get_space(&bitmap->chunks, chunk_idx);
+
+	if (*chunkp == NULL) {
+		if (!create)
+			return NULL;
+		*chunkp = i_new(struct mail_index_bitmap_chunk, 1);
+		(*chunkp)->refcount = 1;
+	} else if ((*chunkp)->refcount > 1) {
+		new_chunk = bitmap_chunk_dup(*chunkp);
+		bitmap_chunk_unref(chunkp);
+		*chunkp = new_chunk;
+	}
+	return *chunkp;
+}
+
+static const struct mail_index_bitmap_chunk *
+bitmap_chunk_get(const struct mail_index_bitmap *bitmap,
+		 unsigned int chunk_idx)
+{
+	struct mail_index_bitmap_chunk *const *chunkp;
+
+	if (chunk_idx >= array_count(&bitmap->chunks))
+		return NULL;
+	chunkp = array_idx(&bitmap->chunks, chunk_idx);
+	return *chunkp;
+}
+
+void mail_index_bitmap_free(struct mail_index_bitmap **_bitmap)
+{
+	struct mail_index_bitmap *bitmap = *_bitmap;
+	struct mail_index_bitmap_chunk **chunkp;
+
+	*_bitmap = NULL;
+	array_foreach_modifiable(&bitmap->chunks, chunkp)
+		bitmap_chunk_unref(chunkp);
+	array_free(&bitmap->chunks);
+	i_free(bitmap);
+}
+
+static unsigned int
+bitmap_chunk_offsets_find(const struct mail_index_bitmap_chunk *chunk,
+			  unsigned int offset)
+{
+	unsigned int idx, left_idx = 0, right_idx = chunk->count;
+
+	/* bits are usually set in increasing order */
+	if (right_idx == 0 || chunk->offsets[right_idx-1] < offset)
+		return right_idx;
+
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (chunk->offsets[idx] < offset)
+			left_idx = idx + 1;
+		else
+			right_idx = idx;
+	}
+	return left_idx;
+}
+
+static void bitmap_chunk_to_bits(struct mail_index_bitmap_chunk *chunk)
+{
+	unsigned int i, offset;
+
+	chunk->bits = i_new(uint64_t, BITMAP_CHUNK_WORDS);
+	for (i = 0; i < chunk->count; i++) {
+		offset = chunk->offsets[i];
+		chunk->bits[offset / 64] |= 1ULL << (offset % 64);
+	}
+	i_free(chunk->offsets);
+	chunk->offsets_alloc = 0;
+}
+
+static void bitmap_chunk_to_offsets(struct mail_index_bitmap_chunk *chunk)
+{
+	unsigned int i, n = 0;
+	uint64_t word;
+
+	chunk->offsets_alloc = chunk->count + 16;
+	chunk->offsets = i_new(uint16_t, chunk->offsets_alloc);
+	for (i = 0; i < BITMAP_CHUNK_WORDS; i++) {
+		for (word = chunk->bits[i]; word != 0; word &= word - 1) {
+			chunk->offsets[n++] =
+				i * 64 + __builtin_ctzll(word);
+		}
+	}
+	i_assert(n == chunk->count);
+	i_free(chunk->bits);
+}
+
+/* Returns TRUE if the bit was changed. */
+static bool
+bitmap_chunk_set(struct mail_index_bitmap_chunk *chunk, unsigned int offset,
+		 bool set)
+{
+	unsigned int pos, new_alloc;
+	uint64_t *word, mask;
+
+	if (chunk->bits == NULL) {
+		pos = bitmap_chunk_offsets_find(chunk, offset);
+		if ((pos < chunk->count && chunk->offsets[pos] == offset) == set)
+			return FALSE;
+		if (!set) {
+			memmove(chunk->offsets + pos, chunk->offsets + pos + 1,
+				(chunk->count - pos - 1) * sizeof(uint16_t));
+			chunk->count--;
+			return TRUE;
+		}
+		if (chunk->count < BITMAP_CHUNK_MAX_OFFSETS) {
+			if (chunk->count == chunk->offsets_alloc) {
+				new_alloc = I_MAX(nearest_power(chunk->count + 1),
+						  16);
+				chunk->offsets = i_realloc_type(chunk->offsets,
+					uint16_t, chunk->offsets_alloc,
+					new_alloc);
+				chunk->offsets_alloc = new_alloc;
+			}
+			memmove(chunk->offsets + pos + 1, chunk->offsets + pos,
+				(chunk->count - pos) * sizeof(uint16_t));
+			chunk->offsets[pos] = offset;
+			chunk->count++;
+			return TRUE;
+		}
+		bitmap_chunk_to_bits(chunk);
+	}
+
+	word = &chunk->bits[offset / 64];
+	mask = 1ULL << (offset % 64);
+	if (((*word & mask) != 0) == set)
+		return FALSE;
+	if (set) {
+		*word |= mask;
+		chunk->count++;
+	} else {
+		*word &= ~mask;
+		if (--chunk->count < BITMAP_CHUNK_MAX_OFFSETS / 2)
+			bitmap_chunk_to_offsets(chunk);
+	}
+	return TRUE;
+}
+
+void mail_index_bitmap_set(struct mail_index_bitmap *bitmap,
+			   uint32_t idx, bool set)
+{
+	struct mail_index_bitmap_chunk *chunk;
+
+	/* don't copy a shared chunk if nothing changes */
+	if (mail_index_bitmap_is_set(bitmap, idx) == set)
+		return;
+	chunk = bitmap_chunk_modifiable(bitmap, idx >> BITMAP_CHUNK_SHIFT,
+					set);
+	if (chunk == NULL)
+		return;
+
+	if (bitmap_chunk_set(chunk, idx & BITMAP_CHUNK_MASK, set)) {
+		if (set)
+			bitmap->count++;
+		else
+			bitmap->count--;
+	}
+}
+
+bool mail_index_bitmap_is_set(const struct mail_index_bitmap *bitmap,
+			      uint32_t idx)
+{
+	const struct mail_index_bitmap_chunk *chunk;
+	unsigned int pos, offset = idx & BITMAP_CHUNK_MASK;
+
+	chunk = bitmap_chunk_get(bitmap, idx >> BITMAP_CHUNK_SHIFT);
+	if (chunk == NULL)
+		return FALSE;
+	if (chunk->bits != NULL)
+		return (chunk->bits[offset / 64] & (1ULL << (offset % 64))) != 0;
+	pos = bitmap_chunk_offsets_find(chunk, offset);
+	return pos < chunk->count && chunk->offsets[pos] == offset;
+}
+
+unsigned int mail_index_bitmap_count(const struct mail_index_bitmap *bitmap)
+{
+	return bitmap->count;
+}
+
+#ifdef __SSE2__
+/* Returns TRUE if all the BITMAP_SCAN_WORDS words are the same as fill. */
+static inline bool
+bitmap_words_are_filled(const uint64_t *words, __m128i fill)
+{
+	__m128i eq;
+
+	eq = _mm_and_si128(
+		_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)words), fill),
+		_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(words + 2)),
+			       fill));
+	eq = _mm_and_si128(eq, _mm_and_si128(
+		_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(words + 4)),
+			       fill),
+		_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(words + 6)),
+			       fill)));
+	return _mm_movemask_epi8(eq) == 0xffff;
+}
+#else
+static inline bool
+bitmap_words_are_filled(const uint64_t *words, uint64_t fill)
+{
+	unsigned int i;
+	uint64_t diff = 0;
+
+	for (i = 0; i < BITMAP_SCAN_WORDS; i++)
+		diff |= words[i] ^ fill;
+	return diff == 0;
+}
+#endif
+
+/* Returns the first word >= i in the chunk's bitset which isn't the same
+   as fill, or BITMAP_CHUNK_WORDS if there is none. */
+static unsigned int
+bitmap_chunk_words_find(const uint64_t *words, unsigned int i, uint64_t fill)
+{
+#ifdef __SSE2__
+	const __m128i fill16 = _mm_set1_epi8((char)fill);
+#else
+	const uint64_t fill16 = fill;
+#endif
+
+	for (; i % BITMAP_SCAN_WORDS != 0; i++) {
+		if (words[i] != fill)
+			return i;
+	}
+	/* skip over the filled words BITMAP_SCAN_WORDS at a time */
+	while (i < BITMAP_CHUNK_WORDS &&
+	       bitmap_words_are_filled(words + i, fill16))
+		i += BITMAP_SCAN_WORDS;
+	for (; i < BITMAP_CHUNK_WORDS; i++) {
+		if (words[i] != fill)
+			return i;
+	}
+	return BITMAP_CHUNK_WORDS;
+}
+
+/* Returns the first offset >= given offset whose bit is the same as set,
+   or BITMAP_CHUNK_BITS if there is none. */
+static unsigned int
+bitmap_chunk_find(const struct mail_index_bitmap_chunk *chunk,
+		  unsigned int offset, bool set)
+{
+	const uint64_t invert = set ? 0 : (uint64_t)-1;
+	unsigned int i, pos;
+	uint64_t word;
+
+	if (chunk->count == (set ? 0 : BITMAP_CHUNK_BITS))
+		return BITMAP_CHUNK_BITS;
+
+	if (chunk->bits == NULL) {
+		pos = bitmap_chunk_offsets_find(chunk, offset);
+		if (set) {
+			return pos < chunk->count ? chunk->offsets[pos] :
+				BITMAP_CHUNK_BITS;
+		}
+		for (; pos < chunk->count && chunk->offsets[pos] == offset; pos++)
+			offset++;
+		return offset;
+	}
+
+	i = offset / 64;
+	word = (chunk->bits[i] ^ invert) & ((uint64_t)-1 << (offset % 64));
+	if (word == 0) {
+		/* the words with no matching bits are the same as invert */
+		i = bitmap_chunk_words_find(chunk->bits, i + 1, invert);
+		if (i == BITMAP_CHUNK_WORDS)
+			return BITMAP_CHUNK_BITS;
+		word = chunk->bits[i] ^ invert;
+	}
+	return i * 64 + __builtin_ctzll(word);
+}
+
+uint32_t mail_index_bitmap_find(const struct mail_index_bitmap *bitmap,
+				uint32_t idx, uint32_t limit, bool set)
+{
+	struct mail_index_bitmap_chunk *const *chunks;
+	unsigned int chunk_idx, chunks_count, offset;
+
+	chunks = array_get(&bitmap->chunks, &chunks_count);
+	while (idx < limit) {
+		chunk_idx = idx >> BITMAP_CHUNK_SHIFT;
+		if (chunk_idx >= chunks_count) {
+			/* everything after the last chunk is unset */
+			return set ? limit : idx;
+		}
+		if (chunks[chunk_idx] == NULL) {
+			/* empty chunk */
+			offset = set ? BITMAP_CHUNK_BITS :
+				idx & BITMAP_CHUNK_MASK;
+		} else {
+			offset = bitmap_chunk_find(chunks[chunk_idx],
+						   idx & BITMAP_CHUNK_MASK, set);
+		}
+		if (offset < BITMAP_CHUNK_BITS) {
+			idx = (idx & ~BITMAP_CHUNK_MASK) + offset;
+			return I_MIN(idx, limit);
+		}
+		if ((idx | BITMAP_CHUNK_MASK) == (uint32_t)-1)
+			break;
+		idx = (idx | BITMAP_CHUNK_MASK) + 1;
+	}
+	return limit;
+}
+
+static void
+bitmap_fill_chunk(struct mail_index_bitmap *bitmap, unsigned int chunk_idx,
+		  bool set)
+{
+	struct mail_index_bitmap_chunk **chunkp, *chunk;
+
+	if (chunk_idx < array_count(&bitmap->chunks))
+		chunkp = array_idx_modifiable(&bitmap->chunks, chunk_idx);
+	else if (!set)
+		return;
+	else
+		chunkp = array_idx_get_space(&bitmap->chunks, chunk_idx);
+
+	if (*chunkp != NULL) {
+		bitmap->count -= (*chunkp)->count;
+		bitmap_chunk_unref(chunkp);
+	}
+	if (set) {
+		chunk = *chunkp = i_new(struct mail_index_bitmap_chunk, 1);
+		chunk->refcount = 1;
+		chunk->bits = i_malloc(sizeof(uint64_t) * BITMAP_CHUNK_WORDS);
+		memset(chunk->bits, 0xff, sizeof(uint64_t) * BITMAP_CHUNK_WORDS);
+		chunk->count = BITMAP_CHUNK_BITS;
+		bitmap->count += BITMAP_CHUNK_BITS;
+	}
+}
+
+void mail_index_bitmap_set_range(struct mail_index_bitmap *bitmap,
+				 uint32_t idx1, uint32_t idx2, bool set)
+{
+	uint32_t idx, chunk_end;
+
+	i_assert(idx1 <= idx2);
+
+	for (;;) {
+		chunk_end = idx1 | BITMAP_CHUNK_MASK;
+		if ((idx1 & BITMAP_CHUNK_MASK) == 0 && chunk_end <= idx2) {
+			bitmap_fill_chunk(bitmap, idx1 >> BITMAP_CHUNK_SHIFT,
+					  set);
+		} else if (set) {
+			for (idx = idx1; idx <= I_MIN(chunk_end, idx2); idx++)
+				mail_index_bitmap_set(bitmap, idx, TRUE);
+		} else {
+			/* only the set bits need to be visited */
+			uint32_t limit = I_MIN(chunk_end, idx2) + 1;
+
+			idx = mail_index_bitmap_find(bitmap, idx1, limit, TRUE);
+			while (idx < limit) {
+				mail_index_bitmap_set(bitmap, idx, FALSE);
+				idx = mail_index_bitmap_find(bitmap, idx + 1,
+							     limit, TRUE);
+			}
+		}
+		if (chunk_end >= idx2)
+			break;
+		idx1 = chunk_end + 1;
+	}
+}
+
+void mail_index_bitmap_truncate(struct mail_index_bitmap *bitmap,
+				uint32_t count)
+{
+	struct mail_index_bitmap_chunk **chunks, *chunk;
+	const struct mail_index_bitmap_chunk *const_chunk;
+	unsigned int i, j, chunk_idx, chunks_count, old_count;
+	unsigned int offset = count & BITMAP_CHUNK_MASK;
+
+	chunk_idx = count >> BITMAP_CHUNK_SHIFT;
+	if (chunk_idx >= array_count(&bitmap->chunks))
+		return;
+
+	if (offset != 0 &&
+	    (const_chunk = bitmap_chunk_get(bitmap, chunk_idx)) != NULL &&
+	    bitmap_chunk_find(const_chunk, offset, TRUE) < BITMAP_CHUNK_BITS) {
+		/* the partial chunk has bits to clear */
+		chunk = bitmap_chunk_modifiable(bitmap, chunk_idx, FALSE);
+		old_count = chunk->count;
+		if (chunk->bits == NULL)
+			chunk->count = bitmap_chunk_offsets_find(chunk, offset);
+		else {
+			i = offset / 64;
+			chunk->bits[i] &= (1ULL << (offset % 64)) - 1;
+			memset(chunk->bits + i + 1, 0,
+			       (BITMAP_CHUNK_WORDS - i - 1) * sizeof(uint64_t));
+			chunk->count = 0;
+			for (j = 0; j <= i; j++)
+				chunk->count += __builtin_popcountll(chunk->bits[j]);
+			if (chunk->count < BITMAP_CHUNK_MAX_OFFSETS / 2)
+				bitmap_chunk_to_offsets(chunk);
+		}
+		bitmap->count -= old_count - chunk->count;
+	}
+	if (offset != 0)
+		chunk_idx++;
+	chunks = array_get_modifiable(&bitmap->chunks, &chunks_count);
+	for (i = chunk_idx; i < chunks_count; i++) {
+		if (chunks[i] != NULL) {
+			bitmap->count -= chunks[i]->count;
+			bitmap_chunk_unref(&chunks[i]);
+		}
+	}
+	array_delete(&bitmap->chunks, chunk_idx, chunks_count - chunk_idx);
+}
+
+void mail_index_bitmap_expunge(struct mail_index_bitmap *bitmap,
+			       const struct seq_range *range,
+			       unsigned int range_count)
+{
+	struct mail_index_bitmap new_bitmap;
+	struct mail_index_bitmap_chunk **chunkp;
+	unsigned int i = 0;
+	uint32_t idx, expunged_count = 0;
+
+	if (range_count == 0 || bitmap->count == 0)
+		return;
+
+	/* rebuild the bitmap from the remaining set bits. they're added in
+	   increasing order, which makes this O(set bits). */
+	i_zero(&new_bitmap);
+	i_array_init(&new_bitmap.chunks, array_count(&bitmap->chunks));
+	idx = mail_index_bitmap_find(bitmap, 0, (uint32_t)-1, TRUE);
+	while (idx != (uint32_t)-1) {
+		while (i < range_count && range[i].seq2 <= idx) {
+			expunged_count += range[i].seq2 - range[i].seq1 + 1;
+			i++;
+		}
+		if (i < range_count && range[i].seq1 <= idx + 1) {
+			/* expunged - skip over the rest of the range */
+			idx = range[i].seq2;
+		} else {
+			mail_index_bitmap_set(&new_bitmap,
+					      idx - expunged_count, TRUE);
+			idx++;
+		}
+		idx = mail_index_bitmap_find(bitmap, idx, (uint32_t)-1, TRUE);
+	}
+
+	array_foreach_modifiable(&bitmap->chunks, chunkp)
+		bitmap_chunk_unref(chunkp);
+	array_free(&bitmap->chunks);
+	*bitmap = new_bitmap;
+}
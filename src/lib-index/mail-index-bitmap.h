@@ -0,0 +1,44 @@
+#ifndef MAIL_INDEX_BITMAP_H
+#define MAIL_INDEX_BITMAP_H
+
+struct seq_range;
+
+/* Compressed bitmap of record indexes (seq-1). The bits are split into
+   chunks of 65536 records. Sparse chunks are stored as sorted arrays of
+   16bit offsets and dense chunks as plain bitsets, so a flag that is set
+   in only a few messages takes only a few bytes while looking up the next
+   message with or without the flag stays fast. Chunks that are entirely
+   set or unset are skipped without scanning them. */
+
+struct mail_index_bitmap *mail_index_bitmap_init(void);
+/* Returns a copy of the bitmap. The chunks are shared between the bitmaps
+   and copied only when either one modifies them, so this is cheap. */
+struct mail_index_bitmap *
+mail_index_bitmap_dup(const struct mail_index_bitmap *bitmap);
+void mail_index_bitmap_free(struct mail_index_bitmap **bitmap);
+
+void mail_index_bitmap_set(struct mail_index_bitmap *bitmap,
+			   uint32_t idx, bool set);
+bool mail_index_bitmap_is_set(const struct mail_index_bitmap *bitmap,
+			      uint32_t idx);
+/* Returns the number of set bits. */
+unsigned int mail_index_bitmap_count(const struct mail_index_bitmap *bitmap);
+/* Returns the first idx in [idx, limit) whose bit is the same as set, or
+   limit if there is none. */
+uint32_t mail_index_bitmap_find(const struct mail_index_bitmap *bitmap,
+				uint32_t idx, uint32_t limit, bool set);
+
+/* Set or unset all the bits in [idx1, idx2]. */
+void mail_index_bitmap_set_range(struct mail_index_bitmap *bitmap,
+				 uint32_t idx1, uint32_t idx2, bool set);
+/* Unset all the bits >= count. */
+void mail_index_bitmap_truncate(struct mail_index_bitmap *bitmap,
+				uint32_t count);
+/* Remove the bits of the given sorted sequence ranges (idx = seq-1) and
+   move the following bits down to fill the gaps, the same way as expunging
+   does for the records. */
+void mail_index_bitmap_expunge(struct mail_index_bitmap *bitmap,
+			       const struct seq_range *range,
+			       unsigned int range_count);
+
+#endif
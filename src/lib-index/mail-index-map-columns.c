@@ -0,0 +1,494 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "seq-range-array.h"
+#include "mail-index-private.h"
+#include "mail-index-bitmap.h"
+
+/* UIDs are stored in pages of this many UIDs */
+#define MAIL_INDEX_MAP_UID_PAGE_SHIFT 12
+#define MAIL_INDEX_MAP_UID_PAGE_COUNT (1U << MAIL_INDEX_MAP_UID_PAGE_SHIFT)
+#define MAIL_INDEX_MAP_UID_PAGE_MASK (MAIL_INDEX_MAP_UID_PAGE_COUNT - 1)
+
+struct mail_index_map_uid_page {
+	/* Number of columns using this page */
+	int refcount;
+	uint32_t uids[MAIL_INDEX_MAP_UID_PAGE_COUNT];
+};
+
+/* Dense copy of the UID field and bitmaps of the flags and keywords of the
+   first count records in rec_map. Searching the UIDs touches only 4 bytes
+   per message instead of a full hdr.record_size sized record, and the
+   bitmaps allow jumping directly to the next message with or without a
+   flag or keyword.
+
+   The columns exist only in memory. They're built with a scan over all the
+   records the first time they're needed, which is the same O(n) cost as a
+   search without them. Only after that are they kept up to date while
+   syncing, so flag and keyword searches get faster only when the same
+   process searches the mailbox more than once.
+
+   Cloning the columns shares the UID pages and the bitmap chunks with the
+   clone. The same as with the record pages, they're copied only when either
+   one modifies them. */
+struct mail_index_map_columns {
+	ARRAY(struct mail_index_map_uid_page *) uid_pages;
+	unsigned int uids_count;
+	/* bitmap for each bit in mail_index_record.flags */
+	struct mail_index_bitmap *flags[CHAR_BIT];
+	/* bitmap for each bit in the keywords extension records, i.e. indexed
+	   by the map's keyword index. NULL if the keyword hasn't been set in
+	   any of the messages. */
+	ARRAY(struct mail_index_bitmap *) keywords;
+};
+
+static void mail_index_map_uid_page_unref(struct mail_index_map_uid_page **_page)
+{
+	struct mail_index_map_uid_page *page = *_page;
+
+	*_page = NULL;
+	i_assert(page->refcount > 0);
+	if (--page->refcount == 0)
+		i_free(page);
+}
+
+static void
+mail_index_map_columns_set_uid(struct mail_index_map_columns *columns,
+			       unsigned int idx, uint32_t uid)
+{
+	struct mail_index_map_uid_page **pagep, *new_page;
+	unsigned int page_idx = idx >> MAIL_INDEX_MAP_UID_PAGE_SHIFT;
+
+	i_assert(idx <= columns->uids_count);
+
+	if (page_idx == array_count(&columns->uid_pages)) {
+		new_page = i_new(struct mail_index_map_uid_page, 1);
+		new_page->refcount = 1;
+		array_push_back(&columns->uid_pages, &new_page);
+	}
+	pagep = array_idx_modifiable(&columns->uid_pages, page_idx);
+	if ((*pagep)->refcount > 1) {
+		/* shared with another columns - copy it first */
+		new_page = i_new(struct mail_index_map_uid_page, 1);
+		new_page->refcount = 1;
+		memcpy(new_page->uids, (*pagep)->uids, sizeof(new_page->uids));
+		mail_index_map_uid_page_unref(pagep);
+		*pagep = new_page;
+	}
+	(*pagep)->uids[idx & MAIL_INDEX_MAP_UID_PAGE_MASK] = uid;
+	if (idx == columns->uids_count)
+		columns->uids_count++;
+}
+
+uint32_t
+mail_index_map_columns_get_uid(const struct mail_index_map_columns *columns,
+			       unsigned int idx)
+{
+	struct mail_index_map_uid_page *const *pagep;
+
+	i_assert(idx < columns->uids_count);
+	pagep = array_idx(&columns->uid_pages,
+			  idx >> MAIL_INDEX_MAP_UID_PAGE_SHIFT);
+	return (*pagep)->uids[idx & MAIL_INDEX_MAP_UID_PAGE_MASK];
+}
+
+static void
+mail_index_map_columns_truncate_uids(struct mail_index_map_columns *columns,
+				     unsigned int count)
+{
+	struct mail_index_map_uid_page **pages;
+	unsigned int i, pages_count, new_pages_count;
+
+	i_assert(count <= columns->uids_count);
+
+	pages = array_get_modifiable(&columns->uid_pages, &pages_count);
+	new_pages_count = (count + MAIL_INDEX_MAP_UID_PAGE_COUNT - 1) /
+		MAIL_INDEX_MAP_UID_PAGE_COUNT;
+	for (i = new_pages_count; i < pages_count; i++)
+		mail_index_map_uid_page_unref(&pages[i]);
+	array_delete(&columns->uid_pages, new_pages_count,
+		     pages_count - new_pages_count);
+	columns->uids_count = count;
+}
+
+static struct mail_index_bitmap *
+mail_index_map_columns_keyword(struct mail_index_map_columns *columns,
+			       unsigned int keyword_bit)
+{
+	struct mail_index_bitmap **bitmapp;
+
+	bitmapp = array_idx_get_space(&columns->keywords, keyword_bit);
+	if (*bitmapp == NULL)
+		*bitmapp = mail_index_bitmap_init();
+	return *bitmapp;
+}
+
+static void
+mail_index_map_columns_add(struct mail_index_map_columns *columns,
+			   const struct mail_index_record *rec,
+			   const struct mail_index_ext *kw_ext)
+{
+	const unsigned char *kw_data;
+	unsigned int i, bit, idx = columns->uids_count;
+
+	mail_index_map_columns_set_uid(columns, idx, rec->uid);
+	for (bit = 0; bit < CHAR_BIT; bit++) {
+		if ((rec->flags & (1 << bit)) != 0)
+			mail_index_bitmap_set(columns->flags[bit], idx, TRUE);
+	}
+	if (kw_ext == NULL)
+		return;
+
+	kw_data = CONST_PTR_OFFSET(rec, kw_ext->record_offset);
+	for (i = 0; i < kw_ext->record_size; i++) {
+		if (kw_data[i] == 0)
+			continue;
+		for (bit = 0; bit < CHAR_BIT; bit++) {
+			if ((kw_data[i] & (1 << bit)) == 0)
+				continue;
+			mail_index_bitmap_set(mail_index_map_columns_keyword(
+				columns, i * CHAR_BIT + bit), idx, TRUE);
+		}
+	}
+}
+
+struct mail_index_map_columns *
+mail_index_map_get_columns(struct mail_index_map *map)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	struct mail_index_map_columns *columns = rec_map->columns;
+	const struct mail_index_ext *kw_ext = NULL;
+	unsigned int i, count, messages_count = map->hdr.messages_count;
+	uint32_t ext_map_idx;
+
+	if (map->index == NULL || messages_count <
+	    map->index->optimization_set.index.columns_min_messages)
+		return NULL;
+	i_assert(messages_count <= rec_map->records_count);
+
+	if (columns == NULL) {
+		columns = rec_map->columns =
+			i_new(struct mail_index_map_columns, 1);
+		i_array_init(&columns->uid_pages,
+			messages_count / MAIL_INDEX_MAP_UID_PAGE_COUNT + 16);
+		for (i = 0; i < N_ELEMENTS(columns->flags); i++)
+			columns->flags[i] = mail_index_bitmap_init();
+		i_array_init(&columns->keywords, 8);
+	}
+
+	/* add the records appended since the columns were last used */
+	count = columns->uids_count;
+	i_assert(count <= rec_map->records_count);
+	if (count < messages_count &&
+	    mail_index_map_lookup_ext(map, MAIL_INDEX_EXT_KEYWORDS,
+				      &ext_map_idx))
+		kw_ext = array_idx(&map->extensions, ext_map_idx);
+	for (; count < messages_count; count++) {
+		mail_index_map_columns_add(columns,
+			MAIL_INDEX_REC_AT_SEQ(map, count + 1), kw_ext);
+	}
+	return columns;
+}
+
+static uint32_t
+flags_bitmaps_find(struct mail_index_bitmap *const *bitmaps, uint32_t idx,
+		   uint32_t count, uint8_t value, uint8_t mask)
+{
+	unsigned int bit;
+	uint32_t next_idx;
+	bool changed;
+
+	/* leapfrog through the bitmaps until they all agree on idx */
+	do {
+		changed = FALSE;
+		for (bit = 0; bit < CHAR_BIT; bit++) {
+			if ((mask & (1 << bit)) == 0)
+				continue;
+			next_idx = mail_index_bitmap_find(bitmaps[bit], idx,
+					count, (value & (1 << bit)) != 0);
+			if (next_idx == count)
+				return count;
+			if (next_idx != idx) {
+				idx = next_idx;
+				changed = TRUE;
+			}
+		}
+	} while (changed);
+	return idx;
+}
+
+uint32_t mail_index_map_find_flags(struct mail_index_map *map, uint32_t seq,
+				   uint8_t flags, uint8_t flags_mask)
+{
+	struct mail_index_map_columns *columns;
+	const struct mail_index_record *rec;
+	unsigned int idx;
+
+	flags &= flags_mask;
+	if (seq == 0 || seq > map->hdr.messages_count)
+		return 0;
+
+	columns = mail_index_map_get_columns(map);
+	if (columns != NULL) {
+		idx = flags_bitmaps_find(columns->flags, seq - 1,
+					 map->hdr.messages_count,
+					 flags, flags_mask);
+		return idx == map->hdr.messages_count ? 0 : idx + 1;
+	}
+
+	for (; seq <= map->hdr.messages_count; seq++) {
+		rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
+		if ((rec->flags & flags_mask) == flags)
+			return seq;
+	}
+	return 0;
+}
+
+static bool
+mail_index_map_get_keyword_bit(struct mail_index_map *map,
+			       unsigned int keyword_idx,
+			       unsigned int *keyword_bit_r)
+{
+	const unsigned int *keyword_idx_map;
+	unsigned int i, count;
+
+	if (!array_is_created(&map->keyword_idx_map))
+		return FALSE;
+	keyword_idx_map = array_get(&map->keyword_idx_map, &count);
+	for (i = 0; i < count; i++) {
+		if (keyword_idx_map[i] == keyword_idx) {
+			*keyword_bit_r = i;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+uint32_t mail_index_map_find_keyword(struct mail_index_map *map, uint32_t seq,
+				     unsigned int keyword_idx, bool set)
+{
+	struct mail_index_map_columns *columns;
+	struct mail_index_bitmap *const *bitmapp;
+	const struct mail_index_record *rec;
+	const struct mail_index_ext *ext;
+	const unsigned char *data;
+	unsigned int keyword_bit, idx;
+	uint32_t ext_map_idx;
+
+	if (seq == 0 || seq > map->hdr.messages_count)
+		return 0;
+	if (!mail_index_map_get_keyword_bit(map, keyword_idx, &keyword_bit)) {
+		/* none of the messages have the keyword */
+		return set ? 0 : seq;
+	}
+
+	columns = mail_index_map_get_columns(map);
+	if (columns != NULL) {
+		if (keyword_bit >= array_count(&columns->keywords))
+			return set ? 0 : seq;
+		bitmapp = array_idx(&columns->keywords, keyword_bit);
+		if (*bitmapp == NULL)
+			return set ? 0 : seq;
+		idx = mail_index_bitmap_find(*bitmapp, seq - 1,
+					     map->hdr.messages_count, set);
+		return idx == map->hdr.messages_count ? 0 : idx + 1;
+	}
+
+	if (!mail_index_map_lookup_ext(map, MAIL_INDEX_EXT_KEYWORDS,
+				       &ext_map_idx))
+		return set ? 0 : seq;
+	ext = array_idx(&map->extensions, ext_map_idx);
+	if (keyword_bit / CHAR_BIT >= ext->record_size)
+		return set ? 0 : seq;
+
+	for (; seq <= map->hdr.messages_count; seq++) {
+		rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
+		data = CONST_PTR_OFFSET(rec, ext->record_offset);
+		if (((data[keyword_bit / CHAR_BIT] &
+		      (1 << (keyword_bit % CHAR_BIT))) != 0) == set)
+			return seq;
+	}
+	return 0;
+}
+
+struct mail_index_map_columns *
+mail_index_map_columns_clone(const struct mail_index_map_columns *columns)
+{
+	struct mail_index_map_columns *new_columns;
+	struct mail_index_map_uid_page *page;
+	struct mail_index_bitmap *bitmap, *new_bitmap;
+	unsigned int i;
+
+	new_columns = i_new(struct mail_index_map_columns, 1);
+	i_array_init(&new_columns->uid_pages,
+		     array_count(&columns->uid_pages) + 16);
+	array_foreach_elem(&columns->uid_pages, page) {
+		page->refcount++;
+		array_push_back(&new_columns->uid_pages, &page);
+	}
+	new_columns->uids_count = columns->uids_count;
+	for (i = 0; i < N_ELEMENTS(columns->flags); i++)
+		new_columns->flags[i] = mail_index_bitmap_dup(columns->flags[i]);
+	i_array_init(&new_columns->keywords, array_count(&columns->keywords) + 8);
+	array_foreach_elem(&columns->keywords, bitmap) {
+		new_bitmap = bitmap == NULL ? NULL :
+			mail_index_bitmap_dup(bitmap);
+		array_push_back(&new_columns->keywords, &new_bitmap);
+	}
+	return new_columns;
+}
+
+void mail_index_map_columns_free(struct mail_index_map_columns **_columns)
+{
+	struct mail_index_map_columns *columns = *_columns;
+	struct mail_index_map_uid_page **pagep;
+	struct mail_index_bitmap **bitmapp;
+	unsigned int i;
+
+	*_columns = NULL;
+	array_foreach_modifiable(&columns->uid_pages, pagep)
+		mail_index_map_uid_page_unref(pagep);
+	array_free(&columns->uid_pages);
+	for (i = 0; i < N_ELEMENTS(columns->flags); i++)
+		mail_index_bitmap_free(&columns->flags[i]);
+	array_foreach_modifiable(&columns->keywords, bitmapp) {
+		if (*bitmapp != NULL)
+			mail_index_bitmap_free(bitmapp);
+	}
+	array_free(&columns->keywords);
+	i_free(columns);
+}
+
+void mail_index_map_columns_invalidate(struct mail_index_record_map *rec_map)
+{
+	if (rec_map->columns != NULL)
+		mail_index_map_columns_free(&rec_map->columns);
+}
+
+void mail_index_map_columns_truncate(struct mail_index_record_map *rec_map,
+				     unsigned int count)
+{
+	struct mail_index_map_columns *columns = rec_map->columns;
+	struct mail_index_bitmap *bitmap;
+	unsigned int i;
+
+	if (columns == NULL || columns->uids_count <= count)
+		return;
+	mail_index_map_columns_truncate_uids(columns, count);
+	for (i = 0; i < N_ELEMENTS(columns->flags); i++)
+		mail_index_bitmap_truncate(columns->flags[i], count);
+	array_foreach_elem(&columns->keywords, bitmap) {
+		if (bitmap != NULL)
+			mail_index_bitmap_truncate(bitmap, count);
+	}
+}
+
+/* Returns FALSE if none of seq1..seq2 are in the columns yet. Records past
+   the columns are picked up when the columns are extended. */
+static bool
+mail_index_map_columns_clip(struct mail_index_map_columns *columns,
+			    uint32_t seq1, uint32_t *seq2)
+{
+	*seq2 = I_MIN(*seq2, columns->uids_count);
+	return seq1 <= *seq2;
+}
+
+void mail_index_map_columns_update_flags(struct mail_index_record_map *rec_map,
+					 uint32_t seq1, uint32_t seq2,
+					 uint8_t add_flags, uint8_t remove_flags)
+{
+	struct mail_index_map_columns *columns = rec_map->columns;
+	unsigned int bit;
+
+	if (columns == NULL || !mail_index_map_columns_clip(columns, seq1, &seq2))
+		return;
+
+	for (bit = 0; bit < CHAR_BIT; bit++) {
+		if ((add_flags & (1 << bit)) != 0) {
+			mail_index_bitmap_set_range(columns->flags[bit],
+						    seq1 - 1, seq2 - 1, TRUE);
+		} else if ((remove_flags & (1 << bit)) != 0) {
+			mail_index_bitmap_set_range(columns->flags[bit],
+						    seq1 - 1, seq2 - 1, FALSE);
+		}
+	}
+}
+
+void mail_index_map_columns_update_keyword(struct mail_index_record_map *rec_map,
+					   unsigned int keyword_bit,
+					   uint32_t seq1, uint32_t seq2,
+					   bool set)
+{
+	struct mail_index_map_columns *columns = rec_map->columns;
+	struct mail_index_bitmap *const *bitmapp;
+
+	if (columns == NULL || !mail_index_map_columns_clip(columns, seq1, &seq2))
+		return;
+
+	if (set) {
+		mail_index_bitmap_set_range(
+			mail_index_map_columns_keyword(columns, keyword_bit),
+			seq1 - 1, seq2 - 1, TRUE);
+	} else if (keyword_bit < array_count(&columns->keywords)) {
+		bitmapp = array_idx(&columns->keywords, keyword_bit);
+		if (*bitmapp != NULL) {
+			mail_index_bitmap_set_range(*bitmapp, seq1 - 1,
+						    seq2 - 1, FALSE);
+		}
+	}
+}
+
+void mail_index_map_columns_reset_keywords(struct mail_index_record_map *rec_map,
+					   uint32_t seq1, uint32_t seq2)
+{
+	struct mail_index_map_columns *columns = rec_map->columns;
+	struct mail_index_bitmap *bitmap;
+
+	if (columns == NULL || !mail_index_map_columns_clip(columns, seq1, &seq2))
+		return;
+
+	array_foreach_elem(&columns->keywords, bitmap) {
+		if (bitmap != NULL) {
+			mail_index_bitmap_set_range(bitmap, seq1 - 1, seq2 - 1,
+						    FALSE);
+		}
+	}
+}
+
+void mail_index_map_columns_expunge(struct mail_index_record_map *rec_map,
+				    const struct seq_range *range,
+				    unsigned int range_count)
+{
+	struct mail_index_map_columns *columns = rec_map->columns;
+	struct mail_index_bitmap *bitmap;
+	unsigned int i, count, src, dest;
+
+	if (columns == NULL || range_count == 0)
+		return;
+
+	/* same as what sync_expunge_range() does for the records, but only
+	   for the part covered by the columns. The UID pages before the first
+	   expunged message aren't touched, so they stay shared. */
+	count = columns->uids_count;
+	src = dest = I_MIN(range[0].seq1 - 1, count);
+	i = 0;
+	while (src < count) {
+		if (i < range_count && src == range[i].seq1 - 1) {
+			src = range[i++].seq2;
+			continue;
+		}
+		mail_index_map_columns_set_uid(columns, dest++,
+			mail_index_map_columns_get_uid(columns, src++));
+	}
+	mail_index_map_columns_truncate_uids(columns, dest);
+
+	/* the bitmaps have no bits set past the columns, so the ranges can be
+	   used as they are */
+	for (i = 0; i < N_ELEMENTS(columns->flags); i++)
+		mail_index_bitmap_expunge(columns->flags[i], range, range_count);
+	array_foreach_elem(&columns->keywords, bitmap) {
+		if (bitmap != NULL)
+			mail_index_bitmap_expunge(bitmap, range, range_count);
+	}
+}
@@ -244,9 +244,15 @@ static void mail_index_map_clear_recent_flags(struct mail_index_map *map)
 	uint32_t seq;
 
 	for (seq = 1; seq <= map->hdr.messages_count; seq++) {
-		rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
+		/* don't copy shared record pages that have nothing to clear */
+		if ((MAIL_INDEX_REC_AT_SEQ(map, seq)->flags & MAIL_RECENT) == 0)
+			continue;
+		rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(map, seq);
 		rec->flags &= ENUM_NEGATE(MAIL_RECENT);
 	}
+	mail_index_map_columns_update_flags(map->rec_map, 1,
+					    map->hdr.messages_count,
+					    0, MAIL_RECENT);
 }
 
 int mail_index_map_check_header(struct mail_index_map *map,
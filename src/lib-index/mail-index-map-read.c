@@ -37,7 +37,7 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 
 	i_assert(rec_map->mmap_base == NULL);
 
-	buffer_free(&rec_map->buffer);
+	mail_index_record_map_free_pages(rec_map);
 	if (file_size > SSIZE_T_MAX) {
 		/* too large file to map into memory */
 		mail_index_set_error(index, "Index file too large: %s",
@@ -102,6 +102,7 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 	buffer_append(map->hdr_copy_buf, rec_map->mmap_base, hdr->header_size);
 
 	rec_map->records = PTR_OFFSET(rec_map->mmap_base, map->hdr.header_size);
+	mail_index_map_columns_invalidate(rec_map);
 	return 1;
 }
 
@@ -141,7 +142,8 @@ mail_index_try_read_map(struct mail_index_map *map,
 	void *data = NULL;
 	ssize_t ret;
 	size_t pos, records_size, initial_buf_pos = 0;
-	unsigned int records_count = 0, extra;
+	size_t page_size, offset, size, copy_size, extra;
+	unsigned int i, records_count = 0;
 
 	i_assert(map->rec_map->mmap_base == NULL);
 
@@ -199,27 +201,33 @@ mail_index_try_read_map(struct mail_index_map *map,
 				records_count);
 		}
 
-		if (map->rec_map->buffer == NULL) {
-			map->rec_map->buffer =
-				buffer_create_dynamic(default_pool,
-						      records_size);
-		}
-
-		/* @UNSAFE */
-		buffer_set_used_size(map->rec_map->buffer, 0);
-		if (initial_buf_pos <= hdr->header_size)
-			extra = 0;
-		else {
-			extra = initial_buf_pos - hdr->header_size;
-			buffer_append(map->rec_map->buffer,
-				      CONST_PTR_OFFSET(buf, hdr->header_size),
-				      extra);
-		}
-		if (records_size > extra) {
-			data = buffer_append_space_unsafe(map->rec_map->buffer,
-							  records_size - extra);
-			ret = pread_full(index->fd, data, records_size - extra,
-					 hdr->header_size + extra);
+		mail_index_record_map_init_pages(map->rec_map, records_count,
+						 hdr->record_size);
+		map->rec_map->records_count = records_count;
+		mail_index_map_columns_invalidate(map->rec_map);
+
+		/* @UNSAFE: read the records directly into the pages. The
+		   beginning of them may have already been read into buf. */
+		extra = initial_buf_pos <= hdr->header_size ? 0 :
+			initial_buf_pos - hdr->header_size;
+		page_size = MAIL_INDEX_RECORD_PAGE_COUNT * hdr->record_size;
+		for (i = 0, offset = 0; ret > 0 && offset < records_size; i++) {
+			data = map->rec_map->pages[i]->data;
+			size = I_MIN(records_size - offset, page_size);
+			copy_size = 0;
+			if (offset < extra) {
+				copy_size = I_MIN(size, extra - offset);
+				memcpy(data, CONST_PTR_OFFSET(buf,
+					hdr->header_size + offset), copy_size);
+			}
+			if (copy_size < size) {
+				ret = pread_full(index->fd,
+						 PTR_OFFSET(data, copy_size),
+						 size - copy_size,
+						 hdr->header_size + offset +
+						 copy_size);
+			}
+			offset += size;
 		}
 	}
 
@@ -239,10 +247,6 @@ mail_index_try_read_map(struct mail_index_map *map,
 		return 0;
 	}
 
-	map->rec_map->records =
-		buffer_get_modifiable_data(map->rec_map->buffer, NULL);
-	map->rec_map->records_count = records_count;
-
 	mail_index_map_copy_hdr(map, hdr);
 	i_assert(map->hdr_copy_buf->used == map->hdr.header_size);
 	return 1;
@@ -389,7 +393,9 @@ mail_index_map_latest_file(struct mail_index *index, const char **reason_r)
 		mail_index_unmap(&new_map);
 		return ret < 0 ? -1 : (unusable ? 0 : 1);
 	}
-	i_assert(new_map->rec_map->records != NULL);
+	i_assert(new_map->rec_map->records != NULL ||
+		 new_map->rec_map->pages_count > 0 ||
+		 new_map->rec_map->records_count == 0);
 
 	index->main_index_hdr_log_file_seq = new_map->hdr.log_file_seq;
 	index->main_index_hdr_log_file_tail_offset =
@@ -266,14 +266,179 @@ struct mail_index_map *mail_index_map_alloc(struct mail_index *index)
 	return mail_index_map_clone(&tmp_map);
 }
 
+static struct mail_index_record_page *
+mail_index_record_page_alloc(unsigned int record_size)
+{
+	struct mail_index_record_page *page;
+
+	page = i_malloc(sizeof(*page) +
+			MAIL_INDEX_RECORD_PAGE_COUNT * record_size);
+	page->refcount = 1;
+	return page;
+}
+
+static void mail_index_record_page_unref(struct mail_index_record_page **_page)
+{
+	struct mail_index_record_page *page = *_page;
+
+	*_page = NULL;
+	i_assert(page->refcount > 0);
+	if (--page->refcount == 0)
+		i_free(page);
+}
+
+static void
+mail_index_record_map_add_page(struct mail_index_record_map *rec_map,
+			       struct mail_index_record_page *page)
+{
+	if (rec_map->pages_count == rec_map->pages_alloc_count) {
+		unsigned int new_count =
+			nearest_power(rec_map->pages_alloc_count + 1);
+
+		rec_map->pages = i_realloc_type(rec_map->pages,
+						struct mail_index_record_page *,
+						rec_map->pages_alloc_count,
+						new_count);
+		rec_map->pages_alloc_count = new_count;
+	}
+	rec_map->pages[rec_map->pages_count++] = page;
+}
+
+void mail_index_record_map_free_pages(struct mail_index_record_map *rec_map)
+{
+	unsigned int i;
+
+	for (i = 0; i < rec_map->pages_count; i++)
+		mail_index_record_page_unref(&rec_map->pages[i]);
+	i_free(rec_map->pages);
+	rec_map->pages_count = rec_map->pages_alloc_count = 0;
+}
+
+void mail_index_record_map_truncate_pages(struct mail_index_record_map *rec_map)
+{
+	unsigned int pages_count;
+
+	pages_count = (rec_map->records_count + MAIL_INDEX_RECORD_PAGE_COUNT-1) /
+		MAIL_INDEX_RECORD_PAGE_COUNT;
+	while (rec_map->pages_count > pages_count) {
+		mail_index_record_page_unref(
+			&rec_map->pages[--rec_map->pages_count]);
+	}
+}
+
+void mail_index_record_map_init_pages(struct mail_index_record_map *rec_map,
+				      unsigned int records_count,
+				      unsigned int record_size)
+{
+	unsigned int i, pages_count;
+
+	i_assert(rec_map->records == NULL);
+
+	mail_index_record_map_free_pages(rec_map);
+	pages_count = (records_count + MAIL_INDEX_RECORD_PAGE_COUNT-1) /
+		MAIL_INDEX_RECORD_PAGE_COUNT;
+	for (i = 0; i < pages_count; i++) {
+		mail_index_record_map_add_page(rec_map,
+			mail_index_record_page_alloc(record_size));
+	}
+}
+
+struct mail_index_record *
+mail_index_map_idx_modifiable(struct mail_index_map *map, uint32_t idx)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	struct mail_index_record_page *page, *new_page;
+	unsigned int page_idx = idx >> MAIL_INDEX_RECORD_PAGE_SHIFT;
+
+	if (rec_map->records != NULL) {
+		return PTR_OFFSET(rec_map->records,
+				  idx * map->hdr.record_size);
+	}
+
+	i_assert(page_idx < rec_map->pages_count);
+	page = rec_map->pages[page_idx];
+	if (page->refcount > 1) {
+		/* the page is shared with another rec_map */
+		new_page = mail_index_record_page_alloc(map->hdr.record_size);
+		memcpy(new_page->data, page->data,
+		       MAIL_INDEX_RECORD_PAGE_COUNT * map->hdr.record_size);
+		mail_index_record_page_unref(&rec_map->pages[page_idx]);
+		rec_map->pages[page_idx] = page = new_page;
+	}
+	return PTR_OFFSET(page->data, (idx & MAIL_INDEX_RECORD_PAGE_MASK) *
+			  map->hdr.record_size);
+}
+
+const void *mail_index_map_get_records(struct mail_index_map *map,
+				       uint32_t idx, unsigned int *count_r)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+
+	i_assert(idx < rec_map->records_count);
+
+	if (rec_map->records != NULL)
+		*count_r = rec_map->records_count - idx;
+	else {
+		*count_r = I_MIN(rec_map->records_count - idx,
+				 MAIL_INDEX_RECORD_PAGE_COUNT -
+				 (idx & MAIL_INDEX_RECORD_PAGE_MASK));
+	}
+	return MAIL_INDEX_MAP_IDX(map, idx);
+}
+
+void *mail_index_map_append_record(struct mail_index_map *map)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	uint32_t idx = rec_map->records_count;
+
+	i_assert(rec_map->records == NULL);
+
+	if ((idx >> MAIL_INDEX_RECORD_PAGE_SHIFT) == rec_map->pages_count) {
+		mail_index_record_map_add_page(rec_map,
+			mail_index_record_page_alloc(map->hdr.record_size));
+	}
+	return MAIL_INDEX_MAP_IDX_MODIFIABLE(map, idx);
+}
+
+void mail_index_map_move_records(struct mail_index_map *map, uint32_t dest_idx,
+				 uint32_t src_idx, unsigned int count)
+{
+	unsigned int record_size = map->hdr.record_size;
+	unsigned int n;
+	void *dest;
+
+	i_assert(dest_idx <= src_idx);
+
+	if (dest_idx == src_idx || count == 0)
+		return;
+	if (map->rec_map->records != NULL) {
+		memmove(MAIL_INDEX_MAP_IDX_MODIFIABLE(map, dest_idx),
+			MAIL_INDEX_MAP_IDX(map, src_idx), count * record_size);
+		return;
+	}
+
+	/* move the records in pieces that don't cross page boundaries.
+	   Only the pages starting from dest_idx are modified. */
+	while (count > 0) {
+		n = I_MIN(count, MAIL_INDEX_RECORD_PAGE_COUNT -
+			  (dest_idx & MAIL_INDEX_RECORD_PAGE_MASK));
+		n = I_MIN(n, MAIL_INDEX_RECORD_PAGE_COUNT -
+			  (src_idx & MAIL_INDEX_RECORD_PAGE_MASK));
+		/* get dest first, since it may replace src's page */
+		dest = MAIL_INDEX_MAP_IDX_MODIFIABLE(map, dest_idx);
+		memmove(dest, MAIL_INDEX_MAP_IDX(map, src_idx),
+			n * record_size);
+		dest_idx += n;
+		src_idx += n;
+		count -= n;
+	}
+}
+
 static void mail_index_record_map_free(struct mail_index_map *map,
 				       struct mail_index_record_map *rec_map)
 {
-	if (rec_map->buffer != NULL) {
-		i_assert(rec_map->mmap_base == NULL);
-		buffer_free(&rec_map->buffer);
-	} else if (rec_map->mmap_base != NULL) {
-		i_assert(rec_map->buffer == NULL);
+	mail_index_record_map_free_pages(rec_map);
+	if (rec_map->mmap_base != NULL) {
 		if (munmap(rec_map->mmap_base, rec_map->mmap_size) < 0)
 			mail_index_set_syscall_error(map->index, "munmap()");
 		rec_map->mmap_base = NULL;
@@ -281,6 +446,8 @@ static void mail_index_record_map_free(struct mail_index_map *map,
 	array_free(&rec_map->maps);
 	if (rec_map->modseq != NULL)
 		mail_index_map_modseq_free(&rec_map->modseq);
+	if (rec_map->columns != NULL)
+		mail_index_map_columns_free(&rec_map->columns);
 	i_free(rec_map);
 }
 
@@ -323,18 +490,37 @@ void mail_index_unmap(struct mail_index_map **_map)
 }
 
 static void mail_index_map_copy_records(struct mail_index_record_map *dest,
-					const struct mail_index_record_map *src,
+					struct mail_index_record_map *src,
 					unsigned int record_size)
 {
-	size_t size;
-
-	size = src->records_count * record_size;
-	/* +1% so we have a bit of space to grow. useful for huge mailboxes. */
-	dest->buffer = buffer_create_dynamic(default_pool,
-					     size + I_MAX(size/100, 1024));
-	buffer_append(dest->buffer, src->records, size);
-
-	dest->records = buffer_get_modifiable_data(dest->buffer, NULL);
+	struct mail_index_record_page *page;
+	unsigned int i, count, pages_count;
+
+	pages_count = (src->records_count + MAIL_INDEX_RECORD_PAGE_COUNT-1) /
+		MAIL_INDEX_RECORD_PAGE_COUNT;
+	if (src->records == NULL) {
+		/* share the pages. they're copied only when modified. */
+		i_assert(dest != src);
+		i_assert(pages_count <= src->pages_count);
+		for (i = 0; i < pages_count; i++) {
+			src->pages[i]->refcount++;
+			mail_index_record_map_add_page(dest, src->pages[i]);
+		}
+	} else {
+		/* copy the mmap()ed records to memory. dest may be the same
+		   as src. */
+		for (i = 0; i < pages_count; i++) {
+			page = mail_index_record_page_alloc(record_size);
+			count = I_MIN(src->records_count -
+				      i * MAIL_INDEX_RECORD_PAGE_COUNT,
+				      MAIL_INDEX_RECORD_PAGE_COUNT);
+			memcpy(page->data, CONST_PTR_OFFSET(src->records,
+				i * MAIL_INDEX_RECORD_PAGE_COUNT * record_size),
+			       count * record_size);
+			mail_index_record_map_add_page(dest, page);
+		}
+		dest->records = NULL;
+	}
 	dest->records_count = src->records_count;
 }
 
@@ -385,11 +571,9 @@ struct mail_index_map *mail_index_map_clone(const struct mail_index_map *map)
 	mem_map = i_new(struct mail_index_map, 1);
 	mem_map->index = map->index;
 	mem_map->refcount = 1;
-	if (map->rec_map == NULL) {
+	if (map->rec_map == NULL)
 		mem_map->rec_map = mail_index_record_map_alloc(mem_map);
-		mem_map->rec_map->buffer =
-			buffer_create_dynamic(default_pool, 1024);
-	} else {
+	else {
 		mem_map->rec_map = map->rec_map;
 		array_push_back(&mem_map->rec_map->maps, &mem_map);
 	}
@@ -435,6 +619,10 @@ void mail_index_record_map_move_to_private(struct mail_index_map *map)
 		new_map = mail_index_record_map_alloc(map);
 		mail_index_map_copy_records(new_map, map->rec_map,
 					    map->hdr.record_size);
+		if (map->rec_map->columns != NULL) {
+			new_map->columns =
+				mail_index_map_columns_clone(map->rec_map->columns);
+		}
 		mail_index_record_map_unlink(map);
 		map->rec_map = new_map;
 		if (map->rec_map->modseq != NULL)
@@ -449,14 +637,15 @@ void mail_index_record_map_move_to_private(struct mail_index_map *map)
 		   so truncate them away. */
 		i_assert(new_map->records_count > map->hdr.messages_count);
 		new_map->records_count = map->hdr.messages_count;
+		mail_index_map_columns_truncate(new_map,
+						new_map->records_count);
 		if (new_map->records_count == 0)
 			new_map->last_appended_uid = 0;
 		else {
 			rec = MAIL_INDEX_REC_AT_SEQ(map, new_map->records_count);
 			new_map->last_appended_uid = rec->uid;
 		}
-		buffer_set_used_size(new_map->buffer, new_map->records_count *
-				     map->hdr.record_size);
+		mail_index_record_map_truncate_pages(new_map);
 	}
 }
 
@@ -478,6 +667,8 @@ void mail_index_map_move_to_memory(struct mail_index_map *map)
 		new_map = mail_index_record_map_alloc(map);
 		new_map->modseq = map->rec_map->modseq == NULL ? NULL :
 			mail_index_map_modseq_clone(map->rec_map->modseq);
+		new_map->columns = map->rec_map->columns == NULL ? NULL :
+			mail_index_map_columns_clone(map->rec_map->columns);
 	}
 
 	mail_index_map_copy_records(new_map, map->rec_map,
@@ -512,13 +703,15 @@ static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 				       uint32_t uid, uint32_t left_idx,
 				       int nearest_side)
 {
-	const struct mail_index_record *rec_base, *rec;
-	uint32_t idx, right_idx, record_size;
+	const struct mail_index_map_columns *columns;
+	uint32_t idx, right_idx, rec_uid;
 
 	i_assert(map->hdr.messages_count <= map->rec_map->records_count);
 
-	rec_base = map->rec_map->records;
-	record_size = map->hdr.record_size;
+	columns = mail_index_map_get_columns(map);
+#define BSEARCH_UID_AT(idx) \
+	(columns != NULL ? mail_index_map_columns_get_uid(columns, idx) : \
+	 MAIL_INDEX_MAP_IDX(map, idx)->uid)
 
 	idx = left_idx;
 	right_idx = I_MIN(map->hdr.messages_count, uid);
@@ -527,29 +720,30 @@ static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 	while (left_idx < right_idx) {
 		idx = (left_idx + right_idx) / 2;
 
-                rec = CONST_PTR_OFFSET(rec_base, idx * record_size);
-		if (rec->uid < uid)
+		rec_uid = BSEARCH_UID_AT(idx);
+		if (rec_uid < uid)
 			left_idx = idx+1;
-		else if (rec->uid > uid)
+		else if (rec_uid > uid)
 			right_idx = idx;
 		else
 			break;
 	}
 	i_assert(idx < map->hdr.messages_count);
 
-	rec = CONST_PTR_OFFSET(rec_base, idx * record_size);
-	if (rec->uid != uid) {
+	rec_uid = BSEARCH_UID_AT(idx);
+	if (rec_uid != uid) {
 		if (nearest_side > 0) {
 			/* we want uid or larger */
-			return rec->uid > uid ? idx+1 :
+			return rec_uid > uid ? idx+1 :
 				(idx == map->hdr.messages_count-1 ? 0 : idx+2);
 		} else {
 			/* we want uid or smaller */
-			return rec->uid < uid ? idx + 1 : idx;
+			return rec_uid < uid ? idx + 1 : idx;
 		}
 	}
 
 	return idx+1;
+#undef BSEARCH_UID_AT
 }
 
 void mail_index_map_lookup_seq_range(struct mail_index_map *map,
@@ -201,24 +201,28 @@ int mail_index_modseq_set(struct mail_index_view *view,
 {
 	struct mail_index_map_modseq *mmap = mail_index_map_modseq(view);
 	const struct mail_index_ext *ext;
-	struct mail_index_record *rec;
-	uint64_t *modseqp;
+	const struct mail_index_record *rec;
+	struct mail_index_record *new_rec;
+	const uint64_t *modseqp;
 	uint32_t ext_map_idx;
 
 	if (mmap == NULL)
 		return -1;
 
-	rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
 	if (!mail_index_map_get_ext_idx(view->map, view->index->modseq_ext_id,
 					&ext_map_idx))
 		return -1;
 
 	ext = array_idx(&view->map->extensions, ext_map_idx);
-	modseqp = PTR_OFFSET(rec, ext->record_offset);
+	rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
+	modseqp = CONST_PTR_OFFSET(rec, ext->record_offset);
 	if (*modseqp > min_modseq)
 		return 0;
 	else {
-		*modseqp = min_modseq;
+		/* the record's page may get copied here */
+		new_rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(view->map, seq);
+		memcpy(PTR_OFFSET(new_rec, ext->record_offset),
+		       &min_modseq, sizeof(min_modseq));
 		return 1;
 	}
 }
@@ -309,7 +313,7 @@ mail_index_modseq_update(struct mail_index_modseq_sync *ctx,
 
 	ext = array_idx(&ctx->view->map->extensions, ext_map_idx);
 	for (; seq1 <= seq2; seq1++) {
-		rec = MAIL_INDEX_REC_AT_SEQ(ctx->view->map, seq1);
+		rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(ctx->view->map, seq1);
 		modseqp = PTR_OFFSET(rec, ext->record_offset);
 		if (*modseqp == 0 || (nonzeros && *modseqp < modseq))
 			*modseqp = modseq;
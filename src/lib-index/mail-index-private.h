@@ -29,12 +29,21 @@ struct mail_index_sync_map_ctx;
 #define MAIL_INDEX_MAP_IS_IN_MEMORY(map) \
 	((map)->rec_map->mmap_base == NULL)
 
+/* In-memory records are stored in pages of this many records */
+#define MAIL_INDEX_RECORD_PAGE_SHIFT 8
+#define MAIL_INDEX_RECORD_PAGE_COUNT (1U << MAIL_INDEX_RECORD_PAGE_SHIFT)
+#define MAIL_INDEX_RECORD_PAGE_MASK (MAIL_INDEX_RECORD_PAGE_COUNT - 1)
+
+/* Use the _MODIFIABLE() variants when changing the record. They make sure
+   that the change isn't visible to other rec_maps sharing the same page. */
 #define MAIL_INDEX_MAP_IDX(map, idx) \
-	((struct mail_index_record *) \
-	 PTR_OFFSET((map)->rec_map->records, (idx) * (map)->hdr.record_size))
-#define MAIL_INDEX_REC_AT_SEQ(map, seq)					\
-	((struct mail_index_record *)					\
-	 PTR_OFFSET((map)->rec_map->records, ((seq)-1) * (map)->hdr.record_size))
+	mail_index_map_idx(map, idx)
+#define MAIL_INDEX_MAP_IDX_MODIFIABLE(map, idx) \
+	mail_index_map_idx_modifiable(map, idx)
+#define MAIL_INDEX_REC_AT_SEQ(map, seq) \
+	mail_index_map_idx(map, (seq)-1)
+#define MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(map, seq) \
+	mail_index_map_idx_modifiable(map, (seq)-1)
 
 #define MAIL_TRANSACTION_FLAG_UPDATE_IS_INTERNAL(u) \
 	((((u)->add_flags | (u)->remove_flags) & MAIL_INDEX_FLAGS_MASK) == 0 && \
@@ -121,18 +130,35 @@ struct mail_index_modseq_header {
 	uint32_t log_offset;
 };
 
+struct mail_index_record_page {
+	/* Number of rec_maps using this page */
+	int refcount;
+	/* keep the records 64bit aligned */
+	uint32_t unused_padding;
+	/* MAIL_INDEX_RECORD_PAGE_COUNT records */
+	unsigned char data[FLEXIBLE_ARRAY_MEMBER];
+};
+
 struct mail_index_record_map {
 	ARRAY(struct mail_index_map *) maps;
 
 	void *mmap_base;
 	size_t mmap_size, mmap_used_size;
 
-	buffer_t *buffer;
-
-	void *records; /* struct mail_index_record[] */
+	/* struct mail_index_record[] pointing to the mmap()ed index.
+	   NULL when the records are in memory pages. */
+	void *records;
 	unsigned int records_count;
 
+	/* Pages containing the in-memory records. Cloning a rec_map shares
+	   its pages with the clone. A shared page is copied when either one
+	   modifies it, so a change copies only the pages it touches. */
+	struct mail_index_record_page **pages;
+	unsigned int pages_count, pages_alloc_count;
+
 	struct mail_index_map_modseq *modseq;
+	/* UID column and flag/keyword bitmaps, see mail-index-map-columns.c */
+	struct mail_index_map_columns *columns;
 	uint32_t last_appended_uid;
 };
 
@@ -356,6 +382,47 @@ int mail_index_lock_fd(struct mail_index *index, const char *path, int fd,
 
 /* Allocate a new empty map. */
 struct mail_index_map *mail_index_map_alloc(struct mail_index *index);
+/* Returns the record at the given 0-based index. Use
+   MAIL_INDEX_MAP_IDX_MODIFIABLE() when the record is going to be changed. */
+static inline const struct mail_index_record *
+mail_index_map_idx(const struct mail_index_map *map, uint32_t idx)
+{
+	const struct mail_index_record_map *rec_map = map->rec_map;
+	const struct mail_index_record_page *page;
+
+	if (rec_map->records != NULL) {
+		return CONST_PTR_OFFSET(rec_map->records,
+					idx * map->hdr.record_size);
+	}
+	page = rec_map->pages[idx >> MAIL_INDEX_RECORD_PAGE_SHIFT];
+	return CONST_PTR_OFFSET(page->data, (idx & MAIL_INDEX_RECORD_PAGE_MASK) *
+				map->hdr.record_size);
+}
+/* Returns a record that can be modified. If its page is shared with another
+   rec_map, the page is copied first. */
+struct mail_index_record *
+mail_index_map_idx_modifiable(struct mail_index_map *map, uint32_t idx);
+/* Returns the records starting from idx that are stored contiguously in
+   memory. count_r is set to the number of such records, which is at least 1
+   and doesn't go past rec_map->records_count. */
+const void *mail_index_map_get_records(struct mail_index_map *map,
+				       uint32_t idx, unsigned int *count_r);
+/* Add a new record to the end of the in-memory rec_map. Returns the new
+   record, which the caller must initialize. records_count isn't updated. */
+void *mail_index_map_append_record(struct mail_index_map *map);
+/* memmove() count records from src_idx to dest_idx, which must not be
+   after src_idx. */
+void mail_index_map_move_records(struct mail_index_map *map, uint32_t dest_idx,
+				 uint32_t src_idx, unsigned int count);
+/* Replace the rec_map's pages with new zero-filled private pages that have
+   space for records_count records of record_size. */
+void mail_index_record_map_init_pages(struct mail_index_record_map *rec_map,
+				      unsigned int records_count,
+				      unsigned int record_size);
+/* Drop the pages that are past records_count. */
+void mail_index_record_map_truncate_pages(struct mail_index_record_map *rec_map);
+void mail_index_record_map_free_pages(struct mail_index_record_map *rec_map);
+
 /* Replace index->map with the latest index changes. This may reopen the index
    file and/or it may read the latest changes from transaction log. The log is
    read up to EOF, but non-synced expunges are skipped.
@@ -393,6 +460,47 @@ void mail_index_map_lookup_seq_range(struct mail_index_map *map,
 				     uint32_t *first_seq_r,
 				     uint32_t *last_seq_r);
 
+/* Returns the map's columns, or NULL if the map has too few messages for the
+   columns to be worth building. The columns are built lazily and kept up to
+   date while syncing the map. */
+struct mail_index_map_columns *
+mail_index_map_get_columns(struct mail_index_map *map);
+/* Returns the UID of the message at idx (seq-1). */
+uint32_t
+mail_index_map_columns_get_uid(const struct mail_index_map_columns *columns,
+			       unsigned int idx);
+/* Returns the first seq >= given seq where (rec->flags & flags_mask) ==
+   flags, or 0 if there are no such messages. */
+uint32_t mail_index_map_find_flags(struct mail_index_map *map, uint32_t seq,
+				   uint8_t flags, uint8_t flags_mask);
+/* Returns the first seq >= given seq where the keyword (index's keyword_idx)
+   is set or unset, or 0 if there are no such messages. */
+uint32_t mail_index_map_find_keyword(struct mail_index_map *map, uint32_t seq,
+				     unsigned int keyword_idx, bool set);
+/* Returns a copy of the columns. The UID pages and bitmap chunks are shared
+   and copied only when modified. */
+struct mail_index_map_columns *
+mail_index_map_columns_clone(const struct mail_index_map_columns *columns);
+void mail_index_map_columns_free(struct mail_index_map_columns **columns);
+/* Drop the columns after the records were modified in some other way than
+   with the functions below. */
+void mail_index_map_columns_invalidate(struct mail_index_record_map *rec_map);
+void mail_index_map_columns_truncate(struct mail_index_record_map *rec_map,
+				     unsigned int count);
+void mail_index_map_columns_update_flags(struct mail_index_record_map *rec_map,
+					 uint32_t seq1, uint32_t seq2,
+					 uint8_t add_flags, uint8_t remove_flags);
+/* keyword_bit is the keyword's bit in the keywords extension records */
+void mail_index_map_columns_update_keyword(struct mail_index_record_map *rec_map,
+					   unsigned int keyword_bit,
+					   uint32_t seq1, uint32_t seq2,
+					   bool set);
+void mail_index_map_columns_reset_keywords(struct mail_index_record_map *rec_map,
+					   uint32_t seq1, uint32_t seq2);
+void mail_index_map_columns_expunge(struct mail_index_record_map *rec_map,
+				    const struct seq_range *range,
+				    unsigned int range_count);
+
 /* Returns 1 on success, 0 on non-critical errors we want to silently fix,
    -1 if map isn't usable. The caller is responsible for logging the errors
    if -1 is returned. */
@@ -121,11 +121,11 @@ static void sync_ext_reorder(struct mail_index_map *map, uint32_t ext_map_idx,
 	struct mail_index_ext *ext, **sorted;
 	struct mail_index_ext_header *ext_hdr;
 	uint16_t *old_offsets, *copy_sizes, min_align, max_align;
+	struct mail_index_record_map new_rec_map;
 	uint32_t offset, new_record_size, rec_idx;
 	unsigned int i, count;
 	const void *src;
-	buffer_t *new_buffer;
-	size_t new_buffer_size;
+	void *dest;
 
 	i_assert(MAIL_INDEX_MAP_IS_IN_MEMORY(map) && map->refcount == 1);
 
@@ -193,37 +193,32 @@ static void sync_ext_reorder(struct mail_index_map *map, uint32_t ext_map_idx,
 	new_record_size = offset;
 	i_assert(new_record_size >= sizeof(struct mail_index_record));
 
-	/* copy the records to new buffer */
-	new_buffer_size = map->rec_map->records_count * new_record_size;
-	new_buffer = buffer_create_dynamic(default_pool, new_buffer_size);
-	src = map->rec_map->records;
-	offset = 0;
+	/* copy the records to new pages */
+	i_zero(&new_rec_map);
+	mail_index_record_map_init_pages(&new_rec_map,
+					 map->rec_map->records_count,
+					 new_record_size);
 	for (rec_idx = 0; rec_idx < map->rec_map->records_count; rec_idx++) {
+		src = MAIL_INDEX_MAP_IDX(map, rec_idx);
+		dest = PTR_OFFSET(new_rec_map.pages[rec_idx >>
+					MAIL_INDEX_RECORD_PAGE_SHIFT]->data,
+				  (rec_idx & MAIL_INDEX_RECORD_PAGE_MASK) *
+				  new_record_size);
 		/* write the base record */
-		buffer_write(new_buffer, offset, src,
-			     sizeof(struct mail_index_record));
+		memcpy(dest, src, sizeof(struct mail_index_record));
 
 		/* write extensions */
 		for (i = 0; i < count; i++) {
-			buffer_write(new_buffer, offset + ext[i].record_offset,
-				     CONST_PTR_OFFSET(src, old_offsets[i]),
-				     copy_sizes[i]);
+			memcpy(PTR_OFFSET(dest, ext[i].record_offset),
+			       CONST_PTR_OFFSET(src, old_offsets[i]),
+			       copy_sizes[i]);
 		}
-		src = CONST_PTR_OFFSET(src, map->hdr.record_size);
-		offset += new_record_size;
 	}
 
-	if (new_buffer->used != new_buffer_size) {
-		/* we didn't fully write the last record */
-		size_t space = new_buffer_size - new_buffer->used;
-		i_assert(space < new_record_size);
-		buffer_append_zero(new_buffer, space);
-	}
-
-	buffer_free(&map->rec_map->buffer);
-	map->rec_map->buffer = new_buffer;
-	map->rec_map->records =
-		buffer_get_modifiable_data(map->rec_map->buffer, NULL);
+	mail_index_record_map_free_pages(map->rec_map);
+	map->rec_map->pages = new_rec_map.pages;
+	map->rec_map->pages_count = new_rec_map.pages_count;
+	map->rec_map->pages_alloc_count = new_rec_map.pages_alloc_count;
 	map->hdr.record_size = new_record_size;
 
 	/* update record offsets in headers */
@@ -530,10 +525,12 @@ static void mail_index_sync_ext_clear(struct mail_index_view *view,
 	i_assert(map->hdr_copy_buf->used == map->hdr.header_size);
 
 	for (seq = 1; seq <= view->map->rec_map->records_count; seq++) {
-		rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
+		rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(view->map, seq);
 		memset(PTR_OFFSET(rec, ext->record_offset), 0,
 		       ext->record_size);
 	}
+	if (ext->index_idx == view->index->keywords_ext_id)
+		mail_index_map_columns_invalidate(view->map->rec_map);
 }
 
 int mail_index_sync_ext_reset(struct mail_index_sync_map_ctx *ctx,
@@ -625,7 +622,7 @@ mail_index_sync_ext_rec_update(struct mail_index_sync_map_ctx *ctx,
 	i_assert(ext->record_offset + ctx->cur_ext_record_size <=
 		 view->map->hdr.record_size);
 
-	rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
+	rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(view->map, seq);
 	old_data = PTR_OFFSET(rec, ext->record_offset);
 
 	/* @UNSAFE */
@@ -634,6 +631,11 @@ mail_index_sync_ext_rec_update(struct mail_index_sync_map_ctx *ctx,
 		memset(PTR_OFFSET(old_data, ctx->cur_ext_record_size), 0,
 		       ext->record_size - ctx->cur_ext_record_size);
 	}
+	if (ext->index_idx == view->index->keywords_ext_id) {
+		/* keywords are normally updated with keyword transactions,
+		   which keep the columns up to date */
+		mail_index_map_columns_invalidate(view->map->rec_map);
+	}
 	return 1;
 }
 
@@ -664,7 +666,7 @@ mail_index_sync_ext_atomic_inc(struct mail_index_sync_map_ctx *ctx,
 	i_assert(ext->record_offset + ctx->cur_ext_record_size <=
 		 view->map->hdr.record_size);
 
-	rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
+	rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(view->map, seq);
 	data = PTR_OFFSET(rec, ext->record_offset);
 
 	min_value = u->diff >= 0 ? 0 : (uint64_t)(-(int64_t)u->diff);
@@ -211,13 +211,13 @@ sync_expunge_call_handlers(struct mail_index_sync_map_ctx *ctx,
 			   uint32_t seq1, uint32_t seq2)
 {
 	const struct mail_index_expunge_handler *eh;
-	struct mail_index_record *rec;
+	const struct mail_index_record *rec;
 	uint32_t seq;
 
 	array_foreach(&ctx->expunge_handlers, eh) {
 		for (seq = seq1; seq <= seq2; seq++) {
 			rec = MAIL_INDEX_REC_AT_SEQ(ctx->view->map, seq);
-			eh->handler(ctx, PTR_OFFSET(rec, eh->record_offset),
+			eh->handler(ctx, CONST_PTR_OFFSET(rec, eh->record_offset),
 				    eh->sync_context);
 		}
 	}
@@ -267,7 +267,7 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 	for (i = 0; i < count; i++) {
 		uint32_t seq1 = range[i].seq1;
 		uint32_t seq2 = range[i].seq2;
-		struct mail_index_record *rec;
+		const struct mail_index_record *rec;
 		uint32_t seq_count, seq;
 
 		i_assert(seq1 > prev_seq2);
@@ -281,10 +281,8 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 			/* @UNSAFE: move (prev_seq2+1) .. (seq1-1) to its
 			   final location in the map if necessary */
 			uint32_t move_count = (seq1-1) - (prev_seq2+1) + 1;
-			if (prev_seq2+1-1 != dest_seq1-1)
-				memmove(MAIL_INDEX_REC_AT_SEQ(map, dest_seq1),
-					MAIL_INDEX_REC_AT_SEQ(map, prev_seq2+1),
-					move_count * map->hdr.record_size);
+			mail_index_map_move_records(map, dest_seq1-1,
+						    prev_seq2, move_count);
 			dest_seq1 += move_count;
 		}
 		seq_count = seq2 - seq1 + 1;
@@ -296,23 +294,11 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 	/* Final stragglers */
 	if (orig_rec_count > prev_seq2) {
 		uint32_t final_move_count = orig_rec_count - prev_seq2;
-		memmove(MAIL_INDEX_REC_AT_SEQ(map, dest_seq1),
-			MAIL_INDEX_REC_AT_SEQ(map, prev_seq2+1),
-			final_move_count * map->hdr.record_size);
+		mail_index_map_move_records(map, dest_seq1-1, prev_seq2,
+					    final_move_count);
 	}
-}
-
-static void *sync_append_record(struct mail_index_map *map)
-{
-	size_t append_pos;
-	void *ret;
-
-	append_pos = map->rec_map->records_count * map->hdr.record_size;
-	ret = buffer_get_space_unsafe(map->rec_map->buffer, append_pos,
-				      map->hdr.record_size);
-	map->rec_map->records =
-		buffer_get_modifiable_data(map->rec_map->buffer, NULL);
-	return ret;
+	mail_index_record_map_truncate_pages(map->rec_map);
+	mail_index_map_columns_expunge(map->rec_map, range, count);
 }
 
 static bool sync_update_ignored_change(struct mail_index_sync_map_ctx *ctx)
@@ -407,7 +393,7 @@ static int sync_append(const struct mail_index_record *rec,
 	} else {
 		/* don't rely on buffer->used being at the correct position.
 		   at least expunges can move it */
-		dest = sync_append_record(map);
+		dest = mail_index_map_append_record(map);
 		memcpy(dest, rec, sizeof(*rec));
 		memset(PTR_OFFSET(dest, sizeof(*rec)), 0,
 		       map->hdr.record_size - sizeof(*rec));
@@ -454,16 +440,19 @@ static int sync_flag_update(const struct mail_transaction_flag_update *u,
 
         flag_mask = (unsigned char)~u->remove_flags;
 
+	mail_index_map_columns_update_flags(view->map->rec_map, seq1, seq2,
+					    u->add_flags, u->remove_flags);
+
 	if (((u->add_flags | u->remove_flags) &
 	     (MAIL_SEEN | MAIL_DELETED)) == 0) {
 		/* we're not modifying any counted/lowwatered flags */
 		for (seq = seq1; seq <= seq2; seq++) {
-			rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
+			rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(view->map, seq);
 			rec->flags = (rec->flags & flag_mask) | u->add_flags;
 		}
 	} else {
 		for (seq = seq1; seq <= seq2; seq++) {
-			rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
+			rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(view->map, seq);
 
 			old_flags = rec->flags;
 			rec->flags = (rec->flags & flag_mask) | u->add_flags;
@@ -259,6 +259,81 @@ static void tview_lookup_first(struct mail_index_view *view,
 	}
 }
 
+static void tview_lookup_next_flags(struct mail_index_view *view, uint32_t seq,
+				    enum mail_flags flags, uint8_t flags_mask,
+				    uint32_t *seq_r)
+{
+	struct mail_index_view_transaction *tview =
+		(struct mail_index_view_transaction *)view;
+	struct mail_index_transaction *t = tview->t;
+	const struct mail_index_record *rec;
+	unsigned int append_count;
+	uint32_t update_seq = 0;
+
+	if (!t->reset) {
+		if (array_is_created(&t->updates) &&
+		    seq <= t->max_flagupdate_seq &&
+		    I_MAX(seq, t->min_flagupdate_seq) < t->first_new_seq)
+			update_seq = I_MAX(seq, t->min_flagupdate_seq);
+
+		tview->super->lookup_next_flags(view, seq, flags, flags_mask,
+						seq_r);
+		if (update_seq != 0 && (*seq_r == 0 || *seq_r > update_seq)) {
+			/* the transaction may have changed the flags */
+			*seq_r = update_seq;
+		}
+		if (*seq_r != 0)
+			return;
+	} else {
+		*seq_r = 0;
+	}
+
+	if (t->last_new_seq == 0 || seq > t->last_new_seq)
+		return;
+
+	/* flag updates to appended messages are applied directly to them */
+	rec = array_get(&t->appends, &append_count);
+	if (seq < t->first_new_seq)
+		seq = t->first_new_seq;
+	rec += seq - t->first_new_seq;
+	for (; seq <= t->last_new_seq; seq++, rec++) {
+		if ((rec->flags & flags_mask) == (uint8_t)flags) {
+			*seq_r = seq;
+			break;
+		}
+	}
+}
+
+static void tview_lookup_next_keyword(struct mail_index_view *view,
+				      uint32_t seq, unsigned int keyword_idx,
+				      bool set, uint32_t *seq_r)
+{
+	struct mail_index_view_transaction *tview =
+		(struct mail_index_view_transaction *)view;
+	struct mail_index_transaction *t = tview->t;
+	uint32_t update_seq = 0;
+
+	/* keyword updates to both existing and appended messages are kept in
+	   t->keyword_updates, so anything in the flag update range may have
+	   been changed */
+	if (seq <= t->max_flagupdate_seq)
+		update_seq = I_MAX(seq, t->min_flagupdate_seq);
+
+	if (!t->reset) {
+		tview->super->lookup_next_keyword(view, seq, keyword_idx, set,
+						  seq_r);
+	} else {
+		*seq_r = 0;
+	}
+	if (*seq_r == 0 && !set && t->last_new_seq != 0 &&
+	    seq <= t->last_new_seq) {
+		/* appended messages don't have any other keywords */
+		*seq_r = I_MAX(seq, t->first_new_seq);
+	}
+	if (update_seq != 0 && (*seq_r == 0 || *seq_r > update_seq))
+		*seq_r = update_seq;
+}
+
 static void keyword_index_add(ARRAY_TYPE(keyword_indexes) *keywords,
 			      unsigned int idx)
 {
@@ -504,6 +579,8 @@ static struct mail_index_view_vfuncs trans_view_vfuncs = {
 	tview_lookup_uid,
 	tview_lookup_seq_range,
 	tview_lookup_first,
+	tview_lookup_next_flags,
+	tview_lookup_next_keyword,
 	tview_lookup_keywords,
 	tview_lookup_ext_full,
 	tview_get_header_ext,
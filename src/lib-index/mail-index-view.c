@@ -255,7 +255,6 @@ static void view_lookup_first(struct mail_index_view *view,
 #define LOW_UPDATE(x) \
 	STMT_START { if ((x) > low_uid) low_uid = x; } STMT_END
 	const struct mail_index_header *hdr = &view->map->hdr;
-	const struct mail_index_record *rec;
 	uint32_t seq, seq2, low_uid = 1;
 
 	*seq_r = 0;
@@ -273,14 +272,21 @@ static void view_lookup_first(struct mail_index_view *view,
 			return;
 	}
 
-	i_assert(hdr->messages_count <= view->map->rec_map->records_count);
-	for (; seq <= hdr->messages_count; seq++) {
-		rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
-		if ((rec->flags & flags_mask) == (uint8_t)flags) {
-			*seq_r = seq;
-			break;
-		}
-	}
+	*seq_r = mail_index_map_find_flags(view->map, seq, flags, flags_mask);
+}
+
+static void view_lookup_next_flags(struct mail_index_view *view, uint32_t seq,
+				   enum mail_flags flags, uint8_t flags_mask,
+				   uint32_t *seq_r)
+{
+	*seq_r = mail_index_map_find_flags(view->map, seq, flags, flags_mask);
+}
+
+static void view_lookup_next_keyword(struct mail_index_view *view,
+				     uint32_t seq, unsigned int keyword_idx,
+				     bool set, uint32_t *seq_r)
+{
+	*seq_r = mail_index_map_find_keyword(view->map, seq, keyword_idx, set);
 }
 
 static void
@@ -524,6 +530,20 @@ void mail_index_lookup_first(struct mail_index_view *view,
 	view->v.lookup_first(view, flags, flags_mask, seq_r);
 }
 
+void mail_index_lookup_next_flags(struct mail_index_view *view, uint32_t seq,
+				  enum mail_flags flags, uint8_t flags_mask,
+				  uint32_t *seq_r)
+{
+	view->v.lookup_next_flags(view, seq, flags, flags_mask, seq_r);
+}
+
+void mail_index_lookup_next_keyword(struct mail_index_view *view, uint32_t seq,
+				    unsigned int keyword_idx, bool set,
+				    uint32_t *seq_r)
+{
+	view->v.lookup_next_keyword(view, seq, keyword_idx, set, seq_r);
+}
+
 void mail_index_lookup_ext(struct mail_index_view *view, uint32_t seq,
 			   uint32_t ext_id, const void **data_r,
 			   bool *expunged_r)
@@ -591,6 +611,8 @@ static struct mail_index_view_vfuncs view_vfuncs = {
 	view_lookup_uid,
 	view_lookup_seq_range,
 	view_lookup_first,
+	view_lookup_next_flags,
+	view_lookup_next_keyword,
 	view_lookup_keywords,
 	view_lookup_ext_full,
 	view_get_header_ext,
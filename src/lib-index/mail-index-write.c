@@ -58,7 +58,8 @@ static int mail_index_recreate(struct mail_index *index)
 {
 	struct mail_index_map *map = index->map;
 	struct ostream *output;
-	unsigned int base_size;
+	const void *records;
+	unsigned int base_size, i, count;
 	const char *path;
 	int ret = 0, fd;
 
@@ -84,8 +85,10 @@ static int mail_index_recreate(struct mail_index *index)
 	o_stream_nsend(output, &hdr, base_size);
 	o_stream_nsend(output, MAIL_INDEX_MAP_HDR_OFFSET(map, base_size),
 		       hdr.header_size - base_size);
-	o_stream_nsend(output, map->rec_map->records,
-		       map->rec_map->records_count * hdr.record_size);
+	for (i = 0; i < map->rec_map->records_count; i += count) {
+		records = mail_index_map_get_records(map, i, &count);
+		o_stream_nsend(output, records, count * hdr.record_size);
+	}
 	if (o_stream_finish(output) < 0) {
 		mail_index_file_set_syscall_error(index, path, "write()");
 		ret = -1;
@@ -38,6 +38,7 @@ static const struct mail_index_optimization_settings default_optimization_set =
 	.index = {
 		.rewrite_min_log_bytes = 8 * 1024,
 		.rewrite_max_log_bytes = 128 * 1024,
+		.columns_min_messages = 10000,
 	},
 	.log = {
 		.min_size = 32 * 1024,
@@ -196,6 +197,8 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 		dest->index.rewrite_min_log_bytes = set->index.rewrite_min_log_bytes;
 	if (set->index.rewrite_max_log_bytes != 0)
 		dest->index.rewrite_max_log_bytes = set->index.rewrite_max_log_bytes;
+	if (set->index.columns_min_messages != 0)
+		dest->index.columns_min_messages = set->index.columns_min_messages;
 
 	/* log */
 	if (set->log.min_size != 0)
@@ -226,6 +229,8 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 			set->cache.purge_header_continue_count;
 	if (set->cache.record_max_size != 0)
 		dest->cache.record_max_size = set->cache.record_max_size;
+	if (set->cache.compress_min_size != 0)
+		dest->cache.compress_min_size = set->cache.compress_min_size;
 
 	dest->cache.max_header_name_length = set->cache.max_header_name_length;
 	dest->cache.max_headers_count = set->cache.max_headers_count;
@@ -40,6 +40,10 @@ enum mail_index_open_flags {
 	/* MAIL_INDEX_MAIL_FLAG_DIRTY can be used as a backend-specific flag.
 	   All special handling of the flag is disabled by this. */
 	MAIL_INDEX_OPEN_FLAG_NO_DIRTY		= 0x1000,
+	/* Don't purge the cache file automatically. The caller checks
+	   mail_cache_need_background_purge() and has the purging done by
+	   another process with mail_cache_purge_if_wanted(). */
+	MAIL_INDEX_OPEN_FLAG_CACHE_PURGE_BACKGROUND = 0x2000,
 };
 
 enum mail_index_header_compat_flags {
@@ -311,6 +315,13 @@ struct mail_index_base_optimization_settings {
 	   from the .log on refresh is between these min/max values. */
 	uoff_t rewrite_min_log_bytes;
 	uoff_t rewrite_max_log_bytes;
+	/* Keep a separate in-memory UID column and flag/keyword bitmaps of
+	   the records when the mailbox has at least this many messages. They
+	   speed up UID lookups and flag/keyword searches in large
+	   mailboxes. They aren't stored in the index files, so the first
+	   lookup in a process builds them by scanning all the records. Only
+	   the following lookups can skip over the non-matching messages. */
+	unsigned int columns_min_messages;
 };
 
 struct mail_index_log_optimization_settings {
@@ -349,6 +360,9 @@ struct mail_index_cache_optimization_settings {
 	/* Purge the file when we need to follow more than n next_offsets to
 	   find the latest cache header. */
 	unsigned int purge_header_continue_count;
+	/* When purging, compress variable sized fields that are at least
+	   this large. 0 = don't compress. Requires zstd support. */
+	unsigned int compress_min_size;
 };
 
 struct mail_index_optimization_settings {
@@ -623,6 +637,19 @@ bool mail_index_lookup_seq(struct mail_index_view *view,
 void mail_index_lookup_first(struct mail_index_view *view,
 			     enum mail_flags flags, uint8_t flags_mask,
 			     uint32_t *seq_r);
+/* Skip over mails that can't have (mail->flags & flags_mask) == flags.
+   Returns the first mail at or after seq that may match, or 0 if none of
+   them can. All the mails before the returned seq are known not to match,
+   but the returned mail itself may not match if there are uncommitted flag
+   changes in the view's transaction, so the caller must still check it. */
+void mail_index_lookup_next_flags(struct mail_index_view *view, uint32_t seq,
+				  enum mail_flags flags, uint8_t flags_mask,
+				  uint32_t *seq_r);
+/* Same as mail_index_lookup_next_flags(), but skip over mails that can't
+   have the keyword set (set=TRUE) or unset (set=FALSE). */
+void mail_index_lookup_next_keyword(struct mail_index_view *view, uint32_t seq,
+				    unsigned int keyword_idx, bool set,
+				    uint32_t *seq_r);
 
 /* Append a new record to index. */
 void mail_index_append(struct mail_index_transaction *t, uint32_t uid,
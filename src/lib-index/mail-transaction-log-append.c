@@ -1,11 +1,14 @@
 /* Copyright (c) 2003-2018 Dovecot authors, see the included COPYING file */
 
+#define _GNU_SOURCE /* syncfs() */
 #include "lib.h"
 #include "array.h"
 #include "write-full.h"
 #include "mail-index-private.h"
 #include "mail-transaction-log-private.h"
 
+static struct mail_transaction_log_fsync_batch *log_fsync_batch = NULL;
+
 void mail_transaction_log_append_add(struct mail_transaction_log_append_ctx *ctx,
 				     enum mail_transaction_type type,
 				     const void *data, size_t size)
@@ -59,6 +62,33 @@ log_buffer_move_to_memory(struct mail_transaction_log_append_ctx *ctx)
 	return 0;
 }
 
+static bool log_fsync_batch_add(struct mail_transaction_log_file *file)
+{
+	struct mail_transaction_log_fsync_batch_file *bfile;
+	int fd;
+
+	log_fsync_batch->delayed_fsyncs++;
+	array_foreach_modifiable(&log_fsync_batch->files, bfile) {
+		if (bfile->st_ino == file->st_ino &&
+		    CMP_DEV_T(bfile->st_dev, file->st_dev))
+			return TRUE;
+	}
+
+	fd = dup(file->fd);
+	if (fd == -1) {
+		mail_index_file_set_syscall_error(file->log->index,
+						  file->filepath, "dup()");
+		log_fsync_batch->delayed_fsyncs--;
+		return FALSE;
+	}
+	bfile = array_append_space(&log_fsync_batch->files);
+	bfile->fd = fd;
+	bfile->st_ino = file->st_ino;
+	bfile->st_dev = file->st_dev;
+	bfile->filepath = i_strdup(file->filepath);
+	return TRUE;
+}
+
 static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 {
 	struct mail_transaction_log_file *file = ctx->log->head;
@@ -87,7 +117,9 @@ static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 	if ((ctx->want_fsync &&
 	     file->log->index->set.fsync_mode != FSYNC_MODE_NEVER) ||
 	    file->log->index->set.fsync_mode == FSYNC_MODE_ALWAYS) {
-		if (fdatasync(file->fd) < 0) {
+		if (log_fsync_batch != NULL && log_fsync_batch_add(file)) {
+			/* synced by mail_transaction_log_fsync_batch_end() */
+		} else if (fdatasync(file->fd) < 0) {
 			mail_index_file_set_syscall_error(ctx->log->index,
 							  file->filepath,
 							  "fdatasync()");
@@ -252,3 +284,90 @@ int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **
 	i_free(ctx);
 	return ret;
 }
+
+struct mail_transaction_log_fsync_batch *
+mail_transaction_log_fsync_batch_begin(enum mail_transaction_log_fsync_batch_flags flags)
+{
+	i_assert(log_fsync_batch == NULL);
+
+	log_fsync_batch = i_new(struct mail_transaction_log_fsync_batch, 1);
+	log_fsync_batch->flags = flags;
+	i_array_init(&log_fsync_batch->files, 8);
+	return log_fsync_batch;
+}
+
+#ifdef HAVE_SYNCFS
+static unsigned int
+log_fsync_batch_close_same_fs(struct mail_transaction_log_fsync_batch *batch,
+			      unsigned int idx)
+{
+	struct mail_transaction_log_fsync_batch_file *files;
+	unsigned int i, count, closed = 0;
+
+	files = array_get_modifiable(&batch->files, &count);
+	for (i = idx + 1; i < count; i++) {
+		if (files[i].fd != -1 &&
+		    CMP_DEV_T(files[i].st_dev, files[idx].st_dev)) {
+			i_close_fd(&files[i].fd);
+			closed++;
+		}
+	}
+	return closed;
+}
+#endif
+
+static int
+log_fsync_batch_sync_file(struct mail_transaction_log_fsync_batch *batch ATTR_UNUSED,
+			  struct mail_transaction_log_fsync_batch_file *bfile,
+			  const char **error_r)
+{
+#ifdef HAVE_SYNCFS
+	unsigned int idx = array_ptr_to_idx(&batch->files, bfile);
+
+	if ((batch->flags & MAIL_TRANSACTION_LOG_FSYNC_BATCH_FLAG_SYNCFS) != 0 &&
+	    log_fsync_batch_close_same_fs(batch, idx) > 0) {
+		/* the rest of the files in this filesystem are synced by
+		   the same syncfs() */
+		if (syncfs(bfile->fd) < 0) {
+			*error_r = t_strdup_printf("syncfs(%s) failed: %m",
+						   bfile->filepath);
+			return -1;
+		}
+		return 0;
+	}
+#endif
+	if (fdatasync(bfile->fd) < 0) {
+		*error_r = t_strdup_printf("fdatasync(%s) failed: %m",
+					   bfile->filepath);
+		return -1;
+	}
+	return 0;
+}
+
+int mail_transaction_log_fsync_batch_end(struct mail_transaction_log_fsync_batch **_batch,
+					 const char **error_r)
+{
+	struct mail_transaction_log_fsync_batch *batch = *_batch;
+	struct mail_transaction_log_fsync_batch_file *bfile;
+	const char *error;
+	int ret = 0;
+
+	*_batch = NULL;
+	i_assert(log_fsync_batch == batch);
+	log_fsync_batch = NULL;
+
+	array_foreach_modifiable(&batch->files, bfile) {
+		if (bfile->fd != -1) {
+			if (log_fsync_batch_sync_file(batch, bfile, &error) < 0 &&
+			    ret == 0) {
+				*error_r = error;
+				ret = -1;
+			}
+			i_close_fd(&bfile->fd);
+		}
+		i_free(bfile->filepath);
+	}
+	array_free(&batch->files);
+	i_free(batch);
+	return ret;
+}
@@ -138,6 +138,23 @@ struct mail_transaction_log {
 	bool log_2_unlink_checked:1;
 };
 
+struct mail_transaction_log_fsync_batch_file {
+	/* dup()ed fd, so the file can be synced even if the log was already
+	   closed */
+	int fd;
+	ino_t st_ino;
+	dev_t st_dev;
+	char *filepath;
+};
+
+struct mail_transaction_log_fsync_batch {
+	enum mail_transaction_log_fsync_batch_flags flags;
+	/* Log files written since the batch was started, each only once */
+	ARRAY(struct mail_transaction_log_fsync_batch_file) files;
+	/* Number of fdatasync()s that were delayed to this batch */
+	unsigned int delayed_fsyncs;
+};
+
 void
 mail_transaction_log_file_set_corrupted(struct mail_transaction_log_file *file,
 					const char *fmt, ...)
@@ -371,6 +371,13 @@ struct mail_transaction_log_append_ctx {
 	bool want_fsync:1;
 };
 
+enum mail_transaction_log_fsync_batch_flags {
+	/* Use a single syncfs() for files in the same filesystem instead of
+	   an fdatasync() for each file. This is ignored if syncfs() isn't
+	   supported. */
+	MAIL_TRANSACTION_LOG_FSYNC_BATCH_FLAG_SYNCFS	= 0x01,
+};
+
 #define LOG_IS_BEFORE(seq1, offset1, seq2, offset2) \
 	(((offset1) < (offset2) && (seq1) == (seq2)) || (seq1) < (seq2))
 
@@ -462,6 +469,20 @@ void mail_transaction_log_append_add(struct mail_transaction_log_append_ctx *ctx
 				     const void *data, size_t size);
 int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **ctx);
 
+/* Start a group commit. Until mail_transaction_log_fsync_batch_end() is called,
+   the fdatasync()s of the transaction log appends in this process aren't done
+   immediately. Instead each written log file is fdatasync()ed once when the
+   batch ends. The caller must not report any of the commits as successful
+   before mail_transaction_log_fsync_batch_end() has succeeded. Only one batch
+   can exist at a time. */
+struct mail_transaction_log_fsync_batch *
+mail_transaction_log_fsync_batch_begin(enum mail_transaction_log_fsync_batch_flags flags);
+/* Sync all the log files written after the batch was started. Returns 0 if
+   ok, -1 if syncing some file failed. The rest of the files are still
+   synced after a failure. */
+int mail_transaction_log_fsync_batch_end(struct mail_transaction_log_fsync_batch **batch,
+					 const char **error_r);
+
 /* Lock transaction log for index synchronization. This is used as the main
    exclusive lock for index changes. The index/log can still be read since they
    don't use locking, but the log can't be written to while it's locked.
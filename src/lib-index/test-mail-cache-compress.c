@@ -0,0 +1,350 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "test-common.h"
+#include "test-mail-cache.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+static const char *test_hdr_hosts[] = {
+	"mx1.example.com", "mx2.example.com", "smtp.example.org",
+	"mail.example.net", "relay.example.com"
+};
+
+static const char *test_mail_cache_compress_hdr(unsigned int n)
+{
+	const char *host = test_hdr_hosts[n % N_ELEMENTS(test_hdr_hosts)];
+
+	return t_strdup_printf(
+		"Received: from %s (%s [192.0.2.%u])\n"
+		"\tby imap.example.com (Postfix) with ESMTPS id %X\n"
+		"\tfor <user%u@example.com>; Mon, %u Jan 2026 12:%02u:%02u +0000\n"
+		"From: Sender %u <sender%u@example.org>\n"
+		"To: user%u@example.com\n"
+		"Subject: Weekly report number %u\n"
+		"Message-ID: <%x.%u@%s>\n"
+		"Content-Type: text/plain; charset=utf-8\n",
+		host, host, n % 250, n * 2654435761U, n % 10, n % 28 + 1,
+		n % 60, n * 7 % 60, n, n % 100, n % 10, n,
+		n * 40503U, n, host);
+}
+
+static void
+test_mail_cache_compress_train(unsigned int first, unsigned int count,
+			       buffer_t *dict)
+{
+	buffer_t *samples = t_buffer_create(1024*64);
+	ARRAY(size_t) sample_sizes;
+	const char *hdr;
+	size_t size;
+	unsigned int i;
+
+	t_array_init(&sample_sizes, count);
+	for (i = first; i < first + count; i++) {
+		hdr = test_mail_cache_compress_hdr(i);
+		size = strlen(hdr);
+		buffer_append(samples, hdr, size);
+		array_push_back(&sample_sizes, &size);
+	}
+	mail_cache_compress_train_dict(samples->data,
+				       array_front(&sample_sizes), count,
+				       MAIL_CACHE_COMPRESS_DICT_MAX_SIZE, dict);
+}
+
+static void test_mail_cache_compress_roundtrip(void)
+{
+	struct mail_cache_compressor *compressor;
+	buffer_t *dict, *compressed, *output;
+	const char *error, *hdr;
+	size_t plain_size = 0, dict_compressed_size = 0;
+	unsigned int i;
+
+	test_begin("mail cache compress roundtrip");
+	dict = buffer_create_dynamic(default_pool, 1024);
+	test_mail_cache_compress_train(0, 1000, dict);
+	test_assert(dict->used > 0 &&
+		    dict->used <= MAIL_CACHE_COMPRESS_DICT_MAX_SIZE);
+
+	compressed = buffer_create_dynamic(default_pool, 1024);
+	output = buffer_create_dynamic(default_pool, 1024);
+
+	/* with and without the dictionary */
+	for (unsigned int d = 0; d < 2; d++) {
+		compressor = d == 0 ? mail_cache_compressor_init(NULL, 0) :
+			mail_cache_compressor_init(dict->data, dict->used);
+		for (i = 1000; i < 1100; i++) {
+			hdr = test_mail_cache_compress_hdr(i);
+			buffer_set_used_size(compressed, 0);
+			buffer_set_used_size(output, 0);
+			test_assert_idx(mail_cache_compress(compressor, hdr,
+				strlen(hdr), compressed), i);
+			test_assert_idx(mail_cache_decompress(compressor,
+				compressed->data, compressed->used,
+				strlen(hdr), output, &error) == 0, i);
+			test_assert_idx(output->used == strlen(hdr) &&
+				memcmp(output->data, hdr, output->used) == 0, i);
+			if (d == 1) {
+				plain_size += strlen(hdr);
+				dict_compressed_size += compressed->used;
+			}
+		}
+		mail_cache_compressor_deinit(&compressor);
+	}
+	/* the dictionary makes a big difference for small fields */
+	test_assert(dict_compressed_size * 2 < plain_size);
+
+	/* long repeating content */
+	compressor = mail_cache_compressor_init(NULL, 0);
+	string_t *str = t_str_new(4096);
+	for (i = 0; i < 1000; i++)
+		str_append(str, "abc");
+	str_append(str, "xyz");
+	buffer_set_used_size(compressed, 0);
+	buffer_set_used_size(output, 0);
+	test_assert(mail_cache_compress(compressor, str_data(str),
+					str_len(str), compressed));
+	test_assert(compressed->used < 64);
+	test_assert(mail_cache_decompress(compressor, compressed->data,
+					  compressed->used, str_len(str),
+					  output, &error) == 0);
+	test_assert(buffer_cmp(output, str));
+
+	/* content compressing better than MAIL_CACHE_COMPRESS_MAX_RATIO
+	   isn't compressed */
+	buffer_set_used_size(compressed, 0);
+	void *zeros = i_malloc(1024*1024);
+	test_assert(!mail_cache_compress(compressor, zeros, 1024*1024,
+					 compressed));
+	test_assert(compressed->used == 0);
+	i_free(zeros);
+
+	/* random data doesn't compress */
+	unsigned char random_data[256];
+	random_fill(random_data, sizeof(random_data));
+	test_assert(!mail_cache_compress(compressor, random_data,
+					 sizeof(random_data), compressed));
+	test_assert(compressed->used == 0);
+	/* too small data isn't compressed */
+	test_assert(!mail_cache_compress(compressor, "aaaa", 4, compressed));
+	mail_cache_compressor_deinit(&compressor);
+
+	buffer_free(&dict);
+	buffer_free(&compressed);
+	buffer_free(&output);
+	test_end();
+}
+
+static void test_mail_cache_compress_train_small(void)
+{
+	buffer_t *dict = t_buffer_create(64);
+	size_t size = 12;
+
+	test_begin("mail cache compress train small");
+	mail_cache_compress_train_dict("", NULL, 0, 1024, dict);
+	test_assert(dict->used == 0);
+	mail_cache_compress_train_dict("short sample", &size, 1, 1024, dict);
+	test_assert(dict->used == 0);
+	test_end();
+}
+
+static void test_mail_cache_compress_corrupted(void)
+{
+	struct mail_cache_compressor *compressor, *compressor2;
+	const char *hdr = test_mail_cache_compress_hdr(1);
+	buffer_t *dict, *compressed, *output;
+	unsigned char *data;
+	const char *error;
+	uint32_t out_size;
+	unsigned int i;
+
+	test_begin("mail cache compress corrupted");
+	dict = t_buffer_create(1024);
+	test_mail_cache_compress_train(100, 1000, dict);
+	compressor = mail_cache_compressor_init(dict->data, dict->used);
+	compressed = t_buffer_create(1024);
+	test_assert(mail_cache_compress(compressor, hdr, strlen(hdr),
+					compressed));
+	output = t_buffer_create(1024);
+
+	/* missing dictionary */
+	compressor2 = mail_cache_compressor_init(NULL, 0);
+	test_assert(mail_cache_decompress(compressor2, compressed->data,
+					  compressed->used, 1024, output,
+					  &error) < 0);
+	test_assert(output->used == 0);
+	mail_cache_compressor_deinit(&compressor2);
+
+	/* truncated */
+	for (i = 0; i < compressed->used; i++) {
+		test_assert_idx(mail_cache_decompress(compressor,
+			compressed->data, i, 1024, output, &error) < 0, i);
+		test_assert_idx(output->used == 0, i);
+	}
+
+	/* wrong uncompressed size */
+	data = buffer_get_modifiable_data(compressed, NULL);
+	data[0]++;
+	test_assert(mail_cache_decompress(compressor, compressed->data,
+					  compressed->used, 1024, output,
+					  &error) < 0);
+	data[0] -= 2;
+	test_assert(mail_cache_decompress(compressor, compressed->data,
+					  compressed->used, 1024, output,
+					  &error) < 0);
+	data[0]++;
+	test_assert(output->used == 0);
+
+	/* the uncompressed size isn't trusted for allocating memory */
+	test_assert(mail_cache_decompress(compressor, compressed->data,
+					  compressed->used, strlen(hdr) - 1,
+					  output, &error) < 0);
+	test_assert(strstr(error, "too large") != NULL);
+	memcpy(&out_size, data, sizeof(out_size));
+	data[0] = data[1] = data[2] = 0; data[3] = 0x40;
+	test_assert(mail_cache_decompress(compressor, compressed->data,
+					  compressed->used, UINT32_MAX, output,
+					  &error) < 0);
+	test_assert(strstr(error, "too large") != NULL);
+	test_assert(output->used == 0);
+	memcpy(data, &out_size, sizeof(out_size));
+
+	/* garbage must not crash or write outside the output */
+	for (i = 0; i < 10000; i++) {
+		unsigned int pos = sizeof(uint32_t) +
+			i_rand_limit(compressed->used - sizeof(uint32_t));
+		unsigned char orig = data[pos];
+
+		data[pos] = i_rand_limit(256);
+		buffer_set_used_size(output, 0);
+		if (mail_cache_decompress(compressor, compressed->data,
+					  compressed->used, 1024, output,
+					  &error) < 0)
+			test_assert_idx(output->used == 0, i);
+		else
+			test_assert_idx(output->used == strlen(hdr), i);
+		data[pos] = orig;
+	}
+	mail_cache_compressor_deinit(&compressor);
+	test_end();
+}
+
+static void test_mail_cache_compress_unsupported(void)
+{
+	struct mail_cache_compressor *compressor;
+	const char *hdr = test_mail_cache_compress_hdr(1);
+	buffer_t *dict, *compressed;
+	const char *error;
+
+	test_begin("mail cache compress unsupported");
+	dict = t_buffer_create(1024);
+	test_mail_cache_compress_train(0, 1000, dict);
+	test_assert(dict->used == 0);
+
+	compressor = mail_cache_compressor_init(NULL, 0);
+	compressed = t_buffer_create(1024);
+	test_assert(!mail_cache_compress(compressor, hdr, strlen(hdr),
+					 compressed));
+	test_assert(compressed->used == 0);
+	buffer_append(compressed, "\x10\0\0\0garbage", 11);
+	test_assert(mail_cache_decompress(compressor, compressed->data,
+					  compressed->used, 1024, compressed,
+					  &error) < 0);
+	mail_cache_compressor_deinit(&compressor);
+	test_end();
+}
+
+static void
+test_mail_cache_compress_benchmark_run(unsigned int count,
+				       unsigned int compress_min_size)
+{
+	struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.compress_min_size = compress_min_size,
+		},
+	};
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_view *cache_view;
+	struct timeval start, end;
+	struct stat st;
+	string_t *str;
+	unsigned int i, n;
+	long long usecs;
+
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	for (i = 1; i <= count; i++) {
+		test_mail_cache_add_mail(&ctx, ctx.cache_field.idx,
+					 test_mail_cache_compress_hdr(i));
+	}
+	i_gettimeofday(&start);
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	i_gettimeofday(&end);
+	usecs = timeval_diff_usecs(&end, &start);
+	if (stat(ctx.cache->filepath, &st) < 0)
+		i_fatal("stat(%s) failed: %m", ctx.cache->filepath);
+	printf("compress_min_size=%u: %u messages, cache file %lld bytes, "
+	       "purge %lld usecs\n", compress_min_size, count,
+	       (long long)st.st_size, usecs);
+
+	/* the same as what happens for FETCH of a cached header */
+	test_mail_cache_view_sync(&ctx);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	str = str_new(default_pool, 1024);
+	i_gettimeofday(&start);
+	for (n = 0; n < 10; n++) {
+		for (i = 1; i <= count; i++) {
+			str_truncate(str, 0);
+			if (mail_cache_lookup_field(cache_view, str, i,
+						    ctx.cache_field.idx) != 1)
+				i_fatal("lookup failed");
+		}
+	}
+	i_gettimeofday(&end);
+	usecs = timeval_diff_usecs(&end, &start);
+	printf("  %u lookups in %lld usecs (%.0f lookups/sec)\n",
+	       count * n, usecs, usecs == 0 ? 0 :
+	       (double)count * n * 1000000 / usecs);
+	str_free(&str);
+	mail_cache_view_close(&cache_view);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+}
+
+static void test_mail_cache_compress_benchmark(unsigned int count)
+{
+	test_mail_cache_compress_benchmark_run(count, 0);
+	if (mail_cache_compress_is_supported())
+		test_mail_cache_compress_benchmark_run(count, 64);
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*const test_functions[])(void) = {
+		test_mail_cache_compress_roundtrip,
+		test_mail_cache_compress_train_small,
+		test_mail_cache_compress_corrupted,
+		NULL
+	};
+	static void (*const test_functions_unsupported[])(void) = {
+		test_mail_cache_compress_unsupported,
+		NULL
+	};
+
+	if (argc >= 2 && strcmp(argv[1], "benchmark") == 0) {
+		/* test-mail-cache-compress benchmark [<messages count>] */
+		lib_init();
+		test_mail_cache_compress_benchmark(argc < 3 ? 10000 :
+						   atoi(argv[2]));
+		lib_deinit();
+		return 0;
+	}
+	if (!mail_cache_compress_is_supported())
+		return test_run(test_functions_unsupported);
+	return test_run(test_functions);
+}
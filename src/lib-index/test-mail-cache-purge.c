@@ -1044,6 +1044,170 @@ static void test_mail_cache_update_need_purge_deleted_records2(void)
 	test_end();
 }
 
+static void test_mail_cache_purge_background(void)
+{
+	struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.purge_min_size = 1,
+			.purge_delete_percentage = 30,
+		},
+	};
+	struct mail_index_transaction *trans;
+	struct test_mail_cache_ctx ctx, ctx2;
+	const char *reason;
+	uint32_t seq, file_seq;
+
+	test_begin("mail cache purge background");
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	ctx.index->flags |= MAIL_INDEX_OPEN_FLAG_CACHE_PURGE_BACKGROUND;
+
+	for (seq = 1; seq <= 10; seq++)
+		test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo");
+	test_assert(!mail_cache_need_background_purge(ctx.cache, &file_seq));
+
+	/* syncing doesn't purge */
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	for (seq = 1; seq <= 3; seq++)
+		mail_index_expunge(trans, seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_mail_cache_index_sync(&ctx);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 0);
+	test_assert(!mail_cache_need_purge(ctx.cache, &reason));
+	test_assert(mail_cache_need_background_purge(ctx.cache, &file_seq));
+	test_assert(file_seq == ctx.cache->hdr->file_seq);
+
+	/* another process purges it */
+	test_mail_cache_init(test_mail_index_open(), &ctx2);
+	mail_index_set_optimization_settings(ctx2.index, &optimization_set);
+	ctx2.index->flags |= MAIL_INDEX_OPEN_FLAG_CACHE_PURGE_BACKGROUND;
+	test_assert(mail_cache_purge_if_wanted(ctx2.cache) == 1);
+	test_assert(test_mail_cache_get_purge_count(&ctx2) == 1);
+	test_assert(mail_cache_purge_if_wanted(ctx2.cache) == 0);
+	test_mail_cache_deinit(&ctx2);
+
+	test_assert(mail_cache_reopen(ctx.cache) == 1);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+	test_assert(ctx.cache->hdr->deleted_record_count == 0);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static unsigned int
+test_mail_cache_compressed_count(struct test_mail_cache_ctx *ctx,
+				 uint32_t messages_count)
+{
+	struct mail_cache_view *cache_view;
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	unsigned int count = 0;
+	uint32_t seq;
+
+	cache_view = mail_cache_view_open(ctx->cache, ctx->view);
+	for (seq = 1; seq <= messages_count; seq++) {
+		mail_cache_lookup_iter_init(cache_view, seq, &iter);
+		while (mail_cache_lookup_iter_next(&iter, &field) > 0) {
+			if (field.compressed)
+				count++;
+		}
+	}
+	mail_cache_view_close(&cache_view);
+	return count;
+}
+
+static const char *test_mail_cache_purge_compress_value(uint32_t seq)
+{
+	return t_strdup_printf("From: user%u@example.com\n"
+		"To: recipient%u@example.org\n"
+		"Subject: This is a message number %u\n"
+		"Message-ID: <%u.%x@mail.example.com>\n"
+		"Content-Type: text/plain; charset=utf-8\n",
+		seq % 10, seq % 7, seq, seq, seq * 2654435761U);
+}
+
+static void test_mail_cache_purge_compress(void)
+{
+	struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.compress_min_size = 32,
+		},
+	};
+	struct test_mail_cache_ctx ctx, ctx2;
+	struct mail_cache_view *cache_view;
+	uint32_t seq, messages_count = 500;
+
+	test_begin("mail cache purge compress");
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	for (seq = 1; seq <= messages_count; seq++) {
+		test_mail_cache_add_mail(&ctx, ctx.cache_field.idx,
+			test_mail_cache_purge_compress_value(seq));
+	}
+	/* too small to be compressed */
+	test_mail_cache_add_field(&ctx, 1, ctx.cache_field2.idx, "bar");
+	test_assert(test_mail_cache_compressed_count(&ctx, messages_count) == 0);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+
+	if (!mail_cache_compress_is_supported()) {
+		/* the setting is ignored */
+		test_expect_error_string("without zstd support");
+		test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+		test_expect_no_more_errors();
+		test_assert(ctx.cache->compress_dict->used == 0);
+		test_assert(test_mail_cache_compressed_count(&ctx, messages_count) == 0);
+		test_mail_cache_deinit(&ctx);
+		test_mail_index_delete();
+		test_end();
+		return;
+	}
+
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	test_assert(ctx.cache->compress_dict->used > 0);
+	test_assert(test_mail_cache_compressed_count(&ctx, messages_count) ==
+		    messages_count);
+
+	/* adding a new field rewrites the fields header, which must keep
+	   the dictionary */
+	test_mail_cache_add_field(&ctx, 2, ctx.cache_field3.idx, "baz");
+
+	/* another process can read the compressed fields */
+	test_mail_cache_init(test_mail_index_open(), &ctx2);
+	cache_view = mail_cache_view_open(ctx2.cache, ctx2.view);
+	for (seq = 1; seq <= messages_count; seq++) {
+		test_assert_idx(cache_equals(cache_view, seq,
+			ctx2.cache_field.idx,
+			test_mail_cache_purge_compress_value(seq)), seq);
+	}
+	test_assert(cache_equals(cache_view, 1, ctx2.cache_field2.idx, "bar"));
+	test_assert(cache_equals(cache_view, 2, ctx2.cache_field3.idx, "baz"));
+	test_assert(ctx2.cache->compress_dict->used ==
+		    ctx.cache->compress_dict->used);
+	mail_cache_view_close(&cache_view);
+	test_mail_cache_deinit(&ctx2);
+
+	/* purging again decompresses with the old dictionary and compresses
+	   with the new one */
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	test_assert(test_mail_cache_compressed_count(&ctx, messages_count) ==
+		    messages_count);
+
+	/* purging without compression writes the fields uncompressed */
+	ctx.index->optimization_set.cache.compress_min_size = 0;
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	test_assert(ctx.cache->compress_dict->used == 0);
+	test_assert(test_mail_cache_compressed_count(&ctx, messages_count) == 0);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(cache_equals(cache_view, messages_count,
+		ctx.cache_field.idx,
+		test_mail_cache_purge_compress_value(messages_count)));
+	mail_cache_view_close(&cache_view);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 static void test_mail_cache_purge_deadlines(void)
 {
 	static const uint32_t BASE_TIME = 1000;
@@ -1108,6 +1272,8 @@ int main(void)
 		test_mail_cache_update_need_purge_continued_records2,
 		test_mail_cache_update_need_purge_deleted_records,
 		test_mail_cache_update_need_purge_deleted_records2,
+		test_mail_cache_purge_background,
+		test_mail_cache_purge_compress,
 		test_mail_cache_purge_deadlines,
 		NULL
 	};
@@ -1,6 +1,7 @@
 /* Copyright (c) 2020 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
 #include "str.h"
 #include "write-full.h"
 #include "test-common.h"
@@ -749,6 +750,142 @@ static void test_mail_cache_size_corruption(void)
 	test_end();
 }
 
+static void test_mail_cache_lookup_headers_range(void)
+{
+	enum {
+		TEST_FIELD_HEADER1,
+		TEST_FIELD_HEADER2,
+	};
+	struct mail_cache_field cache_fields[] = {
+		{
+			.name = "header1",
+			.type = MAIL_CACHE_FIELD_HEADER,
+			.decision = MAIL_CACHE_DECISION_YES,
+		},
+		{
+			.name = "header2",
+			.type = MAIL_CACHE_FIELD_HEADER,
+			.decision = MAIL_CACHE_DECISION_YES,
+		},
+	};
+	unsigned int lookup_header_fields[2];
+	struct test_mail_cache_ctx ctx;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	struct mail_cache_headers_result *results;
+	pool_t pool;
+	string_t *str = t_str_new(64);
+	uint32_t seq, count = 20;
+
+	test_begin("mail cache lookup headers range");
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	mail_cache_register_fields(ctx.cache, cache_fields,
+				   N_ELEMENTS(cache_fields),
+				   unsafe_data_stack_pool);
+	lookup_header_fields[0] = cache_fields[TEST_FIELD_HEADER2].idx;
+	lookup_header_fields[1] = cache_fields[TEST_FIELD_HEADER1].idx;
+	for (seq = 1; seq <= count; seq++)
+		test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+
+	/* add the headers in reverse order, so the cache file offsets are
+	   in a different order than the sequences. Leave header2 missing
+	   from some of the mails. */
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	for (seq = count; seq > 0; seq--) {
+		struct test_header_data header_data1 = {
+			.line1 = 15,
+			.line2 = 30,
+		};
+		struct test_header_data header_data2 = {
+			.line1 = 10,
+			.line2 = 20,
+		};
+		memcpy(header_data1.headers, t_strdup_printf(
+			"f%02u\nb%02u\n", seq, seq), sizeof(header_data1.headers));
+		memcpy(header_data2.headers, t_strdup_printf(
+			"1%02u\n4%02u\n", seq, seq), sizeof(header_data2.headers));
+
+		trans = mail_index_transaction_begin(ctx.view, 0);
+		cache_trans = mail_cache_get_transaction(cache_view, trans);
+		mail_cache_add(cache_trans, seq,
+			       cache_fields[TEST_FIELD_HEADER1].idx,
+			       &header_data1, sizeof(header_data1));
+		if (seq % 5 != 0) {
+			mail_cache_add(cache_trans, seq,
+				       cache_fields[TEST_FIELD_HEADER2].idx,
+				       &header_data2, sizeof(header_data2));
+		}
+		test_assert(mail_index_transaction_commit(&trans) == 0);
+	}
+	test_mail_cache_view_sync(&ctx);
+
+	pool = pool_alloconly_create(MEMPOOL_GROWING"test headers range", 1024);
+
+	/* the caching decisions are updated only for the used results */
+	ioloop_time = 1000000;
+	for (unsigned int i = 0; i < N_ELEMENTS(cache_fields); i++)
+		ctx.cache->fields[cache_fields[i].idx].field.last_used = 0;
+	test_assert(mail_cache_lookup_headers_range(cache_view, 2, count,
+		lookup_header_fields, N_ELEMENTS(lookup_header_fields),
+		pool, &results) == 0);
+	for (unsigned int i = 0; i < N_ELEMENTS(cache_fields); i++) {
+		test_assert_idx(ctx.cache->fields[cache_fields[i].idx].
+				field.last_used == 0, i);
+	}
+	mail_cache_lookup_headers_range_used(cache_view, 2,
+		lookup_header_fields, N_ELEMENTS(lookup_header_fields));
+	for (unsigned int i = 0; i < N_ELEMENTS(cache_fields); i++) {
+		test_assert_idx(ctx.cache->fields[cache_fields[i].idx].
+				field.last_used == ioloop_time, i);
+	}
+	p_clear(pool);
+
+	/* the results must be the same as with single lookups */
+	test_assert(mail_cache_lookup_headers_range(cache_view, 2, count,
+		lookup_header_fields, N_ELEMENTS(lookup_header_fields),
+		pool, &results) == 0);
+	for (seq = 2; seq <= count; seq++) {
+		const struct mail_cache_headers_result *result =
+			&results[seq - 2];
+
+		str_truncate(str, 0);
+		test_assert_idx(mail_cache_lookup_headers(cache_view, str, seq,
+			lookup_header_fields, N_ELEMENTS(lookup_header_fields)) ==
+			(seq % 5 != 0 ? 1 : 0), seq);
+		test_assert_idx(result->found == (seq % 5 != 0), seq);
+		if (result->found) {
+			test_assert_idx(result->size == str_len(str) &&
+				memcmp(result->data, str_data(str),
+				       str_len(str)) == 0, seq);
+			test_assert_strcmp_idx(str_c(str), t_strdup_printf(
+				"1%02u\nf%02u\n4%02u\nb%02u\n",
+				seq, seq, seq, seq), seq);
+		}
+	}
+
+	/* only header1 exists for all of them */
+	test_assert(mail_cache_lookup_headers_range(cache_view, 1, count,
+		&cache_fields[TEST_FIELD_HEADER1].idx, 1, pool, &results) == 0);
+	for (seq = 1; seq <= count; seq++) {
+		test_assert_idx(results[seq - 1].found &&
+			results[seq - 1].size == 8 &&
+			memcmp(results[seq - 1].data, t_strdup_printf(
+				"f%02u\nb%02u\n", seq, seq), 8) == 0, seq);
+	}
+
+	/* no fields */
+	test_assert(mail_cache_lookup_headers_range(cache_view, 1, 1,
+		NULL, 0, pool, &results) == 0);
+	test_assert(results[0].found && results[0].size == 0);
+
+	pool_unref(&pool);
+	mail_cache_view_close(&cache_view);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 static void test_mail_cache_duplicate_fields(void)
 {
 	enum {
@@ -820,6 +957,7 @@ int main(void)
 		test_mail_cache_in_memory,
 		test_mail_cache_size_corruption,
 		test_mail_cache_duplicate_fields,
+		test_mail_cache_lookup_headers_range,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,135 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "test-common.h"
+#include "test-mail-index.h"
+#include "mail-index-alloc-cache.h"
+
+#include <sys/stat.h>
+
+#define TEST_INDEX_COUNT 8
+
+static const char *test_index_dir(unsigned int i)
+{
+	return t_strdup_printf(TESTDIR_NAME"/box%u", i);
+}
+
+static struct mail_index *test_index_get(unsigned int i)
+{
+	struct mail_index *index;
+
+	index = mail_index_alloc_cache_get(NULL, NULL, test_index_dir(i),
+					   "test.dovecot.index");
+	test_assert_idx(mail_index_open_or_create(index,
+		MAIL_INDEX_OPEN_FLAG_CREATE) == 0, i);
+	return index;
+}
+
+static void test_index_use(unsigned int i)
+{
+	struct mail_index *index = test_index_get(i);
+
+	mail_index_close(index);
+	mail_index_alloc_cache_unref(&index);
+}
+
+static bool test_index_is_cached(unsigned int i)
+{
+	return mail_index_alloc_cache_find(test_index_dir(i)) != NULL;
+}
+
+static void test_mail_index_alloc_cache_lru(void)
+{
+	struct mail_index_alloc_cache_settings set = {
+		.max_count = 3,
+	};
+	struct ioloop *ioloop;
+	struct mail_index *index, *index2;
+	unsigned int i;
+
+	test_begin("mail index alloc cache lru");
+	ioloop = io_loop_create();
+	mail_index_alloc_cache_set_settings(&set);
+	test_mail_index_delete();
+	if (mkdir(TESTDIR_NAME, 0700) < 0)
+		i_error("mkdir(%s) failed: %m", TESTDIR_NAME);
+	for (i = 1; i <= TEST_INDEX_COUNT; i++) {
+		if (mkdir(test_index_dir(i), 0700) < 0)
+			i_error("mkdir(%s) failed: %m", test_index_dir(i));
+	}
+
+	/* only the 3 most recently used are kept */
+	for (i = 1; i <= 5; i++)
+		test_index_use(i);
+	for (i = 1; i <= 5; i++)
+		test_assert_idx(test_index_is_cached(i) == (i >= 3), i);
+
+	/* reusing an index makes it the most recently used */
+	index = mail_index_alloc_cache_find(test_index_dir(3));
+	index2 = test_index_get(3);
+	test_assert(index == index2);
+	mail_index_close(index2);
+	mail_index_alloc_cache_unref(&index2);
+	test_index_use(6);
+	test_assert(!test_index_is_cached(4));
+	test_assert(test_index_is_cached(3));
+	test_assert(test_index_is_cached(5));
+	test_assert(test_index_is_cached(6));
+
+	/* indexes in use don't count towards the limits */
+	index = test_index_get(1);
+	test_index_use(7);
+	test_assert(test_index_is_cached(1));
+	test_assert(test_index_is_cached(3));
+	test_assert(!test_index_is_cached(5));
+	test_assert(test_index_is_cached(6));
+	test_assert(test_index_is_cached(7));
+	mail_index_close(index);
+	mail_index_alloc_cache_unref(&index);
+	test_assert(test_index_is_cached(1));
+	test_assert(!test_index_is_cached(3));
+
+	/* memory budget that no index fits into */
+	set.max_size = 1;
+	mail_index_alloc_cache_set_settings(&set);
+	test_index_use(8);
+	for (i = 1; i <= TEST_INDEX_COUNT; i++)
+		test_assert_idx(!test_index_is_cached(i), i);
+
+	/* unlimited memory again */
+	set.max_size = 0;
+	mail_index_alloc_cache_set_settings(&set);
+	test_index_use(8);
+	test_assert(test_index_is_cached(8));
+
+	/* expire by time */
+	ioloop_time += 11;
+	test_index_use(2);
+	test_assert(test_index_is_cached(2));
+	test_assert(!test_index_is_cached(8));
+
+	/* max_count=0 disables caching */
+	set.max_count = 0;
+	mail_index_alloc_cache_set_settings(&set);
+	test_index_use(3);
+	test_assert(!test_index_is_cached(3));
+	test_assert(!test_index_is_cached(2));
+
+	set.max_count = 3;
+	mail_index_alloc_cache_set_settings(&set);
+	test_index_use(2);
+	mail_index_alloc_cache_destroy_unrefed();
+	test_assert(!test_index_is_cached(2));
+	io_loop_destroy(&ioloop);
+	test_mail_index_delete();
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_mail_index_alloc_cache_lru,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -0,0 +1,223 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "seq-range-array.h"
+#include "test-common.h"
+#include "mail-index-bitmap.h"
+
+/* spans a few chunks, the last one partially */
+#define TEST_BITMAP_COUNT (65536 * 3 + 1000)
+
+static void
+test_bitmap_check(const struct mail_index_bitmap *bitmap, const bool *bits,
+		  uint32_t count)
+{
+	unsigned int i, set_count = 0;
+	uint32_t idx, expected;
+	bool set;
+
+	for (idx = 0; idx < count; idx++) {
+		if (bits[idx])
+			set_count++;
+		if (mail_index_bitmap_is_set(bitmap, idx) != bits[idx]) {
+			test_assert_idx(FALSE, idx);
+			break;
+		}
+	}
+	test_assert(mail_index_bitmap_count(bitmap) == set_count);
+
+	/* iterate through all the set bits */
+	expected = 0;
+	idx = mail_index_bitmap_find(bitmap, 0, count, TRUE);
+	for (;;) {
+		while (expected < count && !bits[expected])
+			expected++;
+		if (idx != expected) {
+			test_assert_idx(idx == expected, expected);
+			break;
+		}
+		if (idx == count)
+			break;
+		expected++;
+		idx = mail_index_bitmap_find(bitmap, idx + 1, count, TRUE);
+	}
+
+	for (i = 0; i < 1000; i++) {
+		idx = i_rand_limit(count);
+		set = i_rand_limit(2) == 0;
+		for (expected = idx; expected < count; expected++) {
+			if (bits[expected] == set)
+				break;
+		}
+		test_assert_idx(mail_index_bitmap_find(bitmap, idx, count,
+						       set) == expected, idx);
+	}
+}
+
+static void test_mail_index_bitmap_random(void)
+{
+	struct mail_index_bitmap *bitmap, *bitmap2;
+	ARRAY_TYPE(seq_range) expunges;
+	const struct seq_range *range;
+	bool *bits, *bits2;
+	unsigned int i, range_count, density;
+	uint32_t idx, idx1, idx2, count = TEST_BITMAP_COUNT;
+
+	test_begin("mail index bitmap random");
+	bitmap = mail_index_bitmap_init();
+	bits = i_new(bool, TEST_BITMAP_COUNT);
+	test_bitmap_check(bitmap, bits, count);
+
+	/* a different density for each chunk, so some of them are sparse and
+	   some get converted to bitsets */
+	for (idx = 0; idx < count; idx++) {
+		density = (idx >> 16) % 3 == 0 ? 1000 :
+			(idx >> 16) % 3 == 1 ? 10 : 2;
+		if (i_rand_limit(density) == 0) {
+			mail_index_bitmap_set(bitmap, idx, TRUE);
+			bits[idx] = TRUE;
+		}
+	}
+	test_bitmap_check(bitmap, bits, count);
+
+	/* unset most of the bits in the dense chunks */
+	for (idx = 0; idx < count; idx++) {
+		if (bits[idx] && i_rand_limit(10) != 0) {
+			mail_index_bitmap_set(bitmap, idx, FALSE);
+			bits[idx] = FALSE;
+		}
+	}
+	test_bitmap_check(bitmap, bits, count);
+
+	/* ranges, including full chunks */
+	for (i = 0; i < 50; i++) {
+		idx1 = i_rand_limit(count);
+		idx2 = idx1 + i_rand_limit(i < 5 ? 200000 : 1000);
+		idx2 = I_MIN(idx2, count - 1);
+		mail_index_bitmap_set_range(bitmap, idx1, idx2, i % 2 == 0);
+		for (idx = idx1; idx <= idx2; idx++)
+			bits[idx] = i % 2 == 0;
+	}
+	test_bitmap_check(bitmap, bits, count);
+
+	/* duplicates are independent */
+	bitmap2 = mail_index_bitmap_dup(bitmap);
+	bits2 = i_new(bool, TEST_BITMAP_COUNT);
+	memcpy(bits2, bits, sizeof(bool) * count);
+	mail_index_bitmap_set_range(bitmap2, 0, count - 1, FALSE);
+	test_bitmap_check(bitmap, bits, count);
+	test_assert(mail_index_bitmap_count(bitmap2) == 0);
+	mail_index_bitmap_free(&bitmap2);
+	i_free(bits2);
+
+	/* expunge */
+	t_array_init(&expunges, 64);
+	for (i = 0; i < 200; i++) {
+		idx1 = i_rand_minmax(1, count);
+		idx2 = idx1 + i_rand_limit(i < 3 ? 70000 : 20);
+		seq_range_array_add_range(&expunges, idx1, I_MIN(idx2, count));
+	}
+	range = array_get(&expunges, &range_count);
+	mail_index_bitmap_expunge(bitmap, range, range_count);
+	for (i = range_count; i > 0; i--) {
+		idx1 = range[i-1].seq1 - 1;
+		idx2 = range[i-1].seq2;
+		memmove(bits + idx1, bits + idx2, count - idx2);
+		count -= idx2 - idx1;
+	}
+	test_bitmap_check(bitmap, bits, count);
+
+	/* truncate in the middle of a chunk and at a chunk boundary */
+	count = I_MIN(count, 65536 + 1234);
+	mail_index_bitmap_truncate(bitmap, count);
+	test_bitmap_check(bitmap, bits, count);
+	memset(bits + count, 0, TEST_BITMAP_COUNT - count);
+	test_bitmap_check(bitmap, bits, TEST_BITMAP_COUNT);
+	mail_index_bitmap_truncate(bitmap, 65536);
+	memset(bits + 65536, 0, TEST_BITMAP_COUNT - 65536);
+	test_bitmap_check(bitmap, bits, TEST_BITMAP_COUNT);
+
+	mail_index_bitmap_free(&bitmap);
+	i_free(bits);
+	test_end();
+}
+
+static void test_mail_index_bitmap_full_chunks(void)
+{
+	struct mail_index_bitmap *bitmap;
+
+	test_begin("mail index bitmap full chunks");
+	bitmap = mail_index_bitmap_init();
+	mail_index_bitmap_set_range(bitmap, 0, 65536 * 2 - 1, TRUE);
+	test_assert(mail_index_bitmap_count(bitmap) == 65536 * 2);
+	test_assert(mail_index_bitmap_find(bitmap, 0, 65536 * 3, FALSE) ==
+		    65536 * 2);
+	test_assert(mail_index_bitmap_find(bitmap, 0, 1000, FALSE) == 1000);
+
+	mail_index_bitmap_set(bitmap, 65536 + 5, FALSE);
+	test_assert(mail_index_bitmap_find(bitmap, 10, 65536 * 3, FALSE) ==
+		    65536 + 5);
+	test_assert(mail_index_bitmap_find(bitmap, 65536 + 5, 65536 * 3,
+					   TRUE) == 65536 + 6);
+
+	mail_index_bitmap_set_range(bitmap, 0, 65536 * 2 - 1, FALSE);
+	test_assert(mail_index_bitmap_count(bitmap) == 0);
+	test_assert(mail_index_bitmap_find(bitmap, 0, 65536 * 3, TRUE) ==
+		    65536 * 3);
+	mail_index_bitmap_free(&bitmap);
+	test_end();
+}
+
+static void test_mail_index_bitmap_scan(void)
+{
+	/* offsets around the word and the scanned word group boundaries */
+	static const unsigned int offsets[] = {
+		0, 1, 63, 64, 127, 128, 511, 512, 513, 1000, 4095, 4096,
+		65535 - 512, 65534, 65535
+	};
+	struct mail_index_bitmap *bitmap;
+	unsigned int i, j, offset;
+
+	test_begin("mail index bitmap scan");
+	for (i = 0; i < N_ELEMENTS(offsets); i++) {
+		offset = offsets[i];
+
+		/* a single unset bit in a full chunk */
+		bitmap = mail_index_bitmap_init();
+		mail_index_bitmap_set_range(bitmap, 0, 65535 - 1, TRUE);
+		mail_index_bitmap_set(bitmap, 65535, TRUE);
+		mail_index_bitmap_set(bitmap, offset, FALSE);
+		for (j = 0; j <= i; j++) {
+			test_assert_idx(mail_index_bitmap_find(bitmap,
+				offsets[j], 65536, FALSE) == offset, i);
+		}
+		if (offset < 65535) {
+			test_assert_idx(mail_index_bitmap_find(bitmap,
+				offset + 1, 65536, FALSE) == 65536, i);
+		}
+		mail_index_bitmap_free(&bitmap);
+
+		/* the first set bit in a dense area */
+		bitmap = mail_index_bitmap_init();
+		mail_index_bitmap_set_range(bitmap, 65536 + offset,
+			65536 + I_MIN(offset + 4999, 65535), TRUE);
+		test_assert_idx(mail_index_bitmap_find(bitmap, 0, 65536 * 2,
+			TRUE) == 65536 + offset, i);
+		test_assert_idx(mail_index_bitmap_find(bitmap, 65536, 65536 * 2,
+			TRUE) == 65536 + offset, i);
+		mail_index_bitmap_free(&bitmap);
+	}
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_mail_index_bitmap_random,
+		test_mail_index_bitmap_full_chunks,
+		test_mail_index_bitmap_scan,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -2,19 +2,28 @@
 
 #include "lib.h"
 #include "array.h"
+#include "time-util.h"
 #include "test-common.h"
 #include "mail-index-private.h"
 #include "mail-index-modseq.h"
 #include "mail-index-transaction-private.h"
 
-static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_count)
+#include <stdio.h>
+
+static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_count,
+							bool columns)
 {
+	struct mail_index index;
 	struct mail_index_record_map rec_map;
 	struct mail_index_map map;
 	uint32_t seq, first_uid, last_uid, first_seq, last_seq, max_uid;
 
+	i_zero(&index);
 	i_zero(&map);
 	i_zero(&rec_map);
+	index.optimization_set.index.columns_min_messages =
+		columns ? 1 : UINT_MAX;
+	map.index = &index;
 	map.rec_map = &rec_map;
 	map.hdr.messages_count = messages_count;
 	map.hdr.record_size = sizeof(struct mail_index_record);
@@ -22,7 +31,7 @@ static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_cou
 	rec_map.records = i_new(struct mail_index_record, map.hdr.messages_count);
 
 	for (seq = 1; seq <= map.hdr.messages_count; seq++)
-		MAIL_INDEX_REC_AT_SEQ(&map, seq)->uid = seq*2;
+		MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(&map, seq)->uid = seq*2;
 	max_uid = (seq-1)*2;
 	map.hdr.next_uid = max_uid + 1;
 
@@ -34,6 +43,9 @@ static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_cou
 			test_assert((first_uid+1)/2 == first_seq && last_uid/2 == last_seq);
 		}
 	}
+	test_assert((rec_map.columns != NULL) == columns);
+	if (rec_map.columns != NULL)
+		mail_index_map_columns_free(&rec_map.columns);
 	i_free(rec_map.records);
 }
 
@@ -43,15 +55,481 @@ static void test_mail_index_map_lookup_seq_range(void)
 
 	test_begin("mail index map lookup seq range");
 	for (i = 1; i < 20; i++)
-		test_mail_index_map_lookup_seq_range_count(i);
+		test_mail_index_map_lookup_seq_range_count(i, FALSE);
+	test_end();
+
+	test_begin("mail index map lookup seq range with columns");
+	for (i = 1; i < 20; i++)
+		test_mail_index_map_lookup_seq_range_count(i, TRUE);
 	test_end();
 }
 
-int main(void)
+static uint32_t
+test_find_flags_slow(struct mail_index_map *map, uint32_t seq,
+		     uint8_t flags, uint8_t flags_mask)
+{
+	for (; seq <= map->hdr.messages_count; seq++) {
+		if ((MAIL_INDEX_REC_AT_SEQ(map, seq)->flags & flags_mask) ==
+		    flags)
+			return seq;
+	}
+	return 0;
+}
+
+#define TEST_KEYWORDS_COUNT 20
+
+static uint32_t
+test_find_keyword_slow(struct mail_index_map *map, uint32_t seq,
+		       unsigned int keyword_idx, bool set)
+{
+	const struct mail_index_record *rec;
+	const unsigned char *data;
+
+	for (; seq <= map->hdr.messages_count; seq++) {
+		rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
+		data = CONST_PTR_OFFSET(rec, sizeof(struct mail_index_record));
+		if (((data[keyword_idx / CHAR_BIT] &
+		      (1 << (keyword_idx % CHAR_BIT))) != 0) == set)
+			return seq;
+	}
+	return 0;
+}
+
+static void
+test_mail_index_map_check_keywords(struct mail_index_map *map, uint32_t seq)
+{
+	struct mail_index *index = map->index;
+	unsigned int min_messages =
+		index->optimization_set.index.columns_min_messages;
+	unsigned int i;
+	uint32_t seq_r;
+	bool set;
+
+	for (i = 0; i < TEST_KEYWORDS_COUNT * 2; i++) {
+		set = i % 2 == 0;
+		seq_r = test_find_keyword_slow(map, seq, i / 2, set);
+		test_assert_idx(mail_index_map_find_keyword(map, seq, i / 2,
+							    set) == seq_r, seq);
+		/* the same without the columns */
+		index->optimization_set.index.columns_min_messages = UINT_MAX;
+		test_assert_idx(mail_index_map_find_keyword(map, seq, i / 2,
+							    set) == seq_r, seq);
+		index->optimization_set.index.columns_min_messages =
+			min_messages;
+	}
+	/* keyword that doesn't exist in the map */
+	test_assert(mail_index_map_find_keyword(map, seq,
+			TEST_KEYWORDS_COUNT, TRUE) == 0);
+	test_assert(mail_index_map_find_keyword(map, seq,
+			TEST_KEYWORDS_COUNT, FALSE) == seq);
+}
+
+static void
+test_mail_index_map_update_keyword(struct mail_index_map *map,
+				   unsigned int keyword_idx,
+				   uint32_t seq1, uint32_t seq2, bool set)
+{
+	struct mail_index_record *rec;
+	unsigned char *data;
+	uint32_t seq;
+
+	for (seq = seq1; seq <= seq2; seq++) {
+		rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(map, seq);
+		data = PTR_OFFSET(rec, sizeof(struct mail_index_record));
+		if (set)
+			data[keyword_idx / CHAR_BIT] |= 1 << (keyword_idx % CHAR_BIT);
+		else
+			data[keyword_idx / CHAR_BIT] &= ~(1 << (keyword_idx % CHAR_BIT));
+	}
+	mail_index_map_columns_update_keyword(map->rec_map, keyword_idx,
+					      seq1, seq2, set);
+}
+
+static void test_mail_index_map_check_columns(struct mail_index_map *map)
+{
+	static const uint8_t flag_tests[][2] = {
+		{ MAIL_SEEN, MAIL_SEEN },
+		{ 0, MAIL_SEEN },
+		{ MAIL_DELETED, MAIL_DELETED | MAIL_SEEN },
+		{ MAIL_FLAGGED | MAIL_ANSWERED, MAIL_FLAGGED | MAIL_ANSWERED },
+	};
+	const struct mail_index_map_columns *columns;
+	unsigned int i;
+	uint32_t seq;
+
+	for (seq = 1; seq <= map->hdr.messages_count; seq++) {
+		for (i = 0; i < N_ELEMENTS(flag_tests); i++) {
+			test_assert_idx(mail_index_map_find_flags(map, seq,
+					flag_tests[i][0], flag_tests[i][1]) ==
+				test_find_flags_slow(map, seq,
+					flag_tests[i][0], flag_tests[i][1]), seq);
+		}
+		test_mail_index_map_check_keywords(map, seq);
+	}
+	columns = mail_index_map_get_columns(map);
+	test_assert(columns != NULL);
+	for (seq = 1; columns != NULL && seq <= map->hdr.messages_count; seq++) {
+		test_assert_idx(mail_index_map_columns_get_uid(columns, seq-1) ==
+				MAIL_INDEX_REC_AT_SEQ(map, seq)->uid, seq);
+	}
+}
+
+static void test_mail_index_map_columns(void)
+{
+#define TEST_COLUMNS_COUNT 200
+	struct mail_index index;
+	struct mail_index_record_map rec_map;
+	struct mail_index_map map;
+	struct mail_index_record *rec;
+	struct mail_index_ext *ext;
+	ARRAY_TYPE(seq_range) expunges;
+	const struct seq_range *range;
+	unsigned int i, j, count, rec_count;
+	uint32_t seq, seq1, seq2;
+
+	test_begin("mail index map columns");
+	i_zero(&index);
+	i_zero(&map);
+	i_zero(&rec_map);
+	index.optimization_set.index.columns_min_messages = 1;
+	map.index = &index;
+	map.rec_map = &rec_map;
+	map.hdr.record_size = sizeof(struct mail_index_record) + 12;
+	map.hdr.messages_count = TEST_COLUMNS_COUNT;
+	rec_map.records_count = map.hdr.messages_count;
+	rec_map.records = i_malloc(map.hdr.record_size * TEST_COLUMNS_COUNT);
+
+	/* keywords are in the 4 bytes after the base record. The map's
+	   keyword indexes are the same as the index's. */
+	t_array_init(&map.extensions, 1);
+	ext = array_append_space(&map.extensions);
+	ext->name = MAIL_INDEX_EXT_KEYWORDS;
+	ext->record_offset = sizeof(struct mail_index_record);
+	ext->record_size = 4;
+	t_array_init(&map.keyword_idx_map, TEST_KEYWORDS_COUNT);
+	for (i = 0; i < TEST_KEYWORDS_COUNT; i++)
+		array_push_back(&map.keyword_idx_map, &i);
+
+	for (seq = 1; seq <= map.hdr.messages_count; seq++) {
+		rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(&map, seq);
+		rec->uid = seq * 3;
+		rec->flags = i_rand_limit(MAIL_FLAGS_MASK + 1);
+		/* keyword 0 in all messages, keyword 1 in none */
+		*(uint32_t *)PTR_OFFSET(rec, ext->record_offset) =
+			(i_rand_limit(1U << TEST_KEYWORDS_COUNT) & ~2U) | 1;
+	}
+	test_mail_index_map_check_columns(&map);
+
+	/* update flags the same way as syncing does */
+	for (i = 0; i < 50; i++) {
+		uint8_t add_flags = i_rand_limit(MAIL_FLAGS_MASK + 1);
+		uint8_t remove_flags = i_rand_limit(MAIL_FLAGS_MASK + 1) &
+			~add_flags;
+
+		seq1 = i_rand_minmax(1, map.hdr.messages_count);
+		seq2 = i_rand_minmax(seq1, map.hdr.messages_count);
+
+		for (seq = seq1; seq <= seq2; seq++) {
+			rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(&map, seq);
+			rec->flags = (rec->flags & ~remove_flags) | add_flags;
+		}
+		mail_index_map_columns_update_flags(&rec_map, seq1, seq2,
+						    add_flags, remove_flags);
+	}
+	test_mail_index_map_check_columns(&map);
+
+	/* update keywords the same way as syncing does */
+	for (i = 0; i < 50; i++) {
+		seq1 = i_rand_minmax(1, map.hdr.messages_count);
+		seq2 = i_rand_minmax(seq1, map.hdr.messages_count);
+		test_mail_index_map_update_keyword(&map,
+			i_rand_limit(TEST_KEYWORDS_COUNT), seq1, seq2,
+			i_rand_limit(2) == 0);
+	}
+	seq1 = i_rand_minmax(1, map.hdr.messages_count);
+	seq2 = i_rand_minmax(seq1, map.hdr.messages_count);
+	for (seq = seq1; seq <= seq2; seq++) {
+		rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(&map, seq);
+		memset(PTR_OFFSET(rec, ext->record_offset), 0, ext->record_size);
+	}
+	mail_index_map_columns_reset_keywords(&rec_map, seq1, seq2);
+	test_mail_index_map_check_columns(&map);
+
+	/* expunge some messages */
+	t_array_init(&expunges, 16);
+	for (i = 0; i < 20; i++) {
+		seq1 = i_rand_minmax(1, map.hdr.messages_count);
+		seq2 = seq1 + i_rand_limit(3);
+		seq_range_array_add_range(&expunges, seq1,
+			I_MIN(seq2, map.hdr.messages_count));
+	}
+	range = array_get(&expunges, &count);
+	for (i = count; i > 0; i--) {
+		for (j = range[i-1].seq2; j >= range[i-1].seq1; j--) {
+			rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(&map, j);
+			rec_count = map.hdr.messages_count - j;
+			memmove(rec, PTR_OFFSET(rec, map.hdr.record_size),
+				rec_count * map.hdr.record_size);
+			map.hdr.messages_count--;
+		}
+	}
+	rec_map.records_count = map.hdr.messages_count;
+	mail_index_map_columns_expunge(&rec_map, range, count);
+	test_mail_index_map_check_columns(&map);
+
+	/* append more records */
+	rec_map.records = i_realloc(rec_map.records,
+				    map.hdr.record_size * TEST_COLUMNS_COUNT,
+				    map.hdr.record_size *
+				    (map.hdr.messages_count + 10));
+	for (i = 0; i < 10; i++) {
+		rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(&map,
+						       ++map.hdr.messages_count);
+		rec->uid = TEST_COLUMNS_COUNT * 3 + i + 1;
+		rec->flags = MAIL_DELETED;
+		*(uint32_t *)PTR_OFFSET(rec, ext->record_offset) = 2;
+	}
+	rec_map.records_count = map.hdr.messages_count;
+	test_mail_index_map_check_columns(&map);
+
+	/* truncate */
+	map.hdr.messages_count = rec_map.records_count = 5;
+	mail_index_map_columns_truncate(&rec_map, 5);
+	test_mail_index_map_check_columns(&map);
+
+	mail_index_map_columns_free(&rec_map.columns);
+	i_free(rec_map.records);
+	test_end();
+}
+
+static struct mail_index_map *
+test_mail_index_map_create(struct mail_index *index, unsigned int count)
+{
+	struct mail_index_map *map;
+	struct mail_index_record *rec;
+	unsigned int i;
+
+	map = mail_index_map_alloc(index);
+	for (i = 0; i < count; i++) {
+		rec = mail_index_map_append_record(map);
+		rec->uid = i + 1;
+		map->rec_map->records_count++;
+		map->hdr.messages_count++;
+	}
+	map->hdr.next_uid = count + 1;
+	return map;
+}
+
+static void test_mail_index_map_cow_pages(void)
+{
+#define TEST_COW_COUNT (MAIL_INDEX_RECORD_PAGE_COUNT * 3 + 10)
+	struct mail_index index;
+	struct mail_index_map *map, *map2;
+	struct mail_index_record_map *rec_map;
+	struct mail_index_record *rec;
+	unsigned int i, count;
+	uint32_t seq, seq2;
+
+	test_begin("mail index map copy-on-write pages");
+	i_zero(&index);
+	index.optimization_set.index.columns_min_messages = UINT_MAX;
+	map = test_mail_index_map_create(&index, TEST_COW_COUNT);
+	rec_map = map->rec_map;
+	test_assert(rec_map->records == NULL);
+	test_assert(rec_map->pages_count == 4);
+
+	/* cloning shares all the pages */
+	map2 = mail_index_map_clone(map);
+	mail_index_record_map_move_to_private(map2);
+	test_assert(map2->rec_map != rec_map);
+	test_assert(map2->rec_map->pages_count == 4);
+	for (i = 0; i < rec_map->pages_count; i++) {
+		test_assert_idx(map2->rec_map->pages[i] == rec_map->pages[i], i);
+		test_assert_idx(rec_map->pages[i]->refcount == 2, i);
+	}
+
+	/* modifying a record copies only its page */
+	seq = MAIL_INDEX_RECORD_PAGE_COUNT + 5;
+	MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(map2, seq)->flags = MAIL_SEEN;
+	test_assert(map2->rec_map->pages[1] != rec_map->pages[1]);
+	test_assert(rec_map->pages[1]->refcount == 1);
+	test_assert(map2->rec_map->pages[1]->refcount == 1);
+	for (i = 0; i < rec_map->pages_count; i++) {
+		if (i != 1)
+			test_assert_idx(rec_map->pages[i]->refcount == 2, i);
+	}
+	test_assert(MAIL_INDEX_REC_AT_SEQ(map, seq)->flags == 0);
+	test_assert(MAIL_INDEX_REC_AT_SEQ(map2, seq)->flags == MAIL_SEEN);
+	test_assert(MAIL_INDEX_REC_AT_SEQ(map2, seq)->uid == seq);
+
+	/* appending to a shared last page copies it */
+	rec = mail_index_map_append_record(map2);
+	rec->uid = TEST_COW_COUNT + 1;
+	map2->rec_map->records_count++;
+	map2->hdr.messages_count++;
+	test_assert(map2->rec_map->pages[3] != rec_map->pages[3]);
+	test_assert(rec_map->pages[3]->refcount == 1);
+	test_assert(map2->rec_map->pages[0] == rec_map->pages[0]);
+
+	/* expunge the last 3 records of the first page and the first 2
+	   records of the second page, so records move across pages */
+	seq = MAIL_INDEX_RECORD_PAGE_COUNT - 2;
+	count = map2->rec_map->records_count;
+	mail_index_map_move_records(map2, seq - 1, seq + 4, count - (seq + 4));
+	map2->rec_map->records_count -= 5;
+	map2->hdr.messages_count -= 5;
+	mail_index_record_map_truncate_pages(map2->rec_map);
+	test_assert(map2->rec_map->pages_count == 4);
+	test_assert(map2->rec_map->pages[0] != rec_map->pages[0]);
+	for (seq2 = 1; seq2 <= map2->hdr.messages_count; seq2++) {
+		rec = MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(map2, seq2);
+		test_assert_idx(rec->uid == (seq2 < seq ? seq2 : seq2 + 5),
+				seq2);
+		test_assert_idx((rec->flags == MAIL_SEEN) ==
+				(rec->uid == MAIL_INDEX_RECORD_PAGE_COUNT + 5),
+				seq2);
+	}
+
+	/* the original map didn't change */
+	test_assert(rec_map->records_count == TEST_COW_COUNT);
+	for (seq2 = 1; seq2 <= map->hdr.messages_count; seq2++) {
+		test_assert_idx(MAIL_INDEX_REC_AT_SEQ(map, seq2)->uid == seq2,
+				seq2);
+		test_assert_idx(MAIL_INDEX_REC_AT_SEQ(map, seq2)->flags == 0,
+				seq2);
+	}
+
+	/* truncating drops the unused pages */
+	map2->rec_map->records_count = map2->hdr.messages_count =
+		MAIL_INDEX_RECORD_PAGE_COUNT;
+	mail_index_record_map_truncate_pages(map2->rec_map);
+	test_assert(map2->rec_map->pages_count == 1);
+
+	mail_index_unmap(&map2);
+	for (i = 0; i < rec_map->pages_count; i++)
+		test_assert_idx(rec_map->pages[i]->refcount == 1, i);
+	mail_index_unmap(&map);
+	test_end();
+}
+
+static void test_mail_index_map_check_uid_column(struct mail_index_map *map)
+{
+	const struct mail_index_map_columns *columns;
+	uint32_t seq;
+
+	columns = mail_index_map_get_columns(map);
+	test_assert(columns != NULL);
+	for (seq = 1; columns != NULL && seq <= map->hdr.messages_count; seq++) {
+		test_assert_idx(mail_index_map_columns_get_uid(columns, seq-1) ==
+				MAIL_INDEX_REC_AT_SEQ(map, seq)->uid, seq);
+	}
+}
+
+static void test_mail_index_map_cow_columns(void)
+{
+#define TEST_COW_COLUMNS_COUNT (65536 * 2 + 10)
+	struct mail_index index;
+	struct mail_index_map *map, *map2;
+	struct seq_range range;
+	uint32_t seq;
+
+	test_begin("mail index map copy-on-write columns");
+	i_zero(&index);
+	index.optimization_set.index.columns_min_messages = 1;
+	map = test_mail_index_map_create(&index, TEST_COW_COLUMNS_COUNT);
+	for (seq = 1; seq <= map->hdr.messages_count; seq++)
+		MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(map, seq)->flags = MAIL_SEEN;
+	test_assert(mail_index_map_get_columns(map) != NULL);
+	test_assert(mail_index_map_find_flags(map, 1, 0, MAIL_SEEN) == 0);
+
+	map2 = mail_index_map_clone(map);
+	mail_index_record_map_move_to_private(map2);
+	test_assert(map2->rec_map != map->rec_map);
+	test_assert(map2->rec_map->columns != NULL);
+
+	/* flag change in the clone isn't visible in the original */
+	seq = 65536 + 5;
+	MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(map2, seq)->flags = 0;
+	mail_index_map_columns_update_flags(map2->rec_map, seq, seq,
+					    0, MAIL_SEEN);
+	test_assert(mail_index_map_find_flags(map2, 1, 0, MAIL_SEEN) == seq);
+	test_assert(mail_index_map_find_flags(map, 1, 0, MAIL_SEEN) == 0);
+
+	/* neither is an expunge */
+	range.seq1 = 10;
+	range.seq2 = 20;
+	mail_index_map_move_records(map2, range.seq1 - 1, range.seq2,
+				    map2->hdr.messages_count - range.seq2);
+	map2->rec_map->records_count -= 11;
+	map2->hdr.messages_count -= 11;
+	mail_index_record_map_truncate_pages(map2->rec_map);
+	mail_index_map_columns_expunge(map2->rec_map, &range, 1);
+	test_assert(mail_index_map_find_flags(map2, 1, 0, MAIL_SEEN) ==
+		    seq - 11);
+	test_mail_index_map_check_uid_column(map2);
+	test_mail_index_map_check_uid_column(map);
+
+	mail_index_unmap(&map2);
+	test_mail_index_map_check_uid_column(map);
+	test_assert(mail_index_map_find_flags(map, 1, 0, MAIL_SEEN) == 0);
+	mail_index_unmap(&map);
+	test_end();
+}
+
+static void test_mail_index_map_benchmark(unsigned int count)
+{
+	struct mail_index index;
+	struct mail_index_map *map, *map2;
+	struct timeval start, end;
+	unsigned int i, copied_pages = 0;
+	uint32_t seq = count / 2 + 1;
+
+	i_zero(&index);
+	/* the default */
+	index.optimization_set.index.columns_min_messages = 10000;
+	map = test_mail_index_map_create(&index, count);
+	/* searching builds the columns */
+	(void)mail_index_map_find_flags(map, 1, MAIL_SEEN, MAIL_SEEN);
+
+	/* the same as what happens when a flag change is synced to a map
+	   whose rec_map is shared with another view */
+	i_gettimeofday(&start);
+	map2 = mail_index_map_clone(map);
+	mail_index_record_map_move_to_private(map2);
+	MAIL_INDEX_REC_AT_SEQ_MODIFIABLE(map2, seq)->flags |= MAIL_SEEN;
+	mail_index_map_columns_update_flags(map2->rec_map, seq, seq,
+					    MAIL_SEEN, 0);
+	i_gettimeofday(&end);
+
+	for (i = 0; i < map2->rec_map->pages_count; i++) {
+		if (map2->rec_map->pages[i] != map->rec_map->pages[i])
+			copied_pages++;
+	}
+	printf("%u messages: private map with one flag change in %lld usecs, "
+	       "%u/%u pages copied\n", count, timeval_diff_usecs(&end, &start),
+	       copied_pages, map2->rec_map->pages_count);
+	mail_index_unmap(&map2);
+	mail_index_unmap(&map);
+}
+
+int main(int argc, char *argv[])
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_map_lookup_seq_range,
+		test_mail_index_map_columns,
+		test_mail_index_map_cow_pages,
+		test_mail_index_map_cow_columns,
 		NULL
 	};
+
+	if (argc >= 2 && strcmp(argv[1], "benchmark") == 0) {
+		/* test-mail-index-map benchmark [<messages count>] */
+		lib_init();
+		test_mail_index_map_benchmark(argc < 3 ? 1000000 :
+					      atoi(argv[2]));
+		lib_deinit();
+		return 0;
+	}
 	return test_run(test_functions);
 }
+
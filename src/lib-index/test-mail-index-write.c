@@ -67,6 +67,13 @@ int mail_index_move_to_memory(struct mail_index *index ATTR_UNUSED)
 	return -1;
 }
 
+const void *mail_index_map_get_records(struct mail_index_map *map ATTR_UNUSED,
+				       uint32_t idx ATTR_UNUSED,
+				       unsigned int *count_r ATTR_UNUSED)
+{
+	i_unreached();
+}
+
 int mail_transaction_log_rotate(struct mail_transaction_log *log, bool reset)
 {
 	i_assert(!reset);
@@ -158,11 +158,244 @@ static void test_mail_index_new_extension(void)
 	test_end();
 }
 
+static void
+test_mail_index_lookup_next_flags_check(struct mail_index_view *view,
+					enum mail_flags flags,
+					uint8_t flags_mask, bool exact)
+{
+	const struct mail_index_record *rec;
+	uint32_t seq, seq2, next_seq, count;
+
+	count = mail_index_view_get_messages_count(view);
+	for (seq = 1; seq <= count; seq++) {
+		mail_index_lookup_next_flags(view, seq, flags, flags_mask,
+					     &next_seq);
+		test_assert_idx(next_seq == 0 ||
+				(next_seq >= seq && next_seq <= count), seq);
+		/* none of the skipped messages can match */
+		for (seq2 = seq; seq2 <= count &&
+		     (next_seq == 0 || seq2 < next_seq); seq2++) {
+			rec = mail_index_lookup(view, seq2);
+			test_assert_idx((rec->flags & flags_mask) != flags, seq2);
+		}
+		if (next_seq != 0 && exact) {
+			rec = mail_index_lookup(view, next_seq);
+			test_assert_idx((rec->flags & flags_mask) == flags, seq);
+		}
+	}
+}
+
+static void test_mail_index_lookup_next_flags(void)
+{
+	struct mail_index_optimization_settings optimization_set = {
+		.index = { .columns_min_messages = 1 },
+	};
+	struct mail_index *index;
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view, *tview;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid, uid_validity = 1234;
+
+	test_begin("mail index lookup next flags");
+	index = test_mail_index_init();
+	mail_index_set_optimization_settings(index, &optimization_set);
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= 40; uid++) {
+		mail_index_append(trans, uid, &seq);
+		if (uid % 3 == 0)
+			mail_index_update_flags(trans, seq, MODIFY_ADD, MAIL_SEEN);
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &view,
+					  &trans, 0) == 1);
+	for (seq = 5; seq <= 10; seq++)
+		mail_index_expunge(trans, seq);
+	mail_index_update_flags_range(trans, 15, 20, MODIFY_ADD,
+				      MAIL_DELETED | MAIL_SEEN);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+
+	view = mail_index_view_open(index);
+	test_assert(mail_index_view_get_messages_count(view) == 34);
+	test_assert(view->map->rec_map->columns != NULL);
+	test_mail_index_lookup_next_flags_check(view, MAIL_SEEN, MAIL_SEEN, TRUE);
+	test_mail_index_lookup_next_flags_check(view, 0, MAIL_SEEN, TRUE);
+	test_mail_index_lookup_next_flags_check(view, MAIL_DELETED,
+						MAIL_DELETED, TRUE);
+
+	/* uncommitted changes in a transaction view */
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_flags(trans, 2, MODIFY_ADD, MAIL_DELETED);
+	mail_index_update_flags(trans, 30, MODIFY_REMOVE, MAIL_SEEN);
+	mail_index_append(trans, 41, &seq);
+	mail_index_append(trans, 42, &seq);
+	mail_index_update_flags(trans, seq, MODIFY_ADD, MAIL_DELETED);
+	tview = mail_index_transaction_open_updated_view(trans);
+	test_mail_index_lookup_next_flags_check(tview, MAIL_SEEN, MAIL_SEEN, FALSE);
+	test_mail_index_lookup_next_flags_check(tview, 0, MAIL_SEEN, FALSE);
+	test_mail_index_lookup_next_flags_check(tview, MAIL_DELETED,
+						MAIL_DELETED, FALSE);
+	mail_index_lookup_next_flags(tview, 36, MAIL_DELETED, MAIL_DELETED,
+				     &seq);
+	test_assert(seq == 36);
+	mail_index_view_close(&tview);
+	mail_index_transaction_rollback(&trans);
+
+	mail_index_view_close(&view);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static bool
+test_mail_index_has_keyword(struct mail_index_view *view, uint32_t seq,
+			    unsigned int keyword_idx)
+{
+	ARRAY_TYPE(keyword_indexes) keywords;
+	unsigned int idx;
+
+	t_array_init(&keywords, 4);
+	mail_index_lookup_keywords(view, seq, &keywords);
+	array_foreach_elem(&keywords, idx) {
+		if (idx == keyword_idx)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+test_mail_index_lookup_next_keyword_check_set(struct mail_index_view *view,
+					      unsigned int keyword_idx,
+					      bool set, bool exact)
+{
+	uint32_t seq, seq2, next_seq, count;
+
+	count = mail_index_view_get_messages_count(view);
+	for (seq = 1; seq <= count; seq++) {
+		mail_index_lookup_next_keyword(view, seq, keyword_idx, set,
+					       &next_seq);
+		test_assert_idx(next_seq == 0 ||
+				(next_seq >= seq && next_seq <= count), seq);
+		/* none of the skipped messages can match */
+		for (seq2 = seq; seq2 <= count &&
+		     (next_seq == 0 || seq2 < next_seq); seq2++) {
+			test_assert_idx(test_mail_index_has_keyword(view, seq2,
+						keyword_idx) != set, seq2);
+		}
+		if (next_seq != 0 && exact) {
+			test_assert_idx(test_mail_index_has_keyword(view,
+						next_seq, keyword_idx) == set,
+					seq);
+		}
+	}
+}
+
+static void
+test_mail_index_lookup_next_keyword_check(struct mail_index_view *view,
+					  unsigned int keyword_idx, bool exact)
+{
+	test_mail_index_lookup_next_keyword_check_set(view, keyword_idx,
+						      TRUE, exact);
+	test_mail_index_lookup_next_keyword_check_set(view, keyword_idx,
+						      FALSE, exact);
+}
+
+static void test_mail_index_lookup_next_keyword(void)
+{
+	struct mail_index_optimization_settings optimization_set = {
+		.index = { .columns_min_messages = 1 },
+	};
+	const char *const kw_a_names[] = { "a", NULL };
+	const char *const kw_b_names[] = { "b", NULL };
+	const char *const kw_c_names[] = { "c", NULL };
+	struct mail_index *index;
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view, *tview;
+	struct mail_index_transaction *trans;
+	struct mail_keywords *kw_a, *kw_b, *kw_c;
+	uint32_t seq, uid, uid_validity = 1234;
+
+	test_begin("mail index lookup next keyword");
+	index = test_mail_index_init();
+	mail_index_set_optimization_settings(index, &optimization_set);
+	kw_a = mail_index_keywords_create(index, kw_a_names);
+	kw_b = mail_index_keywords_create(index, kw_b_names);
+	kw_c = mail_index_keywords_create(index, kw_c_names);
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= 40; uid++) {
+		mail_index_append(trans, uid, &seq);
+		if (uid % 3 == 0)
+			mail_index_update_keywords(trans, seq, MODIFY_ADD, kw_a);
+		if (uid > 30)
+			mail_index_update_keywords(trans, seq, MODIFY_ADD, kw_b);
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	/* build the columns before the keywords are changed */
+	view = mail_index_view_open(index);
+	mail_index_lookup_next_keyword(view, 1, kw_a->idx[0], TRUE, &seq);
+	test_assert(seq == 3);
+	test_assert(view->map->rec_map->columns != NULL);
+	mail_index_view_close(&view);
+
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &view,
+					  &trans, 0) == 1);
+	for (seq = 5; seq <= 10; seq++)
+		mail_index_expunge(trans, seq);
+	for (seq = 15; seq <= 20; seq++) {
+		mail_index_update_keywords(trans, seq, MODIFY_ADD, kw_a);
+		mail_index_update_keywords(trans, seq, MODIFY_REMOVE, kw_b);
+	}
+	mail_index_update_keywords(trans, 38, MODIFY_REPLACE, kw_a);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+
+	view = mail_index_view_open(index);
+	test_assert(mail_index_view_get_messages_count(view) == 34);
+	test_assert(view->map->rec_map->columns != NULL);
+	test_mail_index_lookup_next_keyword_check(view, kw_a->idx[0], TRUE);
+	test_mail_index_lookup_next_keyword_check(view, kw_b->idx[0], TRUE);
+	test_mail_index_lookup_next_keyword_check(view, kw_c->idx[0], TRUE);
+
+	/* uncommitted changes in a transaction view */
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_keywords(trans, 2, MODIFY_ADD, kw_a);
+	mail_index_update_keywords(trans, 30, MODIFY_REMOVE, kw_b);
+	mail_index_append(trans, 41, &seq);
+	mail_index_append(trans, 42, &seq);
+	mail_index_update_keywords(trans, seq, MODIFY_ADD, kw_c);
+	tview = mail_index_transaction_open_updated_view(trans);
+	test_mail_index_lookup_next_keyword_check(tview, kw_a->idx[0], FALSE);
+	test_mail_index_lookup_next_keyword_check(tview, kw_b->idx[0], FALSE);
+	test_mail_index_lookup_next_keyword_check(tview, kw_c->idx[0], FALSE);
+	mail_index_view_close(&tview);
+	mail_index_transaction_rollback(&trans);
+
+	mail_index_view_close(&view);
+	mail_index_keywords_unref(&kw_a);
+	mail_index_keywords_unref(&kw_b);
+	mail_index_keywords_unref(&kw_c);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_rotate,
 		test_mail_index_new_extension,
+		test_mail_index_lookup_next_flags,
+		test_mail_index_lookup_next_keyword,
 		NULL
 	};
 	return test_run(test_functions);
@@ -1,11 +1,15 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "buffer.h"
+#include "time-util.h"
 #include "test-common.h"
 #include "mail-index-private.h"
 #include "mail-transaction-log-private.h"
 
+#include <stdio.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 
 static bool log_lock_failure = FALSE;
@@ -166,11 +170,179 @@ static void test_mail_transaction_log_append(void)
 	i_unlink(tmp_path);
 }
 
-int main(void)
+static void
+test_append_fsync_file_init(struct mail_transaction_log *log,
+			    struct mail_transaction_log_file *file,
+			    const char *path)
+{
+	struct stat st;
+
+	i_zero(file);
+	file->log = log;
+	file->filepath = i_strdup(path);
+	file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (file->fd == -1)
+		i_fatal("open(%s) failed: %m", path);
+	if (fstat(file->fd, &st) < 0)
+		i_fatal("fstat(%s) failed: %m", path);
+	file->st_ino = st.st_ino;
+	file->st_dev = st.st_dev;
+}
+
+static void test_append_fsync_file_deinit(struct mail_transaction_log_file *file)
+{
+	i_close_fd(&file->fd);
+	i_unlink(file->filepath);
+	i_free(file->filepath);
+}
+
+static void test_append_one(struct mail_transaction_log *log,
+			    struct mail_transaction_log_file *file)
+{
+	static const uint32_t uid = 1;
+	struct mail_transaction_log_append_ctx *ctx;
+
+	log->head = file;
+	if (mail_transaction_log_append_begin(log->index, 0, &ctx) < 0)
+		i_unreached();
+	mail_transaction_log_append_add(ctx, MAIL_TRANSACTION_APPEND,
+					&uid, sizeof(uid));
+	if (mail_transaction_log_append_commit(&ctx) < 0)
+		i_unreached();
+}
+
+static void test_mail_transaction_log_append_fsync_batch(void)
+{
+	struct mail_transaction_log log;
+	struct mail_index index;
+	struct mail_transaction_log_file file1, file2;
+	struct mail_transaction_log_fsync_batch *batch;
+	const char *error;
+	int fd1;
+
+	test_begin("transaction log append: fsync batch");
+	i_zero(&log);
+	i_zero(&index);
+	log.index = &index;
+	index.log = &log;
+	index.set.fsync_mode = FSYNC_MODE_ALWAYS;
+	test_append_fsync_file_init(&log, &file1, ".test.log.fsync1");
+	test_append_fsync_file_init(&log, &file2, ".test.log.fsync2");
+
+	/* each file is added to the batch only once */
+	batch = mail_transaction_log_fsync_batch_begin(0);
+	test_append_one(&log, &file1);
+	test_append_one(&log, &file2);
+	test_append_one(&log, &file1);
+	test_assert(array_count(&batch->files) == 2);
+	test_assert(batch->delayed_fsyncs == 3);
+	test_assert(file1.sync_offset == 2 * (sizeof(struct mail_transaction_header) + sizeof(uint32_t)));
+
+	/* the log files can be closed before the batch ends */
+	fd1 = file1.fd;
+	file1.fd = -1;
+	i_close_fd(&fd1);
+	test_assert(mail_transaction_log_fsync_batch_end(&batch, &error) == 0);
+	test_assert(batch == NULL);
+
+	/* without a batch nothing is delayed */
+	file1.fd = open(file1.filepath, O_RDWR);
+	batch = mail_transaction_log_fsync_batch_begin(
+		MAIL_TRANSACTION_LOG_FSYNC_BATCH_FLAG_SYNCFS);
+	test_append_one(&log, &file1);
+	test_append_one(&log, &file2);
+	test_assert(mail_transaction_log_fsync_batch_end(&batch, &error) == 0);
+	test_append_one(&log, &file1);
+
+	/* fsync_mode=never doesn't add anything */
+	index.set.fsync_mode = FSYNC_MODE_NEVER;
+	batch = mail_transaction_log_fsync_batch_begin(0);
+	test_append_one(&log, &file1);
+	test_assert(array_count(&batch->files) == 0);
+	test_assert(mail_transaction_log_fsync_batch_end(&batch, &error) == 0);
+
+	test_append_fsync_file_deinit(&file1);
+	test_append_fsync_file_deinit(&file2);
+	test_end();
+}
+
+static void
+test_mail_transaction_log_append_benchmark(unsigned int mailboxes_count,
+					   unsigned int deliveries_count)
+{
+	static const struct {
+		const char *name;
+		bool batch;
+		enum mail_transaction_log_fsync_batch_flags flags;
+	} modes[] = {
+		{ "fdatasync per commit", FALSE, 0 },
+		{ "batched fdatasync", TRUE, 0 },
+		{ "batched syncfs", TRUE,
+		  MAIL_TRANSACTION_LOG_FSYNC_BATCH_FLAG_SYNCFS },
+	};
+	struct mail_transaction_log log;
+	struct mail_index index;
+	struct mail_transaction_log_file *files;
+	struct mail_transaction_log_fsync_batch *batch = NULL;
+	struct timeval start, end;
+	const char *error;
+	unsigned int i, j, m;
+
+	i_zero(&log);
+	i_zero(&index);
+	log.index = &index;
+	index.log = &log;
+	index.set.fsync_mode = FSYNC_MODE_ALWAYS;
+
+	/* Each delivery commits one transaction to each mailbox's log, the
+	   same as LMTP delivering a mail to mailboxes_count recipients. */
+	files = i_new(struct mail_transaction_log_file, mailboxes_count);
+	for (m = 0; m < N_ELEMENTS(modes); m++) {
+		for (j = 0; j < mailboxes_count; j++) {
+			test_append_fsync_file_init(&log, &files[j],
+				t_strdup_printf(".test.log.benchmark.%u", j));
+		}
+		i_gettimeofday(&start);
+		for (i = 0; i < deliveries_count; i++) {
+			if (modes[m].batch) {
+				batch = mail_transaction_log_fsync_batch_begin(
+					modes[m].flags);
+			}
+			for (j = 0; j < mailboxes_count; j++)
+				test_append_one(&log, &files[j]);
+			if (batch != NULL &&
+			    mail_transaction_log_fsync_batch_end(&batch, &error) < 0)
+				i_fatal("%s", error);
+		}
+		i_gettimeofday(&end);
+		printf("%s: %u deliveries to %u mailboxes in %lld usecs "
+		       "(%lld usecs/delivery)\n", modes[m].name,
+		       deliveries_count, mailboxes_count,
+		       timeval_diff_usecs(&end, &start),
+		       timeval_diff_usecs(&end, &start) / deliveries_count);
+		for (j = 0; j < mailboxes_count; j++)
+			test_append_fsync_file_deinit(&files[j]);
+	}
+	i_free(files);
+}
+
+int main(int argc, char *argv[])
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_transaction_log_append,
+		test_mail_transaction_log_append_fsync_batch,
 		NULL
 	};
+
+	if (argc >= 2 && strcmp(argv[1], "benchmark") == 0) {
+		/* test-mail-transaction-log-append benchmark
+		     [<mailboxes count> [<deliveries count>]] */
+		lib_init();
+		test_mail_transaction_log_append_benchmark(
+			argc < 3 ? 10 : atoi(argv[2]),
+			argc < 4 ? 100 : atoi(argv[3]));
+		lib_deinit();
+		return 0;
+	}
 	return test_run(test_functions);
 }
@@ -0,0 +1,222 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "istream-crlf.h"
+#include "istream-nonuls.h"
+#include "istream-dot.h"
+#include "ostream.h"
+#include "ostream-dot.h"
+#include "time-util.h"
+#include "strnum.h"
+
+#include <stdio.h>
+
+/**
+ * Measures the throughput of the streams that filter whole message bodies
+ * byte by byte: LF -> CRLF and CRLF -> LF conversion, NUL filtering and
+ * SMTP/LMTP dot-stuffing and -unstuffing. The input is a generated corpus
+ * of messages with headers, a plain text body with some lines beginning
+ * with a dot and a base64 encoded attachment.
+ */
+
+#define BENCH_TEXT_LINES 60
+#define BENCH_BASE64_LINES 1300
+
+static const char *const bench_words[] = {
+	"the", "message", "dovecot", "mailbox", "server", "attachment",
+	"regards", "meeting", "tomorrow", "please", "find", "attached",
+	"report", "quarterly", "numbers", "thanks", "a", "of", "to", "and"
+};
+
+static void bench_add_line(string_t *str, const char *line, bool crlf)
+{
+	str_append(str, line);
+	str_append(str, crlf ? "\r\n" : "\n");
+}
+
+static void bench_add_message(string_t *str, unsigned int idx, bool crlf)
+{
+	string_t *line = t_str_new(128);
+	unsigned int i, j;
+
+	bench_add_line(str, t_strdup_printf(
+		"Message-ID: <%u.bench@example.com>", idx), crlf);
+	bench_add_line(str, "From: Sender <sender@example.com>", crlf);
+	bench_add_line(str, "To: Recipient <recipient@example.com>", crlf);
+	bench_add_line(str, t_strdup_printf("Subject: Benchmark message %u",
+					    idx), crlf);
+	bench_add_line(str, "Date: Tue, 1 Jan 2030 00:00:00 +0000", crlf);
+	bench_add_line(str, "MIME-Version: 1.0", crlf);
+	bench_add_line(str, "Content-Type: multipart/mixed; boundary=\"b\"",
+		       crlf);
+	bench_add_line(str, "", crlf);
+	bench_add_line(str, "--b", crlf);
+	bench_add_line(str, "Content-Type: text/plain; charset=utf-8", crlf);
+	bench_add_line(str, "", crlf);
+	for (i = 0; i < BENCH_TEXT_LINES; i++) {
+		str_truncate(line, 0);
+		if (i_rand_limit(10) == 0)
+			str_append_c(line, '.');
+		while (str_len(line) < 70) {
+			j = i_rand_limit(N_ELEMENTS(bench_words));
+			str_append(line, bench_words[j]);
+			str_append_c(line, ' ');
+		}
+		bench_add_line(str, str_c(line), crlf);
+	}
+	bench_add_line(str, "--b", crlf);
+	bench_add_line(str, "Content-Type: application/octet-stream", crlf);
+	bench_add_line(str, "Content-Transfer-Encoding: base64", crlf);
+	bench_add_line(str, "", crlf);
+	for (i = 0; i < BENCH_BASE64_LINES; i++) {
+		str_truncate(line, 0);
+		for (j = 0; j < 76; j++) {
+			str_append_c(line, "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+				     "abcdefghijklmnopqrstuvwxyz0123456789+/"
+				     [i_rand_limit(64)]);
+		}
+		bench_add_line(str, str_c(line), crlf);
+	}
+	bench_add_line(str, "--b--", crlf);
+}
+
+static void bench_print(const char *name, size_t size, uint64_t nsecs)
+{
+	printf("%-22s %8.02lf MB/s\n", name,
+	       (double)size * 1000 / (nsecs == 0 ? 1 : nsecs));
+}
+
+static size_t bench_read_all(struct istream *input)
+{
+	const unsigned char *data;
+	size_t size, total = 0;
+
+	i_stream_set_max_buffer_size(input, IO_BLOCK_SIZE);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		total += size;
+		i_stream_skip(input, size);
+	}
+	i_assert(input->stream_errno == 0);
+	i_stream_unref(&input);
+	return total;
+}
+
+static void
+bench_istream(const char *name, const buffer_t *corpus, unsigned int rounds,
+	      struct istream *(*create)(struct istream *input))
+{
+	struct istream *input, *filter;
+	uint64_t ts_0;
+	unsigned int i;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < rounds; i++) {
+		input = i_stream_create_from_buffer(corpus);
+		filter = create(input);
+		i_stream_unref(&input);
+		(void)bench_read_all(filter);
+	}
+	bench_print(name, corpus->used * rounds, i_nanoseconds() - ts_0);
+}
+
+static struct istream *bench_create_crlf(struct istream *input)
+{
+	return i_stream_create_crlf(input);
+}
+
+static struct istream *bench_create_lf(struct istream *input)
+{
+	return i_stream_create_lf(input);
+}
+
+static struct istream *bench_create_nonuls(struct istream *input)
+{
+	return i_stream_create_nonuls(input, '\x80');
+}
+
+static struct istream *bench_create_dot(struct istream *input)
+{
+	return i_stream_create_dot(input, FALSE);
+}
+
+static void
+bench_ostream_dot(const buffer_t *corpus, unsigned int rounds,
+		  buffer_t *output_r)
+{
+	struct ostream *output, *dot_output;
+	uint64_t ts_0;
+	unsigned int i;
+	size_t pos, size;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < rounds; i++) {
+		buffer_set_used_size(output_r, 0);
+		output = o_stream_create_buffer(output_r);
+		dot_output = o_stream_create_dot(output, FALSE);
+		for (pos = 0; pos < corpus->used; pos += size) {
+			size = I_MIN(corpus->used - pos, IO_BLOCK_SIZE);
+			o_stream_nsend(dot_output,
+				       CONST_PTR_OFFSET(corpus->data, pos),
+				       size);
+		}
+		if (o_stream_finish(dot_output) <= 0)
+			i_unreached();
+		o_stream_destroy(&dot_output);
+		o_stream_destroy(&output);
+	}
+	bench_print("ostream-dot", corpus->used * rounds,
+		    i_nanoseconds() - ts_0);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [messages [rounds]]\n", prog);
+	fprintf(stderr, "Uses 100 messages and 20 rounds if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int i, count = 100, rounds = 20;
+	buffer_t *lf_corpus, *crlf_corpus, *dot_corpus;
+
+	lib_init();
+	if (argc > 3 ||
+	    (argc > 1 && (str_to_uint(argv[1], &count) < 0 || count == 0)) ||
+	    (argc > 2 && (str_to_uint(argv[2], &rounds) < 0 || rounds == 0))) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+
+	lf_corpus = buffer_create_dynamic(default_pool, 1024*1024);
+	crlf_corpus = buffer_create_dynamic(default_pool, 1024*1024);
+	dot_corpus = buffer_create_dynamic(default_pool, 1024*1024);
+	for (i = 0; i < count; i++) T_BEGIN {
+		bench_add_message(lf_corpus, i, FALSE);
+	} T_END;
+	for (i = 0; i < count; i++) T_BEGIN {
+		bench_add_message(crlf_corpus, i, TRUE);
+	} T_END;
+	printf("Using %u messages (%zu bytes with LFs), %u rounds\n\n",
+	       count, lf_corpus->used, rounds);
+
+	bench_istream("istream-crlf (LF)", lf_corpus, rounds,
+		      bench_create_crlf);
+	bench_istream("istream-crlf (CRLF)", crlf_corpus, rounds,
+		      bench_create_crlf);
+	bench_istream("istream-lf (CRLF)", crlf_corpus, rounds,
+		      bench_create_lf);
+	bench_istream("istream-nonuls", crlf_corpus, rounds,
+		      bench_create_nonuls);
+	bench_ostream_dot(crlf_corpus, rounds, dot_corpus);
+	bench_istream("istream-dot", dot_corpus, rounds, bench_create_dot);
+
+	buffer_free(&lf_corpus);
+	buffer_free(&crlf_corpus);
+	buffer_free(&dot_corpus);
+	lib_deinit();
+	return 0;
+}
@@ -145,6 +145,17 @@ static ssize_t i_stream_dot_read(struct istream_private *stream)
 
 	data = i_stream_get_data(stream->parent, &size);
 	for (i = 0; i < size && dest < stream->buffer_size; i++) {
+		if (dstream->state == 0) {
+			/* copy everything until the next CR or LF */
+			size_t len = I_MIN(size - i, stream->buffer_size - dest);
+
+			len = i_memcspn(data + i, len, "\r\n", 2);
+			memcpy(stream->w_buffer + dest, data + i, len);
+			dest += len;
+			i += len;
+			if (i == size || dest == stream->buffer_size)
+				break;
+		}
 		switch (dstream->state) {
 		case 0:
 			break;
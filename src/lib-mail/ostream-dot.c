@@ -108,6 +108,17 @@ o_stream_dot_sendv(struct ostream_private *stream,
 		for (; p < pend && (size_t)(p-data)+2 < max_bytes; p++) {
 			char add = 0;
 
+			if (dstream->state == STREAM_STATE_NONE) {
+				/* skip over everything until the next CR or
+				   LF. If there is none, the last byte is
+				   handled normally below. */
+				size_t left = I_MIN((size_t)(pend - p),
+					max_bytes - 2 - (size_t)(p - data));
+				size_t skip = i_memcspn(p, left, "\r\n", 2);
+
+				p += I_MIN(skip, left - 1);
+			}
+
 			switch (dstream->state) {
 			/* none */
 			case STREAM_STATE_NONE:
@@ -90,6 +90,13 @@ enum master_login_state {
    doveconf. */
 #define DOVECOT_CONFIG_FD_ENV "DOVECOT_CONFIG_FD"
 
+/* getenv(MASTER_SSL_SHARED_KEYS_FD_ENV) returns the read-only fd to the TLS
+   session ticket keys shared by login processes, and
+   getenv(MASTER_SSL_SHARED_SESSIONS_FD_ENV) returns the fd to their shared
+   TLS session cache, if it's enabled. The fds are after the listener fds. */
+#define MASTER_SSL_SHARED_KEYS_FD_ENV "SSL_SHARED_KEYS_FD"
+#define MASTER_SSL_SHARED_SESSIONS_FD_ENV "SSL_SHARED_SESSIONS_FD"
+
 /* getenv(DOVECOT_STATS_WRITER_SOCKET_PATH) returns path to the stats-writer
    socket. */
 #define DOVECOT_STATS_WRITER_SOCKET_PATH "STATS_WRITER_SOCKET_PATH"
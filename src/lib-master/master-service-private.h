@@ -75,6 +75,7 @@ struct master_service {
 	struct setting_parser_context *set_parser;
 
 	struct ssl_iostream_context *ssl_ctx;
+	struct ssl_iostream_shared *ssl_shared;
 	time_t ssl_params_last_refresh;
 
 	char *current_user;
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ioloop.h"
 #include "event-filter.h"
 #include "path-util.h"
 #include "mmap-util.h"
@@ -55,6 +56,10 @@ static const struct setting_define master_service_setting_defines[] = {
 	DEF(BOOL, shutdown_clients),
 	DEF(BOOL, verbose_proctitle),
 
+	DEF(TIME_MSECS, ioloop_io_budget),
+	DEF(TIME_MSECS, ioloop_iteration_budget),
+	DEF(TIME, ioloop_lag_stats_interval),
+
 	DEF(STR, haproxy_trusted_networks),
 	DEF(TIME, haproxy_timeout),
 
@@ -93,6 +98,10 @@ static const struct master_service_settings master_service_default_settings = {
 	.shutdown_clients = TRUE,
 	.verbose_proctitle = FALSE,
 
+	.ioloop_io_budget = 0,
+	.ioloop_iteration_budget = 0,
+	.ioloop_lag_stats_interval = 0,
+
 	.haproxy_trusted_networks = "",
 	.haproxy_timeout = 3
 };
@@ -688,6 +697,13 @@ int master_service_settings_read(struct master_service *service,
 
 	if (service->set->shutdown_clients)
 		master_service_set_die_with_master(master_service, TRUE);
+	if (service->ioloop != NULL) {
+		io_loop_set_budget(service->ioloop,
+				   service->set->ioloop_io_budget * 1000,
+				   service->set->ioloop_iteration_budget * 1000);
+		io_loop_set_lag_stats(service->ioloop, service->event,
+			service->set->ioloop_lag_stats_interval * 1000);
+	}
 
 	/* if we change any settings afterwards, they're in expanded form.
 	   especially all settings from userdb are already expanded. */
@@ -28,6 +28,10 @@ struct master_service_settings {
 	bool shutdown_clients;
 	bool verbose_proctitle;
 
+	unsigned int ioloop_io_budget;
+	unsigned int ioloop_iteration_budget;
+	unsigned int ioloop_lag_stats_interval;
+
 	const char *haproxy_trusted_networks;
 	unsigned int haproxy_timeout;
 };
@@ -3,7 +3,9 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "buffer.h"
+#include "env-util.h"
 #include "iostream-ssl.h"
+#include "iostream-ssl-shared.h"
 #include "master-service-private.h"
 #include "master-service-settings.h"
 #include "master-service-ssl-settings.h"
@@ -107,3 +109,43 @@ void master_service_ssl_ctx_deinit(struct master_service *service)
 		ssl_iostream_context_unref(&service->ssl_ctx);
 	service->ssl_ctx_initialized = FALSE;
 }
+
+static int master_service_ssl_shared_get_fd(const char *env_name)
+{
+	const char *value = getenv(env_name);
+	int fd;
+
+	if (value == NULL)
+		return -1;
+	if (str_to_int(value, &fd) < 0 || fd < MASTER_LISTEN_FD_FIRST)
+		i_fatal("Invalid %s: %s", env_name, value);
+	env_remove(env_name);
+	return fd;
+}
+
+void master_service_ssl_shared_init(struct master_service *service)
+{
+	const char *error;
+	int keys_fd, sessions_fd;
+
+	i_assert(service->ssl_shared == NULL);
+
+	keys_fd = master_service_ssl_shared_get_fd(
+		MASTER_SSL_SHARED_KEYS_FD_ENV);
+	sessions_fd = master_service_ssl_shared_get_fd(
+		MASTER_SSL_SHARED_SESSIONS_FD_ENV);
+	if (keys_fd == -1) {
+		i_close_fd(&sessions_fd);
+		return;
+	}
+	if (ssl_iostream_shared_open(keys_fd, sessions_fd,
+				     &service->ssl_shared, &error) < 0)
+		e_error(service->event, "%s", error);
+	else
+		ssl_iostream_shared_set_global(service->ssl_shared);
+}
+
+void master_service_ssl_shared_deinit(struct master_service *service)
+{
+	ssl_iostream_shared_free(&service->ssl_shared);
+}
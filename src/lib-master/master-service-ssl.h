@@ -13,4 +13,9 @@ bool master_service_ssl_is_enabled(struct master_service *service);
 void master_service_ssl_ctx_init(struct master_service *service);
 void master_service_ssl_ctx_deinit(struct master_service *service);
 
+/* Map the TLS session state shared with the other processes of the service
+   from the fds given by the master process, if any. */
+void master_service_ssl_shared_init(struct master_service *service);
+void master_service_ssl_shared_deinit(struct master_service *service);
+
 #endif
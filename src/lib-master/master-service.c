@@ -443,6 +443,11 @@ master_service_init(const char *name, enum master_service_flags flags,
 		value = getenv("SOCKET_COUNT");
 		if (value == NULL || str_to_uint(value, &count) < 0)
 			count = 0;
+		/* the shared TLS state fds are after the listeners */
+		if (getenv(MASTER_SSL_SHARED_KEYS_FD_ENV) != NULL)
+			count++;
+		if (getenv(MASTER_SSL_SHARED_SESSIONS_FD_ENV) != NULL)
+			count++;
 		fd_debug_verify_leaks(MASTER_LISTEN_FD_FIRST + count, 1024);
 	}
 #endif
@@ -612,6 +617,8 @@ master_service_init(const char *name, enum master_service_flags flags,
 		value = getenv(MASTER_SERVICE_IDLE_KILL_ENV);
 		if (value != NULL && str_to_uint(value, &count) == 0)
 			service->idle_kill_secs = count;
+
+		master_service_ssl_shared_init(service);
 	} else {
 		master_service_set_client_limit(service, 1);
 		master_service_set_service_count(service, 1);
@@ -1036,6 +1043,11 @@ unsigned int master_service_get_client_limit(struct master_service *service)
 	return service->total_available_count;
 }
 
+unsigned int master_service_get_available_count(struct master_service *service)
+{
+	return service->master_status.available_count;
+}
+
 unsigned int master_service_get_process_limit(struct master_service *service)
 {
 	return service->process_limit;
@@ -1427,6 +1439,17 @@ void master_service_client_connection_destroyed(struct master_service *service)
 	}
 }
 
+void master_service_client_connection_release(struct master_service *service)
+{
+	/* we can listen again */
+	master_service_io_listeners_add(service);
+
+	i_assert(service->master_status.available_count <
+		 service->total_available_count);
+	service->master_status.available_count++;
+	master_status_update(service);
+}
+
 const char *
 master_service_connection_get_type(const struct master_service_connection *conn)
 {
@@ -1525,6 +1548,7 @@ static void master_service_deinit_real(struct master_service **_service)
 	for (unsigned int i = 0; i < service->socket_count; i++)
 		io_remove(&service->listeners[i].io);
 	master_service_ssl_ctx_deinit(service);
+	master_service_ssl_shared_deinit(service);
 
 	if (service->stats_client != NULL)
 		stats_client_deinit(&service->stats_client);
@@ -180,6 +180,8 @@ void master_service_set_client_limit(struct master_service *service,
 				     unsigned int client_limit);
 /* Returns the maximum number of clients we can handle. */
 unsigned int master_service_get_client_limit(struct master_service *service);
+/* Returns the number of new client connections that can still be created. */
+unsigned int master_service_get_available_count(struct master_service *service);
 /* Returns how many processes of this type can be created before reaching the
    limit. */
 unsigned int master_service_get_process_limit(struct master_service *service);
@@ -257,6 +259,11 @@ void master_service_client_connection_accept(struct master_service_connection *c
 void master_service_client_connection_created(struct master_service *service);
 /* Call whenever a client connection is destroyed. */
 void master_service_client_connection_destroyed(struct master_service *service);
+/* Release a client connection slot taken with
+   master_service_client_connection_created() that ended up not being used for
+   any client. Unlike master_service_client_connection_destroyed(), this
+   doesn't count towards service_count. */
+void master_service_client_connection_release(struct master_service *service);
 /* Returns the listener type for this connection. If the type is unassigned, the
    connection name is parsed for a "-suffix" which is returned instead to easily
    implement backwards compatibility for custom listeners that are still
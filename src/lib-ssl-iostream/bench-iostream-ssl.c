@@ -0,0 +1,275 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "net.h"
+#include "str.h"
+#include "randgen.h"
+#include "safe-mkstemp.h"
+#include "write-full.h"
+#include "istream.h"
+#include "ostream.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "iostream-openssl.h"
+#include "iostream-ssl.h"
+#include "iostream-ssl-test.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+ * Measures the SSL throughput over a TCP loopback connection. The server
+ * sends a file with o_stream_send_istream() and the client reads it. With
+ * kTLS the kernel encrypts the data and the file is sent with sendfile().
+ * Both endpoints run in the same process, so the result includes both the
+ * encryption and the decryption.
+ */
+
+struct bench_endpoint {
+	int fd;
+	struct ssl_iostream_context *ctx;
+	struct ssl_iostream *iostream;
+	struct istream *input;
+	struct ostream *output;
+	struct io *io;
+	struct istream *file_input;
+	uoff_t received;
+	bool finished;
+};
+
+static void bench_tcp_socketpair(int fd[2])
+{
+	struct ip_addr ip;
+	in_port_t port = 0;
+	int listen_fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	listen_fd = net_listen(&ip, &port, 1);
+	if (listen_fd == -1)
+		i_fatal("net_listen() failed: %m");
+	fd[1] = net_connect_ip_blocking(&ip, port, NULL);
+	if (fd[1] == -1)
+		i_fatal("net_connect_ip() failed: %m");
+	fd_set_nonblock(listen_fd, FALSE);
+	fd[0] = net_accept(listen_fd, NULL, NULL);
+	if (fd[0] < 0)
+		i_fatal("net_accept() failed: %m");
+	i_close_fd(&listen_fd);
+	fd_set_nonblock(fd[0], TRUE);
+	fd_set_nonblock(fd[1], TRUE);
+}
+
+static void bench_handshake_input(struct bench_endpoint *ep)
+{
+	if (ssl_iostream_handshake(ep->iostream) < 0)
+		i_fatal("SSL handshake failed: %s",
+			ssl_iostream_get_last_error(ep->iostream));
+	if (ssl_iostream_is_handshaked(ep->iostream))
+		io_loop_stop(current_ioloop);
+}
+
+static int bench_send(struct bench_endpoint *ep)
+{
+	int ret;
+
+	if ((ret = o_stream_flush(ep->output)) <= 0) {
+		if (ret < 0) {
+			i_fatal("write(%s) failed: %s",
+				o_stream_get_name(ep->output),
+				o_stream_get_error(ep->output));
+		}
+		return 0;
+	}
+	if (!ep->finished) {
+		switch (o_stream_send_istream(ep->output, ep->file_input)) {
+		case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+			ep->finished = TRUE;
+			break;
+		case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+			i_unreached();
+		case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+			return 0;
+		case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+			i_fatal("read(%s) failed: %s",
+				i_stream_get_name(ep->file_input),
+				i_stream_get_error(ep->file_input));
+		case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+			i_fatal("write(%s) failed: %s",
+				o_stream_get_name(ep->output),
+				o_stream_get_error(ep->output));
+		}
+	}
+	return o_stream_finish(ep->output);
+}
+
+static void bench_receive(struct bench_endpoint *ep)
+{
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	while ((ret = i_stream_read_more(ep->input, &data, &size)) > 0) {
+		ep->received += size;
+		i_stream_skip(ep->input, size);
+	}
+	if (ret < 0) {
+		if (ep->input->stream_errno != 0) {
+			i_fatal("read(%s) failed: %s",
+				i_stream_get_name(ep->input),
+				i_stream_get_error(ep->input));
+		}
+		io_loop_stop(current_ioloop);
+	}
+}
+
+static void
+bench_endpoint_init(struct bench_endpoint *ep, int fd, bool client, bool ktls)
+{
+	struct ssl_iostream_settings set;
+	const char *error;
+	int ret;
+
+	i_zero(ep);
+	ep->fd = fd;
+	ep->input = i_stream_create_fd(fd, IO_BLOCK_SIZE*16);
+	ep->output = o_stream_create_fd(fd, IO_BLOCK_SIZE*16);
+	o_stream_uncork(ep->output);
+
+	if (client) {
+		ssl_iostream_test_settings_client(&set);
+		set.allow_invalid_cert = TRUE;
+		ret = ssl_iostream_context_init_client(&set, &ep->ctx, &error);
+	} else {
+		ssl_iostream_test_settings_server(&set);
+		ret = ssl_iostream_context_init_server(&set, &ep->ctx, &error);
+	}
+	if (ret < 0)
+		i_fatal("SSL context initialization failed: %s", error);
+	set.ktls = ktls;
+	if (client) {
+		ret = io_stream_create_ssl_client(ep->ctx, "localhost", &set,
+						  NULL, &ep->input, &ep->output,
+						  &ep->iostream, &error);
+	} else {
+		ret = io_stream_create_ssl_server(ep->ctx, &set, NULL,
+						  &ep->input, &ep->output,
+						  &ep->iostream, &error);
+	}
+	if (ret < 0)
+		i_fatal("SSL stream creation failed: %s", error);
+	ep->io = io_add_istream(ep->input, bench_handshake_input, ep);
+}
+
+static void bench_endpoint_deinit(struct bench_endpoint *ep)
+{
+	io_remove(&ep->io);
+	i_stream_unref(&ep->file_input);
+	ssl_iostream_destroy(&ep->iostream);
+	i_stream_unref(&ep->input);
+	o_stream_unref(&ep->output);
+	ssl_iostream_context_unref(&ep->ctx);
+	i_close_fd(&ep->fd);
+}
+
+static const char *bench_ktls_str(enum ssl_iostream_ktls_flags flags)
+{
+	if (flags == 0)
+		return "none";
+	if (flags == (SSL_IOSTREAM_KTLS_SEND | SSL_IOSTREAM_KTLS_RECV))
+		return "send+recv";
+	return (flags & SSL_IOSTREAM_KTLS_SEND) != 0 ? "send" : "recv";
+}
+
+static void bench_run(int file_fd, uoff_t size, bool ktls)
+{
+	struct bench_endpoint server, client;
+	struct ioloop *ioloop;
+	uint64_t ts_0, ts_1;
+	int fd[2];
+
+	ioloop = io_loop_create();
+	bench_tcp_socketpair(fd);
+	bench_endpoint_init(&server, fd[0], FALSE, ktls);
+	bench_endpoint_init(&client, fd[1], TRUE, ktls);
+
+	(void)ssl_iostream_handshake(client.iostream);
+	while (!ssl_iostream_is_handshaked(server.iostream) ||
+	       !ssl_iostream_is_handshaked(client.iostream))
+		io_loop_run(ioloop);
+	io_remove(&server.io);
+	io_remove(&client.io);
+
+	server.file_input = i_stream_create_fd(file_fd, IO_BLOCK_SIZE*16);
+	o_stream_set_flush_callback(server.output, bench_send, &server);
+	client.io = io_add_istream(client.input, bench_receive, &client);
+
+	ts_0 = i_nanoseconds();
+	o_stream_set_flush_pending(server.output, TRUE);
+	io_loop_run(ioloop);
+	ts_1 = i_nanoseconds();
+	if (client.received != size)
+		i_fatal("Received %"PRIuUOFF_T" bytes, expected %"PRIuUOFF_T,
+			client.received, size);
+
+	printf("ktls=%-3s  offloaded: server %-9s client %-9s  %8.02lf MB/s\n",
+	       ktls ? "yes" : "no",
+	       bench_ktls_str(ssl_iostream_get_ktls(server.iostream)),
+	       bench_ktls_str(ssl_iostream_get_ktls(client.iostream)),
+	       (double)size * 1000 / (ts_1 - ts_0 == 0 ? 1 : ts_1 - ts_0));
+	fflush(stdout);
+
+	bench_endpoint_deinit(&client);
+	bench_endpoint_deinit(&server);
+	io_loop_destroy(&ioloop);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [megabytes [rounds]]\n", prog);
+	fprintf(stderr, "Uses 100 MB and 3 rounds if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	string_t *path;
+	unsigned char buf[IO_BLOCK_SIZE*16];
+	unsigned int i, mbytes = 100, rounds = 3;
+	uoff_t size;
+	int fd;
+
+	lib_init();
+	if (argc > 3 ||
+	    (argc > 1 && (str_to_uint(argv[1], &mbytes) < 0 || mbytes == 0)) ||
+	    (argc > 2 && (str_to_uint(argv[2], &rounds) < 0 || rounds == 0))) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	ssl_iostream_openssl_init();
+
+	path = t_str_new(128);
+	str_append(path, ".bench-iostream-ssl.");
+	fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1)
+		i_fatal("safe_mkstemp(%s) failed: %m", str_c(path));
+	i_unlink(str_c(path));
+	size = (uoff_t)mbytes * 1024 * 1024;
+	for (uoff_t pos = 0; pos < size; pos += sizeof(buf)) {
+		random_fill(buf, sizeof(buf));
+		if (write_full(fd, buf, I_MIN(sizeof(buf), size - pos)) < 0)
+			i_fatal("write(%s) failed: %m", str_c(path));
+	}
+	printf("Sending %u MB over TCP loopback, %u rounds\n\n", mbytes, rounds);
+
+	for (i = 0; i < rounds; i++) {
+		bench_run(fd, size, FALSE);
+		bench_run(fd, size, TRUE);
+	}
+
+	i_close_fd(&fd);
+	ssl_iostream_openssl_deinit();
+	lib_deinit();
+	return 0;
+}
@@ -4,7 +4,10 @@
 #include "str.h"
 #include "hex-binary.h"
 #include "safe-memset.h"
+#include "buffer.h"
+#include "sha2.h"
 #include "iostream-openssl.h"
+#include "iostream-ssl-shared.h"
 #include "dovecot-openssl-common.h"
 
 #include <openssl/crypto.h>
@@ -15,12 +18,22 @@
 #include <openssl/pem.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+#ifdef HAVE_EVP_MAC_CTX_new
+#  include <openssl/core_names.h>
+#endif
 #include <arpa/inet.h>
 
 #ifndef HAVE_EVP_PKEY_get0_DH
 #  define EVP_PKEY_get0_DH(x) ((x)->pkey.dh)
 #endif
 
+#ifdef HAVE_EVP_MAC_CTX_new
+#  define SSL_TICKET_MAC_CTX EVP_MAC_CTX
+#else
+#  define SSL_TICKET_MAC_CTX HMAC_CTX
+#endif
+
 struct ssl_iostream_password_context {
 	const char *password;
 	const char *error;
@@ -571,11 +584,192 @@ ssl_iostream_context_load_ca(struct ssl_iostream_context *ctx,
 	return 0;
 }
 
+static int
+ssl_ticket_key_set_mac(SSL_TICKET_MAC_CTX *mac_ctx,
+		       const struct ssl_iostream_ticket_key *key)
+{
+#ifdef HAVE_EVP_MAC_CTX_new
+	OSSL_PARAM params[3];
+
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+		(void *)key->hmac_key, sizeof(key->hmac_key));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+		(char *)"SHA256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	return EVP_MAC_CTX_set_params(mac_ctx, params);
+#else
+	return HMAC_Init_ex(mac_ctx, key->hmac_key, sizeof(key->hmac_key),
+			    EVP_sha256(), NULL);
+#endif
+}
+
+static int
+ssl_ticket_key_callback(SSL *ssl ATTR_UNUSED, unsigned char *key_name,
+			unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx,
+			SSL_TICKET_MAC_CTX *mac_ctx, int enc)
+{
+	struct ssl_iostream_shared *shared = ssl_iostream_shared_get_global();
+	struct ssl_iostream_ticket_key keys[2];
+	const EVP_CIPHER *cipher = EVP_aes_256_cbc();
+	unsigned int i, count;
+	int ret = -1;
+
+	if (shared == NULL)
+		return 0;
+	count = ssl_iostream_shared_get_ticket_keys(shared, keys);
+	if (count == 0) {
+		/* no tickets */
+		ret = 0;
+	} else if (enc == 1) {
+		memcpy(key_name, keys[0].name, sizeof(keys[0].name));
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(cipher)) > 0 &&
+		    EVP_EncryptInit_ex(cipher_ctx, cipher, NULL,
+				       keys[0].aes_key, iv) > 0 &&
+		    ssl_ticket_key_set_mac(mac_ctx, &keys[0]) > 0)
+			ret = 1;
+	} else {
+		for (i = 0; i < count; i++) {
+			if (memcmp(key_name, keys[i].name,
+				   sizeof(keys[i].name)) == 0)
+				break;
+		}
+		if (i == count) {
+			/* expired key - do a full handshake */
+			ret = 0;
+		} else if (ssl_ticket_key_set_mac(mac_ctx, &keys[i]) > 0 &&
+			   EVP_DecryptInit_ex(cipher_ctx, cipher, NULL,
+					      keys[i].aes_key, iv) > 0) {
+			/* renew the ticket if it was encrypted with the
+			   previous key */
+			ret = i == 0 ? 1 : 2;
+		}
+	}
+	safe_memset(keys, 0, sizeof(keys));
+	return ret;
+}
+
+static int ssl_session_new_callback(SSL *ssl ATTR_UNUSED, SSL_SESSION *session)
+{
+	struct ssl_iostream_shared *shared = ssl_iostream_shared_get_global();
+	unsigned char data[SSL_IOSTREAM_SESSION_DATA_MAX_SIZE], *p = data;
+	const unsigned char *id;
+	unsigned int id_len;
+	int size;
+
+	if (shared == NULL)
+		return 0;
+	size = i2d_SSL_SESSION(session, NULL);
+	if (size <= 0 || (size_t)size > sizeof(data))
+		return 0;
+	if (i2d_SSL_SESSION(session, &p) != size)
+		return 0;
+
+	id = SSL_SESSION_get_id(session, &id_len);
+	(void)ssl_iostream_shared_session_store(shared, id, id_len, data, size,
+		SSL_SESSION_get_time(session) +
+		SSL_SESSION_get_timeout(session));
+	safe_memset(data, 0, size);
+	/* we didn't keep a reference to the session */
+	return 0;
+}
+
+static SSL_SESSION *
+ssl_session_get_callback(SSL *ssl ATTR_UNUSED, const unsigned char *id,
+			 int id_len, int *copy_r)
+{
+	struct ssl_iostream_shared *shared = ssl_iostream_shared_get_global();
+	unsigned char data[SSL_IOSTREAM_SESSION_DATA_MAX_SIZE];
+	SSL_SESSION *session = NULL;
+	const unsigned char *p;
+	buffer_t buf;
+
+	*copy_r = 0;
+	if (shared == NULL || id_len <= 0)
+		return NULL;
+
+	buffer_create_from_data(&buf, data, sizeof(data));
+	if (ssl_iostream_shared_session_lookup(shared, id, id_len, &buf)) {
+		p = buf.data;
+		session = d2i_SSL_SESSION(NULL, &p, buf.used);
+	}
+	safe_memset(data, 0, buf.used);
+	return session;
+}
+
+static void
+ssl_session_remove_callback(SSL_CTX *ssl_ctx ATTR_UNUSED,
+			    SSL_SESSION *session)
+{
+	struct ssl_iostream_shared *shared = ssl_iostream_shared_get_global();
+	const unsigned char *id;
+	unsigned int id_len;
+
+	if (shared == NULL)
+		return;
+	id = SSL_SESSION_get_id(session, &id_len);
+	ssl_iostream_shared_session_remove(shared, id, id_len);
+}
+
+static void
+ssl_sid_ctx_add_str(struct sha256_ctx *hash_ctx, const char *str)
+{
+	if (str != NULL)
+		sha256_loop(hash_ctx, str, strlen(str));
+	sha256_loop(hash_ctx, "", 1);
+}
+
+static void
+ssl_iostream_context_init_shared(struct ssl_iostream_context *ctx,
+				 struct ssl_iostream_shared *shared)
+{
+	struct sha256_ctx hash_ctx;
+	unsigned char sid_ctx[SHA256_RESULTLEN];
+
+	/* Sessions (including tickets) can be resumed only by contexts with
+	   the same session ID context. Use a hash of the settings affecting
+	   the client authentication, so a session can't be resumed with
+	   different certificates or CAs. */
+	sha256_init(&hash_ctx);
+	ssl_sid_ctx_add_str(&hash_ctx, ctx->set.cert.cert);
+	ssl_sid_ctx_add_str(&hash_ctx, ctx->set.alt_cert.cert);
+	ssl_sid_ctx_add_str(&hash_ctx, ctx->set.ca);
+	ssl_sid_ctx_add_str(&hash_ctx, ctx->set.ca_file);
+	ssl_sid_ctx_add_str(&hash_ctx, ctx->set.ca_dir);
+	ssl_sid_ctx_add_str(&hash_ctx, ctx->set.cert_username_field);
+	ssl_sid_ctx_add_str(&hash_ctx, ctx->set.verify_remote_cert ?
+			    "verify" : "");
+	sha256_result(&hash_ctx, sid_ctx);
+	i_assert(sizeof(sid_ctx) <= SSL_MAX_SID_CTX_LENGTH);
+	(void)SSL_CTX_set_session_id_context(ctx->ssl_ctx, sid_ctx,
+					     sizeof(sid_ctx));
+
+	if (ctx->set.tickets) {
+#ifdef HAVE_EVP_MAC_CTX_new
+		(void)SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx->ssl_ctx,
+			ssl_ticket_key_callback);
+#else
+		(void)SSL_CTX_set_tlsext_ticket_key_cb(ctx->ssl_ctx,
+			ssl_ticket_key_callback);
+#endif
+	}
+	if (ssl_iostream_shared_get_session_cache_size(shared) > 0) {
+		/* the shared cache replaces the per-process cache */
+		SSL_CTX_set_session_cache_mode(ctx->ssl_ctx,
+			SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+		SSL_CTX_sess_set_new_cb(ctx->ssl_ctx, ssl_session_new_callback);
+		SSL_CTX_sess_set_get_cb(ctx->ssl_ctx, ssl_session_get_callback);
+		SSL_CTX_sess_set_remove_cb(ctx->ssl_ctx,
+					   ssl_session_remove_callback);
+	}
+}
+
 static int
 ssl_iostream_context_set(struct ssl_iostream_context *ctx,
 			 const struct ssl_iostream_settings *set,
 			 const char **error_r)
 {
+	struct ssl_iostream_shared *shared;
+
 	ssl_iostream_settings_init_from(ctx->pool, &ctx->set, set);
 	if (set->cipher_list != NULL &&
 	    SSL_CTX_set_cipher_list(ctx->ssl_ctx, set->cipher_list) == 0) {
@@ -673,6 +867,9 @@ ssl_iostream_context_set(struct ssl_iostream_context *ctx,
 #ifdef HAVE_SSL_client_hello_get0_ciphers
 		SSL_CTX_set_client_hello_cb(ctx->ssl_ctx, ssl_clienthello_callback, ctx);
 #endif
+		shared = ssl_iostream_shared_get_global();
+		if (shared != NULL)
+			ssl_iostream_context_init_shared(ctx, shared);
 	}
 	return 0;
 }
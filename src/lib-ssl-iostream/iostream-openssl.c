@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "istream-private.h"
 #include "ostream-private.h"
+#include "net.h"
 #include "iostream-openssl.h"
 
 #include <openssl/rand.h>
@@ -271,6 +272,30 @@ openssl_iostream_set(struct ssl_iostream *ssl_io,
 	return 0;
 }
 
+static int
+openssl_iostream_get_ktls_fd(struct istream *input, struct ostream *output)
+{
+#ifdef HAVE_BIO_get_ktls_send
+	struct ip_addr ip;
+	int fd = i_stream_get_fd(input);
+
+	/* OpenSSL reads and writes the socket directly, so there can't be
+	   any filter streams or input that was already read. */
+	if (fd == -1 || fd != o_stream_get_fd(output) ||
+	    input->real_stream->parent != NULL ||
+	    output->real_stream->parent != NULL ||
+	    i_stream_get_data_size(input) > 0)
+		return -1;
+	/* kTLS is available only for TCP sockets */
+	if (net_getsockname(fd, &ip, NULL) < 0 ||
+	    (ip.family != AF_INET && ip.family != AF_INET6))
+		return -1;
+	return fd;
+#else
+	return -1;
+#endif
+}
+
 static int
 openssl_iostream_create(struct ssl_iostream_context *ctx,
 			struct event *event_parent, const char *host,
@@ -282,6 +307,7 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 	struct ssl_iostream *ssl_io;
 	SSL *ssl;
 	BIO *bio_int, *bio_ext;
+	int ktls_fd = -1;
 
 	/* Don't allow an existing io_add_istream() to be use on the input.
 	   It would seem to work, but it would also cause hangs. */
@@ -294,12 +320,34 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 		return -1;
 	}
 
+	if (set->ktls)
+		ktls_fd = openssl_iostream_get_ktls_fd(*input, *output);
+	if (ktls_fd != -1) {
+		/* OpenSSL can enable kTLS only when it's using a socket BIO
+		   while the handshake changes the keys. There's no bio_ext,
+		   plain_input and plain_output are used only for flushing
+		   and for waiting on the fd. */
+		bio_int = BIO_new_socket(ktls_fd, BIO_NOCLOSE);
+		if (bio_int == NULL) {
+			*error_r = t_strdup_printf("BIO_new_socket() failed: %s",
+						   openssl_iostream_error());
+			SSL_free(ssl);
+			return -1;
+		}
+		bio_ext = NULL;
+#ifdef HAVE_BIO_get_ktls_send
+		SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#endif
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+		/* handle disconnections the same way as with BIO pairs */
+		SSL_set_options(ssl, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
 	/* BIO pairs use default buffer sizes (17 kB in OpenSSL 0.9.8e).
 	   Each of the BIOs have one "write buffer". BIO_write() copies data
 	   to them, while BIO_read() reads from the other BIO's write buffer
 	   into the given buffer. The bio_int is used by OpenSSL and bio_ext
 	   is used by this library. */
-	if (BIO_new_bio_pair(&bio_int, 0, &bio_ext, 0) != 1) {
+	} else if (BIO_new_bio_pair(&bio_int, 0, &bio_ext, 0) != 1) {
 		*error_r = t_strdup_printf("BIO_new_bio_pair() failed: %s",
 					   openssl_iostream_error());
 		SSL_free(ssl);
@@ -386,6 +434,11 @@ void openssl_iostream_shutdown(struct ssl_iostream *ssl_io)
 	i_assert(ssl_io->ssl_output != NULL);
 
 	ssl_io->destroyed = TRUE;
+	if (ssl_io->bio_ext == NULL) {
+		/* plaintext written directly to the kTLS socket must be sent
+		   before the close_notify alert */
+		(void)o_stream_flush(ssl_io->plain_output);
+	}
 	if (ssl_io->handshaked && SSL_shutdown(ssl_io->ssl) != 1) {
 		/* if bidirectional shutdown fails we need to clear
 		   the error queue */
@@ -559,6 +612,26 @@ openssl_iostream_bio_input(struct ssl_iostream *ssl_io,
 	return (bytes_read ? 1 : 0);
 }
 
+int openssl_iostream_socket_flush(struct ssl_iostream *ssl_io)
+{
+	int ret;
+
+	i_assert(ssl_io->bio_ext == NULL);
+
+	if ((ret = o_stream_flush(ssl_io->plain_output)) < 0) {
+		i_free(ssl_io->plain_stream_errstr);
+		ssl_io->plain_stream_errstr =
+			i_strdup(o_stream_get_error(ssl_io->plain_output));
+		ssl_io->plain_stream_errno =
+			ssl_io->plain_output->stream_errno;
+		ssl_io->closed = TRUE;
+		return -1;
+	}
+	if (ret == 0)
+		o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+	return ret;
+}
+
 int openssl_iostream_bio_sync(struct ssl_iostream *ssl_io,
 			      enum openssl_iostream_sync_type type)
 {
@@ -566,6 +639,11 @@ int openssl_iostream_bio_sync(struct ssl_iostream *ssl_io,
 
 	i_assert(type != OPENSSL_IOSTREAM_SYNC_TYPE_NONE);
 
+	if (ssl_io->bio_ext == NULL) {
+		/* OpenSSL does its own socket I/O */
+		return openssl_iostream_socket_flush(ssl_io) < 0 ? -1 : 0;
+	}
+
 	ret = openssl_iostream_bio_output(ssl_io);
 	if (ret >= 0 && openssl_iostream_bio_input(ssl_io, type) > 0)
 		ret = 1;
@@ -594,6 +672,12 @@ int openssl_iostream_handle_error(struct ssl_iostream *ssl_io, int ret,
 	err = SSL_get_error(ssl_io->ssl, ret);
 	switch (err) {
 	case SSL_ERROR_WANT_WRITE:
+		if (ssl_io->bio_ext == NULL) {
+			/* socket's send buffer is full */
+			ssl_io->want_read = FALSE;
+			o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+			return 0;
+		}
 		if (type != OPENSSL_IOSTREAM_SYNC_TYPE_NONE &&
 		    openssl_iostream_bio_sync(ssl_io, type) == 0) {
 			if (type != OPENSSL_IOSTREAM_SYNC_TYPE_WRITE)
@@ -677,6 +761,53 @@ openssl_iostream_cert_match_name(struct ssl_iostream *ssl_io,
 	return openssl_cert_match_name(ssl_io->ssl, verify_name, reason_r);
 }
 
+static enum ssl_iostream_ktls_flags
+openssl_iostream_get_ktls(struct ssl_iostream *ssl_io)
+{
+	enum ssl_iostream_ktls_flags flags = 0;
+
+	if (!ssl_io->handshaked || ssl_io->bio_ext != NULL)
+		return 0;
+#ifdef HAVE_BIO_get_ktls_send
+	if (BIO_get_ktls_send(SSL_get_wbio(ssl_io->ssl)))
+		flags |= SSL_IOSTREAM_KTLS_SEND;
+	if (BIO_get_ktls_recv(SSL_get_rbio(ssl_io->ssl)))
+		flags |= SSL_IOSTREAM_KTLS_RECV;
+#endif
+	return flags;
+}
+
+static void openssl_iostream_ktls_debug(struct ssl_iostream *ssl_io)
+{
+	enum ssl_iostream_ktls_flags flags = openssl_iostream_get_ktls(ssl_io);
+
+	if (flags == 0) {
+		e_debug(ssl_io->event, "Kernel TLS not available for %s - "
+			"encrypting in OpenSSL",
+			SSL_CIPHER_get_name(SSL_get_current_cipher(ssl_io->ssl)));
+	} else {
+		e_debug(ssl_io->event, "Kernel TLS enabled for %s%s%s",
+			(flags & SSL_IOSTREAM_KTLS_SEND) != 0 ? "send" : "",
+			flags == (SSL_IOSTREAM_KTLS_SEND |
+				  SSL_IOSTREAM_KTLS_RECV) ? " and " : "",
+			(flags & SSL_IOSTREAM_KTLS_RECV) != 0 ? "receive" : "");
+	}
+}
+
+static void
+openssl_iostream_handshake_finished_event(struct ssl_iostream *ssl_io)
+{
+	bool resumed = SSL_session_reused(ssl_io->ssl) != 0;
+	struct event_passthrough *e =
+		event_create_passthrough(ssl_io->event)->
+		set_name("ssl_handshake_finished")->
+		add_str("session_resumed", resumed ? "yes" : "no")->
+		add_str("protocol", SSL_get_version(ssl_io->ssl));
+
+	e_debug(e->event(), "SSL handshake finished (%s)",
+		resumed ? "session resumed" : "full handshake");
+}
+
 static int openssl_iostream_handshake(struct ssl_iostream *ssl_io)
 {
 	const char *reason, *error = NULL;
@@ -689,6 +820,17 @@ static int openssl_iostream_handshake(struct ssl_iostream *ssl_io)
 	if (ssl_io->destroyed)
 		return 0;
 
+	if (ssl_io->bio_ext == NULL) {
+		/* anything written to plain_output before starting SSL
+		   (e.g. STARTTLS reply) must be sent before the handshake */
+		if ((ret = openssl_iostream_socket_flush(ssl_io)) < 0) {
+			openssl_iostream_closed(ssl_io);
+			return -1;
+		}
+		if (ret == 0)
+			return 0;
+	}
+
 	if (ssl_io->ctx->client_ctx) {
 		while ((ret = SSL_connect(ssl_io->ssl)) <= 0) {
 			ret = openssl_iostream_handle_error(ssl_io, ret,
@@ -728,6 +870,9 @@ static int openssl_iostream_handshake(struct ssl_iostream *ssl_io)
 	}
 	i_free_and_null(ssl_io->last_error);
 	ssl_io->handshaked = TRUE;
+	openssl_iostream_handshake_finished_event(ssl_io);
+	if (ssl_io->bio_ext == NULL)
+		openssl_iostream_ktls_debug(ssl_io);
 
 	if (ssl_io->ssl_output != NULL)
 		(void)o_stream_flush(ssl_io->ssl_output);
@@ -961,6 +1106,7 @@ static const struct iostream_ssl_vfuncs ssl_vfuncs = {
 	.get_pfs = openssl_iostream_get_pfs,
 	.get_protocol_name = openssl_iostream_get_protocol_name,
 	.get_ja3 = openssl_iostream_get_ja3,
+	.get_ktls = openssl_iostream_get_ktls,
 };
 
 void ssl_iostream_openssl_init(void)
@@ -33,6 +33,7 @@ struct ssl_iostream {
 	struct ssl_iostream_context *ctx;
 
 	SSL *ssl;
+	/* NULL if OpenSSL uses a socket BIO for kTLS */
 	BIO *bio_ext;
 
 	struct istream *plain_input;
@@ -107,6 +108,11 @@ int openssl_min_protocol_to_options(const char *min_protocol, long *opt_r,
 int openssl_iostream_bio_sync(struct ssl_iostream *ssl_io,
 			      enum openssl_iostream_sync_type type);
 
+/* Flush plain_output when OpenSSL is writing to the socket directly.
+   Returns 1 if everything was flushed, 0 if not (flush pending is set), and
+   -1 if an error occurred. */
+int openssl_iostream_socket_flush(struct ssl_iostream *ssl_io);
+
 /* Returns 1 if the operation should be retried (we read/wrote more data),
    0 if the operation should retried later once more data has been
    read/written, -1 if a fatal error occurred (errno is set). */
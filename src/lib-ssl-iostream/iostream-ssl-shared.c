@@ -0,0 +1,524 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "ioloop.h"
+#include "hmac.h"
+#include "randgen.h"
+#include "safe-memset.h"
+#include "safe-mkstemp.h"
+#include "sha2.h"
+#include "str.h"
+#include "iostream-ssl-shared.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SSL_SHARED_MAGIC 0x53534c53 /* "SSLS" */
+/* How many times to retry reading while another process is writing */
+#define SSL_SHARED_READ_MAX_RETRIES 1000
+/* A session slot locked for longer than this was left locked by a process
+   that died while writing it. Writing a session takes microseconds. */
+#define SSL_SHARED_SESSION_LOCK_STALE_SECS 2
+#define SSL_SHARED_SESSION_KEY_SIZE 32
+
+/* All the data is protected by sequence locks: the sequence number is odd
+   while the data is being written. Readers copy the data and retry if the
+   sequence number changed meanwhile, so they never block writers. */
+struct ssl_shared_header {
+	uint32_t magic;
+	/* Number of sessions in the session cache file */
+	uint32_t session_count;
+
+	uint32_t keys_seq;
+	/* Number of ticket keys generated. The current key is
+	   keys[(keys_generated-1) % 2] and the previous key is the other
+	   one. */
+	uint32_t keys_generated;
+	struct ssl_iostream_ticket_key keys[2];
+
+	/* HMAC key for the sessions. It's in the read-only file, so a
+	   process can't change it for the other processes. */
+	unsigned char session_key[SSL_SHARED_SESSION_KEY_SIZE];
+};
+
+struct ssl_shared_session {
+	/* Sessions are written by multiple processes, so the sequence number
+	   is also the write lock. */
+	uint32_t seq;
+	uint32_t unused_padding;
+	/* When the lock was taken */
+	int64_t lock_time;
+
+	/* The following fields are authenticated by the mac */
+	uint16_t id_size;
+	uint16_t data_size;
+	int64_t expire_time;
+	unsigned char id[SSL_IOSTREAM_SESSION_ID_MAX_SIZE];
+	unsigned char data[SSL_IOSTREAM_SESSION_DATA_MAX_SIZE];
+	unsigned char mac[SHA256_RESULTLEN];
+};
+
+struct ssl_iostream_shared {
+	/* Read-only fd to the ticket keys */
+	int keys_fd;
+	/* Session cache fd, or -1 if there's no session cache */
+	int sessions_fd;
+
+	struct ssl_shared_header *hdr;
+	struct ssl_shared_session *sessions;
+	unsigned int session_count;
+
+	/* TRUE if this process created the shared state and may rotate the
+	   ticket keys */
+	bool keys_writable:1;
+};
+
+static struct ssl_iostream_shared *ssl_shared_global = NULL;
+
+static int
+ssl_shared_mmap(int fd, size_t size, int prot, void **base_r,
+		const char **error_r)
+{
+	*base_r = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	if (*base_r == MAP_FAILED) {
+		*base_r = NULL;
+		*error_r = t_strdup_printf("mmap(ssl shared) failed: %m");
+		return -1;
+	}
+	return 0;
+}
+
+/* Create an unlinked file with the given size and map it read-write.
+   If ro_fd_r isn't NULL, the returned fd is read-only and the read-write
+   fd is closed. */
+static int
+ssl_shared_create_file(const char *path_prefix, size_t size, int *ro_fd_r,
+		       int *fd_r, void **base_r, const char **error_r)
+{
+	string_t *path;
+	int fd, ro_fd = -1, ret = 0;
+
+	path = t_str_new(128);
+	str_append(path, path_prefix);
+	fd = safe_mkstemp_hostpid(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("safe_mkstemp(%s) failed: %m",
+					   str_c(path));
+		return -1;
+	}
+	if (ro_fd_r != NULL) {
+		ro_fd = open(str_c(path), O_RDONLY);
+		if (ro_fd == -1) {
+			*error_r = t_strdup_printf("open(%s) failed: %m",
+						   str_c(path));
+			ret = -1;
+		}
+	}
+	/* the fd is passed to the child processes - nobody needs the path */
+	i_unlink(str_c(path));
+	if (ret == 0 && ftruncate(fd, size) < 0) {
+		*error_r = t_strdup_printf("ftruncate(%s, %zu) failed: %m",
+					   str_c(path), size);
+		ret = -1;
+	}
+	if (ret == 0 &&
+	    ssl_shared_mmap(fd, size, PROT_READ | PROT_WRITE,
+			    base_r, error_r) < 0)
+		ret = -1;
+	if (ret < 0) {
+		i_close_fd(&ro_fd);
+		i_close_fd(&fd);
+		return -1;
+	}
+	if (ro_fd_r != NULL) {
+		/* the mapping stays writable, but the fd doesn't */
+		i_close_fd(&fd);
+		*ro_fd_r = ro_fd;
+	} else {
+		*fd_r = fd;
+	}
+	return 0;
+}
+
+int ssl_iostream_shared_create(const char *path_prefix,
+			       unsigned int session_cache_size,
+			       struct ssl_iostream_shared **shared_r,
+			       const char **error_r)
+{
+	struct ssl_iostream_shared *shared;
+	void *base;
+
+	if (session_cache_size > UINT32_MAX /
+	    sizeof(struct ssl_shared_session)) {
+		*error_r = t_strdup_printf(
+			"SSL session cache size too large: %u",
+			session_cache_size);
+		return -1;
+	}
+
+	shared = i_new(struct ssl_iostream_shared, 1);
+	shared->keys_fd = -1;
+	shared->sessions_fd = -1;
+	shared->keys_writable = TRUE;
+	if (ssl_shared_create_file(path_prefix, sizeof(*shared->hdr),
+				   &shared->keys_fd, NULL, &base,
+				   error_r) < 0) {
+		ssl_iostream_shared_free(&shared);
+		return -1;
+	}
+	shared->hdr = base;
+	if (session_cache_size > 0) {
+		if (ssl_shared_create_file(path_prefix,
+				(size_t)session_cache_size *
+				sizeof(struct ssl_shared_session),
+				NULL, &shared->sessions_fd, &base,
+				error_r) < 0) {
+			ssl_iostream_shared_free(&shared);
+			return -1;
+		}
+		shared->sessions = base;
+	}
+	shared->session_count = session_cache_size;
+	shared->hdr->magic = SSL_SHARED_MAGIC;
+	shared->hdr->session_count = session_cache_size;
+	random_fill(shared->hdr->session_key,
+		    sizeof(shared->hdr->session_key));
+	ssl_iostream_shared_rotate_ticket_keys(shared);
+	*shared_r = shared;
+	return 0;
+}
+
+static int ssl_shared_check_size(int fd, uoff_t size, const char **error_r)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0) {
+		*error_r = t_strdup_printf("fstat(ssl shared) failed: %m");
+		return -1;
+	}
+	if ((uoff_t)st.st_size != size) {
+		*error_r = t_strdup_printf(
+			"ssl shared: Invalid file size %"PRIuUOFF_T
+			" (expected %"PRIuUOFF_T")", (uoff_t)st.st_size, size);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+ssl_shared_open(struct ssl_iostream_shared *shared, const char **error_r)
+{
+	void *base;
+
+	if (ssl_shared_check_size(shared->keys_fd, sizeof(*shared->hdr),
+				  error_r) < 0)
+		return -1;
+	if (ssl_shared_mmap(shared->keys_fd, sizeof(*shared->hdr), PROT_READ,
+			    &base, error_r) < 0)
+		return -1;
+	shared->hdr = base;
+	if (shared->hdr->magic != SSL_SHARED_MAGIC) {
+		*error_r = "ssl shared: Invalid magic";
+		return -1;
+	}
+
+	/* the session count comes from the read-only keys file, so it can
+	   be trusted */
+	if (shared->hdr->session_count == 0 || shared->sessions_fd == -1)
+		return 0;
+	if (ssl_shared_check_size(shared->sessions_fd,
+			(uoff_t)shared->hdr->session_count *
+			sizeof(struct ssl_shared_session), error_r) < 0)
+		return -1;
+	if (ssl_shared_mmap(shared->sessions_fd,
+			    (size_t)shared->hdr->session_count *
+			    sizeof(struct ssl_shared_session),
+			    PROT_READ | PROT_WRITE, &base, error_r) < 0)
+		return -1;
+	shared->sessions = base;
+	shared->session_count = shared->hdr->session_count;
+	return 0;
+}
+
+int ssl_iostream_shared_open(int keys_fd, int sessions_fd,
+			     struct ssl_iostream_shared **shared_r,
+			     const char **error_r)
+{
+	struct ssl_iostream_shared *shared;
+
+	shared = i_new(struct ssl_iostream_shared, 1);
+	shared->keys_fd = keys_fd;
+	shared->sessions_fd = sessions_fd;
+	if (ssl_shared_open(shared, error_r) < 0) {
+		ssl_iostream_shared_free(&shared);
+		return -1;
+	}
+	*shared_r = shared;
+	return 0;
+}
+
+void ssl_iostream_shared_free(struct ssl_iostream_shared **_shared)
+{
+	struct ssl_iostream_shared *shared = *_shared;
+
+	if (shared == NULL)
+		return;
+	*_shared = NULL;
+
+	if (ssl_shared_global == shared)
+		ssl_shared_global = NULL;
+	if (shared->sessions != NULL &&
+	    munmap(shared->sessions, (size_t)shared->session_count *
+		   sizeof(struct ssl_shared_session)) < 0)
+		i_error("munmap(ssl shared sessions) failed: %m");
+	if (shared->hdr != NULL &&
+	    munmap(shared->hdr, sizeof(*shared->hdr)) < 0)
+		i_error("munmap(ssl shared keys) failed: %m");
+	i_close_fd(&shared->keys_fd);
+	i_close_fd(&shared->sessions_fd);
+	i_free(shared);
+}
+
+void ssl_iostream_shared_get_fds(struct ssl_iostream_shared *shared,
+				 int *keys_fd_r, int *sessions_fd_r)
+{
+	*keys_fd_r = shared->keys_fd;
+	*sessions_fd_r = shared->sessions_fd;
+}
+
+unsigned int
+ssl_iostream_shared_get_session_cache_size(struct ssl_iostream_shared *shared)
+{
+	return shared->session_count;
+}
+
+void ssl_iostream_shared_rotate_ticket_keys(struct ssl_iostream_shared *shared)
+{
+	struct ssl_shared_header *hdr = shared->hdr;
+	struct ssl_iostream_ticket_key key;
+	uint32_t seq;
+
+	i_assert(shared->keys_writable);
+	random_fill(&key, sizeof(key));
+
+	/* only the creator rotates the keys, so no write lock is needed */
+	seq = __atomic_load_n(&hdr->keys_seq, __ATOMIC_RELAXED);
+	i_assert((seq & 1) == 0);
+	__atomic_store_n(&hdr->keys_seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&hdr->keys[hdr->keys_generated % 2], &key, sizeof(key));
+	hdr->keys_generated++;
+	__atomic_store_n(&hdr->keys_seq, seq + 2, __ATOMIC_RELEASE);
+
+	safe_memset(&key, 0, sizeof(key));
+}
+
+unsigned int
+ssl_iostream_shared_get_ticket_keys(struct ssl_iostream_shared *shared,
+				    struct ssl_iostream_ticket_key keys_r[2])
+{
+	struct ssl_shared_header *hdr = shared->hdr;
+	uint32_t seq, generated;
+	unsigned int i;
+
+	for (i = 0; i < SSL_SHARED_READ_MAX_RETRIES; i++) {
+		seq = __atomic_load_n(&hdr->keys_seq, __ATOMIC_ACQUIRE);
+		if ((seq & 1) != 0)
+			continue;
+		generated = hdr->keys_generated;
+		if (generated > 0) {
+			memcpy(&keys_r[0], &hdr->keys[(generated - 1) % 2],
+			       sizeof(keys_r[0]));
+			memcpy(&keys_r[1], &hdr->keys[generated % 2],
+			       sizeof(keys_r[1]));
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&hdr->keys_seq, __ATOMIC_RELAXED) == seq)
+			return I_MIN(generated, 2);
+	}
+	/* the master apparently died while rotating the keys */
+	return 0;
+}
+
+static struct ssl_shared_session *
+ssl_shared_session_get_slot(struct ssl_iostream_shared *shared,
+			    const unsigned char *id, size_t id_size)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	/* FNV-1a. The hash must be the same in all processes, so the
+	   randomized mem_hash() can't be used. */
+	for (i = 0; i < id_size; i++) {
+		hash ^= id[i];
+		hash *= 16777619U;
+	}
+	return &shared->sessions[hash % shared->session_count];
+}
+
+static bool
+ssl_shared_session_lock(struct ssl_shared_session *slot, uint32_t *seq_r)
+{
+	uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	uint32_t new_seq = seq + 1;
+	int64_t lock_time;
+
+	if ((seq & 1) != 0) {
+		/* don't wait for other processes - the cache is only an
+		   optimization. But if the lock is stale, the process
+		   holding it has died and we can take it over. */
+		lock_time = __atomic_load_n(&slot->lock_time, __ATOMIC_RELAXED);
+		if (lock_time >= ioloop_time - SSL_SHARED_SESSION_LOCK_STALE_SECS &&
+		    lock_time <= ioloop_time + SSL_SHARED_SESSION_LOCK_STALE_SECS)
+			return FALSE;
+		new_seq = seq + 2;
+	}
+	if (!__atomic_compare_exchange_n(&slot->seq, &seq, new_seq, FALSE,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return FALSE;
+	__atomic_store_n(&slot->lock_time, (int64_t)ioloop_time,
+			 __ATOMIC_RELAXED);
+	*seq_r = new_seq;
+	return TRUE;
+}
+
+static void
+ssl_shared_session_unlock(struct ssl_shared_session *slot, uint32_t seq)
+{
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+static void
+ssl_shared_session_mac(struct ssl_iostream_shared *shared,
+		       const struct ssl_shared_session *session,
+		       unsigned char mac_r[STATIC_ARRAY SHA256_RESULTLEN])
+{
+	struct hmac_context ctx;
+
+	i_assert(session->id_size <= SSL_IOSTREAM_SESSION_ID_MAX_SIZE);
+	i_assert(session->data_size <= SSL_IOSTREAM_SESSION_DATA_MAX_SIZE);
+
+	hmac_init(&ctx, shared->hdr->session_key,
+		  sizeof(shared->hdr->session_key), &hash_method_sha256);
+	hmac_update(&ctx, &session->id_size, sizeof(session->id_size));
+	hmac_update(&ctx, &session->data_size, sizeof(session->data_size));
+	hmac_update(&ctx, &session->expire_time,
+		    sizeof(session->expire_time));
+	hmac_update(&ctx, session->id, session->id_size);
+	hmac_update(&ctx, session->data, session->data_size);
+	hmac_final(&ctx, mac_r);
+}
+
+bool ssl_iostream_shared_session_store(struct ssl_iostream_shared *shared,
+				       const unsigned char *id, size_t id_size,
+				       const unsigned char *data,
+				       size_t data_size, time_t expire_time)
+{
+	struct ssl_shared_session *slot, session;
+	uint32_t seq;
+
+	if (shared->session_count == 0 || id_size == 0 ||
+	    id_size > SSL_IOSTREAM_SESSION_ID_MAX_SIZE ||
+	    data_size > SSL_IOSTREAM_SESSION_DATA_MAX_SIZE)
+		return FALSE;
+
+	i_zero(&session);
+	session.id_size = id_size;
+	memcpy(session.id, id, id_size);
+	session.data_size = data_size;
+	memcpy(session.data, data, data_size);
+	session.expire_time = expire_time;
+	ssl_shared_session_mac(shared, &session, session.mac);
+
+	slot = ssl_shared_session_get_slot(shared, id, id_size);
+	if (!ssl_shared_session_lock(slot, &seq))
+		return FALSE;
+	memcpy(&slot->id_size, &session.id_size,
+	       sizeof(session) - offsetof(struct ssl_shared_session, id_size));
+	ssl_shared_session_unlock(slot, seq);
+	safe_memset(&session, 0, sizeof(session));
+	return TRUE;
+}
+
+bool ssl_iostream_shared_session_lookup(struct ssl_iostream_shared *shared,
+					const unsigned char *id,
+					size_t id_size, buffer_t *data)
+{
+	struct ssl_shared_session *slot, session;
+	unsigned char mac[SHA256_RESULTLEN];
+	unsigned int i;
+	uint32_t seq;
+	bool found = FALSE;
+
+	if (shared->session_count == 0 || id_size == 0 ||
+	    id_size > SSL_IOSTREAM_SESSION_ID_MAX_SIZE)
+		return FALSE;
+
+	slot = ssl_shared_session_get_slot(shared, id, id_size);
+	for (i = 0; i < SSL_SHARED_READ_MAX_RETRIES; i++) {
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if ((seq & 1) != 0) {
+			/* being written - most likely replaced by another
+			   session */
+			break;
+		}
+		memcpy(&session, slot, sizeof(session));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+			found = TRUE;
+			break;
+		}
+	}
+	if (!found)
+		return FALSE;
+
+	/* Any process can write to the session cache. Make sure the
+	   session was written as a whole by a process that has the key. */
+	if (session.id_size != id_size ||
+	    memcmp(session.id, id, id_size) != 0 ||
+	    session.expire_time <= ioloop_time ||
+	    session.data_size > SSL_IOSTREAM_SESSION_DATA_MAX_SIZE)
+		found = FALSE;
+	else {
+		ssl_shared_session_mac(shared, &session, mac);
+		found = mem_equals_timing_safe(mac, session.mac, sizeof(mac));
+	}
+	if (found)
+		buffer_append(data, session.data, session.data_size);
+	safe_memset(&session, 0, sizeof(session));
+	return found;
+}
+
+void ssl_iostream_shared_session_remove(struct ssl_iostream_shared *shared,
+					const unsigned char *id,
+					size_t id_size)
+{
+	struct ssl_shared_session *slot;
+	uint32_t seq;
+
+	if (shared->session_count == 0 || id_size == 0 ||
+	    id_size > SSL_IOSTREAM_SESSION_ID_MAX_SIZE)
+		return;
+
+	slot = ssl_shared_session_get_slot(shared, id, id_size);
+	if (!ssl_shared_session_lock(slot, &seq))
+		return;
+	if (slot->id_size == id_size && memcmp(slot->id, id, id_size) == 0) {
+		slot->id_size = 0;
+		slot->data_size = 0;
+	}
+	ssl_shared_session_unlock(slot, seq);
+}
+
+void ssl_iostream_shared_set_global(struct ssl_iostream_shared *shared)
+{
+	ssl_shared_global = shared;
+}
+
+struct ssl_iostream_shared *ssl_iostream_shared_get_global(void)
+{
+	return ssl_shared_global;
+}
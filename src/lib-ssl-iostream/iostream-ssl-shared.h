@@ -0,0 +1,91 @@
+#ifndef IOSTREAM_SSL_SHARED_H
+#define IOSTREAM_SSL_SHARED_H
+
+/* State shared by all the SSL server processes for TLS session resumption:
+   the session ticket keys and an optional session cache. The master process
+   creates it and passes the fds to the login processes, which map them with
+   ssl_iostream_shared_open(). This allows a client to resume its session
+   in a different process than where the session was created.
+
+   The ticket keys and the session cache are in separate files. Only the
+   creator can modify the ticket keys: the other processes get a read-only
+   fd to them. All the processes write to the session cache, so its entries
+   are authenticated with a key stored in the read-only file. A lookup
+   ignores entries that weren't written as a whole with the key, such as
+   garbage written to the file or an entry left half-written by a process
+   that died while writing it. The key is readable by all the processes,
+   so just like with the ticket keys, a compromised process can still
+   create sessions that the other processes accept. */
+
+struct ssl_iostream_shared;
+
+#define SSL_IOSTREAM_TICKET_KEY_NAME_SIZE 16
+#define SSL_IOSTREAM_TICKET_KEY_SECRET_SIZE 32
+/* Maximum session ID length in TLS */
+#define SSL_IOSTREAM_SESSION_ID_MAX_SIZE 32
+/* Maximum size of a serialized session. Larger sessions (e.g. with a client
+   certificate chain) aren't stored in the shared cache. */
+#define SSL_IOSTREAM_SESSION_DATA_MAX_SIZE 2048
+
+struct ssl_iostream_ticket_key {
+	unsigned char name[SSL_IOSTREAM_TICKET_KEY_NAME_SIZE];
+	unsigned char aes_key[SSL_IOSTREAM_TICKET_KEY_SECRET_SIZE];
+	unsigned char hmac_key[SSL_IOSTREAM_TICKET_KEY_SECRET_SIZE];
+};
+
+/* Create new shared state into unlinked temporary files, which are created
+   using the given path prefix. session_cache_size is the number of sessions
+   that can be stored in the cache. 0 disables the session cache. Random
+   ticket keys are generated immediately. */
+int ssl_iostream_shared_create(const char *path_prefix,
+			       unsigned int session_cache_size,
+			       struct ssl_iostream_shared **shared_r,
+			       const char **error_r);
+/* Map shared state from the fds returned by ssl_iostream_shared_get_fds().
+   sessions_fd is -1 if the session cache is disabled. The fds are closed by
+   ssl_iostream_shared_free(), or immediately if opening fails. */
+int ssl_iostream_shared_open(int keys_fd, int sessions_fd,
+			     struct ssl_iostream_shared **shared_r,
+			     const char **error_r);
+void ssl_iostream_shared_free(struct ssl_iostream_shared **shared);
+
+/* Returns the read-only ticket keys fd and the session cache fd, which is
+   -1 if the session cache is disabled. */
+void ssl_iostream_shared_get_fds(struct ssl_iostream_shared *shared,
+				 int *keys_fd_r, int *sessions_fd_r);
+unsigned int
+ssl_iostream_shared_get_session_cache_size(struct ssl_iostream_shared *shared);
+
+/* Generate a new ticket key. The previous key is still kept for decrypting
+   tickets, so tickets stay valid for two rotation intervals. This must be
+   called only by the process that created the shared state. */
+void ssl_iostream_shared_rotate_ticket_keys(struct ssl_iostream_shared *shared);
+/* Returns the current ticket key in keys_r[0] and the previous one (if any)
+   in keys_r[1]. New tickets must be encrypted only with the current key.
+   Returns the number of keys. */
+unsigned int
+ssl_iostream_shared_get_ticket_keys(struct ssl_iostream_shared *shared,
+				    struct ssl_iostream_ticket_key keys_r[2]);
+
+/* Store a serialized session to the cache. It may replace an older session
+   using the same slot. If another process is updating the same slot, the
+   session isn't stored. Returns FALSE if the session wasn't stored. */
+bool ssl_iostream_shared_session_store(struct ssl_iostream_shared *shared,
+				       const unsigned char *id, size_t id_size,
+				       const unsigned char *data,
+				       size_t data_size, time_t expire_time);
+/* Lookup a session from the cache. The session data is appended to the
+   buffer. Returns FALSE if the session wasn't found or it has expired. */
+bool ssl_iostream_shared_session_lookup(struct ssl_iostream_shared *shared,
+					const unsigned char *id,
+					size_t id_size, buffer_t *data);
+void ssl_iostream_shared_session_remove(struct ssl_iostream_shared *shared,
+					const unsigned char *id,
+					size_t id_size);
+
+/* Set/get the shared state used by the SSL server contexts of this process.
+   The caller still owns the shared state. */
+void ssl_iostream_shared_set_global(struct ssl_iostream_shared *shared);
+struct ssl_iostream_shared *ssl_iostream_shared_get_global(void);
+
+#endif
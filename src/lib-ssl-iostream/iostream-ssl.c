@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "module-dir.h"
 #include "iostream-ssl-private.h"
+#include "iostream-ssl-shared.h"
 
 #define OFFSET(name) offsetof(struct ssl_iostream_settings, name)
 static const size_t ssl_iostream_settings_string_offsets[] = {
@@ -31,6 +32,7 @@ static const struct iostream_ssl_vfuncs *ssl_vfuncs = NULL;
 static void ssl_module_unload(void)
 {
 	ssl_iostream_context_cache_free();
+	ssl_iostream_shared_set_global(NULL);
 	module_dir_unload(&ssl_module);
 }
 
@@ -325,6 +327,7 @@ void ssl_iostream_settings_drop_stream_only(struct ssl_iostream_settings *set)
 	set->verbose = FALSE;
 	set->verbose_invalid_cert = FALSE;
 	set->allow_invalid_cert = FALSE;
+	set->ktls = FALSE;
 }
 
 const char *ssl_iostream_get_cipher(struct ssl_iostream *ssl_io,
@@ -347,3 +350,8 @@ const char *ssl_iostream_get_ja3(struct ssl_iostream *ssl_io)
 {
 	return ssl_vfuncs->get_ja3(ssl_io);
 }
+
+enum ssl_iostream_ktls_flags ssl_iostream_get_ktls(struct ssl_iostream *ssl_io)
+{
+	return ssl_vfuncs->get_ktls(ssl_io);
+}
@@ -34,6 +34,9 @@ struct ssl_iostream_settings {
 	bool prefer_server_ciphers; /* both */
 	bool compression; /* context-only */
 	bool tickets; /* context-only */
+	/* Let OpenSSL offload the encryption to kernel TLS after the
+	   handshake. Requires the streams to be directly on a TCP socket. */
+	bool ktls; /* stream-only */
 };
 
 /* Load SSL module */
@@ -162,6 +165,20 @@ const char *ssl_iostream_get_protocol_name(struct ssl_iostream *ssl_io);
 
 const char *ssl_iostream_get_last_error(struct ssl_iostream *ssl_io);
 
+enum ssl_iostream_ktls_flags {
+	/* Kernel encrypts the data written to the socket */
+	SSL_IOSTREAM_KTLS_SEND = 0x01,
+	/* Kernel decrypts the data read from the socket */
+	SSL_IOSTREAM_KTLS_RECV = 0x02,
+};
+/* Returns which directions are offloaded to kernel TLS. Returns 0 if the
+   ktls setting isn't enabled, the kernel or OpenSSL doesn't support it or
+   the handshake hasn't finished yet. With SSL_IOSTREAM_KTLS_SEND the
+   plaintext can be written directly to the SSL ostream's fd once the SSL
+   ostream has been flushed. o_stream_send_istream() does this automatically,
+   so sendfile() and splice() can be used. */
+enum ssl_iostream_ktls_flags ssl_iostream_get_ktls(struct ssl_iostream *ssl_io);
+
 int ssl_iostream_context_init_client(const struct ssl_iostream_settings *set,
 				     struct ssl_iostream_context **ctx_r,
 				     const char **error_r);
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "istream-private.h"
+#include "ostream.h"
 #include "iostream-openssl.h"
 
 struct ssl_istream {
@@ -63,6 +64,17 @@ static ssize_t i_stream_ssl_read(struct istream_private *stream)
 		return -1;
 	}
 
+	if (ssl_io->bio_ext == NULL) {
+		/* OpenSSL reads the socket directly. If the ostream was
+		   waiting for input, it may be able to continue after this
+		   read. */
+		ssl_io->want_read = FALSE;
+		if (ssl_io->ostream_flush_waiting_input) {
+			ssl_io->ostream_flush_waiting_input = FALSE;
+			o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+		}
+	}
+
 	total_ret = 0;
 	for (;;) {
 		int pending = SSL_pending(ssl_io->ssl);
@@ -105,6 +105,22 @@ static int o_stream_ssl_flush_buffer(struct ssl_ostream *sstream)
 
 	i_assert(!sstream->shutdown);
 
+	if (ssl_io->bio_ext == NULL &&
+	    o_stream_get_buffer_used_size(ssl_io->plain_output) > 0) {
+		/* plaintext sent directly to the kTLS socket must be written
+		   before anything else is written via OpenSSL */
+		ret = openssl_iostream_socket_flush(ssl_io);
+		if (ret < 0) {
+			io_stream_set_error(&sstream->ostream.iostream,
+					    "%s", ssl_io->plain_stream_errstr);
+			sstream->ostream.ostream.stream_errno =
+				ssl_io->plain_stream_errno;
+			return -1;
+		}
+		if (ret == 0)
+			return 0;
+	}
+
 	while (pos < sstream->buffer->used) {
 		/* we're writing plaintext data to OpenSSL, which it encrypts
 		   and writes to bio_int's buffer. ssl_iostream_bio_sync()
@@ -181,7 +197,9 @@ static int o_stream_ssl_flush(struct ostream_private *stream)
 	/* Stream is finished; shutdown the SSL write direction once our buffer
 	   is empty. */
 	if (stream->finished && !sstream->shutdown && ret >= 0 &&
-	    (sstream->buffer == NULL || sstream->buffer->used == 0)) {
+	    (sstream->buffer == NULL || sstream->buffer->used == 0) &&
+	    (ssl_io->bio_ext != NULL ||
+	     o_stream_get_buffer_used_size(plain_output) == 0)) {
 		sstream->shutdown = TRUE;
 		if (SSL_shutdown(ssl_io->ssl) < 0) {
 			io_stream_set_error(
@@ -228,6 +246,35 @@ o_stream_ssl_sendv(struct ostream_private *stream,
 	return bytes_sent;
 }
 
+static enum ostream_send_istream_result
+o_stream_ssl_send_istream(struct ostream_private *outstream,
+			  struct istream *instream)
+{
+	struct ssl_ostream *sstream = (struct ssl_ostream *)outstream;
+	struct ssl_iostream *ssl_io = sstream->ssl_io;
+	struct ostream *plain_output = ssl_io->plain_output;
+	enum ostream_send_istream_result res;
+	uoff_t old_offset;
+
+	if ((ssl_iostream_get_ktls(ssl_io) & SSL_IOSTREAM_KTLS_SEND) == 0 ||
+	    (sstream->buffer != NULL && sstream->buffer->used > 0))
+		return io_stream_copy(&outstream->ostream, instream);
+
+	/* The kernel encrypts everything written to the socket, so the
+	   plaintext can be sent directly to plain_output. This allows it to
+	   use sendfile() or splice(). */
+	o_stream_set_splice(plain_output, outstream->splice_allowed);
+	old_offset = plain_output->offset;
+	res = o_stream_send_istream(plain_output, instream);
+	outstream->ostream.offset += plain_output->offset - old_offset;
+	if (res == OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT) {
+		io_stream_set_error(&outstream->iostream, "%s",
+				    o_stream_get_error(plain_output));
+		outstream->ostream.stream_errno = plain_output->stream_errno;
+	}
+	return res;
+}
+
 static void o_stream_ssl_switch_ioloop_to(struct ostream_private *stream,
 					  struct ioloop *ioloop)
 {
@@ -264,10 +311,17 @@ o_stream_ssl_get_buffer_used_size(const struct ostream_private *stream)
 {
 	const struct ssl_ostream *sstream = (const struct ssl_ostream *)stream;
 	BIO *bio = SSL_get_wbio(sstream->ssl_io->ssl);
-	size_t wbuf_avail = BIO_ctrl_get_write_guarantee(bio);
-	size_t wbuf_total_size = BIO_get_write_buf_size(bio, 0);
+	size_t wbuf_avail, wbuf_total_size;
 	size_t buffer_used = (sstream->buffer == NULL ? 0 :
 			      sstream->buffer->used);
+
+	if (sstream->ssl_io->bio_ext == NULL) {
+		/* socket BIO - OpenSSL doesn't buffer anything */
+		return buffer_used +
+			o_stream_get_buffer_used_size(sstream->ssl_io->plain_output);
+	}
+	wbuf_avail = BIO_ctrl_get_write_guarantee(bio);
+	wbuf_total_size = BIO_get_write_buf_size(bio, 0);
 	i_assert(wbuf_avail <= wbuf_total_size);
 	return buffer_used + (wbuf_total_size - wbuf_avail) +
 		o_stream_get_buffer_used_size(sstream->ssl_io->plain_output);
@@ -319,6 +373,7 @@ struct ostream *openssl_o_stream_create_ssl(struct ssl_iostream *ssl_io)
 	sstream->ostream.iostream.destroy = o_stream_ssl_destroy;
 	sstream->ostream.sendv = o_stream_ssl_sendv;
 	sstream->ostream.flush = o_stream_ssl_flush;
+	sstream->ostream.send_istream = o_stream_ssl_send_istream;
 	sstream->ostream.switch_ioloop_to = o_stream_ssl_switch_ioloop_to;
 
 	sstream->ostream.get_buffer_used_size =
@@ -0,0 +1,433 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "buffer.h"
+#include "ioloop.h"
+#include "lib-signals.h"
+#include "istream.h"
+#include "ostream.h"
+#include "iostream-openssl.h"
+#include "iostream-ssl.h"
+#include "iostream-ssl-shared.h"
+#include "iostream-ssl-test.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#define TEST_SHARED_PATH_PREFIX ".test-iostream-ssl-shared."
+
+struct test_resume_endpoint {
+	int fd;
+	struct istream *input;
+	struct ostream *output;
+	struct ssl_iostream *iostream;
+	struct io *io;
+	bool server;
+	bool sent;
+	bool failed;
+};
+
+static struct ssl_iostream_shared *test_shared_create(unsigned int count)
+{
+	struct ssl_iostream_shared *shared;
+	const char *error;
+
+	if (ssl_iostream_shared_create(TEST_SHARED_PATH_PREFIX, count,
+				       &shared, &error) < 0)
+		i_fatal("ssl_iostream_shared_create() failed: %s", error);
+	return shared;
+}
+
+static struct ssl_iostream_shared *
+test_shared_open(struct ssl_iostream_shared *shared)
+{
+	struct ssl_iostream_shared *shared2;
+	const char *error;
+	int keys_fd, sessions_fd;
+
+	ssl_iostream_shared_get_fds(shared, &keys_fd, &sessions_fd);
+	keys_fd = dup(keys_fd);
+	if (keys_fd == -1)
+		i_fatal("dup() failed: %m");
+	if (sessions_fd != -1) {
+		sessions_fd = dup(sessions_fd);
+		if (sessions_fd == -1)
+			i_fatal("dup() failed: %m");
+	}
+	if (ssl_iostream_shared_open(keys_fd, sessions_fd,
+				     &shared2, &error) < 0)
+		i_fatal("ssl_iostream_shared_open() failed: %s", error);
+	return shared2;
+}
+
+static void test_iostream_ssl_shared_ticket_keys(void)
+{
+	struct ssl_iostream_shared *shared, *shared2;
+	struct ssl_iostream_ticket_key keys[2], keys2[2];
+	int keys_fd, sessions_fd;
+
+	test_begin("ssl shared ticket keys");
+	shared = test_shared_create(0);
+	shared2 = test_shared_open(shared);
+
+	/* the keys can't be modified through the fd given to the other
+	   processes */
+	ssl_iostream_shared_get_fds(shared, &keys_fd, &sessions_fd);
+	test_assert((fcntl(keys_fd, F_GETFL) & O_ACCMODE) == O_RDONLY);
+	test_assert(sessions_fd == -1);
+	test_assert(pwrite(keys_fd, "x", 1, 0) < 0);
+
+	test_assert(ssl_iostream_shared_get_ticket_keys(shared, keys) == 1);
+	test_assert(ssl_iostream_shared_get_ticket_keys(shared2, keys2) == 1);
+	test_assert(memcmp(&keys[0], &keys2[0], sizeof(keys[0])) == 0);
+
+	/* the rotation is visible in the other mapping and the old key is
+	   kept as the previous key */
+	ssl_iostream_shared_rotate_ticket_keys(shared);
+	test_assert(ssl_iostream_shared_get_ticket_keys(shared2, keys2) == 2);
+	test_assert(memcmp(&keys[0], &keys2[1], sizeof(keys[0])) == 0);
+	test_assert(memcmp(keys[0].name, keys2[0].name,
+			   sizeof(keys[0].name)) != 0);
+
+	ssl_iostream_shared_rotate_ticket_keys(shared);
+	test_assert(ssl_iostream_shared_get_ticket_keys(shared2, keys) == 2);
+	test_assert(memcmp(&keys[1], &keys2[0], sizeof(keys[0])) == 0);
+
+	ssl_iostream_shared_free(&shared2);
+	ssl_iostream_shared_free(&shared);
+	test_end();
+}
+
+static void test_iostream_ssl_shared_sessions(void)
+{
+	struct ssl_iostream_shared *shared, *shared2;
+	const unsigned char id1[] = "session id 1", id2[] = "session id 2";
+	unsigned char large[SSL_IOSTREAM_SESSION_DATA_MAX_SIZE + 1];
+	buffer_t *buf = t_buffer_create(64);
+	unsigned int i;
+
+	test_begin("ssl shared sessions");
+	shared = test_shared_create(4);
+	shared2 = test_shared_open(shared);
+	test_assert(ssl_iostream_shared_get_session_cache_size(shared2) == 4);
+
+	test_assert(!ssl_iostream_shared_session_lookup(shared, id1,
+							sizeof(id1), buf));
+	test_assert(ssl_iostream_shared_session_store(shared, id1, sizeof(id1),
+		(const unsigned char *)"data1", 5, ioloop_time + 100));
+	test_assert(ssl_iostream_shared_session_lookup(shared2, id1,
+						       sizeof(id1), buf));
+	test_assert(buf->used == 5 && memcmp(buf->data, "data1", 5) == 0);
+	test_assert(!ssl_iostream_shared_session_lookup(shared2, id2,
+							sizeof(id2), buf));
+
+	/* expired */
+	test_assert(ssl_iostream_shared_session_store(shared2, id2, sizeof(id2),
+		(const unsigned char *)"data2", 5, ioloop_time - 1));
+	buffer_set_used_size(buf, 0);
+	test_assert(!ssl_iostream_shared_session_lookup(shared, id2,
+							sizeof(id2), buf));
+	test_assert(buf->used == 0);
+
+	/* too large */
+	memset(large, 0, sizeof(large));
+	test_assert(!ssl_iostream_shared_session_store(shared, id2, sizeof(id2),
+		large, sizeof(large), ioloop_time + 100));
+
+	/* remove */
+	ssl_iostream_shared_session_remove(shared2, id1, sizeof(id1));
+	test_assert(!ssl_iostream_shared_session_lookup(shared, id1,
+							sizeof(id1), buf));
+
+	/* sessions replace each others when the cache is full */
+	for (i = 0; i < 100; i++) {
+		unsigned char id[4] = { i, i >> 8, 0xaa, 0x55 };
+
+		test_assert_idx(ssl_iostream_shared_session_store(shared,
+			id, sizeof(id), id, sizeof(id), ioloop_time + 100), i);
+		buffer_set_used_size(buf, 0);
+		test_assert_idx(ssl_iostream_shared_session_lookup(shared2,
+			id, sizeof(id), buf), i);
+		test_assert_idx(buf->used == sizeof(id) &&
+				memcmp(buf->data, id, sizeof(id)) == 0, i);
+	}
+
+	ssl_iostream_shared_free(&shared2);
+	ssl_iostream_shared_free(&shared);
+	test_end();
+}
+
+static void test_iostream_ssl_shared_sessions_corrupted(void)
+{
+	struct ssl_iostream_shared *shared, *shared2;
+	const unsigned char id[] = "session id";
+	buffer_t *buf = t_buffer_create(64);
+	unsigned char *map;
+	uint32_t *seq;
+	struct stat st;
+	off_t i;
+	int keys_fd, sessions_fd;
+
+	test_begin("ssl shared sessions corrupted");
+	shared = test_shared_create(1);
+	shared2 = test_shared_open(shared);
+	/* all the processes can write to the sessions file */
+	ssl_iostream_shared_get_fds(shared, &keys_fd, &sessions_fd);
+	if (fstat(sessions_fd, &st) < 0)
+		i_fatal("fstat() failed: %m");
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   sessions_fd, 0);
+	if (map == MAP_FAILED)
+		i_fatal("mmap() failed: %m");
+
+	/* modified session data is ignored */
+	test_assert(ssl_iostream_shared_session_store(shared, id, sizeof(id),
+		(const unsigned char *)"data1", 5, ioloop_time + 100));
+	for (i = 0; i + 5 <= st.st_size; i++) {
+		if (memcmp(map + i, "data1", 5) == 0)
+			break;
+	}
+	test_assert(i + 5 <= st.st_size);
+	if (i + 5 <= st.st_size)
+		map[i + 4] = '2';
+	test_assert(!ssl_iostream_shared_session_lookup(shared2, id,
+							sizeof(id), buf));
+	test_assert(buf->used == 0);
+
+	/* the sequence number is at the beginning of the only slot. An odd
+	   number means that a process is writing the slot. */
+	seq = (uint32_t *)map;
+	test_assert(ssl_iostream_shared_session_store(shared, id, sizeof(id),
+		(const unsigned char *)"data1", 5, ioloop_time + 100));
+	*seq += 1;
+	test_assert(!ssl_iostream_shared_session_lookup(shared2, id,
+							sizeof(id), buf));
+	test_assert(!ssl_iostream_shared_session_store(shared2, id, sizeof(id),
+		(const unsigned char *)"data2", 5, ioloop_time + 100));
+
+	/* the process died while writing - the lock is taken over after a
+	   while */
+	ioloop_time += 10;
+	test_assert(ssl_iostream_shared_session_store(shared2, id, sizeof(id),
+		(const unsigned char *)"data2", 5, ioloop_time + 100));
+	test_assert((*seq & 1) == 0);
+	test_assert(ssl_iostream_shared_session_lookup(shared, id,
+						       sizeof(id), buf));
+	test_assert(buf->used == 5 && memcmp(buf->data, "data2", 5) == 0);
+	ioloop_time -= 10;
+
+	if (munmap(map, st.st_size) < 0)
+		i_fatal("munmap() failed: %m");
+	ssl_iostream_shared_free(&shared2);
+	ssl_iostream_shared_free(&shared);
+	test_end();
+}
+
+static void test_resume_input(struct test_resume_endpoint *ep)
+{
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	if (ep->server) {
+		if ((ret = ssl_iostream_handshake(ep->iostream)) < 0) {
+			ep->failed = TRUE;
+			io_loop_stop(current_ioloop);
+		} else if (ret > 0 && !ep->sent) {
+			o_stream_nsend_str(ep->output, "x");
+			test_assert(o_stream_flush(ep->output) > 0);
+			ep->sent = TRUE;
+		}
+		return;
+	}
+	/* Reading also processes the TLSv1.3 session tickets, which are
+	   sent after the handshake. */
+	if ((ret = i_stream_read_more(ep->input, &data, &size)) > 0) {
+		test_assert(size == 1 && data[0] == 'x');
+		io_loop_stop(current_ioloop);
+	} else if (ret < 0) {
+		ep->failed = TRUE;
+		io_loop_stop(current_ioloop);
+	}
+}
+
+static void
+test_resume_endpoint_init(struct test_resume_endpoint *ep, int fd,
+			  struct ssl_iostream_context *ctx, bool server)
+{
+	struct ssl_iostream_settings set;
+	const char *error;
+	int ret;
+
+	i_zero(ep);
+	ep->fd = fd;
+	ep->server = server;
+	ep->input = i_stream_create_fd(fd, 1024);
+	ep->output = o_stream_create_fd(fd, 1024);
+	o_stream_uncork(ep->output);
+	i_zero(&set);
+	set.allow_invalid_cert = TRUE;
+	if (server) {
+		ret = io_stream_create_ssl_server(ctx, &set, NULL,
+						  &ep->input, &ep->output,
+						  &ep->iostream, &error);
+	} else {
+		ret = io_stream_create_ssl_client(ctx, "localhost", &set, NULL,
+						  &ep->input, &ep->output,
+						  &ep->iostream, &error);
+	}
+	if (ret < 0)
+		i_fatal("SSL stream creation failed: %s", error);
+	ep->io = io_add_istream(ep->input, test_resume_input, ep);
+}
+
+static void test_resume_endpoint_deinit(struct test_resume_endpoint *ep)
+{
+	io_remove(&ep->io);
+	ssl_iostream_destroy(&ep->iostream);
+	i_stream_unref(&ep->input);
+	o_stream_unref(&ep->output);
+	i_close_fd(&ep->fd);
+}
+
+static void test_resume_timeout(void *context ATTR_UNUSED)
+{
+	test_assert(FALSE);
+	io_loop_stop(current_ioloop);
+}
+
+/* Connect to the server and return whether the previous session was
+   resumed. The new session is returned in session. */
+static bool
+test_resume_connect(struct ssl_iostream_context *server_ctx,
+		    struct ssl_iostream_context *client_ctx,
+		    SSL_SESSION **session)
+{
+	struct test_resume_endpoint server, client;
+	struct ioloop *ioloop;
+	struct timeout *to;
+	bool resumed;
+	int fd[2];
+
+	ioloop = io_loop_create();
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+		i_fatal("socketpair() failed: %m");
+	fd_set_nonblock(fd[0], TRUE);
+	fd_set_nonblock(fd[1], TRUE);
+	test_resume_endpoint_init(&server, fd[0], server_ctx, TRUE);
+	test_resume_endpoint_init(&client, fd[1], client_ctx, FALSE);
+	if (*session != NULL)
+		test_assert(SSL_set_session(client.iostream->ssl, *session) == 1);
+
+	to = timeout_add_short(5000, test_resume_timeout, NULL);
+	test_assert(ssl_iostream_handshake(client.iostream) >= 0);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+	test_assert(!server.failed && !client.failed);
+
+	resumed = SSL_session_reused(server.iostream->ssl) != 0;
+	if (*session != NULL)
+		SSL_SESSION_free(*session);
+	*session = SSL_get1_session(client.iostream->ssl);
+
+	test_resume_endpoint_deinit(&server);
+	test_resume_endpoint_deinit(&client);
+	io_loop_destroy(&ioloop);
+	return resumed;
+}
+
+static void test_iostream_ssl_shared_resume_with(bool tickets)
+{
+	struct ssl_iostream_shared *shared;
+	struct ssl_iostream_context *server_ctx1, *server_ctx2, *client_ctx;
+	struct ssl_iostream_settings server_set, client_set;
+	SSL_SESSION *session = NULL;
+	const char *error;
+
+	ssl_iostream_test_settings_server(&server_set);
+	server_set.tickets = tickets;
+	ssl_iostream_test_settings_client(&client_set);
+	client_set.allow_invalid_cert = TRUE;
+	if (ssl_iostream_context_init_client(&client_set, &client_ctx,
+					     &error) < 0)
+		i_fatal("ssl_iostream_context_init_client() failed: %s", error);
+
+	/* Without the shared state the contexts (which are like separate
+	   processes) can't resume each others' sessions. */
+	test_assert(ssl_iostream_context_init_server(&server_set, &server_ctx1,
+						     &error) == 0);
+	test_assert(ssl_iostream_context_init_server(&server_set, &server_ctx2,
+						     &error) == 0);
+	test_assert(!test_resume_connect(server_ctx1, client_ctx, &session));
+	test_assert(test_resume_connect(server_ctx1, client_ctx, &session));
+	test_assert(!test_resume_connect(server_ctx2, client_ctx, &session));
+	ssl_iostream_context_unref(&server_ctx1);
+	ssl_iostream_context_unref(&server_ctx2);
+
+	shared = test_shared_create(tickets ? 0 : 16);
+	ssl_iostream_shared_set_global(shared);
+	test_assert(ssl_iostream_context_init_server(&server_set, &server_ctx1,
+						     &error) == 0);
+	test_assert(ssl_iostream_context_init_server(&server_set, &server_ctx2,
+						     &error) == 0);
+	SSL_SESSION_free(session);
+	session = NULL;
+	test_assert(!test_resume_connect(server_ctx1, client_ctx, &session));
+	test_assert(test_resume_connect(server_ctx2, client_ctx, &session));
+	test_assert(test_resume_connect(server_ctx1, client_ctx, &session));
+
+	if (tickets) {
+		/* tickets encrypted with the previous key are still
+		   accepted, but not with the key before it */
+		ssl_iostream_shared_rotate_ticket_keys(shared);
+		test_assert(test_resume_connect(server_ctx2, client_ctx,
+						&session));
+		ssl_iostream_shared_rotate_ticket_keys(shared);
+		ssl_iostream_shared_rotate_ticket_keys(shared);
+		test_assert(!test_resume_connect(server_ctx1, client_ctx,
+						 &session));
+	}
+
+	SSL_SESSION_free(session);
+	ssl_iostream_context_unref(&server_ctx1);
+	ssl_iostream_context_unref(&server_ctx2);
+	ssl_iostream_context_unref(&client_ctx);
+	ssl_iostream_shared_free(&shared);
+	test_assert(ssl_iostream_shared_get_global() == NULL);
+}
+
+static void test_iostream_ssl_shared_resume(void)
+{
+	test_begin("ssl shared session resumption with tickets");
+	test_iostream_ssl_shared_resume_with(TRUE);
+	test_end();
+
+	test_begin("ssl shared session resumption with session cache");
+	test_iostream_ssl_shared_resume_with(FALSE);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_iostream_ssl_shared_ticket_keys,
+		test_iostream_ssl_shared_sessions,
+		test_iostream_ssl_shared_sessions_corrupted,
+		test_iostream_ssl_shared_resume,
+		NULL
+	};
+	int ret;
+
+	/* the peer may have already closed the connection when the
+	   SSL stream is destroyed */
+	lib_signals_init();
+	lib_signals_ignore(SIGPIPE, TRUE);
+	ssl_iostream_openssl_init();
+	ret = test_run(test_functions);
+	ssl_iostream_openssl_deinit();
+	lib_signals_deinit();
+	return ret;
+}
@@ -2,7 +2,11 @@
 
 #include "test-lib.h"
 #include "buffer.h"
+#include "str.h"
+#include "net.h"
 #include "randgen.h"
+#include "safe-mkstemp.h"
+#include "write-full.h"
 #include "istream.h"
 #include "ostream.h"
 #include "iostream-openssl.h"
@@ -12,6 +16,7 @@
 #include <sys/socket.h>
 
 #define MAX_SENT_BYTES 10000
+#define KTLS_FILE_SIZE (1024*1024)
 
 struct test_endpoint {
 	pool_t pool;
@@ -29,6 +34,7 @@ struct test_endpoint {
 	bool failed;
 
 	struct test_endpoint *other;
+	struct istream *file_input;
 
 	bool finished:1;
 };
@@ -376,6 +382,16 @@ static void test_iostream_ssl_handshake(void)
 							 "127.0.0.1") != 0, idx);
 	idx++;
 
+	/* ktls enabled, but not usable with UNIX sockets */
+	ssl_iostream_test_settings_server(&server_set);
+	ssl_iostream_test_settings_client(&client_set);
+	client_set.allow_invalid_cert = TRUE;
+	server_set.ktls = TRUE;
+	client_set.ktls = TRUE;
+	test_assert_idx(test_iostream_ssl_handshake_real(&server_set, &client_set,
+							 "localhost") == 0, idx);
+	idx++;
+
 	io_loop_destroy(&ioloop);
 
 	test_end();
@@ -548,12 +564,175 @@ static void test_iostream_ssl_small_packets(void)
 	test_end();
 }
 
+static void test_tcp_socketpair(int fd[2])
+{
+	struct ip_addr ip;
+	in_port_t port = 0;
+	int listen_fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	listen_fd = net_listen(&ip, &port, 1);
+	if (listen_fd == -1)
+		i_fatal("net_listen() failed: %m");
+	fd[1] = net_connect_ip_blocking(&ip, port, NULL);
+	if (fd[1] == -1)
+		i_fatal("net_connect_ip() failed: %m");
+	fd_set_nonblock(listen_fd, FALSE);
+	fd[0] = net_accept(listen_fd, NULL, NULL);
+	if (fd[0] < 0)
+		i_fatal("net_accept() failed: %m");
+	i_close_fd(&listen_fd);
+	fd_set_nonblock(fd[0], TRUE);
+	fd_set_nonblock(fd[1], TRUE);
+}
+
+static int ktls_send_callback(struct test_endpoint *ep)
+{
+	int ret;
+
+	if (ep->finished)
+		return flush_output(ep, TRUE);
+	if ((ret = flush_output(ep, FALSE)) <= 0)
+		return ret;
+
+	switch (o_stream_send_istream(ep->output, ep->file_input)) {
+	case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+		return flush_output(ep, TRUE);
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+		i_unreached();
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+		return 0;
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+		break;
+	}
+	test_assert(FALSE);
+	io_loop_stop(current_ioloop);
+	return -1;
+}
+
+static void ktls_read_callback(struct test_endpoint *ep)
+{
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	while ((ret = i_stream_read_more(ep->input, &data, &size)) > 0) {
+		buffer_append(ep->last_write, data, size);
+		i_stream_skip(ep->input, size);
+	}
+	if (ret < 0) {
+		test_assert(ep->input->stream_errno == 0);
+		ep->finished = TRUE;
+		io_loop_stop(current_ioloop);
+	}
+}
+
+static void test_iostream_ssl_ktls(void)
+{
+	struct ssl_iostream_settings set;
+	struct test_endpoint *server, *client;
+	struct ioloop *ioloop;
+	struct timeout *to;
+	string_t *path = t_str_new(128);
+	unsigned char *data;
+	int fd[2], file_fd;
+	const char *error;
+
+	test_begin("ssl: ktls");
+
+	/* the file is sent with sendfile() if kTLS is available */
+	str_append(path, ".test-iostream-ssl-ktls.");
+	file_fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (file_fd == -1)
+		i_fatal("safe_mkstemp(%s) failed: %m", str_c(path));
+	i_unlink(str_c(path));
+	data = i_malloc(KTLS_FILE_SIZE);
+	random_fill(data, KTLS_FILE_SIZE);
+	if (write_full(file_fd, data, KTLS_FILE_SIZE) < 0)
+		i_fatal("write(%s) failed: %m", str_c(path));
+
+	test_tcp_socketpair(fd);
+	ioloop = io_loop_create();
+
+	ssl_iostream_test_settings_server(&set);
+	set.ktls = TRUE;
+	server = create_test_endpoint(fd[0], &set);
+	ssl_iostream_test_settings_client(&set);
+	set.allow_invalid_cert = TRUE;
+	set.ktls = TRUE;
+	client = create_test_endpoint(fd[1], &set);
+	client->client = TRUE;
+	client->other = server;
+	server->other = client;
+
+	test_assert(ssl_iostream_context_init_server(server->set, &server->ctx,
+		    &error) == 0);
+	test_assert(ssl_iostream_context_init_client(client->set, &client->ctx,
+		    &error) == 0);
+	test_assert(io_stream_create_ssl_server(server->ctx, server->set, NULL,
+						&server->input, &server->output,
+						&server->iostream, &error) == 0);
+	test_assert(io_stream_create_ssl_client(client->ctx, "localhost",
+						client->set, NULL,
+						&client->input, &client->output,
+						&client->iostream, &error) == 0);
+	/* kTLS isn't available before the handshake */
+	test_assert(ssl_iostream_get_ktls(server->iostream) == 0);
+
+	server->io = io_add_istream(server->input, handshake_input_callback,
+				    server);
+	client->io = io_add_istream(client->input, handshake_input_callback,
+				    client);
+	test_assert(ssl_iostream_handshake(client->iostream) == 0);
+	to = timeout_add(10000, io_loop_stop, ioloop);
+	io_loop_run(ioloop);
+	test_assert(!server->failed && !client->failed);
+	test_assert(ssl_iostream_is_handshaked(server->iostream));
+	io_remove(&server->io);
+	io_remove(&client->io);
+
+	/* data written via OpenSSL must stay in order with the data written
+	   directly to the socket */
+	o_stream_nsend_str(server->output, "header\n");
+	server->file_input = i_stream_create_fd(file_fd, IO_BLOCK_SIZE);
+	o_stream_set_flush_callback(server->output, ktls_send_callback, server);
+	o_stream_set_flush_pending(server->output, TRUE);
+	client->io = io_add_istream(client->input, ktls_read_callback, client);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+
+	test_assert(client->finished);
+	test_assert(client->last_write->used == 7 + KTLS_FILE_SIZE);
+	test_assert(client->last_write->used >= 7 &&
+		    memcmp(client->last_write->data, "header\n", 7) == 0);
+	test_assert(client->last_write->used == 7 + KTLS_FILE_SIZE &&
+		    memcmp(CONST_PTR_OFFSET(client->last_write->data, 7),
+			   data, KTLS_FILE_SIZE) == 0);
+	test_assert(server->output->offset == 7 + KTLS_FILE_SIZE);
+
+	i_stream_unref(&server->file_input);
+	i_stream_unref(&server->input);
+	o_stream_unref(&server->output);
+	i_stream_unref(&client->input);
+	o_stream_unref(&client->output);
+	destroy_test_endpoint(&server);
+	destroy_test_endpoint(&client);
+	io_loop_destroy(&ioloop);
+	i_close_fd(&file_fd);
+	i_free(data);
+
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_iostream_ssl_handshake,
 		test_iostream_ssl_get_buffer_avail_size,
 		test_iostream_ssl_small_packets,
+		test_iostream_ssl_ktls,
 		NULL
 	};
 	ssl_iostream_openssl_init();
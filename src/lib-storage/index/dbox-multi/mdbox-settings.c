@@ -11,10 +11,13 @@
 #define DEF(type, name) \
 	SETTING_DEFINE_STRUCT_##type(#name, name, struct mdbox_settings)
 
+static bool mdbox_settings_check(void *_set, pool_t pool, const char **error_r);
+
 static const struct setting_define mdbox_setting_defines[] = {
 	DEF(BOOL, mdbox_preallocate_space),
 	DEF(SIZE, mdbox_rotate_size),
 	DEF(TIME, mdbox_rotate_interval),
+	DEF(UINT, mdbox_rebuild_processes),
 
 	SETTING_DEFINE_LIST_END
 };
@@ -22,7 +25,8 @@ static const struct setting_define mdbox_setting_defines[] = {
 static const struct mdbox_settings mdbox_default_settings = {
 	.mdbox_preallocate_space = FALSE,
 	.mdbox_rotate_size = 10*1024*1024,
-	.mdbox_rotate_interval = 0
+	.mdbox_rotate_interval = 0,
+	.mdbox_rebuild_processes = 1
 };
 
 static const struct setting_parser_info mdbox_setting_parser_info = {
@@ -34,10 +38,28 @@ static const struct setting_parser_info mdbox_setting_parser_info = {
 	.struct_size = sizeof(struct mdbox_settings),
 
 	.parent_offset = SIZE_MAX,
-	.parent = &mail_user_setting_parser_info
+	.parent = &mail_user_setting_parser_info,
+
+	.check_func = mdbox_settings_check
 };
 
 const struct setting_parser_info *mdbox_get_setting_parser_info(void)
 {
 	return &mdbox_setting_parser_info;
 }
+
+/* <settings checks> */
+static bool mdbox_settings_check(void *_set, pool_t pool ATTR_UNUSED,
+				 const char **error_r)
+{
+	struct mdbox_settings *set = _set;
+
+	if (set->mdbox_rebuild_processes > MDBOX_REBUILD_MAX_PROCESSES) {
+		*error_r = t_strdup_printf(
+			"mdbox_rebuild_processes must not be higher than %u",
+			MDBOX_REBUILD_MAX_PROCESSES);
+		return FALSE;
+	}
+	return TRUE;
+}
+/* </settings checks> */
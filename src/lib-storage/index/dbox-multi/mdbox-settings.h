@@ -1,10 +1,16 @@
 #ifndef MDBOX_SETTINGS_H
 #define MDBOX_SETTINGS_H
 
+/* <settings checks> */
+/* Upper limit for mdbox_rebuild_processes */
+#define MDBOX_REBUILD_MAX_PROCESSES 64
+/* </settings checks> */
+
 struct mdbox_settings {
 	bool mdbox_preallocate_space;
 	uoff_t mdbox_rotate_size;
 	unsigned int mdbox_rotate_interval;
+	unsigned int mdbox_rebuild_processes;
 };
 
 const struct setting_parser_info *mdbox_get_setting_parser_info(void);
@@ -5,7 +5,10 @@
 #include "ioloop.h"
 #include "istream.h"
 #include "hash.h"
+#include "lib-signals.h"
 #include "str.h"
+#include "time-util.h"
+#include "write-full.h"
 #include "mail-cache.h"
 #include "index-rebuild.h"
 #include "mail-namespace.h"
@@ -17,9 +20,49 @@
 #include "mdbox-storage-rebuild.h"
 
 #include <dirent.h>
+#include <poll.h>
 #include <unistd.h>
+#include <sys/wait.h>
 
 #define REBUILD_MAX_REFCOUNT 32768
+/* Flush the scanning process's output when it grows this large */
+#define REBUILD_SCAN_OUTPUT_FLUSH_SIZE (64*1024)
+/* Send progress events at most this often */
+#define REBUILD_SCAN_PROGRESS_INTERVAL_MSECS 1000
+
+#define REBUILD_SCAN_FLAG_POP3_UIDL	0x01
+#define REBUILD_SCAN_FLAG_POP3_ORDER	0x02
+#define REBUILD_SCAN_FLAG_FILE_DONE	0x04
+
+/* Sent by the scanning processes to the parent for each message, followed
+   by the GUID string. A record with REBUILD_SCAN_FLAG_FILE_DONE and no GUID
+   is sent after the file has been scanned. */
+struct mdbox_rebuild_scan_record {
+	uint32_t file_id;
+	uint32_t offset;
+	uint32_t rec_size;
+	uint16_t flags;
+	uint16_t guid_len;
+	uint64_t mail_size;
+};
+
+struct mdbox_rebuild_file {
+	uint32_t file_id;
+	const char *dir, *fname;
+};
+
+struct mdbox_rebuild_scan_process {
+	pid_t pid;
+	int fd;
+	buffer_t *buf;
+};
+
+struct mdbox_rebuild_scanned_msg {
+	struct mdbox_rebuild_msg *rec;
+	const char *guid;
+	uint16_t flags;
+};
+ARRAY_DEFINE_TYPE(mdbox_rebuild_scanned_msg, struct mdbox_rebuild_scanned_msg);
 
 struct mdbox_rebuild_msg {
 	struct mdbox_rebuild_msg *guid_hash_next;
@@ -52,6 +95,14 @@ struct mdbox_storage_rebuild_context {
 	HASH_TABLE(uint8_t *, struct mdbox_rebuild_msg *) guid_hash;
 	ARRAY(struct mdbox_rebuild_msg *) msgs;
 	ARRAY_TYPE(seq_range) seen_file_ids;
+	ARRAY(struct mdbox_rebuild_file) files;
+
+	/* Set in a scanning process. The found messages are written to
+	   scan_fd instead of being added to msgs. */
+	buffer_t *scan_output;
+	int scan_fd;
+	unsigned int files_scanned, mails_scanned;
+	struct timeval last_progress;
 
 	uint32_t rebuild_count;
 	uint32_t highest_file_id;
@@ -80,6 +131,8 @@ mdbox_storage_rebuild_init(struct mdbox_storage *storage,
 			  guid_128_hash, guid_128_cmp);
 	i_array_init(&ctx->msgs, 512);
 	i_array_init(&ctx->seen_file_ids, 128);
+	i_array_init(&ctx->files, 128);
+	ctx->scan_fd = -1;
 
 	ctx->storage->rebuilding_storage = TRUE;
 	return ctx;
@@ -95,6 +148,7 @@ mdbox_storage_rebuild_deinit(struct mdbox_storage_rebuild_context *ctx)
 	hash_table_destroy(&ctx->guid_hash);
 	pool_unref(&ctx->pool);
 	array_free(&ctx->seen_file_ids);
+	array_free(&ctx->files);
 	array_free(&ctx->msgs);
 	i_free(ctx);
 }
@@ -130,22 +184,104 @@ static int mdbox_rebuild_msg_uid_cmp(struct mdbox_rebuild_msg *const *m1,
 	return 0;
 }
 
-static void rebuild_scan_metadata(struct mdbox_storage_rebuild_context *ctx,
-				  struct dbox_file *file)
+static uint16_t rebuild_scan_metadata_flags(struct dbox_file *file)
 {
+	uint16_t flags = 0;
+
 	if (dbox_file_metadata_get(file, DBOX_METADATA_POP3_UIDL) != NULL)
-		ctx->have_pop3_uidls = TRUE;
+		flags |= REBUILD_SCAN_FLAG_POP3_UIDL;
 	if (dbox_file_metadata_get(file, DBOX_METADATA_POP3_ORDER) != NULL)
+		flags |= REBUILD_SCAN_FLAG_POP3_ORDER;
+	return flags;
+}
+
+static void rebuild_set_metadata_flags(struct mdbox_storage_rebuild_context *ctx,
+				       uint16_t flags)
+{
+	if ((flags & REBUILD_SCAN_FLAG_POP3_UIDL) != 0)
+		ctx->have_pop3_uidls = TRUE;
+	if ((flags & REBUILD_SCAN_FLAG_POP3_ORDER) != 0)
 		ctx->have_pop3_orders = TRUE;
 }
 
+static void rebuild_scan_metadata(struct mdbox_storage_rebuild_context *ctx,
+				  struct dbox_file *file)
+{
+	rebuild_set_metadata_flags(ctx, rebuild_scan_metadata_flags(file));
+}
+
+static void rebuild_add_msg(struct mdbox_storage_rebuild_context *ctx,
+			    struct mdbox_rebuild_msg *rec, const char *guid,
+			    uint16_t flags)
+{
+	struct event *event = ctx->storage->storage.storage.event;
+	struct mdbox_rebuild_msg *old_rec;
+	uint8_t *guid_p;
+
+	rebuild_set_metadata_flags(ctx, flags);
+
+	mail_generate_guid_128_hash(guid, rec->guid_128);
+	i_assert(!guid_128_is_empty(rec->guid_128));
+	array_push_back(&ctx->msgs, &rec);
+
+	guid_p = rec->guid_128;
+	old_rec = hash_table_lookup(ctx->guid_hash, guid_p);
+	if (old_rec == NULL)
+		hash_table_insert(ctx->guid_hash, guid_p, rec);
+	else if (rec->mail_size == old_rec->mail_size) {
+		/* two mails' GUID and size are the same, which quite
+		   likely means that their contents are the same as
+		   well. we'll compare the mail sizes instead of the
+		   record sizes, because the records' metadata may
+		   differ.
+
+		   save this duplicate mail with refcount=0 to the map,
+		   so it will eventually be purged. */
+		rec->seen_zero_ref_in_map = TRUE;
+	} else {
+		/* duplicate GUID, but not a duplicate message. */
+		e_error(event, "Duplicate GUID %s in "
+			"m.%u:%u (size=%"PRIuUOFF_T") and m.%u:%u "
+			"(size=%"PRIuUOFF_T")",
+			guid, old_rec->file_id, old_rec->offset,
+			old_rec->mail_size, rec->file_id, rec->offset,
+			rec->mail_size);
+		rec->guid_hash_next = old_rec->guid_hash_next;
+		old_rec->guid_hash_next = rec;
+	}
+}
+
+static int rebuild_scan_output_flush(struct mdbox_storage_rebuild_context *ctx)
+{
+	if (ctx->scan_output->used == 0)
+		return 0;
+	if (write_full(ctx->scan_fd, ctx->scan_output->data,
+		       ctx->scan_output->used) < 0) {
+		e_error(ctx->storage->storage.storage.event,
+			"rebuild: write() to parent process failed: %m");
+		return -1;
+	}
+	buffer_set_used_size(ctx->scan_output, 0);
+	return 0;
+}
+
+static int
+rebuild_scan_output(struct mdbox_storage_rebuild_context *ctx,
+		    const struct mdbox_rebuild_scan_record *scan_rec,
+		    const char *guid)
+{
+	buffer_append(ctx->scan_output, scan_rec, sizeof(*scan_rec));
+	buffer_append(ctx->scan_output, guid, scan_rec->guid_len);
+	if (ctx->scan_output->used < REBUILD_SCAN_OUTPUT_FLUSH_SIZE)
+		return 0;
+	return rebuild_scan_output_flush(ctx);
+}
+
 static int rebuild_file_mails(struct mdbox_storage_rebuild_context *ctx,
 			      struct dbox_file *file, uint32_t file_id)
 {
-	struct event *event = file->storage->storage.event;
 	const char *guid;
-	uint8_t *guid_p;
-	struct mdbox_rebuild_msg *rec, *old_rec;
+	struct mdbox_rebuild_msg *rec;
 	uoff_t offset, prev_offset;
 	bool last, first, fixed = FALSE;
 	int ret;
@@ -191,42 +327,37 @@ static int rebuild_file_mails(struct mdbox_storage_rebuild_context *ctx,
 			ret = 0;
 			break;
 		}
-		rebuild_scan_metadata(ctx, file);
+		ctx->mails_scanned++;
+
+		if (ctx->scan_output != NULL) {
+			struct mdbox_rebuild_scan_record scan_rec = {
+				.file_id = file_id,
+				.offset = offset,
+				.rec_size = file->input->v_offset - offset,
+				.flags = rebuild_scan_metadata_flags(file),
+				.guid_len = strlen(guid),
+				.mail_size = dbox_file_get_plaintext_size(file),
+			};
+			if (strlen(guid) > UINT16_MAX) {
+				dbox_file_set_corrupted(file,
+					"Message GUID is too long");
+				ret = 0;
+				break;
+			}
+			if (rebuild_scan_output(ctx, &scan_rec, guid) < 0) {
+				ret = -1;
+				break;
+			}
+			continue;
+		}
 
 		rec = p_new(ctx->pool, struct mdbox_rebuild_msg, 1);
 		rec->file_id = file_id;
 		rec->offset = offset;
 		rec->rec_size = file->input->v_offset - offset;
 		rec->mail_size = dbox_file_get_plaintext_size(file);
-		mail_generate_guid_128_hash(guid, rec->guid_128);
-		i_assert(!guid_128_is_empty(rec->guid_128));
-		array_push_back(&ctx->msgs, &rec);
-
-		guid_p = rec->guid_128;
-		old_rec = hash_table_lookup(ctx->guid_hash, guid_p);
-		if (old_rec == NULL)
-			hash_table_insert(ctx->guid_hash, guid_p, rec);
-		else if (rec->mail_size == old_rec->mail_size) {
-			/* two mails' GUID and size are the same, which quite
-			   likely means that their contents are the same as
-			   well. we'll compare the mail sizes instead of the
-			   record sizes, because the records' metadata may
-			   differ.
-
-			   save this duplicate mail with refcount=0 to the map,
-			   so it will eventually be purged. */
-			rec->seen_zero_ref_in_map = TRUE;
-		} else {
-			/* duplicate GUID, but not a duplicate message. */
-			e_error(event, "Duplicate GUID %s in "
-				"m.%u:%u (size=%"PRIuUOFF_T") and m.%u:%u "
-				"(size=%"PRIuUOFF_T")",
-				guid, old_rec->file_id, old_rec->offset,
-				old_rec->mail_size, rec->file_id, rec->offset,
-				rec->mail_size);
-			rec->guid_hash_next = old_rec->guid_hash_next;
-			old_rec->guid_hash_next = rec;
-		}
+		rebuild_add_msg(ctx, rec, guid,
+				rebuild_scan_metadata_flags(file));
 	}
 	if (ret < 0)
 		return -1;
@@ -265,11 +396,9 @@ static int rebuild_add_file(struct mdbox_storage_rebuild_context *ctx,
 			    const char *dir, const char *fname)
 {
 	struct event *event = ctx->storage->storage.storage.event;
-	struct dbox_file *file;
+	struct mdbox_rebuild_file *rfile;
 	uint32_t file_id;
 	const char *id_str, *ext;
-	bool deleted;
-	int ret = 0;
 
 	id_str = fname + strlen(MDBOX_MAIL_FILE_PREFIX);
 	if (str_to_uint32(id_str, &file_id) < 0 || file_id == 0) {
@@ -297,15 +426,325 @@ static int rebuild_add_file(struct mdbox_storage_rebuild_context *ctx,
 	}
 	seq_range_array_add(&ctx->seen_file_ids, file_id);
 
-	file = mdbox_file_init(ctx->storage, file_id);
+	/* the files are scanned only after all of them have been found */
+	rfile = array_append_space(&ctx->files);
+	rfile->file_id = file_id;
+	rfile->dir = p_strdup(ctx->pool, dir);
+	rfile->fname = p_strdup(ctx->pool, fname);
+	return 0;
+}
+
+static void
+rebuild_scan_progress(struct mdbox_storage_rebuild_context *ctx,
+		      unsigned int process_count, bool finished)
+{
+	struct event *event = ctx->storage->storage.storage.event;
+	struct timeval now;
+
+	i_gettimeofday(&now);
+	if (!finished && timeval_diff_msecs(&now, &ctx->last_progress) <
+	    REBUILD_SCAN_PROGRESS_INTERVAL_MSECS)
+		return;
+	ctx->last_progress = now;
+
+	e_debug(event_create_passthrough(event)->
+		set_name(finished ? "mdbox_rebuild_scan_finished" :
+			 "mdbox_rebuild_scan_progress")->
+		add_int("files_scanned", ctx->files_scanned)->
+		add_int("files_count", array_count(&ctx->files))->
+		add_int("mails_scanned", ctx->mails_scanned)->
+		add_int("processes", process_count)->event(),
+		"rebuild: Scanned %u/%u files, %u mails",
+		ctx->files_scanned, array_count(&ctx->files),
+		ctx->mails_scanned);
+}
+
+static int
+rebuild_scan_file(struct mdbox_storage_rebuild_context *ctx,
+		  const struct mdbox_rebuild_file *rfile)
+{
+	struct event *event = ctx->storage->storage.storage.event;
+	struct dbox_file *file;
+	bool deleted;
+	int ret;
+
+	file = mdbox_file_init(ctx->storage, rfile->file_id);
 	if ((ret = dbox_file_open(file, &deleted)) > 0 && !deleted)
-		ret = rebuild_file_mails(ctx, file, file_id);
-	if (ret == 0)
-		e_error(event, "rebuild: Failed to fix file %s/%s", dir, fname);
+		ret = rebuild_file_mails(ctx, file, rfile->file_id);
+	if (ret == 0) {
+		e_error(event, "rebuild: Failed to fix file %s/%s",
+			rfile->dir, rfile->fname);
+	}
 	dbox_file_unref(&file);
 	return ret < 0 ? -1 : 0;
 }
 
+static int
+rebuild_scan_files(struct mdbox_storage_rebuild_context *ctx,
+		   unsigned int process_idx, unsigned int process_count)
+{
+	const struct mdbox_rebuild_file *files;
+	unsigned int i, count;
+	int ret = 0;
+
+	files = array_get(&ctx->files, &count);
+	for (i = process_idx; i < count && ret == 0; i += process_count) {
+		T_BEGIN {
+			ret = rebuild_scan_file(ctx, &files[i]);
+		} T_END;
+		if (ret < 0)
+			break;
+
+		if (ctx->scan_output == NULL) {
+			ctx->files_scanned++;
+			rebuild_scan_progress(ctx, 1, FALSE);
+		} else {
+			struct mdbox_rebuild_scan_record scan_rec = {
+				.file_id = files[i].file_id,
+				.flags = REBUILD_SCAN_FLAG_FILE_DONE,
+			};
+			ret = rebuild_scan_output(ctx, &scan_rec, "");
+		}
+	}
+	if (ret == 0 && ctx->scan_output != NULL)
+		ret = rebuild_scan_output_flush(ctx);
+	return ret;
+}
+
+static void ATTR_NORETURN rebuild_scan_process_exit(int *status)
+{
+	_exit(*status);
+}
+
+static void ATTR_NORETURN
+rebuild_scan_process_run(struct mdbox_storage_rebuild_context *ctx,
+			 unsigned int process_idx, unsigned int process_count,
+			 int fd)
+{
+	int ret;
+
+	/* Scan the files and write the results to the parent. All the state
+	   is shared with the parent process, so none of the normal
+	   deinitialization or atexit callbacks may run here, not even on
+	   i_fatal(). The inherited signal handlers would act for the parent
+	   and the ioloop's epoll/io_uring instance is the parent's, so reset
+	   the signals and move to a new ioloop. Stats events would be written
+	   to the parent's stats connection, so disable them. */
+	i_set_failure_exit_callback(rebuild_scan_process_exit);
+	lib_signals_reset_forked();
+	(void)io_loop_create();
+	event_disable_callbacks(ctx->storage->storage.storage.event);
+
+	ctx->scan_fd = fd;
+	ctx->scan_output = buffer_create_dynamic(default_pool,
+		REBUILD_SCAN_OUTPUT_FLUSH_SIZE + 1024);
+	ret = rebuild_scan_files(ctx, process_idx, process_count);
+	_exit(ret < 0 ? 1 : 0);
+}
+
+static bool
+rebuild_scan_parse(struct mdbox_storage_rebuild_context *ctx,
+		   pool_t guid_pool,
+		   ARRAY_TYPE(mdbox_rebuild_scanned_msg) *scanned,
+		   buffer_t *buf)
+{
+	struct mdbox_rebuild_scan_record scan_rec;
+	struct mdbox_rebuild_scanned_msg *smsg;
+	struct mdbox_rebuild_msg *rec;
+	const unsigned char *data = buf->data;
+	size_t pos = 0;
+
+	while (buf->used - pos >= sizeof(scan_rec)) {
+		memcpy(&scan_rec, data + pos, sizeof(scan_rec));
+		if (buf->used - pos - sizeof(scan_rec) < scan_rec.guid_len)
+			break;
+		pos += sizeof(scan_rec);
+
+		if ((scan_rec.flags & REBUILD_SCAN_FLAG_FILE_DONE) != 0) {
+			if (scan_rec.guid_len != 0)
+				return FALSE;
+			ctx->files_scanned++;
+			continue;
+		}
+		if (scan_rec.guid_len == 0)
+			return FALSE;
+
+		rec = p_new(ctx->pool, struct mdbox_rebuild_msg, 1);
+		rec->file_id = scan_rec.file_id;
+		rec->offset = scan_rec.offset;
+		rec->rec_size = scan_rec.rec_size;
+		rec->mail_size = scan_rec.mail_size;
+
+		/* the GUIDs are added to the hash once all the messages
+		   have been scanned and sorted */
+		smsg = array_append_space(scanned);
+		smsg->rec = rec;
+		smsg->flags = scan_rec.flags;
+		smsg->guid = p_strndup(guid_pool, data + pos,
+				       scan_rec.guid_len);
+		pos += scan_rec.guid_len;
+		ctx->mails_scanned++;
+	}
+	buffer_delete(buf, 0, pos);
+	return TRUE;
+}
+
+static int
+rebuild_scanned_msg_cmp(const struct mdbox_rebuild_scanned_msg *m1,
+			const struct mdbox_rebuild_scanned_msg *m2)
+{
+	return mdbox_rebuild_msg_offset_cmp(&m1->rec, &m2->rec);
+}
+
+static int
+rebuild_scan_files_parallel(struct mdbox_storage_rebuild_context *ctx,
+			    unsigned int process_count)
+{
+	struct mail_storage *storage = &ctx->storage->storage.storage;
+	struct mdbox_rebuild_scan_process *procs;
+	ARRAY_TYPE(mdbox_rebuild_scanned_msg) scanned;
+	struct mdbox_rebuild_scanned_msg *smsg;
+	struct pollfd *pfds;
+	unsigned int i, j, started = 0, running;
+	pool_t guid_pool;
+	ssize_t ret;
+	int fd[2], status, result = 0;
+
+	procs = t_new(struct mdbox_rebuild_scan_process, process_count);
+	pfds = t_new(struct pollfd, process_count);
+	for (i = 0; i < process_count; i++) {
+		if (pipe(fd) < 0) {
+			mail_storage_set_critical(storage,
+				"rebuild: pipe() failed: %m");
+			result = -1;
+			break;
+		}
+		procs[i].pid = fork();
+		if (procs[i].pid < 0) {
+			mail_storage_set_critical(storage,
+				"rebuild: fork() failed: %m");
+			i_close_fd(&fd[0]);
+			i_close_fd(&fd[1]);
+			result = -1;
+			break;
+		}
+		if (procs[i].pid == 0) {
+			/* child */
+			i_close_fd(&fd[0]);
+			for (j = 0; j < i; j++)
+				i_close_fd(&procs[j].fd);
+			rebuild_scan_process_run(ctx, i, process_count, fd[1]);
+		}
+		i_close_fd(&fd[1]);
+		procs[i].fd = fd[0];
+		procs[i].buf = t_buffer_create(REBUILD_SCAN_OUTPUT_FLUSH_SIZE*2);
+		started++;
+	}
+
+	/* read the results while the processes are scanning */
+	guid_pool = pool_alloconly_create("mdbox rebuild guids", 1024*64);
+	i_array_init(&scanned, 1024);
+	running = started;
+	while (running > 0) {
+		for (i = j = 0; i < started; i++) {
+			if (procs[i].fd == -1)
+				continue;
+			pfds[j].fd = procs[i].fd;
+			pfds[j].events = POLLIN;
+			pfds[j].revents = 0;
+			j++;
+		}
+		if (poll(pfds, j, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			i_fatal("poll() failed: %m");
+		}
+		for (i = j = 0; i < started; i++) {
+			if (procs[i].fd == -1)
+				continue;
+			if (pfds[j++].revents == 0)
+				continue;
+
+			ret = read(procs[i].fd,
+				   buffer_append_space_unsafe(procs[i].buf, 8192),
+				   8192);
+			buffer_set_used_size(procs[i].buf, procs[i].buf->used -
+					     8192 + I_MAX(ret, 0));
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0) {
+				mail_storage_set_critical(storage,
+					"rebuild: read() from scanning process "
+					"failed: %m");
+				result = -1;
+			} else if (ret > 0) {
+				if (!rebuild_scan_parse(ctx, guid_pool,
+							&scanned,
+							procs[i].buf)) {
+					mail_storage_set_critical(storage,
+						"rebuild: Scanning process "
+						"sent invalid data");
+					result = -1;
+				} else {
+					rebuild_scan_progress(ctx,
+						process_count, FALSE);
+					continue;
+				}
+			} else if (procs[i].buf->used > 0) {
+				mail_storage_set_critical(storage,
+					"rebuild: Scanning process sent "
+					"truncated data");
+				result = -1;
+			}
+			i_close_fd(&procs[i].fd);
+			running--;
+		}
+	}
+
+	for (i = 0; i < started; i++) {
+		if (waitpid(procs[i].pid, &status, 0) < 0) {
+			mail_storage_set_critical(storage,
+				"rebuild: waitpid() failed: %m");
+			result = -1;
+		} else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			mail_storage_set_critical(storage,
+				"rebuild: Scanning process %s failed",
+				dec2str(procs[i].pid));
+			result = -1;
+		}
+	}
+
+	if (result == 0) {
+		/* add the messages in the same order as if they were
+		   scanned by a single process */
+		array_sort(&scanned, rebuild_scanned_msg_cmp);
+		array_foreach_modifiable(&scanned, smsg)
+			rebuild_add_msg(ctx, smsg->rec, smsg->guid, smsg->flags);
+	}
+	array_free(&scanned);
+	pool_unref(&guid_pool);
+	return result;
+}
+
+static int rebuild_scan_all_files(struct mdbox_storage_rebuild_context *ctx)
+{
+	unsigned int process_count = ctx->storage->set->mdbox_rebuild_processes;
+	int ret;
+
+	/* There's no point in having more processes than files */
+	process_count = I_MIN(process_count, array_count(&ctx->files));
+	i_gettimeofday(&ctx->last_progress);
+	if (process_count <= 1) {
+		process_count = 1;
+		ret = rebuild_scan_files(ctx, 0, 1);
+	} else T_BEGIN {
+		ret = rebuild_scan_files_parallel(ctx, process_count);
+	} T_END;
+	if (ret == 0)
+		rebuild_scan_progress(ctx, process_count, TRUE);
+	return ret;
+}
+
 static void
 rebuild_add_missing_map_uids(struct mdbox_storage_rebuild_context *ctx,
 			     uint32_t next_uid)
@@ -958,6 +1397,8 @@ static int mdbox_storage_rebuild_scan(struct mdbox_storage_rebuild_context *ctx)
 				ctx->storage->alt_storage_dir, TRUE) < 0)
 			return -1;
 	}
+	if (rebuild_scan_all_files(ctx) < 0)
+		return -1;
 
 	rebuild_apply_map(ctx);
 	if (rebuild_mailboxes(ctx) < 0 ||
@@ -16,6 +16,10 @@
 #include "index-storage.h"
 #include "index-mail.h"
 
+/* Maximum number of messages whose cached headers are looked up at once
+   when they are fetched sequentially. */
+#define INDEX_MAIL_HEADERS_BATCH_COUNT 100
+
 static const struct message_parser_settings msg_parser_set = {
 	.hdr_flags = MESSAGE_HEADER_PARSER_FLAG_SKIP_INITIAL_LWSP |
 		MESSAGE_HEADER_PARSER_FLAG_DROP_CR,
@@ -928,6 +932,81 @@ static void index_mail_filter_stream_destroy(struct index_mail *mail)
 	i_stream_destroy(&mail->data.filter_stream);
 }
 
+static bool
+index_mail_headers_batch_lookup(struct index_mail *mail,
+				struct mailbox_header_lookup_ctx *headers,
+				string_t *dest)
+{
+	struct mail *_mail = &mail->mail.mail;
+	const struct mail_cache_headers_result *result;
+	uint32_t seq2, messages_count;
+
+	if (!mail->mail.search_mail)
+		return FALSE;
+
+	if (mail->headers_batch_ctx != headers) {
+		/* different headers than previously - start over */
+		mailbox_header_lookup_unref(&mail->headers_batch_ctx);
+		mailbox_header_lookup_ref(headers);
+		mail->headers_batch_ctx = headers;
+		mail->headers_batch = NULL;
+		mail->headers_batch_last_seq = _mail->seq;
+		return FALSE;
+	}
+	if (mail->headers_batch == NULL ||
+	    _mail->seq < mail->headers_batch_seq1 ||
+	    _mail->seq > mail->headers_batch_seq2) {
+		if (_mail->seq != mail->headers_batch_last_seq + 1) {
+			/* not fetching sequentially */
+			mail->headers_batch_last_seq = _mail->seq;
+			return FALSE;
+		}
+		/* don't look up messages that the search won't return */
+		messages_count = mail_index_view_get_messages_count(
+			_mail->transaction->view);
+		seq2 = I_MIN(mail->headers_batch_max_seq, messages_count);
+		seq2 = I_MIN(seq2,
+			     _mail->seq + INDEX_MAIL_HEADERS_BATCH_COUNT - 1);
+		if (seq2 <= _mail->seq) {
+			/* nothing to batch */
+			mail->headers_batch_last_seq = _mail->seq;
+			return FALSE;
+		}
+
+		if (mail->headers_batch_pool == NULL) {
+			mail->headers_batch_pool = pool_alloconly_create(
+				MEMPOOL_GROWING"index mail headers batch", 4096);
+		} else {
+			p_clear(mail->headers_batch_pool);
+		}
+		mail->headers_batch = NULL;
+		if (mail_cache_lookup_headers_range(
+				_mail->transaction->cache_view, _mail->seq,
+				seq2, headers->idx, headers->count,
+				mail->headers_batch_pool,
+				&mail->headers_batch) < 0) {
+			mail->headers_batch = NULL;
+			mail->headers_batch_last_seq = _mail->seq;
+			return FALSE;
+		}
+		mail->headers_batch_seq1 = _mail->seq;
+		mail->headers_batch_seq2 = seq2;
+	}
+	mail->headers_batch_last_seq = _mail->seq;
+
+	result = &mail->headers_batch[_mail->seq - mail->headers_batch_seq1];
+	if (!result->found) {
+		/* The header may have been added to cache after the batch
+		   lookup. Let the caller look it up again. */
+		return FALSE;
+	}
+	mail_cache_lookup_headers_range_used(_mail->transaction->cache_view,
+					     _mail->seq, headers->idx,
+					     headers->count);
+	str_append_data(dest, result->data, result->size);
+	return TRUE;
+}
+
 int index_mail_get_header_stream(struct mail *_mail,
 				 struct mailbox_header_lookup_ctx *headers,
 				 struct istream **stream_r)
@@ -948,7 +1027,8 @@ int index_mail_get_header_stream(struct mail *_mail,
 	}
 
 	dest = str_new(mail->mail.data_pool, 256);
-	if (mail_cache_lookup_headers(_mail->transaction->cache_view, dest,
+	if (index_mail_headers_batch_lookup(mail, headers, dest) ||
+	    mail_cache_lookup_headers(_mail->transaction->cache_view, dest,
 				      _mail->seq, headers->idx,
 				      headers->count) > 0) {
 		str_append(dest, "\n");
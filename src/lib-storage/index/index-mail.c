@@ -2313,6 +2313,8 @@ void index_mail_free(struct mail *_mail)
 
 	mailbox_header_lookup_unref(&mail->data.wanted_headers);
 	mailbox_header_lookup_unref(&mail->mail.wanted_headers);
+	mailbox_header_lookup_unref(&mail->headers_batch_ctx);
+	pool_unref(&mail->headers_batch_pool);
 	event_unref(&mail->mail._event);
 	pool_unref(&mail->mail.data_pool);
 	pool_unref(&mail->mail.pool);
@@ -155,6 +155,20 @@ struct index_mail {
 	ARRAY(unsigned int) header_match_lines;
 	uint8_t header_match_value;
 
+	/* Cached headers looked up for a range of messages at once while
+	   fetching them sequentially. headers_batch_ctx is the headers of the
+	   previous index_mail_get_header_stream() call, headers_batch_last_seq
+	   its sequence. */
+	struct mailbox_header_lookup_ctx *headers_batch_ctx;
+	uint32_t headers_batch_last_seq;
+	/* Set by the search before prefetching the mail: the last sequence
+	   that the search may return after this mail. The batch isn't
+	   extended past it. 0 = unknown, no batching. */
+	uint32_t headers_batch_max_seq;
+	pool_t headers_batch_pool;
+	uint32_t headers_batch_seq1, headers_batch_seq2;
+	struct mail_cache_headers_result *headers_batch;
+
 	bool pop3_state_set:1;
 	/* close() is being called from mail_free() */
 	bool freeing:1;
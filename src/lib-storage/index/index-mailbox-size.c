@@ -1,10 +1,6 @@
 /* Copyright (c) 2002-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
-#include "str.h"
-#include "strescape.h"
-#include "net.h"
-#include "write-full.h"
 #include "mail-search-build.h"
 #include "index-storage.h"
 #include "index-mailbox-size.h"
@@ -36,9 +32,6 @@
 #define VSIZE_LOCK_SUFFIX "dovecot-vsize.lock"
 #define VSIZE_UPDATE_MAX_LOCK_SECS 10
 
-#define INDEXER_SOCKET_NAME "indexer"
-#define INDEXER_HANDSHAKE "VERSION\tindexer-client\t1\t0\n"
-
 struct mailbox_vsize_update {
 	struct mailbox *box;
 	struct mail_index_view *view;
@@ -194,36 +187,6 @@ index_mailbox_vsize_update_write(struct mailbox_vsize_update *update)
 	index_mailbox_vsize_update_write_to_index(update);
 }
 
-static void index_mailbox_vsize_notify_indexer(struct mailbox *box)
-{
-	string_t *str = t_str_new(256);
-	const char *path;
-	int fd;
-
-	path = t_strconcat(box->storage->user->set->base_dir,
-			   "/"INDEXER_SOCKET_NAME, NULL);
-	fd = net_connect_unix(path);
-	if (fd == -1) {
-		mailbox_set_critical(box,
-			"Can't start vsize building on background: "
-			"net_connect_unix(%s) failed: %m", path);
-		return;
-	}
-	str_append(str, INDEXER_HANDSHAKE);
-	str_append(str, "APPEND\t0\t");
-	str_append_tabescaped(str, box->storage->user->username);
-	str_append_c(str, '\t');
-	str_append_tabescaped(str, box->vname);
-	str_append_c(str, '\n');
-
-	if (write_full(fd, str_data(str), str_len(str)) < 0) {
-		mailbox_set_critical(box,
-			"Can't start vsize building on background: "
-			"write(%s) failed: %m", path);
-	}
-	i_close_fd(&fd);
-}
-
 void index_mailbox_vsize_update_deinit(struct mailbox_vsize_update **_update)
 {
 	struct mailbox_vsize_update *update = *_update;
@@ -234,7 +197,8 @@ void index_mailbox_vsize_update_deinit(struct mailbox_vsize_update **_update)
 		index_mailbox_vsize_update_write(update);
 	file_lock_free(&update->lock);
 	if (update->finish_in_background)
-		index_mailbox_vsize_notify_indexer(update->box);
+		(void)index_storage_notify_indexer(update->box, "APPEND",
+						   "vsize building");
 
 	mail_index_view_close(&update->view);
 	i_free(update);
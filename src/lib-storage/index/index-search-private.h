@@ -5,6 +5,7 @@
 
 #include <sys/time.h>
 
+struct mail_search_arg;
 struct mail_search_mime_part;
 struct imap_message_part;
 
@@ -19,6 +20,11 @@ struct index_search_context {
 	struct mailbox_header_lookup_ctx *extra_wanted_headers;
 
 	uint32_t seq1, seq2;
+	/* All matching messages have (flags & flags_mask) == flags */
+	enum mail_flags flags;
+	uint8_t flags_mask;
+	/* All matching messages have these keywords set/unset */
+	ARRAY_TYPE(keyword_indexes) keywords_set, keywords_unset;
 	struct mail *cur_mail;
 	struct index_mail *cur_imail;
 	struct mail_thread_context *thread_ctx;
@@ -1122,6 +1122,63 @@ static bool search_limit_by_hdr(struct index_search_context *ctx,
 	return *seq1 <= *seq2;
 }
 
+static void
+search_init_keywords_filter(struct index_search_context *ctx,
+			    const struct mail_search_arg *arg)
+{
+	const struct mail_keywords *keywords = arg->initialized.keywords;
+	ARRAY_TYPE(keyword_indexes) *dest;
+
+	if (keywords == NULL || keywords->count == 0)
+		return;
+
+	if (!arg->match_not)
+		dest = &ctx->keywords_set;
+	else if (keywords->count == 1)
+		dest = &ctx->keywords_unset;
+	else {
+		/* NOT with multiple keywords means that any of them is
+		   unset */
+		return;
+	}
+	if (!array_is_created(dest))
+		i_array_init(dest, keywords->count);
+	array_append(dest, keywords->idx, keywords->count);
+}
+
+static void search_init_flags_filter(struct index_search_context *ctx,
+				     struct mail_search_arg *args)
+{
+	enum mail_flags flags, ignore_flags_mask;
+
+	/* \Recent isn't in the index and private flags aren't in the shared
+	   index, so they can't be used for skipping messages */
+	ignore_flags_mask = MAIL_RECENT;
+	if (ctx->box->view_pvt != NULL)
+		ignore_flags_mask |= mailbox_get_private_flags_mask(ctx->box);
+
+	for (; args != NULL; args = args->next) {
+		if (args->type == SEARCH_KEYWORDS) {
+			search_init_keywords_filter(ctx, args);
+			continue;
+		}
+		if (args->type != SEARCH_FLAGS)
+			continue;
+
+		flags = args->value.flags & ENUM_NEGATE(ignore_flags_mask);
+		if (!args->match_not) {
+			ctx->flags |= flags;
+			ctx->flags_mask |= flags;
+		} else if (flags == args->value.flags &&
+			   bits_is_power_of_two(flags)) {
+			/* NOT with multiple flags means that any of them is
+			   unset, which can't be expressed with a mask */
+			ctx->flags_mask |= flags;
+			ctx->flags &= ENUM_NEGATE(flags);
+		}
+	}
+}
+
 static void search_get_seqset(struct index_search_context *ctx,
 			      unsigned int messages_count,
 			      struct mail_search_arg *args)
@@ -1155,7 +1212,9 @@ static void search_get_seqset(struct index_search_context *ctx,
 		/* no matches */
 		ctx->seq1 = 1;
 		ctx->seq2 = 0;
+		return;
 	}
+	search_init_flags_filter(ctx, args);
 }
 
 static int search_build_subthread(struct mail_thread_iterate_context *iter,
@@ -1404,6 +1463,10 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 		mail_thread_deinit(&ctx->thread_ctx);
 	array_free(&ctx->mail_ctx.results);
 	array_free(&ctx->mail_ctx.module_contexts);
+	if (array_is_created(&ctx->keywords_set))
+		array_free(&ctx->keywords_set);
+	if (array_is_created(&ctx->keywords_unset))
+		array_free(&ctx->keywords_unset);
 
 	array_foreach_elem(&ctx->mail_ctx.mails, mail) {
 		struct index_mail *imail = INDEX_MAIL(mail);
@@ -1752,9 +1815,43 @@ struct mail *index_search_get_mail(struct index_search_context *ctx)
 	return mail;
 }
 
+/* Returns the end of the sequence range starting from seq that the search
+   may return messages from. The messages after it are outside the search's
+   sequence range or sequence sets. */
+static uint32_t
+index_search_get_seq_range_end(struct index_search_context *ctx, uint32_t seq)
+{
+	const struct mail_search_arg *arg;
+	const struct seq_range *range;
+	unsigned int idx, left_idx, right_idx, count;
+	uint32_t seq2 = ctx->seq2;
+
+	/* The root level args are ANDed, so the search can't return
+	   messages outside seq's range in any of their sequence sets. */
+	for (arg = ctx->mail_ctx.args->args; arg != NULL; arg = arg->next) {
+		if (arg->type != SEARCH_SEQSET || arg->match_not)
+			continue;
+		range = array_get(&arg->value.seqset, &count);
+		left_idx = 0;
+		right_idx = count;
+		while (left_idx < right_idx) {
+			idx = (left_idx + right_idx) / 2;
+			if (range[idx].seq2 < seq)
+				left_idx = idx + 1;
+			else
+				right_idx = idx;
+		}
+		if (left_idx == count || range[left_idx].seq1 > seq)
+			return seq;
+		seq2 = I_MIN(seq2, range[left_idx].seq2);
+	}
+	return I_MAX(seq, seq2);
+}
+
 static int search_more_with_prefetching(struct index_search_context *ctx,
 					struct mail **mail_r)
 {
+	struct index_mail *imail;
 	struct mail *mail, *const *mails;
 	unsigned int count;
 	int ret = 0;
@@ -1765,6 +1862,9 @@ static int search_more_with_prefetching(struct index_search_context *ctx,
 		} T_END;
 		if (ret <= 0)
 			break;
+		imail = INDEX_MAIL(mail);
+		imail->headers_batch_max_seq =
+			index_search_get_seq_range_end(ctx, mail->seq);
 
 		if (ctx->mail_ctx.sort_program != NULL) {
 			/* don't prefetch when using a sort program,
@@ -1931,6 +2031,53 @@ bool index_storage_search_next_nonblock(struct mail_search_context *_ctx,
 	return TRUE;
 }
 
+static bool
+search_skip_keywords(struct index_search_context *ctx,
+		     const ARRAY_TYPE(keyword_indexes) *keywords, bool set,
+		     uint32_t *seq)
+{
+	unsigned int keyword_idx;
+	uint32_t next_seq;
+
+	if (!array_is_created(keywords))
+		return TRUE;
+	array_foreach_elem(keywords, keyword_idx) {
+		mail_index_lookup_next_keyword(ctx->view, *seq, keyword_idx,
+					       set, &next_seq);
+		if (next_seq == 0 || next_seq > ctx->seq2)
+			return FALSE;
+		*seq = next_seq;
+	}
+	return TRUE;
+}
+
+/* Skip over messages whose flags or keywords can't match. Returns FALSE if
+   none of the remaining messages can match. */
+static bool
+search_skip_nonmatching(struct index_search_context *ctx, uint32_t *seq)
+{
+	uint32_t prev_seq, next_seq;
+
+	do {
+		prev_seq = *seq;
+		if (ctx->flags_mask != 0) {
+			mail_index_lookup_next_flags(ctx->view, *seq,
+						     ctx->flags, ctx->flags_mask,
+						     &next_seq);
+			if (next_seq == 0 || next_seq > ctx->seq2)
+				return FALSE;
+			*seq = next_seq;
+		}
+		if (!search_skip_keywords(ctx, &ctx->keywords_set, TRUE, seq) ||
+		    !search_skip_keywords(ctx, &ctx->keywords_unset, FALSE, seq))
+			return FALSE;
+		/* each lookup may have skipped past messages that the
+		   previous lookups already checked, so repeat until they all
+		   agree */
+	} while (*seq != prev_seq);
+	return TRUE;
+}
+
 bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 {
         struct index_search_context *ctx = (struct index_search_context *)_ctx;
@@ -1952,6 +2099,10 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 
 	ret = 0;
 	while (_ctx->seq <= ctx->seq2) {
+		if (!search_skip_nonmatching(ctx, &_ctx->seq)) {
+			_ctx->seq = ctx->seq2 + 1;
+			break;
+		}
 		/* check if the sequence matches */
 		ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
 					       search_seqset_arg, ctx);
@@ -89,13 +89,14 @@ static uint32_t index_storage_find_first_pvt_unseen_seq(struct mailbox *box)
 
 	pvt_count = mail_index_view_get_messages_count(box->view_pvt);
 	mail_index_lookup_first(box->view_pvt, 0, MAIL_SEEN, &pvt_seq);
-	if (pvt_seq == 0)
-		pvt_seq = pvt_count+1;
-	for (; pvt_seq <= pvt_count; pvt_seq++) {
+	while (pvt_seq != 0 && pvt_seq <= pvt_count) {
 		pvt_rec = mail_index_lookup(box->view_pvt, pvt_seq);
 		if ((pvt_rec->flags & MAIL_SEEN) == 0 &&
 		    mail_index_lookup_seq(box->view, pvt_rec->uid, &shared_seq))
 			return shared_seq;
+		/* skip directly to the next unseen message */
+		mail_index_lookup_next_flags(box->view_pvt, pvt_seq + 1,
+					     0, MAIL_SEEN, &pvt_seq);
 	}
 	/* if shared index has any messages that don't exist in private index,
 	   the first of them is the first unseen message */
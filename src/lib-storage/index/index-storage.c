@@ -7,6 +7,9 @@
 #include "ioloop.h"
 #include "str.h"
 #include "str-sanitize.h"
+#include "strescape.h"
+#include "net.h"
+#include "write-full.h"
 #include "mkdir-parents.h"
 #include "dict.h"
 #include "fs-api.h"
@@ -29,6 +32,9 @@
 
 #define LOCK_NOTIFY_INTERVAL 30
 
+#define INDEXER_SOCKET_NAME "indexer"
+#define INDEXER_HANDSHAKE "VERSION\tindexer-client\t1\t0\n"
+
 struct index_storage_module index_storage_module =
 	MODULE_CONTEXT_INIT(&mail_storage_module_register);
 
@@ -252,6 +258,40 @@ int index_storage_mailbox_exists_full(struct mailbox *box, const char *subdir,
 	return 0;
 }
 
+int index_storage_notify_indexer(struct mailbox *box, const char *cmd,
+				 const char *what)
+{
+	string_t *str = t_str_new(256);
+	const char *path;
+	int fd, ret = 0;
+
+	path = t_strconcat(box->storage->user->set->base_dir,
+			   "/"INDEXER_SOCKET_NAME, NULL);
+	fd = net_connect_unix(path);
+	if (fd == -1) {
+		mailbox_set_critical(box,
+			"Can't start %s on background: "
+			"net_connect_unix(%s) failed: %m", what, path);
+		return -1;
+	}
+	str_append(str, INDEXER_HANDSHAKE);
+	str_append(str, cmd);
+	str_append(str, "\t0\t");
+	str_append_tabescaped(str, box->storage->user->username);
+	str_append_c(str, '\t');
+	str_append_tabescaped(str, box->vname);
+	str_append_c(str, '\n');
+
+	if (write_full(fd, str_data(str), str_len(str)) < 0) {
+		mailbox_set_critical(box,
+			"Can't start %s on background: "
+			"write(%s) failed: %m", what, path);
+		ret = -1;
+	}
+	i_close_fd(&fd);
+	return ret;
+}
+
 int index_storage_mailbox_alloc_index(struct mailbox *box)
 {
 	const char *cache_dir;
@@ -281,6 +321,7 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 		.index = {
 			.rewrite_min_log_bytes = set->mail_index_rewrite_min_log_bytes,
 			.rewrite_max_log_bytes = set->mail_index_rewrite_max_log_bytes,
+			.columns_min_messages = set->mail_index_columns_min_messages,
 		},
 		.log = {
 			.min_size = set->mail_index_log_rotate_min_size,
@@ -298,6 +339,7 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.purge_delete_percentage = set->mail_cache_purge_delete_percentage,
 			.purge_continued_percentage = set->mail_cache_purge_continued_percentage,
 			.purge_header_continue_count = set->mail_cache_purge_header_continue_count,
+			.compress_min_size = set->mail_cache_field_compress_min_size,
 		},
 	};
 	mail_index_set_optimization_settings(box->index, &optimization_set);
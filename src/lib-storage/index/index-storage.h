@@ -44,6 +44,8 @@ struct index_mailbox_context {
 
 	time_t sync_last_check;
 	uint32_t list_index_sync_ext_id;
+	/* Cache file_seq whose purging was last requested from the indexer */
+	uint32_t cache_purge_requested_file_seq;
 };
 
 #define INDEX_STORAGE_CONTEXT(obj) \
@@ -55,6 +57,11 @@ void index_storage_lock_notify(struct mailbox *box,
 			       enum mailbox_lock_notify_type notify_type,
 			       unsigned int secs_left);
 void index_storage_lock_notify_reset(struct mailbox *box);
+/* Send cmd (e.g. APPEND or OPTIMIZE) for the mailbox to the indexer
+   service, so it gets done on the background. what is used in the error
+   message. Returns 0 if ok, -1 if the indexer couldn't be reached. */
+int index_storage_notify_indexer(struct mailbox *box, const char *cmd,
+				 const char *what);
 
 int index_storage_mailbox_alloc_index(struct mailbox *box);
 void index_storage_mailbox_alloc(struct mailbox *box, const char *vname,
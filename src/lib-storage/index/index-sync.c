@@ -4,6 +4,7 @@
 #include "seq-range-array.h"
 #include "ioloop.h"
 #include "array.h"
+#include "mail-cache.h"
 #include "index-mailbox-size.h"
 #include "index-sync-private.h"
 #include "mailbox-recent-flags.h"
@@ -312,6 +313,30 @@ static void index_mailbox_sync_free(struct index_mailbox_sync_context *ctx)
 	i_free(ctx);
 }
 
+static void index_mailbox_sync_cache_purge(struct mailbox *box,
+					   enum mailbox_sync_flags flags)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+	uint32_t file_seq;
+
+	if (box->cache == NULL)
+		return;
+	if ((flags & MAILBOX_SYNC_FLAG_OPTIMIZE) != 0) {
+		/* most likely indexer-worker handling the request below */
+		(void)mail_cache_purge_if_wanted(box->cache);
+		return;
+	}
+	if (!mail_cache_need_background_purge(box->cache, &file_seq) ||
+	    ibox->cache_purge_requested_file_seq == file_seq)
+		return;
+
+	/* Have the indexer purge the cache file. Readers keep using the
+	   old file until the purged one is renamed over it. */
+	ibox->cache_purge_requested_file_seq = file_seq;
+	if (index_storage_notify_indexer(box, "OPTIMIZE", "cache purging") < 0)
+		(void)mail_cache_purge_if_wanted(box->cache);
+}
+
 int index_mailbox_sync_deinit(struct mailbox_sync_context *_ctx,
 			      struct mailbox_sync_status *status_r)
 {
@@ -363,6 +388,8 @@ int index_mailbox_sync_deinit(struct mailbox_sync_context *_ctx,
 		mailbox_set_index_error(_ctx->box);
 		ret = -1;
 	}
+	if (ret == 0)
+		index_mailbox_sync_cache_purge(_ctx->box, _ctx->flags);
 
 	index_mailbox_sync_free(ctx);
 	return ret;
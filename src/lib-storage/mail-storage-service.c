@@ -16,6 +16,7 @@
 #include "dict.h"
 #include "settings-parser.h"
 #include "auth-master.h"
+#include "mail-index-alloc-cache.h"
 #include "master-service-private.h"
 #include "master-service-settings.h"
 #include "master-service-ssl-settings.h"
@@ -113,6 +114,21 @@ mail_user_set_get_mail_debug(const struct setting_parser_context *set_parser)
 	return mail_set->mail_debug;
 }
 
+static void
+mail_storage_service_init_index_cache(const struct setting_parser_context *set_parser)
+{
+	const struct mail_storage_settings *mail_set;
+	struct mail_index_alloc_cache_settings cache_set;
+
+	mail_set = settings_parser_get_root_set(set_parser,
+			&mail_storage_setting_parser_info);
+	i_zero(&cache_set);
+	cache_set.max_count = mail_set->mail_index_cache_max_count;
+	cache_set.max_size = mail_set->mail_index_cache_max_size;
+	cache_set.timeout_secs = mail_set->mail_index_cache_timeout;
+	mail_index_alloc_cache_set_settings(&cache_set);
+}
+
 static void set_keyval(struct mail_storage_service_ctx *ctx,
 		       struct mail_storage_service_user *user,
 		       const char *key, const char *value)
@@ -1143,6 +1159,10 @@ mail_storage_service_first_init(struct mail_storage_service_ctx *ctx,
 		flags |= AUTH_MASTER_FLAG_NO_IDLE_TIMEOUT;
 	mail_storage_service_set_auth_conn(ctx,
 		auth_master_init(user_set->auth_socket_path, flags));
+
+	/* The index cache is shared by all the users in the process, so use
+	   the global settings instead of any user's. */
+	mail_storage_service_init_index_cache(set_parser);
 }
 
 static int
@@ -54,12 +54,17 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(UINT_HIDDEN, mail_cache_purge_delete_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_continued_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_header_continue_count),
+	DEF(SIZE_HIDDEN, mail_cache_field_compress_min_size),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_min_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_max_log_bytes),
+	DEF(UINT_HIDDEN, mail_index_columns_min_messages),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_min_size),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_max_size),
 	DEF(TIME_HIDDEN, mail_index_log_rotate_min_age),
 	DEF(TIME_HIDDEN, mail_index_log2_max_age),
+	DEF(UINT_HIDDEN, mail_index_cache_max_count),
+	DEF(SIZE_HIDDEN, mail_index_cache_max_size),
+	DEF(TIME_HIDDEN, mail_index_cache_timeout),
 	DEF(TIME, mailbox_idle_check_interval),
 	DEF(UINT, mail_max_keyword_length),
 	DEF(TIME, mail_max_lock_timeout),
@@ -79,6 +84,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(BOOL, mail_full_filesystem_access),
 	DEF(BOOL, maildir_stat_dirs),
 	DEF(BOOL, mail_shared_explicit_inbox),
+	DEF(BOOL_HIDDEN, mail_cache_purge_background),
 	DEF(ENUM, lock_method),
 	DEF(STR, pop3_uidl_format),
 
@@ -112,12 +118,17 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_cache_purge_delete_percentage = 20,
 	.mail_cache_purge_continued_percentage = 200,
 	.mail_cache_purge_header_continue_count = 4,
+	.mail_cache_field_compress_min_size = 0,
 	.mail_index_rewrite_min_log_bytes = 8 * 1024,
 	.mail_index_rewrite_max_log_bytes = 128 * 1024,
+	.mail_index_columns_min_messages = 10000,
 	.mail_index_log_rotate_min_size = 32 * 1024,
 	.mail_index_log_rotate_max_size = 1024 * 1024,
 	.mail_index_log_rotate_min_age = 5 * 60,
 	.mail_index_log2_max_age = 3600 * 24 * 2,
+	.mail_index_cache_max_count = 3,
+	.mail_index_cache_max_size = 0,
+	.mail_index_cache_timeout = 10,
 	.mailbox_idle_check_interval = 30,
 	.mail_max_keyword_length = 50,
 	.mail_max_lock_timeout = 0,
@@ -137,6 +148,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_full_filesystem_access = FALSE,
 	.maildir_stat_dirs = FALSE,
 	.mail_shared_explicit_inbox = FALSE,
+	.mail_cache_purge_background = FALSE,
 	.lock_method = "fcntl:flock:dotlock",
 	.pop3_uidl_format = "%08Xu%08Xv",
 
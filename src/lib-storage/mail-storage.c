@@ -3322,6 +3322,8 @@ mail_storage_settings_to_index_flags(const struct mail_storage_settings *set)
 		index_flags |= MAIL_INDEX_OPEN_FLAG_DOTLOCK_USE_EXCL;
 	if (set->mail_nfs_index)
 		index_flags |= MAIL_INDEX_OPEN_FLAG_NFS_FLUSH;
+	if (set->mail_cache_purge_background)
+		index_flags |= MAIL_INDEX_OPEN_FLAG_CACHE_PURGE_BACKGROUND;
 	return index_flags;
 }
 
@@ -3,10 +3,16 @@
 #include "lib.h"
 #include "test-common.h"
 #include "istream.h"
+#include "str.h"
+#include "time-util.h"
 #include "master-service.h"
 #include "message-size.h"
+#include "mail-cache.h"
 #include "test-mail-storage-common.h"
 
+#include <stdio.h>
+#include <sys/stat.h>
+
 static struct event *test_event;
 
 static int
@@ -725,6 +731,167 @@ static void test_mail_get_last_internal_error(void)
 	test_mail_storage_deinit(&ctx);
 }
 
+static void
+test_mail_fetch_benchmark_save(struct mailbox *box, unsigned int first,
+			       unsigned int count)
+{
+	struct mailbox_transaction_context *trans;
+	struct istream *input;
+	string_t *str = t_str_new(1024);
+	unsigned int i;
+
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	for (i = first; i < first + count; i++) {
+		str_truncate(str, 0);
+		str_printfa(str,
+			"From: Sender %u <sender%u@example.com>\n"
+			"To: Test User <test@example.com>\n"
+			"Cc: List <list%u@lists.example.org>\n"
+			"Subject: Re: benchmark message number %u\n"
+			"Date: Mon, 5 Oct 2026 12:%02u:00 +0300\n"
+			"Message-ID: <%u.benchmark@example.com>\n"
+			"In-Reply-To: <%u.benchmark@example.com>\n"
+			"MIME-Version: 1.0\n"
+			"Content-Type: multipart/alternative; boundary=\"b%u\"\n"
+			"\n"
+			"--b%u\n"
+			"Content-Type: text/plain; charset=utf-8\n"
+			"Content-Transfer-Encoding: quoted-printable\n"
+			"\n"
+			"text body %u\n"
+			"--b%u\n"
+			"Content-Type: text/html; charset=utf-8\n"
+			"Content-Transfer-Encoding: quoted-printable\n"
+			"\n"
+			"<p>html body %u</p>\n"
+			"--b%u--\n",
+			i, i, i % 10, i, i % 60, i, i - 1, i, i, i, i, i, i);
+		input = i_stream_create_from_data(str_data(str), str_len(str));
+		if (test_mail_save_trans(trans, input) < 0)
+			i_fatal("Failed to save mail: %s",
+				mailbox_get_last_internal_error(box, NULL));
+		i_stream_unref(&input);
+	}
+	if (mailbox_transaction_commit(&trans) < 0) {
+		i_fatal("Failed to save mails: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+static long long
+test_mail_fetch_benchmark_fetch(struct mailbox *box, bool cached_only)
+{
+	struct mailbox_transaction_context *trans;
+	struct mailbox_status status;
+	struct mail *mail;
+	struct timeval start, end;
+	const char *envelope, *bodystructure;
+	uint32_t seq;
+
+	mailbox_get_open_status(box, STATUS_MESSAGES, &status);
+	i_gettimeofday(&start);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, MAIL_FETCH_IMAP_ENVELOPE |
+			  MAIL_FETCH_IMAP_BODYSTRUCTURE, NULL);
+	for (seq = 1; seq <= status.messages; seq++) {
+		mail_set_seq(mail, seq);
+		if (cached_only)
+			mail->lookup_abort = MAIL_LOOKUP_ABORT_NOT_IN_CACHE;
+		if (mail_get_special(mail, MAIL_FETCH_IMAP_ENVELOPE,
+				     &envelope) < 0 ||
+		    mail_get_special(mail, MAIL_FETCH_IMAP_BODYSTRUCTURE,
+				     &bodystructure) < 0) {
+			i_fatal("Failed to fetch mail %u: %s", seq,
+				mailbox_get_last_internal_error(box, NULL));
+		}
+		i_assert(envelope[0] != '\0' && bodystructure[0] != '\0');
+	}
+	mail_free(&mail);
+	if (mailbox_transaction_commit(&trans) < 0) {
+		i_fatal("Failed to commit transaction: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	i_gettimeofday(&end);
+	return timeval_diff_usecs(&end, &start);
+}
+
+static void
+test_mail_fetch_benchmark_run(uoff_t compress_min_size, unsigned int count)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.username = t_strdup_printf("bench%"PRIuUOFF_T,
+					    compress_min_size),
+		.driver = "sdbox",
+		.extra_input = (const char *const[]) {
+			"mail_always_cache_fields=imap.envelope imap.bodystructure",
+			t_strdup_printf("mail_cache_field_compress_min_size=%"
+					PRIuUOFF_T, compress_min_size),
+			NULL
+		},
+	};
+	struct mailbox *box;
+	const char *index_dir;
+	struct stat st;
+	long long usecs;
+	unsigned int i;
+
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	if (mailbox_open(box) < 0)
+		i_fatal("Failed to open mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	for (i = 0; i < count; i += 1000) T_BEGIN {
+		test_mail_fetch_benchmark_save(box, i + 1,
+					       I_MIN(1000, count - i));
+	} T_END;
+	if (mailbox_sync(box, 0) < 0)
+		i_fatal("Failed to sync mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	/* make sure everything is cached, then purge the cache file so the
+	   fields get compressed */
+	(void)test_mail_fetch_benchmark_fetch(box, FALSE);
+	if (mail_cache_purge(box->cache, (uint32_t)-1, "benchmark") < 0)
+		i_fatal("Failed to purge cache");
+	if (mailbox_get_path_to(box, MAILBOX_LIST_PATH_TYPE_INDEX,
+				&index_dir) <= 0)
+		i_unreached();
+	if (stat(t_strconcat(index_dir, "/dovecot.index.cache", NULL),
+		 &st) < 0)
+		i_fatal("stat(dovecot.index.cache) failed: %m");
+	mailbox_free(&box);
+
+	/* FETCH ENVELOPE BODYSTRUCTURE from a freshly opened mailbox, the
+	   first time with a cold cache mapping */
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	if (mailbox_open(box) < 0)
+		i_fatal("Failed to open mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	printf("compress_min_size=%"PRIuUOFF_T": %u mails, "
+	       "cache file %lld bytes\n", compress_min_size, count,
+	       (long long)st.st_size);
+	for (i = 0; i < 3; i++) {
+		usecs = test_mail_fetch_benchmark_fetch(box, TRUE);
+		printf("  FETCH ENVELOPE BODYSTRUCTURE in %lld usecs "
+		       "(%.0f mails/sec)\n", usecs,
+		       count * 1000000.0 / (usecs == 0 ? 1 : usecs));
+	}
+	mailbox_free(&box);
+
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+}
+
+static void test_mail_fetch_benchmark(unsigned int count)
+{
+	test_mail_fetch_benchmark_run(0, count);
+	test_mail_fetch_benchmark_run(64, count);
+	test_mail_fetch_benchmark_run(1, count);
+}
+
 int main(int argc, char **argv)
 {
 	void (*const tests[])(void) = {
@@ -750,7 +917,13 @@ int main(int argc, char **argv)
 	test_event = event_create(NULL);
 	if (null_strcmp(argv[1], "-D") == 0)
 		event_set_forced_debug(test_event, TRUE);
-	ret = test_run(tests);
+	if (null_strcmp(argv[1], "benchmark") == 0) {
+		/* test-mail benchmark [<mails count>] */
+		test_mail_fetch_benchmark(argc < 3 ? 100000 : atoi(argv[2]));
+		ret = 0;
+	} else {
+		ret = test_run(tests);
+	}
 	event_unref(&test_event);
 	master_service_deinit(&master_service);
 	return ret;
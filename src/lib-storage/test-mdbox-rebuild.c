@@ -0,0 +1,170 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream.h"
+#include "str.h"
+#include "time-util.h"
+#include "master-service.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+
+#include <stdio.h>
+
+static void
+test_mdbox_rebuild_save(struct mailbox *box, unsigned int first,
+			unsigned int count)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	string_t *str = t_str_new(256);
+	unsigned int i;
+	int ret;
+
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	for (i = first; i < first + count; i++) {
+		str_truncate(str, 0);
+		str_printfa(str, "From: <sender%u@example.com>\n"
+			    "To: <test@example.com>\n"
+			    "Subject: test %u\n"
+			    "\n"
+			    "test body %u\n", i, i, i);
+		input = i_stream_create_from_data(str_data(str), str_len(str));
+		save_ctx = mailbox_save_alloc(trans);
+		if (mailbox_save_begin(&save_ctx, input) < 0)
+			i_fatal("mailbox_save_begin() failed");
+		while ((ret = i_stream_read(input)) > 0) {
+			if (mailbox_save_continue(save_ctx) < 0)
+				i_fatal("mailbox_save_continue() failed");
+		}
+		i_assert(ret == -1 && input->stream_errno == 0);
+		if (mailbox_save_finish(&save_ctx) < 0)
+			i_fatal("mailbox_save_finish() failed");
+		i_stream_unref(&input);
+	}
+	if (mailbox_transaction_commit(&trans) < 0) {
+		i_fatal("Failed to save mails: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+static void
+test_mdbox_rebuild_verify(struct mailbox *box, unsigned int count)
+{
+	struct mailbox_transaction_context *trans;
+	struct mailbox_status status;
+	struct mail *mail;
+	const char *subject = NULL;
+	uint32_t seq;
+
+	mailbox_get_open_status(box, STATUS_MESSAGES, &status);
+	test_assert(status.messages == count);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	for (seq = 1; seq <= status.messages; seq++) {
+		mail_set_seq(mail, seq);
+		test_assert_idx(mail_get_first_header(mail, "Subject",
+						      &subject) > 0, seq);
+		test_assert_strcmp_idx(subject, t_strdup_printf("test %u", seq),
+				       seq);
+	}
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&trans);
+}
+
+static long long
+test_mdbox_rebuild_run(unsigned int processes, unsigned int count)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.username = t_strdup_printf("user%u", processes),
+		.driver = "mdbox",
+		.extra_input = (const char *const[]) {
+			"mdbox_rotate_size=16k",
+			t_strdup_printf("mdbox_rebuild_processes=%u",
+					processes),
+			NULL
+		},
+	};
+	struct mailbox *box;
+	struct timeval start, end;
+	unsigned int i;
+
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	if (mailbox_open(box) < 0)
+		i_fatal("Failed to open mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	for (i = 0; i < count; i += 1000)
+		test_mdbox_rebuild_save(box, i + 1, I_MIN(1000, count - i));
+
+	/* rebuild the map index from the storage files */
+	i_gettimeofday(&start);
+	test_assert(mailbox_sync(box, MAILBOX_SYNC_FLAG_FORCE_RESYNC) == 0);
+	i_gettimeofday(&end);
+	test_mdbox_rebuild_verify(box, count);
+	mailbox_free(&box);
+
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	return timeval_diff_usecs(&end, &start);
+}
+
+static void test_mdbox_rebuild(void)
+{
+	/* "fscking index file" twice and "rebuilding indexes" warnings */
+	test_begin("mdbox rebuild");
+	test_expect_errors(3);
+	(void)test_mdbox_rebuild_run(1, 500);
+	test_end();
+
+	test_begin("mdbox rebuild parallel");
+	test_expect_errors(3);
+	(void)test_mdbox_rebuild_run(4, 500);
+	test_end();
+}
+
+static void test_mdbox_rebuild_benchmark(unsigned int count)
+{
+	static const unsigned int process_counts[] = { 1, 2, 4, 8 };
+	long long usecs;
+
+	for (unsigned int i = 0; i < N_ELEMENTS(process_counts); i++) {
+		usecs = test_mdbox_rebuild_run(process_counts[i], count);
+		printf("%u mails, %u processes: rebuild %lld usecs\n",
+		       count, process_counts[i], usecs);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_mdbox_rebuild,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-mdbox-rebuild",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+
+	if (argc >= 2 && strcmp(argv[1], "benchmark") == 0) {
+		/* test-mdbox-rebuild benchmark [<mails count>] */
+		test_mdbox_rebuild_benchmark(argc < 3 ? 100000 :
+					     atoi(argv[2]));
+		ret = 0;
+	} else {
+		ret = test_run(tests);
+	}
+
+	master_service_deinit(&master_service);
+	return ret;
+}
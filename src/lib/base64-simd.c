@@ -0,0 +1,374 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+
+#include "lib.h"
+#include "base64.h"
+#include "base64-simd.h"
+
+/* The algorithms are based on the work of Wojciech Muła and Daniel Lemire:
+   "Faster Base64 Encoding and Decoding Using AVX2 Instructions" (2018).
+   The kernels are compiled with per-function target attributes, so the
+   rest of the binary doesn't require SSSE3 or AVX2. The CPU support is
+   checked at runtime. */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define BASE64_SIMD_X86
+#  include <immintrin.h>
+#  define ATTR_TARGET_SSSE3 __attribute__((target("ssse3")))
+#  define ATTR_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static bool base64_simd_initialized = FALSE;
+static enum base64_simd_level base64_simd_max_level = BASE64_SIMD_NONE;
+static enum base64_simd_level base64_simd_level = BASE64_SIMD_NONE;
+
+static void base64_simd_init(void)
+{
+#ifdef BASE64_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		base64_simd_max_level = BASE64_SIMD_AVX2;
+	else if (__builtin_cpu_supports("ssse3"))
+		base64_simd_max_level = BASE64_SIMD_SSSE3;
+#endif
+	base64_simd_level = base64_simd_max_level;
+	base64_simd_initialized = TRUE;
+}
+
+enum base64_simd_level base64_simd_get_level(void)
+{
+	if (!base64_simd_initialized)
+		base64_simd_init();
+	return base64_simd_level;
+}
+
+enum base64_simd_level base64_simd_set_level(enum base64_simd_level level)
+{
+	if (!base64_simd_initialized)
+		base64_simd_init();
+	base64_simd_level = I_MIN(level, base64_simd_max_level);
+	return base64_simd_level;
+}
+
+static bool
+base64_simd_get_alphabet(const struct base64_scheme *b64,
+			 char *c62_r, char *c63_r)
+{
+	/* The kernels translate the characters arithmetically, so the
+	   alphabet must be the standard one apart from the last two
+	   characters. Both supported schemes are like that. */
+	if (b64 != &base64_scheme && b64 != &base64url_scheme)
+		return FALSE;
+	*c62_r = b64->encmap[62];
+	*c63_r = b64->encmap[63];
+	return TRUE;
+}
+
+bool base64_simd_is_supported(const struct base64_scheme *b64)
+{
+	char c62, c63;
+
+	return base64_simd_get_level() != BASE64_SIMD_NONE &&
+		base64_simd_get_alphabet(b64, &c62, &c63);
+}
+
+#ifdef BASE64_SIMD_X86
+
+/*
+ * SSSE3
+ */
+
+static inline __m128i ATTR_TARGET_SSSE3
+base64_encode_ssse3_block(__m128i in, __m128i lut)
+{
+	__m128i t0, t1, t2, t3, indices, result, less;
+
+	/* Split the input 3-byte groups into 4 bytes, each containing a
+	   6-bit index */
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+					       4, 5, 3, 4, 1, 2, 0, 1));
+	t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	indices = _mm_or_si128(t1, t3);
+
+	/* Translate the indices to characters by adding an offset looked up
+	   based on the index range: 0..25 -> 13, 26..51 -> 0,
+	   52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+	result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+	less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+	result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+	result = _mm_shuffle_epi8(lut, result);
+	return _mm_add_epi8(result, indices);
+}
+
+static size_t ATTR_TARGET_SSSE3
+base64_encode_ssse3(const unsigned char *src, size_t src_size,
+		    char *dest, size_t dest_size, char c62, char c63)
+{
+	const __m128i lut = _mm_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		c62 - 62, c63 - 63, 'A', 0, 0);
+	size_t src_pos = 0, dest_pos = 0;
+	__m128i in;
+
+	/* 12 bytes are encoded from each 16 byte load */
+	while (src_size - src_pos >= 16 && dest_size - dest_pos >= 16) {
+		in = _mm_loadu_si128((const __m128i *)(src + src_pos));
+		_mm_storeu_si128((__m128i *)(dest + dest_pos),
+				 base64_encode_ssse3_block(in, lut));
+		src_pos += 12;
+		dest_pos += 16;
+	}
+	return src_pos;
+}
+
+static inline __m128i ATTR_TARGET_SSSE3
+base64_decode_ssse3_translate(__m128i in, char c62, char c63, int *valid_r)
+{
+	__m128i upper, lower, digit, e62, e63, offset, valid;
+
+	upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)),
+			      _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), in));
+	lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)),
+			      _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), in));
+	digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+			      _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in));
+	e62 = _mm_cmpeq_epi8(in, _mm_set1_epi8(c62));
+	e63 = _mm_cmpeq_epi8(in, _mm_set1_epi8(c63));
+
+	valid = _mm_or_si128(_mm_or_si128(upper, lower),
+			     _mm_or_si128(_mm_or_si128(digit, e62), e63));
+	*valid_r = _mm_movemask_epi8(valid);
+
+	offset = _mm_or_si128(
+		_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+			     _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+		_mm_or_si128(
+			_mm_or_si128(_mm_and_si128(digit,
+					_mm_set1_epi8(52 - '0')),
+				     _mm_and_si128(e62,
+					_mm_set1_epi8(62 - c62))),
+			_mm_and_si128(e63, _mm_set1_epi8(63 - c63))));
+	return _mm_add_epi8(in, offset);
+}
+
+static inline __m128i ATTR_TARGET_SSSE3
+base64_decode_ssse3_pack(__m128i values)
+{
+	__m128i merged;
+
+	/* [a, b, c, d] 6-bit values -> 16-bit (a << 6 | b), (c << 6 | d)
+	   -> 32-bit (a << 18 | b << 12 | c << 6 | d) */
+	merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+	merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+	/* take the 3 lowest bytes of each 32-bit value in big-endian order */
+	return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4,
+						      10, 9, 8, 14, 13, 12,
+						      -1, -1, -1, -1));
+}
+
+static size_t ATTR_TARGET_SSSE3
+base64_decode_ssse3(const unsigned char *src, size_t src_size,
+		    unsigned char *dest, size_t dest_size, char c62, char c63)
+{
+	size_t src_pos = 0, dest_pos = 0;
+	__m128i in, values;
+	int valid;
+
+	/* 16 characters are decoded into 12 bytes, but all 16 are stored */
+	while (src_size - src_pos >= 16 && dest_size - dest_pos >= 16) {
+		in = _mm_loadu_si128((const __m128i *)(src + src_pos));
+		values = base64_decode_ssse3_translate(in, c62, c63, &valid);
+		if (valid != 0xffff) {
+			/* decode the valid blocks before the invalid one */
+			unsigned int invalid_pos = __builtin_ctz(~valid);
+
+			if (invalid_pos >= 4) {
+				_mm_storeu_si128(
+					(__m128i *)(dest + dest_pos),
+					base64_decode_ssse3_pack(values));
+				src_pos += invalid_pos / 4 * 4;
+			}
+			break;
+		}
+		_mm_storeu_si128((__m128i *)(dest + dest_pos),
+				 base64_decode_ssse3_pack(values));
+		src_pos += 16;
+		dest_pos += 12;
+	}
+	return src_pos;
+}
+
+/*
+ * AVX2
+ */
+
+static size_t ATTR_TARGET_AVX2
+base64_encode_avx2(const unsigned char *src, size_t src_size,
+		   char *dest, size_t dest_size, char c62, char c63)
+{
+	const __m256i shuffle = _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i lut = _mm256_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		c62 - 62, c63 - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		c62 - 62, c63 - 63, 'A', 0, 0);
+	size_t src_pos = 0, dest_pos = 0;
+	__m256i in, t0, t1, t2, t3, indices, result, less;
+
+	/* 24 bytes are encoded from two 16 byte loads, 12 bytes from each
+	   128-bit lane */
+	while (src_size - src_pos >= 28 && dest_size - dest_pos >= 32) {
+		in = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((const __m128i *)(src + src_pos))),
+			_mm_loadu_si128((const __m128i *)(src + src_pos + 12)),
+			1);
+		in = _mm256_shuffle_epi8(in, shuffle);
+		t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+		t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+		t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		indices = _mm256_or_si256(t1, t3);
+
+		result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+		result = _mm256_or_si256(result, _mm256_and_si256(
+			less, _mm256_set1_epi8(13)));
+		result = _mm256_shuffle_epi8(lut, result);
+		_mm256_storeu_si256((__m256i *)(dest + dest_pos),
+				    _mm256_add_epi8(result, indices));
+		src_pos += 24;
+		dest_pos += 32;
+	}
+	return src_pos;
+}
+
+static size_t ATTR_TARGET_AVX2
+base64_decode_avx2(const unsigned char *src, size_t src_size,
+		   unsigned char *dest, size_t dest_size, char c62, char c63)
+{
+	const __m256i pack_shuffle = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i pack_permute = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	size_t src_pos = 0, dest_pos = 0;
+	__m256i in, upper, lower, digit, e62, e63, valid, offset, merged;
+
+	/* 32 characters are decoded into 24 bytes, but all 32 are stored */
+	while (src_size - src_pos >= 32 && dest_size - dest_pos >= 32) {
+		in = _mm256_loadu_si256((const __m256i *)(src + src_pos));
+		upper = _mm256_and_si256(
+			_mm256_cmpgt_epi8(in, _mm256_set1_epi8('A' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in));
+		lower = _mm256_and_si256(
+			_mm256_cmpgt_epi8(in, _mm256_set1_epi8('a' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in));
+		digit = _mm256_and_si256(
+			_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+		e62 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(c62));
+		e63 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(c63));
+		valid = _mm256_or_si256(
+			_mm256_or_si256(upper, lower),
+			_mm256_or_si256(_mm256_or_si256(digit, e62), e63));
+		if (_mm256_movemask_epi8(valid) != -1) {
+			/* let the SSSE3 code handle the partially valid
+			   input */
+			break;
+		}
+
+		offset = _mm256_or_si256(
+			_mm256_or_si256(
+				_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+				_mm256_and_si256(lower,
+					_mm256_set1_epi8(26 - 'a'))),
+			_mm256_or_si256(
+				_mm256_or_si256(
+					_mm256_and_si256(digit,
+						_mm256_set1_epi8(52 - '0')),
+					_mm256_and_si256(e62,
+						_mm256_set1_epi8(62 - c62))),
+				_mm256_and_si256(e63,
+					_mm256_set1_epi8(63 - c63))));
+		merged = _mm256_maddubs_epi16(_mm256_add_epi8(in, offset),
+					      _mm256_set1_epi32(0x01400140));
+		merged = _mm256_madd_epi16(merged,
+					   _mm256_set1_epi32(0x00011000));
+		merged = _mm256_shuffle_epi8(merged, pack_shuffle);
+		/* move the 12 bytes of the second lane after the first 12 */
+		merged = _mm256_permutevar8x32_epi32(merged, pack_permute);
+		_mm256_storeu_si256((__m256i *)(dest + dest_pos), merged);
+		src_pos += 32;
+		dest_pos += 24;
+	}
+	if (src_pos < src_size) {
+		src_pos += base64_decode_ssse3(src + src_pos, src_size - src_pos,
+					       dest + dest_pos,
+					       dest_size - dest_pos, c62, c63);
+	}
+	return src_pos;
+}
+#endif
+
+size_t base64_simd_encode(const struct base64_scheme *b64,
+			  const unsigned char *src, size_t src_size,
+			  char *dest, size_t dest_size)
+{
+#ifdef BASE64_SIMD_X86
+	size_t src_pos = 0, dest_pos;
+	char c62, c63;
+
+	if (!base64_simd_get_alphabet(b64, &c62, &c63))
+		return 0;
+
+	switch (base64_simd_get_level()) {
+	case BASE64_SIMD_NONE:
+		return 0;
+	case BASE64_SIMD_AVX2:
+		src_pos = base64_encode_avx2(src, src_size, dest, dest_size,
+					     c62, c63);
+		/* fall through */
+	case BASE64_SIMD_SSSE3:
+		dest_pos = src_pos / 3 * 4;
+		src_pos += base64_encode_ssse3(src + src_pos,
+					       src_size - src_pos,
+					       dest + dest_pos,
+					       dest_size - dest_pos, c62, c63);
+		break;
+	}
+	return src_pos;
+#else
+	return 0;
+#endif
+}
+
+size_t base64_simd_decode(const struct base64_scheme *b64,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dest, size_t dest_size)
+{
+#ifdef BASE64_SIMD_X86
+	char c62, c63;
+
+	if (!base64_simd_get_alphabet(b64, &c62, &c63))
+		return 0;
+
+	switch (base64_simd_get_level()) {
+	case BASE64_SIMD_NONE:
+		break;
+	case BASE64_SIMD_SSSE3:
+		return base64_decode_ssse3(src, src_size, dest, dest_size,
+					   c62, c63);
+	case BASE64_SIMD_AVX2:
+		return base64_decode_avx2(src, src_size, dest, dest_size,
+					  c62, c63);
+	}
+#endif
+	return 0;
+}
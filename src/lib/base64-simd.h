@@ -0,0 +1,45 @@
+#ifndef BASE64_SIMD_H
+#define BASE64_SIMD_H
+
+/* Vectorized bulk encoding and decoding used internally by base64.c. Only
+   the base64_scheme and base64url_scheme alphabets are supported. */
+
+/* Don't bother calling the SIMD functions with less input or output space
+   than this. */
+#define BASE64_SIMD_MIN_SIZE 16
+
+enum base64_simd_level {
+	BASE64_SIMD_NONE = 0,
+	BASE64_SIMD_SSSE3,
+	BASE64_SIMD_AVX2,
+};
+
+/* Returns the currently used SIMD level. It's the best level supported by
+   the CPU, unless it was lowered with base64_simd_set_level(). */
+enum base64_simd_level base64_simd_get_level(void);
+/* Use at most the given SIMD level. This is only meant for tests and
+   benchmarks. Returns the level that is now actually used. */
+enum base64_simd_level base64_simd_set_level(enum base64_simd_level level);
+
+/* Returns TRUE if SIMD encoding and decoding is used for the scheme. */
+bool base64_simd_is_supported(const struct base64_scheme *b64);
+
+/* Encode as many full 3-byte blocks from src into dest as can be done
+   efficiently. Returns the number of source bytes consumed, which is a
+   multiple of 3. Exactly 4 bytes are written to dest for every 3 bytes
+   consumed and nothing is written beyond dest_size. The rest must be
+   encoded by the caller. */
+size_t base64_simd_encode(const struct base64_scheme *b64,
+			  const unsigned char *src, size_t src_size,
+			  char *dest, size_t dest_size);
+/* Decode as many full 4-character blocks from src into dest as can be done
+   efficiently. The decoding stops before the first block containing a
+   character outside the alphabet (whitespace, padding or invalid). Returns
+   the number of source bytes consumed, which is a multiple of 4. Exactly 3
+   bytes are written to dest for every 4 bytes consumed and nothing is
+   written beyond dest_size. The rest must be decoded by the caller. */
+size_t base64_simd_decode(const struct base64_scheme *b64,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dest, size_t dest_size);
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "base64.h"
+#include "base64-simd.h"
 #include "buffer.h"
 
 /*
@@ -307,6 +308,15 @@ base64_encode_more_data(struct base64_encoder *enc,
 	}
 
 	/* Convert the bulk */
+	if (src_size - src_pos >= BASE64_SIMD_MIN_SIZE &&
+	    (size_t)(end - ptr) >= BASE64_SIMD_MIN_SIZE &&
+	    base64_simd_is_supported(b64)) {
+		size_t n = base64_simd_encode(b64, src_c + src_pos,
+					      src_size - src_pos,
+					      (char *)ptr, end - ptr);
+		src_pos += n;
+		ptr += n / 3 * 4;
+	}
 	for (; src_size - src_pos > 2 && &ptr[3] < end;
 	     src_pos += 3, ptr += 4) {
 		ptr[0] = b64enc[src_c[src_pos] >> 2];
@@ -584,9 +594,35 @@ bool base64_encode_finish(struct base64_encoder *enc, buffer_t *dest)
  * Low-level Base64 decoder
  */
 
+#define BASE64_DECODE_BULK_SIZE 1024
+
 #define IS_EMPTY(c) \
 	((c) == '\n' || (c) == '\r' || (c) == ' ' || (c) == '\t')
 
+static size_t
+base64_decode_bulk(const struct base64_scheme *b64,
+		   const unsigned char *src, size_t src_size,
+		   size_t dst_avail, buffer_t *dest)
+{
+	/* Decode via a temporary buffer, since it's not known beforehand
+	   how much of the input can be decoded. The SIMD code needs some
+	   extra space after the decoded data. */
+	unsigned char out[BASE64_DECODE_BULK_SIZE / 4 * 3 + 32];
+	size_t max_size, size, pos = 0;
+
+	max_size = I_MIN(src_size / 4, dst_avail / 3) * 4;
+	while (max_size - pos >= BASE64_SIMD_MIN_SIZE) {
+		size = I_MIN(max_size - pos, BASE64_DECODE_BULK_SIZE);
+		size = base64_simd_decode(b64, src + pos, size,
+					  out, sizeof(out));
+		buffer_append(dest, out, size / 4 * 3);
+		pos += size;
+		if (size < BASE64_DECODE_BULK_SIZE)
+			break;
+	}
+	return pos;
+}
+
 static inline void
 base64_skip_whitespace(struct base64_decoder *dec, const unsigned char *src_c,
 		       size_t src_size, size_t *src_pos)
@@ -611,6 +647,7 @@ int base64_decode_more(struct base64_decoder *dec,
 		dec->flags, BASE64_DECODE_FLAG_NO_WHITESPACE);
 	bool no_padding = HAS_ALL_BITS(
 		dec->flags, BASE64_DECODE_FLAG_NO_PADDING);
+	bool simd = base64_simd_is_supported(b64);
 	size_t src_pos, dst_avail;
 	int ret = 1;
 
@@ -661,8 +698,24 @@ int base64_decode_more(struct base64_decoder *dec,
 	}
 
 	for (; !dec->seen_padding && src_pos < src_size; src_pos++) {
-		unsigned char in = src_c[src_pos];
-		unsigned char dm = b64->decmap[in];
+		unsigned char in, dm;
+
+		if (simd && dec->sub_pos == 0 &&
+		    src_size - src_pos >= BASE64_SIMD_MIN_SIZE) {
+			/* decode full blocks up to the next non-base64
+			   character (usually a newline) at once */
+			size_t size = base64_decode_bulk(
+				b64, src_c + src_pos, src_size - src_pos,
+				dst_avail, dest);
+
+			src_pos += size;
+			dst_avail -= size / 4 * 3;
+			if (src_pos == src_size)
+				break;
+		}
+
+		in = src_c[src_pos];
+		dm = b64->decmap[in];
 
 		if (dm == 0xff) {
 			if (no_whitespace) {
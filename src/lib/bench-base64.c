@@ -0,0 +1,104 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "base64.h"
+#include "base64-simd.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "strnum.h"
+
+#include <stdio.h>
+
+/**
+ * Measures the base64 encoding and decoding throughput with each supported
+ * SIMD level. The encoding is done both without line wrapping and with
+ * 76 character CRLF-terminated lines as in MIME. The decoding is done for
+ * both of these outputs.
+ */
+
+static const char *const level_names[] = {
+	"scalar", "ssse3", "avx2"
+};
+
+static double bench_gbps(size_t size, unsigned int rounds, uint64_t nsecs)
+{
+	return (double)size * rounds / (nsecs == 0 ? 1 : nsecs);
+}
+
+static void
+bench_level(enum base64_simd_level level, const unsigned char *data,
+	    size_t size, unsigned int rounds)
+{
+	static const size_t line_lens[] = { 0, 76 };
+	buffer_t *encoded, *decoded;
+	uint64_t ts_0, ts_1, ts_2;
+	unsigned int i, j;
+
+	encoded = buffer_create_dynamic(default_pool,
+					MAX_BASE64_ENCODED_SIZE(size) * 2);
+	decoded = buffer_create_dynamic(default_pool, size);
+
+	i_assert(base64_simd_set_level(level) == level);
+	for (i = 0; i < N_ELEMENTS(line_lens); i++) {
+		ts_0 = i_nanoseconds();
+		for (j = 0; j < rounds; j++) {
+			buffer_set_used_size(encoded, 0);
+			base64_scheme_encode(&base64_scheme,
+					     BASE64_ENCODE_FLAG_CRLF,
+					     line_lens[i], data, size, encoded);
+		}
+		ts_1 = i_nanoseconds();
+		for (j = 0; j < rounds; j++) {
+			buffer_set_used_size(decoded, 0);
+			if (base64_decode(encoded->data, encoded->used,
+					  decoded) < 0)
+				i_unreached();
+		}
+		ts_2 = i_nanoseconds();
+		i_assert(decoded->used == size &&
+			 memcmp(decoded->data, data, size) == 0);
+
+		printf("%-7s %-9s encode %6.02lf GB/s  decode %6.02lf GB/s\n",
+		       level_names[level],
+		       line_lens[i] == 0 ? "no lines" : "76 CRLF",
+		       bench_gbps(size, rounds, ts_1 - ts_0),
+		       bench_gbps(size, rounds, ts_2 - ts_1));
+	}
+	buffer_free(&encoded);
+	buffer_free(&decoded);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [size [rounds]]\n", prog);
+	fprintf(stderr, "Encodes 1 MB of data 200 times if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	enum base64_simd_level level, max_level;
+	unsigned int size = 1024*1024, rounds = 200;
+	unsigned char *data;
+
+	lib_init();
+	if (argc > 3 ||
+	    (argc > 1 && (str_to_uint(argv[1], &size) < 0 || size == 0)) ||
+	    (argc > 2 && (str_to_uint(argv[2], &rounds) < 0 || rounds == 0))) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+
+	data = i_malloc(size);
+	random_fill(data, size);
+
+	max_level = base64_simd_get_level();
+	printf("Using %u bytes, %u rounds\n\n", size, rounds);
+	for (level = BASE64_SIMD_NONE; level <= max_level; level++)
+		bench_level(level, data, size, rounds);
+
+	i_free(data);
+	lib_deinit();
+	return 0;
+}
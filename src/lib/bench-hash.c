@@ -0,0 +1,251 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "hash.h"
+#include "time-util.h"
+#include "strnum.h"
+
+#include <stdio.h>
+
+/**
+ * Compares the chained hash table against the open addressing hash table
+ * with string and pointer keys. The keys are inserted, then each key is
+ * looked up, then the same number of missing keys are looked up and finally
+ * all the keys are removed.
+ *
+ * Also compares the speed of str_hash() and strcase_hash() against the
+ * original byte-at-a-time ASU hash with different key lengths.
+ */
+
+static const unsigned int default_counts[] = { 1000, 100000, 1000000 };
+
+static void
+bench_print(const char *name, unsigned int count, uint64_t insert_nsecs,
+	    uint64_t hit_nsecs, uint64_t miss_nsecs, uint64_t remove_nsecs)
+{
+	printf("%-20s insert %7.02lf  hit %7.02lf  miss %7.02lf  "
+	       "remove %7.02lf ns/op\n", name,
+	       (double)insert_nsecs / count, (double)hit_nsecs / count,
+	       (double)miss_nsecs / count, (double)remove_nsecs / count);
+}
+
+static void
+bench_strings(const char *name, bool open, char *const *keys,
+	      char *const *missing_keys, unsigned int count)
+{
+	HASH_TABLE(char *, char *) hash;
+	uint64_t ts_0, ts_1, ts_2, ts_3, ts_4;
+	unsigned int i, found = 0;
+
+	if (open)
+		hash_table_create_open(&hash, default_pool, 0, str_hash, strcmp);
+	else
+		hash_table_create(&hash, default_pool, 0, str_hash, strcmp);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++)
+		hash_table_insert(hash, keys[i], keys[i]);
+	ts_1 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		if (hash_table_lookup(hash, keys[i]) != NULL)
+			found++;
+	}
+	ts_2 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		if (hash_table_lookup(hash, missing_keys[i]) != NULL)
+			found++;
+	}
+	ts_3 = i_nanoseconds();
+	for (i = 0; i < count; i++)
+		hash_table_remove(hash, keys[i]);
+	ts_4 = i_nanoseconds();
+	i_assert(found == count);
+
+	bench_print(name, count, ts_1 - ts_0, ts_2 - ts_1, ts_3 - ts_2,
+		    ts_4 - ts_3);
+	hash_table_destroy(&hash);
+}
+
+static void
+bench_pointers(const char *name, bool open, void *const *keys,
+	       void *const *missing_keys, unsigned int count)
+{
+	HASH_TABLE(void *, void *) hash;
+	uint64_t ts_0, ts_1, ts_2, ts_3, ts_4;
+	unsigned int i, found = 0;
+
+	if (open)
+		hash_table_create_open_direct(&hash, default_pool, 0);
+	else
+		hash_table_create_direct(&hash, default_pool, 0);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++)
+		hash_table_insert(hash, keys[i], keys[i]);
+	ts_1 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		if (hash_table_lookup(hash, keys[i]) != NULL)
+			found++;
+	}
+	ts_2 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		if (hash_table_lookup(hash, missing_keys[i]) != NULL)
+			found++;
+	}
+	ts_3 = i_nanoseconds();
+	for (i = 0; i < count; i++)
+		hash_table_remove(hash, keys[i]);
+	ts_4 = i_nanoseconds();
+	i_assert(found == count);
+
+	bench_print(name, count, ts_1 - ts_0, ts_2 - ts_1, ts_3 - ts_2,
+		    ts_4 - ts_3);
+	hash_table_destroy(&hash);
+}
+
+static void bench_shuffle(void **keys, unsigned int count)
+{
+	unsigned int i, j;
+	void *tmp;
+
+	for (i = count - 1; i > 0; i--) {
+		j = i_rand_limit(i + 1);
+		tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+}
+
+static void bench_count(unsigned int count)
+{
+	pool_t pool = pool_alloconly_create("bench hash keys", 1024*1024);
+	char **str_keys, **str_missing;
+	void **ptr_keys, **ptr_missing;
+	unsigned int i;
+
+	str_keys = i_new(char *, count);
+	str_missing = i_new(char *, count);
+	ptr_keys = i_new(void *, count);
+	ptr_missing = i_new(void *, count);
+	for (i = 0; i < count; i++) {
+		str_keys[i] = p_strdup_printf(pool, "user%u@example.com", i);
+		str_missing[i] = p_strdup_printf(pool, "nouser%u@example.com", i);
+		/* pointer keys are aligned like allocated memory */
+		ptr_keys[i] = POINTER_CAST((i + 1) * 16);
+		ptr_missing[i] = POINTER_CAST((count + i + 1) * 16);
+	}
+	/* access the keys in random order, not in their allocation order */
+	bench_shuffle((void **)str_keys, count);
+	bench_shuffle((void **)str_missing, count);
+	bench_shuffle(ptr_keys, count);
+	bench_shuffle(ptr_missing, count);
+
+	printf("%u keys:\n", count);
+	bench_strings("chained strings", FALSE, str_keys, str_missing, count);
+	bench_strings("open strings", TRUE, str_keys, str_missing, count);
+	bench_pointers("chained pointers", FALSE, ptr_keys, ptr_missing, count);
+	bench_pointers("open pointers", TRUE, ptr_keys, ptr_missing, count);
+	printf("\n");
+
+	i_free(str_keys);
+	i_free(str_missing);
+	i_free(ptr_keys);
+	i_free(ptr_missing);
+	pool_unref(&pool);
+}
+
+static unsigned int ATTR_NO_SANITIZE_INTEGER
+bench_asu_hash(const char *p)
+{
+	const unsigned char *s = (const unsigned char *)p;
+	unsigned int g, h = 0;
+
+	while (*s != '\0') {
+		h = (h << 4) + *s;
+		if ((g = h & 0xf0000000UL) != 0) {
+			h = h ^ (g >> 24);
+			h = h ^ g;
+		}
+		s++;
+	}
+	return h;
+}
+
+static void bench_str_hash_len(unsigned int len)
+{
+#define BENCH_STR_HASH_KEYS 64
+#define BENCH_STR_HASH_ROUNDS 20000
+	char *keys[BENCH_STR_HASH_KEYS];
+	unsigned int i, j, hash = 0;
+	uint64_t ts_0, ts_1, ts_2, ts_3;
+	double ops = BENCH_STR_HASH_KEYS * BENCH_STR_HASH_ROUNDS;
+
+	for (i = 0; i < BENCH_STR_HASH_KEYS; i++) {
+		keys[i] = i_malloc(len + 1);
+		for (j = 0; j < len; j++)
+			keys[i][j] = 'a' + i_rand_limit(26);
+	}
+
+	ts_0 = i_nanoseconds();
+	for (j = 0; j < BENCH_STR_HASH_ROUNDS; j++) {
+		for (i = 0; i < BENCH_STR_HASH_KEYS; i++)
+			hash += bench_asu_hash(keys[i]);
+	}
+	ts_1 = i_nanoseconds();
+	for (j = 0; j < BENCH_STR_HASH_ROUNDS; j++) {
+		for (i = 0; i < BENCH_STR_HASH_KEYS; i++)
+			hash += str_hash(keys[i]);
+	}
+	ts_2 = i_nanoseconds();
+	for (j = 0; j < BENCH_STR_HASH_ROUNDS; j++) {
+		for (i = 0; i < BENCH_STR_HASH_KEYS; i++)
+			hash += strcase_hash(keys[i]);
+	}
+	ts_3 = i_nanoseconds();
+
+	printf("%4u bytes: asu %8.02lf  str_hash %8.02lf  "
+	       "strcase_hash %8.02lf ns/op (%x)\n", len,
+	       (ts_1 - ts_0) / ops, (ts_2 - ts_1) / ops, (ts_3 - ts_2) / ops,
+	       hash);
+	for (i = 0; i < BENCH_STR_HASH_KEYS; i++)
+		i_free(keys[i]);
+}
+
+static void bench_str_hash(void)
+{
+	static const unsigned int lengths[] = { 4, 16, 32, 64, 256, 1024 };
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(lengths); i++)
+		bench_str_hash_len(lengths[i]);
+	printf("\n");
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [count ...]\n", prog);
+	fprintf(stderr, "Runs with 1000, 100000 and 1000000 keys if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int i, count;
+
+	lib_init();
+	bench_str_hash();
+	if (argc == 1) {
+		for (i = 0; i < N_ELEMENTS(default_counts); i++)
+			bench_count(default_counts[i]);
+	} else {
+		for (i = 1; i < (unsigned int)argc; i++) {
+			if (str_to_uint(argv[i], &count) < 0 || count == 0) {
+				fprintf(stderr, "Invalid parameters\n");
+				print_usage(argv[0]);
+			}
+			bench_count(count);
+		}
+	}
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,169 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "time-util.h"
+#include "strnum.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**
+ * Compares the slab pool against the allocfree pool. A number of same-sized
+ * objects are allocated, then half of them are freed and allocated again in
+ * random order, and finally all of them are freed. Each pool is measured in
+ * a separate child process, so that the RSS growth isn't affected by memory
+ * left over in the malloc() heap by the previous measurement.
+ */
+
+static const unsigned int default_sizes[] = { 32, 64, 200 };
+
+enum bench_pool_type {
+	BENCH_POOL_ALLOCFREE,
+	BENCH_POOL_SLAB,
+};
+
+static const char *const bench_pool_names[] = {
+	"allocfree", "slab"
+};
+
+static size_t bench_get_rss(void)
+{
+	char buf[128];
+	unsigned long size, rss;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (f == NULL)
+		return 0;
+	if (fgets(buf, sizeof(buf), f) == NULL ||
+	    sscanf(buf, "%lu %lu", &size, &rss) != 2)
+		rss = 0;
+	fclose(f);
+	return rss * sysconf(_SC_PAGESIZE);
+}
+
+static void bench_shuffle(unsigned int *idx, unsigned int count)
+{
+	unsigned int i, j, tmp;
+
+	for (i = count - 1; i > 0; i--) {
+		j = i_rand_limit(i + 1);
+		tmp = idx[i];
+		idx[i] = idx[j];
+		idx[j] = tmp;
+	}
+}
+
+static void
+bench_pool(enum bench_pool_type type, unsigned int count, unsigned int size)
+{
+	void **objs;
+	unsigned int i, *idx;
+	uint64_t ts_0, ts_1, ts_2, ts_3;
+	size_t rss_0, rss_1;
+	pool_t pool;
+
+	objs = i_new(void *, count);
+	idx = i_new(unsigned int, count);
+	for (i = 0; i < count; i++)
+		idx[i] = i;
+	bench_shuffle(idx, count);
+
+	switch (type) {
+	case BENCH_POOL_ALLOCFREE:
+		pool = pool_allocfree_create("bench");
+		break;
+	case BENCH_POOL_SLAB:
+		pool = pool_slab_create("bench", 0);
+		break;
+	default:
+		i_unreached();
+	}
+
+	rss_0 = bench_get_rss();
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++)
+		objs[i] = p_malloc(pool, size);
+	ts_1 = i_nanoseconds();
+	for (i = 0; i < count / 2; i++)
+		p_free(pool, objs[idx[i]]);
+	for (i = 0; i < count / 2; i++)
+		objs[idx[i]] = p_malloc(pool, size);
+	ts_2 = i_nanoseconds();
+	rss_1 = bench_get_rss();
+	for (i = 0; i < count; i++)
+		p_free(pool, objs[idx[i]]);
+	ts_3 = i_nanoseconds();
+
+	printf("%-10s alloc %6.02lf  churn %6.02lf  free %6.02lf ns/op  "
+	       "RSS +%zu kB\n", bench_pool_names[type],
+	       (double)(ts_1 - ts_0) / count,
+	       (double)(ts_2 - ts_1) / (count / 2 * 2),
+	       (double)(ts_3 - ts_2) / count,
+	       (rss_1 - rss_0) / 1024);
+	fflush(stdout);
+
+	pool_unref(&pool);
+	i_free(objs);
+	i_free(idx);
+}
+
+static void
+bench_pool_fork(enum bench_pool_type type, unsigned int count,
+		unsigned int size)
+{
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0)
+		i_fatal("fork() failed: %m");
+	if (pid == 0) {
+		bench_pool(type, count, size);
+		lib_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		i_fatal("waitpid() failed: %m");
+}
+
+static void bench_size(unsigned int count, unsigned int size)
+{
+	printf("%u objects of %u bytes:\n", count, size);
+	bench_pool_fork(BENCH_POOL_ALLOCFREE, count, size);
+	bench_pool_fork(BENCH_POOL_SLAB, count, size);
+	printf("\n");
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [count [size ...]]\n", prog);
+	fprintf(stderr, "Uses 1000000 objects of 32, 64 and 200 bytes if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int i, count = 1000000, size;
+
+	lib_init();
+	if (argc > 1 && (str_to_uint(argv[1], &count) < 0 || count < 2)) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	if (argc <= 2) {
+		for (i = 0; i < N_ELEMENTS(default_sizes); i++)
+			bench_size(count, default_sizes[i]);
+	} else {
+		for (i = 2; i < (unsigned int)argc; i++) {
+			if (str_to_uint(argv[i], &size) < 0 || size == 0) {
+				fprintf(stderr, "Invalid parameters\n");
+				print_usage(argv[0]);
+			}
+			bench_size(count, size);
+		}
+	}
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,148 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "priorityq.h"
+#include "timer-wheel.h"
+#include "time-util.h"
+#include "strnum.h"
+
+#include <stdio.h>
+
+/**
+ * Compares the priorityq used for normal ioloop timeouts against the timer
+ * wheel used for coarse timeouts. Each item gets a random expiration time
+ * within an hour (in seconds), every third item is removed before it
+ * expires and then the time is advanced one second at a time until all the
+ * items have expired. This mimics a process having lots of idle or
+ * keepalive timeouts.
+ */
+
+#define BENCH_EXPIRE_RANGE_SECS 3600
+
+struct bench_pq_item {
+	struct priorityq_item item;
+	uint64_t expire;
+};
+
+struct bench_wheel_item {
+	struct timer_wheel_item item;
+};
+
+static int bench_pq_cmp(const void *p1, const void *p2)
+{
+	const struct bench_pq_item *i1 = p1, *i2 = p2;
+
+	if (i1->expire < i2->expire)
+		return -1;
+	if (i1->expire > i2->expire)
+		return 1;
+	return 0;
+}
+
+static void
+bench_print(const char *name, unsigned int count, uint64_t add_nsecs,
+	    uint64_t remove_nsecs, uint64_t expire_nsecs)
+{
+	printf("%s\n", name);
+	printf("\tAdd:    %0.02lf ns/item\n", (double)add_nsecs / count);
+	printf("\tRemove: %0.02lf ns/item\n",
+	       (double)remove_nsecs / ((count + 2) / 3));
+	printf("\tExpire: %0.02lf ns/item\n\n", (double)expire_nsecs / count);
+}
+
+static void bench_priorityq(const uint64_t *expires, unsigned int count)
+{
+	struct bench_pq_item *items = i_new(struct bench_pq_item, count);
+	struct priorityq *pq = priorityq_init(bench_pq_cmp, count);
+	struct priorityq_item *item;
+	uint64_t ts_0, ts_1, ts_2, ts_3, now;
+	unsigned int i, expired = 0;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		items[i].expire = expires[i];
+		priorityq_add(pq, &items[i].item);
+	}
+	ts_1 = i_nanoseconds();
+	for (i = 0; i < count; i += 3)
+		priorityq_remove(pq, &items[i].item);
+	ts_2 = i_nanoseconds();
+	for (now = 0; now <= BENCH_EXPIRE_RANGE_SECS; now++) {
+		while ((item = priorityq_peek(pq)) != NULL &&
+		       ((struct bench_pq_item *)item)->expire <= now) {
+			priorityq_remove(pq, item);
+			expired++;
+		}
+	}
+	ts_3 = i_nanoseconds();
+	i_assert(priorityq_count(pq) == 0);
+	i_assert(expired == count - (count + 2) / 3);
+
+	bench_print("priorityq", count, ts_1 - ts_0, ts_2 - ts_1, ts_3 - ts_2);
+	priorityq_deinit(&pq);
+	i_free(items);
+}
+
+static void bench_timer_wheel(const uint64_t *expires, unsigned int count)
+{
+	struct bench_wheel_item *items = i_new(struct bench_wheel_item, count);
+	struct timer_wheel *wheel = timer_wheel_init(0);
+	uint64_t ts_0, ts_1, ts_2, ts_3, now;
+	unsigned int i, expired = 0;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		timer_wheel_item_init(&items[i].item);
+		timer_wheel_add(wheel, &items[i].item, expires[i]);
+	}
+	ts_1 = i_nanoseconds();
+	for (i = 0; i < count; i += 3)
+		timer_wheel_remove(wheel, &items[i].item);
+	ts_2 = i_nanoseconds();
+	for (now = 0; now <= BENCH_EXPIRE_RANGE_SECS; now++) {
+		while (timer_wheel_pop(wheel, now) != NULL)
+			expired++;
+	}
+	ts_3 = i_nanoseconds();
+	i_assert(timer_wheel_count(wheel) == 0);
+	i_assert(expired == count - (count + 2) / 3);
+
+	bench_print("timer wheel", count, ts_1 - ts_0, ts_2 - ts_1, ts_3 - ts_2);
+	timer_wheel_deinit(&wheel);
+	i_free(items);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [count]\n", prog);
+	fprintf(stderr, "Runs with 1000000 timers if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int i, count = 1000000;
+	uint64_t *expires;
+
+	lib_init();
+	if (argc == 2) {
+		if (str_to_uint(argv[1], &count) < 0 || count == 0) {
+			fprintf(stderr, "Invalid parameters\n");
+			print_usage(argv[0]);
+		}
+	} else if (argc != 1) {
+		print_usage(argv[0]);
+	}
+
+	expires = i_new(uint64_t, count);
+	for (i = 0; i < count; i++)
+		expires[i] = 1 + i_rand_limit(BENCH_EXPIRE_RANGE_SECS);
+
+	printf("Using %u timers\n\n", count);
+	bench_priorityq(expires, count);
+	bench_timer_wheel(expires, count);
+
+	i_free(expires);
+	lib_deinit();
+	return 0;
+}
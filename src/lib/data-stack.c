@@ -4,7 +4,10 @@
 
 #include "lib.h"
 #include "backtrace-string.h"
+#include "hash.h"
+#include "sort.h"
 #include "str.h"
+#include "strnum.h"
 #include "data-stack.h"
 
 
@@ -66,6 +69,20 @@ struct stack_frame {
 #endif
 };
 
+/* Profiling state of a frame. These are kept in profile_stack[] indexed by
+   the frame's depth, so they don't grow struct stack_frame. */
+struct stack_frame_profile {
+	/* Profiling session that was active when the frame was pushed,
+	   or 0 if profiling wasn't enabled. */
+	unsigned int session;
+	unsigned int alloc_count;
+	/* Profiled bytes used in data stack when the frame was pushed */
+	size_t start_used;
+	/* The parent frame's peak usage when the frame was pushed */
+	size_t parent_peak;
+	size_t alloc_bytes;
+};
+
 #ifdef STATIC_CHECKER
 struct data_stack_frame {
 	unsigned int id;
@@ -99,6 +116,21 @@ static union {
 	unsigned char data[512];
 } outofmem_area;
 
+/* Freed blocks larger than this aren't kept in unused_block. */
+static size_t data_stack_trim_size = 0;
+
+static bool data_stack_profiling = FALSE;
+static unsigned int data_stack_profile_session = 0;
+static size_t data_stack_profile_event_min_peak;
+/* Bytes currently used by data stack and the highest value it has had
+   since the current frame was pushed. */
+static size_t data_stack_profile_used, data_stack_profile_peak;
+static HASH_TABLE(char *, struct data_stack_frame_profile *) profile_frames;
+/* Indexed by frame depth (data_stack_frame_id when the frame was pushed).
+   Allocated only while profiling. */
+static struct stack_frame_profile *profile_stack;
+static unsigned int profile_stack_count;
+
 static struct stack_block *mem_block_alloc(size_t min_size);
 
 static inline
@@ -107,6 +139,55 @@ unsigned char *data_stack_after_last_alloc(struct stack_block *block)
 	return STACK_BLOCK_DATA(block) + (block->size - block->left);
 }
 
+static struct stack_frame_profile *data_stack_profile_push(unsigned int idx)
+{
+	struct stack_frame_profile *new_stack;
+	unsigned int new_count;
+
+	if (unlikely(idx >= profile_stack_count)) {
+		/* use malloc() directly, since this is called by t_push() */
+		new_count = I_MAX(nearest_power(idx + 1), 64);
+		new_stack = realloc(profile_stack,
+				    sizeof(*profile_stack) * new_count);
+		if (new_stack == NULL) {
+			i_fatal_status(FATAL_OUTOFMEM, "realloc(%zu): "
+				       "Out of memory",
+				       sizeof(*profile_stack) * new_count);
+		}
+		memset(new_stack + profile_stack_count, 0,
+		       sizeof(*profile_stack) *
+		       (new_count - profile_stack_count));
+		profile_stack = new_stack;
+		profile_stack_count = new_count;
+	}
+	return &profile_stack[idx];
+}
+
+/* Returns the current frame's profile, or NULL if the frame wasn't pushed
+   during the current profiling session. */
+static struct stack_frame_profile *data_stack_profile_current(void)
+{
+	unsigned int idx = data_stack_frame_id - 1;
+
+	if (idx >= profile_stack_count ||
+	    profile_stack[idx].session != data_stack_profile_session)
+		return NULL;
+	return &profile_stack[idx];
+}
+
+static void data_stack_profile_add_alloc(size_t size, unsigned int count)
+{
+	struct stack_frame_profile *profile = data_stack_profile_current();
+
+	if (profile != NULL) {
+		profile->alloc_bytes += size;
+		profile->alloc_count += count;
+	}
+	data_stack_profile_used += size;
+	if (data_stack_profile_peak < data_stack_profile_used)
+		data_stack_profile_peak = data_stack_profile_used;
+}
+
 static void data_stack_last_buffer_reset(bool preserve_data ATTR_UNUSED)
 {
 	if (last_buffer_block != NULL) {
@@ -172,14 +253,28 @@ data_stack_frame_t t_push(const char *marker)
 	current_frame->alloc_bytes = 0;
 	current_frame->alloc_count = 0;
 #endif
+	if (unlikely(data_stack_profiling)) {
+		struct stack_frame_profile *profile =
+			data_stack_profile_push(data_stack_frame_id);
+
+		profile->session = data_stack_profile_session;
+		profile->start_used = data_stack_profile_used;
+		profile->parent_peak = data_stack_profile_peak;
+		profile->alloc_bytes = 0;
+		profile->alloc_count = 0;
+		data_stack_profile_peak = data_stack_profile_used;
+	}
 
+	/* increase the frame ID first, so the frame's own allocation is
+	   profiled as part of the new frame */
+	data_stack_frame_id++;
 	t_buffer_alloc(sizeof(*frame));
 
 #ifndef STATIC_CHECKER
-	return data_stack_frame_id++;
+	return data_stack_frame_id - 1;
 #else
 	struct data_stack_frame *ds_frame = i_new(struct data_stack_frame, 1);
-	ds_frame->id = data_stack_frame_id++;
+	ds_frame->id = data_stack_frame_id - 1;
 	return ds_frame;
 #endif
 }
@@ -227,8 +322,12 @@ static void free_blocks(struct stack_block *block)
 
 		if (block == &outofmem_area.block)
 			;
-		else if (unused_block == NULL ||
-			 block->size > unused_block->size) {
+		else if (data_stack_trim_size != 0 &&
+			 block->size > data_stack_trim_size) {
+			/* don't keep transient spikes allocated */
+			free(block);
+		} else if (unused_block == NULL ||
+			   block->size > unused_block->size) {
 			free(unused_block);
 			unused_block = block;
 		} else {
@@ -276,9 +375,72 @@ static void t_pop_verify(void)
 }
 #endif
 
+static void
+data_stack_profile_send_event(const struct data_stack_frame_profile *profile,
+			      size_t peak_bytes, unsigned int alloc_count,
+			      size_t alloc_bytes)
+{
+	struct event *event;
+
+	if (event_datastack_deinitialized)
+		return;
+
+	event = event_create(NULL);
+	event_set_name(event, "data_stack_frame_peak");
+	event_add_str(event, "frame_marker", profile->marker);
+	event_add_int(event, "peak_bytes", peak_bytes);
+	event_add_int(event, "alloc_count", alloc_count);
+	event_add_int(event, "alloc_bytes", alloc_bytes);
+	event_add_int(event, "max_peak_bytes", profile->peak_bytes);
+	e_debug(event, "Data stack frame '%s' used %zu bytes at peak "
+		"(%u allocations, %zu bytes)", profile->marker, peak_bytes,
+		alloc_count, alloc_bytes);
+	event_unref(&event);
+}
+
+static void
+data_stack_profile_record(const struct stack_frame *frame,
+			  const struct stack_frame_profile *frame_profile)
+{
+	struct data_stack_frame_profile *profile;
+	size_t peak_bytes;
+	char *marker;
+
+	i_assert(data_stack_profile_peak >= frame_profile->start_used);
+	peak_bytes = data_stack_profile_peak - frame_profile->start_used;
+
+	/* Recording may allocate from data stack and send events. Don't
+	   profile any of it. */
+	data_stack_profiling = FALSE;
+	if (!hash_table_is_created(profile_frames)) {
+		hash_table_create(&profile_frames, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	profile = hash_table_lookup(profile_frames, frame->marker);
+	if (profile == NULL) {
+		profile = i_new(struct data_stack_frame_profile, 1);
+		marker = i_strdup(frame->marker);
+		profile->marker = marker;
+		hash_table_insert(profile_frames, marker, profile);
+	}
+	profile->push_count++;
+	profile->alloc_count += frame_profile->alloc_count;
+	profile->alloc_bytes += frame_profile->alloc_bytes;
+	if (profile->peak_bytes < peak_bytes)
+		profile->peak_bytes = peak_bytes;
+
+	if (peak_bytes >= data_stack_profile_event_min_peak) {
+		data_stack_profile_send_event(profile, peak_bytes,
+					      frame_profile->alloc_count,
+					      frame_profile->alloc_bytes);
+	}
+	data_stack_profiling = TRUE;
+}
+
 void t_pop_last_unsafe(void)
 {
-	size_t block_space_left;
+	size_t block_space_left, profile_start_used = 0, profile_parent_peak = 0;
+	bool profiled = FALSE;
 
 	if (unlikely(current_frame == NULL))
 		i_panic("t_pop() called with empty stack");
@@ -287,6 +449,19 @@ void t_pop_last_unsafe(void)
 #ifdef DEBUG
 	t_pop_verify();
 #endif
+	if (unlikely(data_stack_profiling)) {
+		const struct stack_frame_profile *profile =
+			data_stack_profile_current();
+
+		if (profile != NULL) {
+			/* Record before popping, since the marker may have
+			   been allocated from the frame itself. */
+			data_stack_profile_record(current_frame, profile);
+			profile_start_used = profile->start_used;
+			profile_parent_peak = profile->parent_peak;
+			profiled = TRUE;
+		}
+	}
 
 	/* Usually the block doesn't change. If it doesn't, the next pointer
 	   must also be NULL. */
@@ -318,6 +493,18 @@ void t_pop_last_unsafe(void)
 
 	current_block->left = block_space_left;
 
+	if (unlikely(data_stack_profiling)) {
+		if (profiled) {
+			data_stack_profile_used = profile_start_used;
+			data_stack_profile_peak =
+				I_MAX(profile_parent_peak,
+				      data_stack_profile_peak);
+		} else {
+			/* frame was pushed before profiling was enabled */
+			data_stack_profile_used = data_stack_get_used_size();
+		}
+	}
+
 	data_stack_frame_id--;
 }
 
@@ -479,6 +666,8 @@ static void *t_malloc_real(size_t size, bool permanent)
 	if (permanent) {
 		/* used for t_try_realloc() */
 		current_frame->last_alloc_size = alloc_size;
+		if (unlikely(data_stack_profiling))
+			data_stack_profile_add_alloc(alloc_size, 1);
 	}
 
 	if (current_block->left < alloc_size) {
@@ -591,6 +780,8 @@ t_try_realloc(void *mem, size_t size)
 			/* just shrink the available size */
 			current_block->left -= alloc_growth;
 			current_frame->last_alloc_size = new_alloc_size;
+			if (unlikely(data_stack_profiling))
+				data_stack_profile_add_alloc(alloc_growth, 0);
 #ifdef DEBUG
 			if (current_block->left < current_block->left_lowwater)
 				current_block->left_lowwater = current_block->left;
@@ -738,6 +929,107 @@ void data_stack_free_unused(void)
 	unused_block = NULL;
 }
 
+void data_stack_set_trim_size(size_t size)
+{
+	data_stack_trim_size = size;
+	if (size != 0 && unused_block != NULL && unused_block->size > size)
+		data_stack_free_unused();
+}
+
+void data_stack_profile_start(size_t event_min_peak_bytes)
+{
+	data_stack_profile_event_min_peak = event_min_peak_bytes;
+	if (data_stack_profiling)
+		return;
+
+	/* frames pushed during earlier profiling sessions are ignored */
+	if (++data_stack_profile_session == 0)
+		data_stack_profile_session++;
+	data_stack_profile_used = data_stack_get_used_size();
+	data_stack_profile_peak = data_stack_profile_used;
+	data_stack_profiling = TRUE;
+}
+
+void data_stack_profile_stop(void)
+{
+	data_stack_profiling = FALSE;
+	/* the next session starts with a new session number, so the frame
+	   states aren't needed anymore */
+	free(profile_stack);
+	profile_stack = NULL;
+	profile_stack_count = 0;
+}
+
+static int
+data_stack_frame_profile_cmp(const struct data_stack_frame_profile *p1,
+			     const struct data_stack_frame_profile *p2)
+{
+	if (p1->peak_bytes != p2->peak_bytes)
+		return p1->peak_bytes > p2->peak_bytes ? -1 : 1;
+	return strcmp(p1->marker, p2->marker);
+}
+
+const struct data_stack_frame_profile *
+data_stack_profile_get(unsigned int *count_r)
+{
+	struct hash_iterate_context *iter;
+	struct data_stack_frame_profile *profiles, *profile;
+	char *marker;
+	unsigned int i = 0;
+	bool profiling = data_stack_profiling;
+
+	if (!hash_table_is_created(profile_frames)) {
+		*count_r = 0;
+		return NULL;
+	}
+
+	data_stack_profiling = FALSE;
+	profiles = t_new(struct data_stack_frame_profile,
+			 hash_table_count(profile_frames));
+	iter = hash_table_iterate_init(profile_frames);
+	while (hash_table_iterate(iter, profile_frames, &marker, &profile))
+		profiles[i++] = *profile;
+	hash_table_iterate_deinit(&iter);
+	i_qsort(profiles, i, sizeof(*profiles), data_stack_frame_profile_cmp);
+	data_stack_profiling = profiling;
+
+	*count_r = i;
+	return profiles;
+}
+
+void data_stack_profile_reset(void)
+{
+	struct hash_iterate_context *iter;
+	struct data_stack_frame_profile *profile;
+	char *marker;
+
+	if (!hash_table_is_created(profile_frames))
+		return;
+
+	iter = hash_table_iterate_init(profile_frames);
+	while (hash_table_iterate(iter, profile_frames, &marker, &profile)) {
+		i_free(marker);
+		i_free(profile);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&profile_frames);
+}
+
+static void data_stack_init_env(void)
+{
+	const char *value;
+	uintmax_t size;
+
+	value = getenv("DATA_STACK_TRIM_SIZE");
+	if (value != NULL && str_to_uintmax(value, &size) == 0 &&
+	    size <= SIZE_MAX)
+		data_stack_trim_size = size;
+	value = getenv("DATA_STACK_PROFILE");
+	if (value != NULL && str_to_uintmax(value, &size) == 0 &&
+	    size <= SIZE_MAX)
+		data_stack_profile_start(size);
+}
+
 void data_stack_init(void)
 {
 	if (data_stack_initialized) {
@@ -759,6 +1051,7 @@ void data_stack_init(void)
 	last_buffer_size = 0;
 
 	root_frame_id = t_push("data_stack_init");
+	data_stack_init_env();
 }
 
 void data_stack_deinit_event(void)
@@ -773,6 +1066,9 @@ void data_stack_deinit(void)
 	    current_frame != NULL)
 		i_panic("Missing t_pop() call");
 
+	data_stack_profile_stop();
+	data_stack_profile_reset();
+
 	free(current_block);
 	current_block = NULL;
 	data_stack_free_unused();
@@ -157,6 +157,55 @@ size_t data_stack_get_used_size(void);
 /* Free all the memory that is currently unused (i.e. reserved for growing
    data stack quickly). */
 void data_stack_free_unused(void);
+/* Free the blocks larger than size immediately when they become unused,
+   instead of keeping the largest one reserved. This way a single large
+   frame (e.g. a huge FETCH) doesn't keep the process's memory usage high
+   afterwards. 0 disables trimming, which is the default. This can also be
+   enabled with the DATA_STACK_TRIM_SIZE environment variable. */
+void data_stack_set_trim_size(size_t size);
+
+/* Data stack profiling records for each frame marker the highest amount of
+   memory that the frame used (including its child frames) and the number of
+   allocations done directly in the frame. Frames with the same marker are
+   combined, so the frames should be named with T_BEGIN or t_push_named().
+
+   Profiling can also be enabled by setting the DATA_STACK_PROFILE
+   environment variable to the event_min_peak_bytes value (see
+   import_environment setting). For each popped frame that used at least
+   event_min_peak_bytes, a "data_stack_frame_peak" debug event is sent with
+   frame_marker, peak_bytes, alloc_count, alloc_bytes and max_peak_bytes
+   fields. These can be aggregated with stats metrics and viewed with
+   doveadm stats dump, e.g.:
+
+   metric data_stack_frames {
+     filter = event=data_stack_frame_peak
+     fields = peak_bytes alloc_count
+     group_by = frame_marker
+   }
+*/
+struct data_stack_frame_profile {
+	const char *marker;
+	/* Number of times the frame has been pushed and popped */
+	unsigned int push_count;
+	/* Highest number of bytes used by the frame and its child frames */
+	size_t peak_bytes;
+	/* Total number of allocations and bytes allocated directly in the
+	   frame */
+	unsigned long long alloc_count;
+	unsigned long long alloc_bytes;
+};
+
+/* Start profiling data stack usage. If already started, only update
+   event_min_peak_bytes. */
+void data_stack_profile_start(size_t event_min_peak_bytes);
+/* Stop profiling. The collected profile is preserved. */
+void data_stack_profile_stop(void);
+/* Returns the collected frame profiles sorted by peak_bytes, largest first.
+   The returned array is allocated from data stack. */
+const struct data_stack_frame_profile *
+data_stack_profile_get(unsigned int *count_r);
+/* Forget the collected frame profiles. */
+void data_stack_profile_reset(void);
 
 void data_stack_init(void);
 void data_stack_deinit_event(void);
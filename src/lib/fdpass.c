@@ -101,15 +101,17 @@ struct const_iovec {
 
 #ifdef SCM_RIGHTS
 
-ssize_t fd_send(int handle, int send_fd, const void *data, size_t size)
+ssize_t fd_send_multi(int handle, const int *send_fds, unsigned int count,
+		      const void *data, size_t size)
 {
         struct msghdr msg;
         struct const_iovec iov;
         struct cmsghdr *cmsg;
-	char buf[CMSG_SPACE(sizeof(int))];
+	char buf[CMSG_SPACE(sizeof(int) * FDPASS_MAX_FDS)];
 
 	/* at least one byte is required to be sent with fd passing */
 	i_assert(size > 0 && size < INT_MAX);
+	i_assert(count <= FDPASS_MAX_FDS);
 
 	memset(&msg, 0, sizeof(struct msghdr));
 
@@ -119,17 +121,17 @@ ssize_t fd_send(int handle, int send_fd, const void *data, size_t size)
         msg.msg_iov = (void *)&iov;
 	msg.msg_iovlen = 1;
 
-	if (send_fd != -1) {
+	if (count > 0) {
 		/* set the control and controllen before CMSG_FIRSTHDR(). */
 		memset(buf, 0, sizeof(buf));
 		msg.msg_control = buf;
-		msg.msg_controllen = sizeof(buf);
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
 
 		cmsg = CMSG_FIRSTHDR(&msg);
 		cmsg->cmsg_level = SOL_SOCKET;
 		cmsg->cmsg_type = SCM_RIGHTS;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
-		memcpy(CMSG_DATA(cmsg), &send_fd, sizeof(send_fd));
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+		memcpy(CMSG_DATA(cmsg), send_fds, sizeof(int) * count);
 
 		/* set the real length we want to use. Do it after all is
 		   set just in case CMSG macros required the extra padding
@@ -140,6 +142,12 @@ ssize_t fd_send(int handle, int send_fd, const void *data, size_t size)
 	return sendmsg(handle, &msg, 0);
 }
 
+ssize_t fd_send(int handle, int send_fd, const void *data, size_t size)
+{
+	return fd_send_multi(handle, &send_fd, send_fd == -1 ? 0 : 1,
+			     data, size);
+}
+
 #ifdef LINUX20
 /* Linux 2.0.x doesn't set any cmsg fields. Note that this might make some
    attacks possible so don't do it unless you really have to. */
@@ -151,15 +159,18 @@ ssize_t fd_send(int handle, int send_fd, const void *data, size_t size)
 	 (cmsg)->cmsg_level == SOL_SOCKET && (cmsg)->cmsg_type == SCM_RIGHTS)
 #endif
 
-ssize_t fd_read(int handle, void *data, size_t size, int *fd)
+ssize_t fd_read_multi(int handle, void *data, size_t size,
+		      int *fds_r, unsigned int *fds_count)
 {
 	struct msghdr msg;
 	struct iovec iov;
 	struct cmsghdr *cmsg;
 	ssize_t ret;
-	char buf[CMSG_SPACE(sizeof(int))];
+	size_t fds_size;
+	char buf[CMSG_SPACE(sizeof(int) * FDPASS_MAX_FDS)];
 
 	i_assert(size > 0 && size < INT_MAX);
+	i_assert(*fds_count > 0 && *fds_count <= FDPASS_MAX_FDS);
 
 	memset(&msg, 0, sizeof (struct msghdr));
 
@@ -171,24 +182,40 @@ ssize_t fd_read(int handle, void *data, size_t size, int *fd)
 
 	memset(buf, 0, sizeof(buf));
 	msg.msg_control = buf;
-	msg.msg_controllen = sizeof(buf);
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * *fds_count);
 
 	ret = recvmsg(handle, &msg, 0);
 	if (ret <= 0) {
-		*fd = -1;
+		*fds_count = 0;
 		return ret;
 	}
 
-	/* at least one byte transferred - we should have the fd now.
+	/* at least one byte transferred - we should have the fds now.
 	   do extra checks to make sure it really is an fd that is being
 	   transferred to avoid potential DoS conditions. some systems don't
 	   set all these values correctly however so CHECK_CMSG() is somewhat
 	   system dependent */
 	cmsg = CMSG_FIRSTHDR(&msg);
 	if (!CHECK_CMSG(cmsg))
+		*fds_count = 0;
+	else {
+		fds_size = (size_t)cmsg->cmsg_len - CMSG_LEN(0);
+		if (fds_size > sizeof(int) * *fds_count)
+			fds_size = sizeof(int) * *fds_count;
+		*fds_count = fds_size / sizeof(int);
+		memcpy(fds_r, CMSG_DATA(cmsg), sizeof(int) * *fds_count);
+	}
+	return ret;
+}
+
+ssize_t fd_read(int handle, void *data, size_t size, int *fd)
+{
+	unsigned int count = 1;
+	ssize_t ret;
+
+	ret = fd_read_multi(handle, data, size, fd, &count);
+	if (count == 0)
 		*fd = -1;
-	else
-		memcpy(fd, CMSG_DATA(cmsg), sizeof(*fd));
 	return ret;
 }
 
@@ -203,10 +230,27 @@ ssize_t fd_send(int handle ATTR_UNUSED, int send_fd ATTR_UNUSED,
 	return -1;
 }
 
+ssize_t fd_send_multi(int handle ATTR_UNUSED,
+		      const int *send_fds ATTR_UNUSED,
+		      unsigned int count ATTR_UNUSED,
+		      const void *data ATTR_UNUSED, size_t size ATTR_UNUSED)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
 ssize_t fd_read(int handle ATTR_UNUSED, void *data ATTR_UNUSED,
 		size_t size ATTR_UNUSED, int *fd ATTR_UNUSED)
 {
 	errno = ENOSYS;
 	return -1;
 }
+
+ssize_t fd_read_multi(int handle ATTR_UNUSED, void *data ATTR_UNUSED,
+		      size_t size ATTR_UNUSED, int *fds_r ATTR_UNUSED,
+		      unsigned int *fds_count ATTR_UNUSED)
+{
+	errno = ENOSYS;
+	return -1;
+}
 #endif
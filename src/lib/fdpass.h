@@ -1,15 +1,26 @@
 #ifndef FDPASS_H
 #define FDPASS_H
 
+/* Maximum number of fds that can be sent or received in one message */
+#define FDPASS_MAX_FDS 32
+
 /* Send data and send_fd (unless it's -1) via sendmsg(). Returns number of
    bytes sent, or -1 on error. If at least 1 byte was sent, the send_fd was
    also sent. */
 ssize_t fd_send(int handle, int send_fd, const void *data, size_t size);
+/* Like fd_send(), but send all the send_fds in the same message. */
+ssize_t fd_send_multi(int handle, const int *send_fds, unsigned int count,
+		      const void *data, size_t size);
 
 /* Receive data and fd via recvmsg(). Returns number of bytes read, 0 on
    disconnection, or -1 on error. If at least 1 byte was read, the fd is also
    returned (if it had been sent). If there was no fd received, it's set to
    -1. See test-istream-unix.c for different test cases. */
 ssize_t fd_read(int handle, void *data, size_t size, int *fd_r);
+/* Like fd_read(), but receive up to *fds_count fds sent in the same message.
+   *fds_count is updated to the number of fds received. Any fds beyond the
+   given count are closed by the kernel. */
+ssize_t fd_read_multi(int handle, void *data, size_t size,
+		      int *fds_r, unsigned int *fds_count);
 
 #endif
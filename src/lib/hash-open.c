@@ -0,0 +1,494 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+
+#include "lib.h"
+#include "bits.h"
+#include "hash-open.h"
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+/* The slots are divided into groups of 16. Each slot has a control byte,
+   which is either EMPTY, DELETED or the lowest 7 bits of the key's hash
+   (fingerprint). A lookup scans a whole group of control bytes at once for
+   the matching fingerprints, so the keys are compared only when the
+   fingerprint matches. The probing continues to the next group until a
+   group with an EMPTY slot is found. */
+#define HASH_OPEN_GROUP_SIZE 16
+#define HASH_OPEN_CTRL_EMPTY 0x80
+#define HASH_OPEN_CTRL_DELETED 0xfe
+#define HASH_OPEN_MIN_CAPACITY HASH_OPEN_GROUP_SIZE
+
+/* Maximum load factor is 7/8 */
+#define HASH_OPEN_MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+struct hash_open_slot {
+	void *key;
+	void *value;
+};
+
+struct hash_open_table {
+	unsigned int initial_capacity;
+	/* number of slots - always a power of 2 */
+	unsigned int capacity;
+	unsigned int count, deleted_count;
+	int frozen;
+	/* Nodes inserted while frozen go here once this table becomes full.
+	   The slots can't be moved while frozen, since iterators point to
+	   them. Each overflow table has twice the capacity of the previous
+	   one. They're merged back to this table when it's thawed. */
+	struct hash_open_table *overflow;
+
+	uint8_t *ctrl;
+	struct hash_open_slot *slots;
+
+	hash_callback_t *hash_cb;
+	hash_cmp_callback_t *key_compare_cb;
+};
+
+static uint32_t ATTR_NO_SANITIZE_INTEGER hash_open_mix(uint32_t h)
+{
+	/* The hash functions commonly used with hash tables (direct pointer
+	   hashes, str_hash()) have poor distribution in the low bits.
+	   Use the murmur3 finalizer to spread them. */
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+#ifdef __SSE2__
+static inline unsigned int
+hash_open_group_match(const uint8_t *ctrl, uint8_t value)
+{
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+
+	return (unsigned int)_mm_movemask_epi8(
+		_mm_cmpeq_epi8(group, _mm_set1_epi8((char)value)));
+}
+
+static inline unsigned int hash_open_group_match_free(const uint8_t *ctrl)
+{
+	/* EMPTY and DELETED are the only ones with the highest bit set */
+	return (unsigned int)_mm_movemask_epi8(
+		_mm_loadu_si128((const __m128i *)ctrl));
+}
+#else
+static inline unsigned int
+hash_open_group_match(const uint8_t *ctrl, uint8_t value)
+{
+	unsigned int i, mask = 0;
+
+	for (i = 0; i < HASH_OPEN_GROUP_SIZE; i++) {
+		if (ctrl[i] == value)
+			mask |= 1U << i;
+	}
+	return mask;
+}
+
+static inline unsigned int hash_open_group_match_free(const uint8_t *ctrl)
+{
+	unsigned int i, mask = 0;
+
+	for (i = 0; i < HASH_OPEN_GROUP_SIZE; i++) {
+		if ((ctrl[i] & 0x80) != 0)
+			mask |= 1U << i;
+	}
+	return mask;
+}
+#endif
+
+static inline unsigned int hash_open_group_match_empty(const uint8_t *ctrl)
+{
+	return hash_open_group_match(ctrl, HASH_OPEN_CTRL_EMPTY);
+}
+
+static inline unsigned int hash_open_first_bit(unsigned int mask)
+{
+	i_assert(mask != 0);
+	return (unsigned int)__builtin_ctz(mask);
+}
+
+static unsigned int hash_open_capacity_for(unsigned int count)
+{
+	uint64_t needed = (uint64_t)count + count / 7 + 1;
+
+	if (needed <= HASH_OPEN_MIN_CAPACITY)
+		return HASH_OPEN_MIN_CAPACITY;
+	if (needed > (1U << 31))
+		i_panic("hash table too large");
+	return nearest_power(needed);
+}
+
+static void
+hash_open_table_alloc(struct hash_open_table *table, unsigned int capacity)
+{
+	table->capacity = capacity;
+	table->ctrl = i_malloc(capacity);
+	memset(table->ctrl, HASH_OPEN_CTRL_EMPTY, capacity);
+	table->slots = i_new(struct hash_open_slot, capacity);
+}
+
+struct hash_open_table *
+hash_open_table_create(unsigned int initial_size, hash_callback_t *hash_cb,
+		       hash_cmp_callback_t *key_compare_cb)
+{
+	struct hash_open_table *table;
+
+	table = i_new(struct hash_open_table, 1);
+	table->hash_cb = hash_cb;
+	table->key_compare_cb = key_compare_cb;
+	table->initial_capacity = hash_open_capacity_for(initial_size);
+	hash_open_table_alloc(table, table->initial_capacity);
+	return table;
+}
+
+static void hash_open_table_free(struct hash_open_table *table)
+{
+	i_free(table->ctrl);
+	i_free(table->slots);
+	i_free(table);
+}
+
+void hash_open_table_destroy(struct hash_open_table **_table)
+{
+	struct hash_open_table *table = *_table;
+
+	*_table = NULL;
+	i_assert(table->frozen == 0);
+	i_assert(table->overflow == NULL);
+	hash_open_table_free(table);
+}
+
+void hash_open_table_clear(struct hash_open_table *table)
+{
+	i_assert(table->frozen == 0);
+	i_assert(table->overflow == NULL);
+
+	memset(table->ctrl, HASH_OPEN_CTRL_EMPTY, table->capacity);
+	memset(table->slots, 0, sizeof(*table->slots) * table->capacity);
+	table->count = 0;
+	table->deleted_count = 0;
+}
+
+/* Returns the slot index of the key, or UINT_MAX if not found. If
+   free_idx_r isn't NULL, it's set to the first free slot in the probe
+   sequence (UINT_MAX if there is none). */
+static unsigned int
+hash_open_find(const struct hash_open_table *table, const void *key,
+	       uint32_t hash, unsigned int *free_idx_r)
+{
+	unsigned int group_mask = table->capacity / HASH_OPEN_GROUP_SIZE - 1;
+	unsigned int group = (hash >> 7) & group_mask;
+	uint8_t fingerprint = hash & 0x7f;
+	unsigned int probe, mask, idx, free_idx = UINT_MAX;
+	const uint8_t *ctrl;
+
+	/* Triangular probing visits each group exactly once. */
+	for (probe = 1; probe <= group_mask + 1; probe++) {
+		ctrl = table->ctrl + group * HASH_OPEN_GROUP_SIZE;
+
+		mask = hash_open_group_match(ctrl, fingerprint);
+		while (mask != 0) {
+			idx = group * HASH_OPEN_GROUP_SIZE +
+				hash_open_first_bit(mask);
+			if (table->key_compare_cb(table->slots[idx].key,
+						  key) == 0) {
+				if (free_idx_r != NULL)
+					*free_idx_r = free_idx;
+				return idx;
+			}
+			mask &= mask - 1;
+		}
+		if (free_idx == UINT_MAX) {
+			mask = hash_open_group_match_free(ctrl);
+			if (mask != 0) {
+				free_idx = group * HASH_OPEN_GROUP_SIZE +
+					hash_open_first_bit(mask);
+			}
+		}
+		if (hash_open_group_match_empty(ctrl) != 0)
+			break;
+		group = (group + probe) & group_mask;
+	}
+	if (free_idx_r != NULL)
+		*free_idx_r = free_idx;
+	return UINT_MAX;
+}
+
+static void
+hash_open_set(struct hash_open_table *table, unsigned int idx, uint32_t hash,
+	      void *key, void *value)
+{
+	i_assert((table->ctrl[idx] & 0x80) != 0);
+
+	if (table->ctrl[idx] == HASH_OPEN_CTRL_DELETED) {
+		i_assert(table->deleted_count > 0);
+		table->deleted_count--;
+	}
+	table->ctrl[idx] = hash & 0x7f;
+	table->slots[idx].key = key;
+	table->slots[idx].value = value;
+	table->count++;
+}
+
+static void
+hash_open_table_rehash(struct hash_open_table *table, unsigned int capacity)
+{
+	uint8_t *old_ctrl = table->ctrl;
+	struct hash_open_slot *old_slots = table->slots;
+	unsigned int i, idx, old_capacity = table->capacity;
+	uint32_t hash;
+
+	hash_open_table_alloc(table, capacity);
+	table->count = 0;
+	table->deleted_count = 0;
+
+	for (i = 0; i < old_capacity; i++) {
+		if ((old_ctrl[i] & 0x80) != 0)
+			continue;
+		hash = hash_open_mix(table->hash_cb(old_slots[i].key));
+		(void)hash_open_find(table, old_slots[i].key, hash, &idx);
+		i_assert(idx != UINT_MAX);
+		hash_open_set(table, idx, hash, old_slots[i].key,
+			      old_slots[i].value);
+	}
+	i_free(old_ctrl);
+	i_free(old_slots);
+}
+
+static void hash_open_table_grow(struct hash_open_table *table)
+{
+	unsigned int capacity = table->capacity;
+
+	/* If at least half of the used slots are DELETED, rehashing them
+	   away is enough. Otherwise double the size. */
+	i_assert(table->frozen == 0);
+	if (table->deleted_count < table->count)
+		capacity *= 2;
+	hash_open_table_rehash(table, capacity);
+}
+
+static void hash_open_table_shrink(struct hash_open_table *table)
+{
+	unsigned int capacity;
+
+	i_assert(table->frozen == 0);
+
+	if (table->capacity <= table->initial_capacity ||
+	    table->count >= table->capacity / 8)
+		return;
+	capacity = I_MAX(hash_open_capacity_for(table->count * 2),
+			 table->initial_capacity);
+	if (capacity < table->capacity)
+		hash_open_table_rehash(table, capacity);
+}
+
+/* Find the key from the table or its overflow tables. Returns the table
+   containing it and sets idx_r, or returns NULL if not found. */
+static struct hash_open_table *
+hash_open_find_any(const struct hash_open_table *table, const void *key,
+		   uint32_t hash, unsigned int *idx_r)
+{
+	for (; table != NULL; table = table->overflow) {
+		*idx_r = hash_open_find(table, key, hash, NULL);
+		if (*idx_r != UINT_MAX)
+			return (struct hash_open_table *)table;
+	}
+	return NULL;
+}
+
+bool hash_open_table_lookup(const struct hash_open_table *table,
+			    const void *key, void **orig_key_r,
+			    void **value_r)
+{
+	unsigned int idx;
+
+	table = hash_open_find_any(table, key,
+				   hash_open_mix(table->hash_cb(key)), &idx);
+	if (table == NULL)
+		return FALSE;
+	*orig_key_r = table->slots[idx].key;
+	*value_r = table->slots[idx].value;
+	return TRUE;
+}
+
+static void
+hash_open_table_insert_frozen(struct hash_open_table *table, uint32_t hash,
+			      void *key, void *value)
+{
+	unsigned int free_idx;
+
+	/* Nothing can be moved, so add the node to the first table in the
+	   overflow chain that still has room for it. */
+	for (;;) {
+		(void)hash_open_find(table, key, hash, &free_idx);
+		if (free_idx != UINT_MAX &&
+		    table->count + table->deleted_count + 1 <=
+		    HASH_OPEN_MAX_LOAD(table->capacity))
+			break;
+		if (table->overflow == NULL) {
+			table->overflow = i_new(struct hash_open_table, 1);
+			table->overflow->hash_cb = table->hash_cb;
+			table->overflow->key_compare_cb = table->key_compare_cb;
+			table->overflow->initial_capacity = table->capacity * 2;
+			hash_open_table_alloc(table->overflow,
+					      table->overflow->initial_capacity);
+		}
+		table = table->overflow;
+	}
+	hash_open_set(table, free_idx, hash, key, value);
+}
+
+void hash_open_table_insert(struct hash_open_table *table,
+			    void *key, void *value, bool update)
+{
+	unsigned int idx, free_idx;
+	uint32_t hash;
+
+	i_assert(table->count < UINT_MAX);
+	i_assert(key != NULL);
+
+	hash = hash_open_mix(table->hash_cb(key));
+	if (table->frozen != 0) {
+		struct hash_open_table *found_table;
+
+		found_table = hash_open_find_any(table, key, hash, &idx);
+		if (found_table != NULL) {
+			i_assert(update);
+			found_table->slots[idx].value = value;
+		} else {
+			hash_open_table_insert_frozen(table, hash, key, value);
+		}
+		return;
+	}
+
+	i_assert(table->overflow == NULL);
+	idx = hash_open_find(table, key, hash, &free_idx);
+	if (idx != UINT_MAX) {
+		i_assert(update);
+		table->slots[idx].value = value;
+		return;
+	}
+
+	if (table->count + table->deleted_count + 1 >
+	    HASH_OPEN_MAX_LOAD(table->capacity)) {
+		hash_open_table_grow(table);
+		(void)hash_open_find(table, key, hash, &free_idx);
+	}
+	i_assert(free_idx != UINT_MAX);
+	hash_open_set(table, free_idx, hash, key, value);
+}
+
+bool hash_open_table_try_remove(struct hash_open_table *table,
+				const void *key)
+{
+	struct hash_open_table *found_table;
+	unsigned int idx, group_idx;
+
+	found_table = hash_open_find_any(table, key,
+					 hash_open_mix(table->hash_cb(key)),
+					 &idx);
+	if (found_table == NULL)
+		return FALSE;
+
+	/* If the group still has an EMPTY slot, lookups would have stopped
+	   at this group anyway, so the slot can become EMPTY as well.
+	   Otherwise it must be marked DELETED to keep the probing going. */
+	group_idx = idx - idx % HASH_OPEN_GROUP_SIZE;
+	if (hash_open_group_match_empty(found_table->ctrl + group_idx) != 0)
+		found_table->ctrl[idx] = HASH_OPEN_CTRL_EMPTY;
+	else {
+		found_table->ctrl[idx] = HASH_OPEN_CTRL_DELETED;
+		found_table->deleted_count++;
+	}
+	found_table->slots[idx].key = NULL;
+	found_table->slots[idx].value = NULL;
+	found_table->count--;
+
+	if (table->frozen == 0)
+		hash_open_table_shrink(table);
+	return TRUE;
+}
+
+unsigned int hash_open_table_count(const struct hash_open_table *table)
+{
+	unsigned int count = 0;
+
+	for (; table != NULL; table = table->overflow)
+		count += table->count;
+	return count;
+}
+
+bool hash_open_table_iterate(struct hash_open_table *table, unsigned int *pos,
+			     void **key_r, void **value_r)
+{
+	unsigned int i, base = 0;
+
+	i_assert(table->frozen > 0);
+
+	/* The positions continue from the table to its overflow tables.
+	   None of them are resized while frozen, so the positions stay
+	   valid. */
+	for (; table != NULL; table = table->overflow) {
+		i = *pos < base ? 0 : *pos - base;
+		for (; i < table->capacity; i++) {
+			if ((table->ctrl[i] & 0x80) == 0) {
+				*key_r = table->slots[i].key;
+				*value_r = table->slots[i].value;
+				*pos = base + i + 1;
+				return TRUE;
+			}
+		}
+		base += table->capacity;
+	}
+	*pos = base;
+	return FALSE;
+}
+
+static void hash_open_table_merge_overflow(struct hash_open_table *table)
+{
+	struct hash_open_table *overflow, *next;
+	const struct hash_open_slot *slot;
+	unsigned int i, free_idx, capacity;
+	uint32_t hash;
+
+	capacity = I_MAX(hash_open_capacity_for(hash_open_table_count(table)),
+			 table->initial_capacity);
+	hash_open_table_rehash(table, capacity);
+	for (overflow = table->overflow; overflow != NULL; overflow = next) {
+		for (i = 0; i < overflow->capacity; i++) {
+			if ((overflow->ctrl[i] & 0x80) != 0)
+				continue;
+			slot = &overflow->slots[i];
+			hash = hash_open_mix(table->hash_cb(slot->key));
+			(void)hash_open_find(table, slot->key, hash, &free_idx);
+			i_assert(free_idx != UINT_MAX);
+			hash_open_set(table, free_idx, hash,
+				      slot->key, slot->value);
+		}
+		next = overflow->overflow;
+		hash_open_table_free(overflow);
+	}
+	table->overflow = NULL;
+}
+
+void hash_open_table_freeze(struct hash_open_table *table)
+{
+	table->frozen++;
+}
+
+void hash_open_table_thaw(struct hash_open_table *table)
+{
+	i_assert(table->frozen > 0);
+
+	if (--table->frozen > 0)
+		return;
+	if (table->overflow != NULL)
+		hash_open_table_merge_overflow(table);
+	hash_open_table_shrink(table);
+}
@@ -0,0 +1,39 @@
+#ifndef HASH_OPEN_H
+#define HASH_OPEN_H
+
+#include "hash.h"
+
+/* Open addressing hash table used internally by hash.c for the tables
+   created with hash_table_create_open(). Don't use these directly, use the
+   hash_table_*() API instead. */
+
+struct hash_open_table *
+hash_open_table_create(unsigned int initial_size, hash_callback_t *hash_cb,
+		       hash_cmp_callback_t *key_compare_cb);
+void hash_open_table_destroy(struct hash_open_table **table);
+void hash_open_table_clear(struct hash_open_table *table);
+
+bool hash_open_table_lookup(const struct hash_open_table *table,
+			    const void *key, void **orig_key_r,
+			    void **value_r);
+/* Insert the key. If it already exists, update its value if update=TRUE,
+   otherwise assert-crash. */
+void hash_open_table_insert(struct hash_open_table *table,
+			    void *key, void *value, bool update);
+bool hash_open_table_try_remove(struct hash_open_table *table,
+				const void *key);
+unsigned int hash_open_table_count(const struct hash_open_table *table);
+
+/* Returns the next node at or after *pos and updates *pos to point after
+   it. Returns FALSE when there are no more nodes. The table must be frozen
+   while iterating. */
+bool hash_open_table_iterate(struct hash_open_table *table, unsigned int *pos,
+			     void **key_r, void **value_r);
+
+/* The table isn't grown, shrunk or rehashed while frozen, so nodes don't
+   move. If it becomes full while frozen, the new nodes are added to
+   overflow tables, which are merged back when the table is thawed. */
+void hash_open_table_freeze(struct hash_open_table *table);
+void hash_open_table_thaw(struct hash_open_table *table);
+
+#endif
@@ -4,7 +4,9 @@
 
 #include "lib.h"
 #include "hash.h"
+#include "hash-open.h"
 #include "primes.h"
+#include "randgen.h"
 
 #include <ctype.h>
 
@@ -12,6 +14,8 @@
 
 #undef hash_table_create
 #undef hash_table_create_direct
+#undef hash_table_create_open
+#undef hash_table_create_open_direct
 #undef hash_table_destroy
 #undef hash_table_clear
 #undef hash_table_lookup
@@ -44,6 +48,10 @@ struct hash_table {
 
 	hash_callback_t *hash_cb;
 	hash_cmp_callback_t *key_compare_cb;
+
+	/* Non-NULL if this is an open addressing table. All the other fields
+	   except node_pool are then unused. */
+	struct hash_open_table *open;
 };
 
 struct hash_iterate_context {
@@ -98,6 +106,29 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			  direct_hash, direct_cmp);
 }
 
+void hash_table_create_open(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb)
+{
+	struct hash_table *table;
+
+	pool_ref(node_pool);
+	table = i_new(struct hash_table, 1);
+	table->node_pool = node_pool;
+	table->open = hash_open_table_create(initial_size, hash_cb,
+					     key_compare_cb);
+	*table_r = table;
+}
+
+void hash_table_create_open_direct(struct hash_table **table_r,
+				   pool_t node_pool,
+				   unsigned int initial_size)
+{
+	hash_table_create_open(table_r, node_pool, initial_size,
+			       direct_hash, direct_cmp);
+}
+
 static void free_node(struct hash_table *table, struct hash_node *node)
 {
 	if (!table->node_pool->alloconly_pool)
@@ -139,7 +170,9 @@ void hash_table_destroy(struct hash_table **_table)
 
 	i_assert(table->frozen == 0);
 
-	if (!table->node_pool->alloconly_pool) {
+	if (table->open != NULL)
+		hash_open_table_destroy(&table->open);
+	else if (!table->node_pool->alloconly_pool) {
 		hash_table_destroy_nodes(table);
 		destroy_node_list(table, table->free_nodes);
 	}
@@ -153,6 +186,11 @@ void hash_table_clear(struct hash_table *table, bool free_nodes)
 {
 	i_assert(table->frozen == 0);
 
+	if (table->open != NULL) {
+		hash_open_table_clear(table->open);
+		return;
+	}
+
 	if (!table->node_pool->alloconly_pool)
 		hash_table_destroy_nodes(table);
 
@@ -191,6 +229,15 @@ void *hash_table_lookup(const struct hash_table *table, const void *key)
 {
 	struct hash_node *node;
 
+	if (table->open != NULL) {
+		void *orig_key, *value;
+
+		if (!hash_open_table_lookup(table->open, key,
+					    &orig_key, &value))
+			return NULL;
+		return value;
+	}
+
 	node = hash_table_lookup_node(table, key, table->hash_cb(key));
 	return node != NULL ? node->value : NULL;
 }
@@ -201,6 +248,11 @@ bool hash_table_lookup_full(const struct hash_table *table,
 {
 	struct hash_node *node;
 
+	if (table->open != NULL) {
+		return hash_open_table_lookup(table->open, lookup_key,
+					      orig_key, value);
+	}
+
 	node = hash_table_lookup_node(table, lookup_key,
 				      table->hash_cb(lookup_key));
 	if (node == NULL)
@@ -297,12 +349,18 @@ hash_table_insert_node(struct hash_table *table, void *key, void *value,
 
 void hash_table_insert(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
+	if (table->open != NULL)
+		hash_open_table_insert(table->open, key, value, FALSE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
 }
 
 void hash_table_update(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
+	if (table->open != NULL)
+		hash_open_table_insert(table->open, key, value, TRUE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
 }
 
 static void
@@ -347,6 +405,9 @@ bool hash_table_try_remove(struct hash_table *table, const void *key)
 	struct hash_node *node;
 	unsigned int hash;
 
+	if (table->open != NULL)
+		return hash_open_table_try_remove(table->open, key);
+
 	hash = table->hash_cb(key);
 
 	node = hash_table_lookup_node(table, key, hash);
@@ -365,6 +426,8 @@ bool hash_table_try_remove(struct hash_table *table, const void *key)
 
 unsigned int hash_table_count(const struct hash_table *table)
 {
+	if (table->open != NULL)
+		return hash_open_table_count(table->open);
 	return table->nodes_count;
 }
 
@@ -376,7 +439,8 @@ struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
 
 	ctx = i_new(struct hash_iterate_context, 1);
 	ctx->table = table;
-	ctx->next = &table->nodes[0];
+	if (table->open == NULL)
+		ctx->next = &table->nodes[0];
 	return ctx;
 }
 
@@ -403,6 +467,15 @@ bool hash_table_iterate(struct hash_iterate_context *ctx,
 {
 	struct hash_node *node;
 
+	if (ctx->table->open != NULL) {
+		if (!hash_open_table_iterate(ctx->table->open, &ctx->pos,
+					     key_r, value_r)) {
+			*key_r = *value_r = NULL;
+			return FALSE;
+		}
+		return TRUE;
+	}
+
 	node = ctx->next;
 	if (node != NULL && node->key == NULL)
 		node = hash_table_iterate_next(ctx, node);
@@ -432,14 +505,20 @@ void hash_table_iterate_deinit(struct hash_iterate_context **_ctx)
 void hash_table_freeze(struct hash_table *table)
 {
 	table->frozen++;
+	if (table->open != NULL)
+		hash_open_table_freeze(table->open);
 }
 
 void hash_table_thaw(struct hash_table *table)
 {
 	i_assert(table->frozen > 0);
 
+	if (table->open != NULL)
+		hash_open_table_thaw(table->open);
 	if (--table->frozen > 0)
 		return;
+	if (table->open != NULL)
+		return;
 
 	if (table->removed_count > 0) {
 		if (!hash_table_resize(table, FALSE))
@@ -519,59 +598,146 @@ void hash_table_copy(struct hash_table *dest, struct hash_table *src)
 	hash_table_thaw(dest);
 }
 
-/* a char* hash function from ASU -- from glib */
-unsigned int ATTR_NO_SANITIZE_INTEGER
-str_hash(const char *p)
+/* The string and memory hashes are based on wyhash (public domain). They
+   process the input 8 bytes at a time and are seeded randomly at startup,
+   so the hash values can't be predicted by an attacker trying to cause
+   collisions. This also means that the hash values differ between
+   processes, so they must never be stored or sent anywhere. */
+static const uint64_t hash_secret[4] = {
+	0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+	0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+static uint64_t hash_seed;
+static bool hash_seed_initialized = FALSE;
+
+void hash_seed_init(void)
 {
-        const unsigned char *s = (const unsigned char *)p;
-	unsigned int g, h = 0;
+	if (hash_seed_initialized)
+		return;
+	random_fill(&hash_seed, sizeof(hash_seed));
+	hash_seed_initialized = TRUE;
+}
 
-	while (*s != '\0') {
-		h = (h << 4) + *s;
-		if ((g = h & 0xf0000000UL) != 0) {
-			h = h ^ (g >> 24);
-			h = h ^ g;
-		}
-		s++;
-	}
+/* Multiply a and b into 128 bits, return the low 64 bits in a and the high
+   64 bits in b. */
+static inline void ATTR_NO_SANITIZE_INTEGER
+hash_mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 r = (unsigned __int128)*a * *b;
+
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32;
+	uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl ? 1 : 0;
+	uint64_t lo = t + (rm1 << 32);
+
+	c += lo < t ? 1 : 0;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
 
-	return h;
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+	hash_mum(&a, &b);
+	return a ^ b;
 }
 
-/* a char* hash function from ASU -- from glib */
-unsigned int ATTR_NO_SANITIZE_INTEGER
-strcase_hash(const char *p)
+/* Convert ASCII a-z to uppercase in all 8 bytes at once. Bytes with the
+   highest bit set are left alone. */
+static inline uint64_t ATTR_NO_SANITIZE_INTEGER
+hash_ascii_upper(uint64_t w)
 {
-        const unsigned char *s = (const unsigned char *)p;
-	unsigned int g, h = 0;
+	uint64_t low7 = w & 0x7f7f7f7f7f7f7f7fULL;
+	/* highest bit is set for bytes >= 'a' and for bytes > 'z' */
+	uint64_t ge_a = low7 + 0x1f1f1f1f1f1f1f1fULL;
+	uint64_t gt_z = low7 + 0x0505050505050505ULL;
+	uint64_t lower = ge_a & ~gt_z & ~w & 0x8080808080808080ULL;
 
-	while (*s != '\0') {
-		h = (h << 4) + i_toupper(*s);
-		if ((g = h & 0xf0000000UL) != 0) {
-			h = h ^ (g >> 24);
-			h = h ^ g;
-		}
-		s++;
-	}
+	return w ^ (lower >> 2);
+}
 
-	return h;
+static inline uint64_t hash_read8(const unsigned char *p, bool fold)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return fold ? hash_ascii_upper(v) : v;
 }
 
-unsigned int ATTR_NO_SANITIZE_INTEGER
-mem_hash(const void *p, unsigned int size)
+static inline uint64_t hash_read4(const unsigned char *p, bool fold)
 {
-	const unsigned char *s = p;
-	unsigned int i, g, h = 0;
+	uint32_t v;
 
-	for (i = 0; i < size; i++) {
-		h = (h << 4) + *s;
-		if ((g = h & 0xf0000000UL) != 0) {
-			h = h ^ (g >> 24);
-			h = h ^ g;
+	memcpy(&v, p, sizeof(v));
+	return fold ? hash_ascii_upper(v) : v;
+}
+
+static inline uint64_t
+hash_read3(const unsigned char *p, size_t len, bool fold)
+{
+	uint64_t v = ((uint64_t)p[0] << 16) |
+		((uint64_t)p[len / 2] << 8) | p[len - 1];
+
+	return fold ? hash_ascii_upper(v) : v;
+}
+
+static inline unsigned int ATTR_NO_SANITIZE_INTEGER
+hash_mem_seeded(const void *data, size_t len, bool fold)
+{
+	const unsigned char *p = data;
+	uint64_t a, b, seed;
+	size_t i;
+
+	i_assert(hash_seed_initialized);
+
+	seed = hash_seed ^ hash_mix(hash_seed ^ hash_secret[0], hash_secret[1]);
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (hash_read4(p, fold) << 32) |
+				hash_read4(p + ((len >> 3) << 2), fold);
+			b = (hash_read4(p + len - 4, fold) << 32) |
+				hash_read4(p + len - 4 - ((len >> 3) << 2), fold);
+		} else if (len > 0) {
+			a = hash_read3(p, len, fold);
+			b = 0;
+		} else {
+			a = b = 0;
 		}
-		s++;
+	} else {
+		for (i = len; i > 16; i -= 16, p += 16) {
+			seed = hash_mix(hash_read8(p, fold) ^ hash_secret[1],
+					hash_read8(p + 8, fold) ^ seed);
+		}
+		/* the last 16 bytes, possibly overlapping the previous
+		   block */
+		a = hash_read8(p + i - 16, fold);
+		b = hash_read8(p + i - 8, fold);
 	}
-	return h;
+	a ^= hash_secret[1];
+	b ^= seed;
+	hash_mum(&a, &b);
+	return (unsigned int)hash_mix(a ^ hash_secret[0] ^ len,
+				      b ^ hash_secret[1]);
+}
+
+unsigned int str_hash(const char *p)
+{
+	return hash_mem_seeded(p, strlen(p), FALSE);
+}
+
+unsigned int strcase_hash(const char *p)
+{
+	return hash_mem_seeded(p, strlen(p), TRUE);
+}
+
+unsigned int mem_hash(const void *p, unsigned int size)
+{
+	return hash_mem_seeded(p, size, FALSE);
 }
 
 unsigned int ATTR_NO_SANITIZE_INTEGER
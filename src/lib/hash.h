@@ -51,6 +51,44 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 		sizeof((*table)._value) != sizeof(void *)), \
 	hash_table_create_direct(&(*table)._table, pool, size))
 
+/* Same as hash_table_create() and hash_table_create_direct(), but use an
+   open addressing table instead of chaining. Lookups are faster and use
+   less memory, since there are no per-node allocations and the probing
+   compares 7 bit fingerprints of 16 slots at a time before comparing any
+   keys. The table is used with the same hash_table_*() API. The node_pool
+   isn't used for allocations. */
+void hash_table_create_open(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb);
+#define hash_table_create_open(table, pool, size, hash_cb, key_cmp_cb) \
+	TYPE_CHECKS(void, \
+	COMPILE_ERROR_IF_TRUE( \
+		sizeof((*table)._key) != sizeof(void *) || \
+		sizeof((*table)._value) != sizeof(void *)) || \
+	COMPILE_ERROR_IF_TRUE( \
+               !__builtin_types_compatible_p(typeof(&key_cmp_cb), \
+                       int (*)(typeof((*table)._key), typeof((*table)._key))) && \
+               !__builtin_types_compatible_p(typeof(&key_cmp_cb), \
+                       int (*)(typeof((*table)._const_key), typeof((*table)._const_key)))) || \
+	COMPILE_ERROR_IF_TRUE( \
+		!__builtin_types_compatible_p(typeof(&hash_cb), \
+			unsigned int (*)(typeof((*table)._key))) && \
+		!__builtin_types_compatible_p(typeof(&hash_cb), \
+		unsigned int (*)(typeof((*table)._const_key)))), \
+	hash_table_create_open(&(*table)._table, pool, size, \
+		(hash_callback_t *)hash_cb, \
+		(hash_cmp_callback_t *)key_cmp_cb))
+void hash_table_create_open_direct(struct hash_table **table_r,
+				   pool_t node_pool,
+				   unsigned int initial_size);
+#define hash_table_create_open_direct(table, pool, size) \
+	TYPE_CHECKS(void, \
+	COMPILE_ERROR_IF_TRUE( \
+		sizeof((*table)._key) != sizeof(void *) || \
+		sizeof((*table)._value) != sizeof(void *)), \
+	hash_table_create_open_direct(&(*table)._table, pool, size))
+
 #define hash_table_is_created(table) \
 	((table)._table != NULL)
 
@@ -160,8 +198,14 @@ void hash_table_copy(struct hash_table *dest, struct hash_table *src);
 #define hash_table_copy(table1, table2) \
 	hash_table_copy((table1)._table, (table2)._table)
 
-/* hash function for strings */
+/* Initialize the random seed for str_hash(), strcase_hash() and mem_hash().
+   This is called by lib_init(). */
+void hash_seed_init(void);
+
+/* hash function for strings. The hash is seeded randomly for each process,
+   so the results can't be stored or shared with other processes. */
 unsigned int str_hash(const char *p) ATTR_PURE;
+/* Same as str_hash(), but ASCII letters are handled case-insensitively. */
 unsigned int strcase_hash(const char *p) ATTR_PURE;
 
 /* fast hash function which uppercases a-z. Does not work well
@@ -169,7 +213,8 @@ unsigned int strcase_hash(const char *p) ATTR_PURE;
    it works by dropping 0x20. */
 unsigned int strfastcase_hash(const char *p) ATTR_PURE;
 
-/* a generic hash for a given memory block */
+/* a generic hash for a given memory block. str_hash(p) is the same as
+   mem_hash(p, strlen(p)). */
 unsigned int mem_hash(const void *p, unsigned int size) ATTR_PURE;
 
 #endif
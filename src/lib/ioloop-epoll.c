@@ -11,12 +11,29 @@
 #include <sys/epoll.h>
 #include <unistd.h>
 
+#ifdef IOLOOP_URING
+/* ioloop-uring.c falls back to these if io_uring isn't available */
+#  define io_loop_handler_init io_loop_handler_epoll_init
+#  define io_loop_handler_deinit io_loop_handler_epoll_deinit
+#  define io_loop_handle_add io_loop_handle_epoll_add
+#  define io_loop_handle_remove io_loop_handle_epoll_remove
+#  define io_loop_handler_run_internal io_loop_handler_epoll_run_internal
+#endif
+
 struct ioloop_handler_context {
 	int epfd;
 
 	unsigned int deleted_count;
 	ARRAY(struct io_list *) fd_index;
 	ARRAY(struct epoll_event) events;
+	/* If the previous iteration exceeded its budget, the order of
+	   handling the fds in the next one: the fds that weren't handled
+	   come first. epoll_wait() doesn't return them in any predictable
+	   position, so the order is stored in the io_lists' budget_pos. */
+	ARRAY(struct io_list *) budget_lists;
+	/* The order of handling this iteration's events, built from
+	   budget_lists. Empty if there is no order. */
+	ARRAY(unsigned int) order;
 };
 
 void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
@@ -27,6 +44,8 @@ void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
 
 	i_array_init(&ctx->events, initial_fd_count);
 	i_array_init(&ctx->fd_index, initial_fd_count);
+	i_array_init(&ctx->budget_lists, 8);
+	i_array_init(&ctx->order, 8);
 
 	ctx->epfd = epoll_create(initial_fd_count);
 	if (ctx->epfd < 0) {
@@ -54,6 +73,8 @@ void io_loop_handler_deinit(struct ioloop *ioloop)
 		i_error("close(epoll) failed: %m");
 	array_free(&ioloop->handler_context->fd_index);
 	array_free(&ioloop->handler_context->events);
+	array_free(&ioloop->handler_context->budget_lists);
+	array_free(&ioloop->handler_context->order);
 	i_free(ioloop->handler_context);
 }
 
@@ -161,6 +182,65 @@ void io_loop_handle_remove(struct io_file *io, bool closed)
 	i_free(io);
 }
 
+static bool
+epoll_order_budget_events(struct ioloop_handler_context *ctx,
+			  unsigned int count)
+{
+	const struct epoll_event *events;
+	struct io_list *list;
+	unsigned int i, j, idx, order_count, *order;
+
+	array_clear(&ctx->order);
+	if (array_count(&ctx->budget_lists) > 0 && count > 0) {
+		/* The fds in the order set by the previous iteration.
+		   Use 1-based indexes, so the fds that are no longer ready
+		   are left as 0 and can be removed. */
+		events = array_front(&ctx->events);
+		for (i = 0; i < count; i++) {
+			list = events[i].data.ptr;
+			if (list->budget_pos > 0) {
+				idx = i + 1;
+				array_idx_set(&ctx->order,
+					      list->budget_pos - 1, &idx);
+			}
+		}
+		order = array_get_modifiable(&ctx->order, &order_count);
+		for (i = j = 0; i < order_count; i++) {
+			if (order[i] != 0)
+				order[j++] = order[i] - 1;
+		}
+		array_delete(&ctx->order, j, order_count - j);
+
+		for (i = 0; i < count; i++) {
+			list = events[i].data.ptr;
+			if (list->budget_pos == 0)
+				array_push_back(&ctx->order, &i);
+		}
+	}
+	array_foreach_elem(&ctx->budget_lists, list)
+		list->budget_pos = 0;
+	array_clear(&ctx->budget_lists);
+	return array_count(&ctx->order) > 0;
+}
+
+static void
+epoll_order_next_events(struct ioloop_handler_context *ctx, bool ordered,
+			unsigned int handled_count, unsigned int count)
+{
+	const struct epoll_event *event;
+	struct io_list *list;
+	unsigned int i, k;
+
+	for (i = 0; i < count; i++) {
+		k = (handled_count + i) % count;
+		event = array_idx(&ctx->events, !ordered ? k :
+				  *array_idx(&ctx->order, k));
+		list = event->data.ptr;
+		array_push_back(&ctx->budget_lists, &list);
+		list->budget_pos = array_count(&ctx->budget_lists);
+	}
+}
+
 void io_loop_handler_run_internal(struct ioloop *ioloop)
 {
 	struct ioloop_handler_context *ctx = ioloop->handler_context;
@@ -170,8 +250,8 @@ void io_loop_handler_run_internal(struct ioloop *ioloop)
 	struct io_file *io;
 	struct timeval tv;
 	unsigned int events_count;
-	int msecs, ret, i, j;
-	bool call;
+	int msecs, ret, i, j, k;
+	bool call, ordered;
 
 	i_assert(ctx != NULL);
 
@@ -197,7 +277,9 @@ void io_loop_handler_run_internal(struct ioloop *ioloop)
 	if (!ioloop->running)
 		return;
 
-	for (i = 0; i < ret; i++) {
+	ordered = epoll_order_budget_events(ctx, I_MAX(ret, 0));
+	for (k = 0; k < ret; k++) {
+		i = ordered ? (int)*array_idx(&ctx->order, k) : k;
 		/* io_loop_handle_add() may cause events array reallocation,
 		   so we have use array_idx() */
 		event = array_idx(&ctx->events, i);
@@ -224,6 +306,13 @@ void io_loop_handler_run_internal(struct ioloop *ioloop)
 					return;
 			}
 		}
+		/* The rest of the fds are still ready and the level-triggered
+		   epoll_wait() returns them again in the next iteration,
+		   which handles them first. */
+		if (io_loop_iteration_over_budget(ioloop)) {
+			epoll_order_next_events(ctx, ordered, k + 1, ret);
+			break;
+		}
 	}
 }
 
@@ -11,6 +11,11 @@ enum {
 
 struct io_list {
 	struct io_file *ios[IOLOOP_IOLIST_IOS_PER_FD];
+	/* If the previous ioloop iteration ran out of budget, this is the
+	   fd's 1-based position in the order of handling the fds in the next
+	   iteration: first the fds that weren't handled, then the ones that
+	   were. 0 = not ordered. */
+	unsigned int budget_pos;
 };
 
 bool ioloop_iolist_add(struct io_list *list, struct io_file *io);
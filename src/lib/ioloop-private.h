@@ -2,6 +2,7 @@
 #define IOLOOP_PRIVATE_H
 
 #include "priorityq.h"
+#include "timer-wheel.h"
 #include "ioloop.h"
 #include "array-decl.h"
 
@@ -16,8 +17,20 @@ struct ioloop {
 
 	struct io_file *io_files;
 	struct io_file *next_io_file;
+	/* The pending IO where to continue when the previous iteration's
+	   budget ran out */
+	struct io_file *next_pending_io_file;
 	struct priorityq *timeouts;
 	ARRAY(struct timeout *) timeouts_new;
+	/* Coarse timeouts in a timer wheel with one second ticks. Created
+	   when the first coarse timeout is added. */
+	struct timer_wheel *coarse_timeouts;
+	/* Wall clock seconds = coarse_timeouts tick + offset. This changes
+	   when time moves. */
+	time_t coarse_timeouts_offset;
+	/* One-shot timeout in the timeouts priorityq for running the
+	   coarse_timeouts wheel. */
+	struct timeout *coarse_timeouts_run_to;
 	struct io_wait_timer *wait_timers;
 
         struct ioloop_handler_context *handler_context;
@@ -31,9 +44,19 @@ struct ioloop {
 
 	unsigned int io_pending_count;
 
+	/* io_loop_set_budget() limits, 0 = unlimited */
+	unsigned int io_budget_usecs;
+	unsigned int iteration_budget_usecs;
+	/* Time when the current iteration's callbacks started to be called */
+	struct timeval iteration_started;
+	/* Time when the current IO callback was called */
+	struct timeval io_started;
+	struct ioloop_lag_stats *lag_stats;
+
 	bool running:1;
 	bool iolooping:1;
 	bool stop_after_run_loop:1;
+	bool iteration_budget_exceeded:1;
 };
 
 struct io {
@@ -69,6 +92,8 @@ struct io_file {
 
 struct timeout {
 	struct priorityq_item item;
+	/* Used instead of item for coarse timeouts */
+	struct timer_wheel_item wheel_item;
 	const char *source_filename;
 	unsigned int source_linenum;
 
@@ -82,6 +107,7 @@ struct timeout {
 	struct ioloop_context *ctx;
 
 	bool one_shot:1;
+	bool coarse:1;
 };
 
 struct io_wait_timer {
@@ -111,6 +137,10 @@ struct ioloop_context {
 int io_loop_run_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r);
 void io_loop_handle_timeouts(struct ioloop *ioloop);
 void io_loop_call_io(struct io *io);
+/* Returns TRUE if the iteration budget set by io_loop_set_budget() has been
+   exceeded. The ioloop handler should then stop calling the IO callbacks and
+   leave the rest of the events to the next iteration. */
+bool io_loop_iteration_over_budget(struct ioloop *ioloop);
 
 void io_loop_handler_run_internal(struct ioloop *ioloop);
 
@@ -121,6 +151,17 @@ void io_loop_handle_remove(struct io_file *io, bool closed);
 void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count);
 void io_loop_handler_deinit(struct ioloop *ioloop);
 
+#ifdef IOLOOP_URING
+/* epoll handler, which io_uring handler uses if the kernel doesn't support
+   io_uring. */
+void io_loop_handler_epoll_run_internal(struct ioloop *ioloop);
+void io_loop_handle_epoll_add(struct io_file *io);
+void io_loop_handle_epoll_remove(struct io_file *io, bool closed);
+void io_loop_handler_epoll_init(struct ioloop *ioloop,
+				unsigned int initial_fd_count);
+void io_loop_handler_epoll_deinit(struct ioloop *ioloop);
+#endif
+
 void io_loop_notify_remove(struct io *io);
 void io_loop_notify_handler_deinit(struct ioloop *ioloop);
 
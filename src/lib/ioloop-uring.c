@@ -0,0 +1,671 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "fd-util.h"
+#include "mmap-util.h"
+#include "ioloop-private.h"
+#include "ioloop-iolist.h"
+
+#ifdef IOLOOP_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+
+/* Number of submission queue entries. The queue is flushed early if it
+   becomes full, so this only limits how many poll requests can be batched
+   into a single io_uring_enter() call. */
+#define IOLOOP_URING_SQ_ENTRIES 256
+/* Number of completion queue entries. Each fd has at most one poll request
+   at a time. If more completions are generated, the kernel keeps them
+   (IORING_FEAT_NODROP) until the next run. */
+#define IOLOOP_URING_CQ_ENTRIES 4096
+#define IOLOOP_URING_REQUIRED_FEATURES \
+	(IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)
+
+/* user_data for the requests whose completions are ignored */
+#define IOLOOP_URING_USER_DATA_IGNORE UINT64_MAX
+#define IOLOOP_URING_USER_DATA(fd, generation) \
+	(((uint64_t)(generation) << 32) | (unsigned int)(fd))
+
+#define IO_URING_ERROR (POLLERR | POLLHUP)
+#define IO_URING_INPUT (POLLIN | POLLPRI | IO_URING_ERROR)
+#define IO_URING_OUTPUT (POLLOUT | IO_URING_ERROR)
+
+struct uring_io_list {
+	struct io_list list;
+
+	/* Incremented every time a new poll request is added for the fd.
+	   Completions from the older requests are ignored. */
+	uint32_t generation;
+	/* Poll request is waiting in the kernel */
+	bool armed;
+};
+
+struct uring_event {
+	int fd;
+	uint32_t generation;
+	int32_t res;
+};
+
+struct ioloop_handler_context {
+	int ring_fd;
+	/* uring_process_epoch when the ring was created */
+	unsigned int epoch;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int sq_entries;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* Number of SQEs not submitted to the kernel yet */
+	unsigned int sq_pending;
+
+	ARRAY(struct uring_io_list *) fd_index;
+	ARRAY(struct uring_event) events;
+	/* If the previous iteration exceeded its budget, the order of
+	   handling the fds in the next one: the fds that weren't handled
+	   come first. They're re-armed, but their completions don't come in
+	   any predictable order, so the order is stored in the io_lists'
+	   budget_pos. */
+	ARRAY(struct io_list *) budget_lists;
+	/* The order of handling this iteration's events, built from
+	   budget_lists. Empty if there is no order. */
+	ARRAY(unsigned int) order;
+};
+
+/* io_uring may not be available even when it has been compiled in: old
+   kernels don't have it and it can be disabled with the
+   kernel.io_uring_disabled sysctl or seccomp. If the first ring can't be
+   created, epoll is used for the rest of the process lifetime.
+   -1 = not tested yet, 0 = use epoll, 1 = use io_uring */
+static int io_uring_supported = -1;
+
+/* The rings are shared with the child processes after fork(). A child must
+   not touch the rings it inherited, or it would be modifying the parent's
+   poll requests. The epoch is stored in a MADV_WIPEONFORK page, so it
+   becomes 0 in the child process and no longer matches the ring's epoch. */
+static unsigned int *uring_process_epoch = NULL;
+static unsigned int uring_epoch_counter = 0;
+
+static unsigned int uring_get_process_epoch(void)
+{
+	void *page;
+
+	if (uring_process_epoch == NULL) {
+		page = mmap(NULL, mmap_get_page_size(), PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (page == MAP_FAILED)
+			i_fatal("mmap(io_uring epoch) failed: %m");
+		if (madvise(page, mmap_get_page_size(), MADV_WIPEONFORK) < 0)
+			i_fatal("madvise(MADV_WIPEONFORK) failed: %m");
+		uring_process_epoch = page;
+	}
+	if (*uring_process_epoch == 0)
+		*uring_process_epoch = ++uring_epoch_counter;
+	return *uring_process_epoch;
+}
+
+static bool uring_is_inherited(const struct ioloop_handler_context *ctx)
+{
+	return *uring_process_epoch != ctx->epoch;
+}
+
+static int uring_enter(struct ioloop_handler_context *ctx,
+		       unsigned int min_complete, int msecs)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = IORING_ENTER_EXT_ARG;
+	int ret;
+
+	i_zero(&arg);
+	if (min_complete > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (msecs >= 0) {
+			ts.tv_sec = msecs / 1000;
+			ts.tv_nsec = (msecs % 1000) * 1000000LL;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+		}
+	}
+	ret = syscall(__NR_io_uring_enter, ctx->ring_fd, ctx->sq_pending,
+		      min_complete, flags, &arg, sizeof(arg));
+	if (ret > 0) {
+		i_assert((unsigned int)ret <= ctx->sq_pending);
+		ctx->sq_pending -= ret;
+	}
+	return ret;
+}
+
+static void uring_submit(struct ioloop_handler_context *ctx)
+{
+	while (ctx->sq_pending > 0) {
+		if (uring_enter(ctx, 0, 0) < 0 && errno != EINTR &&
+		    errno != EAGAIN && errno != EBUSY)
+			i_fatal("io_uring_enter() failed: %m");
+	}
+}
+
+static void
+uring_queue_sqe(struct ioloop_handler_context *ctx,
+		const struct io_uring_sqe *sqe)
+{
+	unsigned int head, tail, idx;
+
+	head = __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE);
+	tail = *ctx->sq_tail;
+	if (tail - head >= ctx->sq_entries) {
+		/* submission queue is full - flush it */
+		uring_submit(ctx);
+	}
+
+	idx = tail & *ctx->sq_mask;
+	ctx->sqes[idx] = *sqe;
+	ctx->sq_array[idx] = idx;
+	__atomic_store_n(ctx->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ctx->sq_pending++;
+}
+
+static unsigned int uring_poll_mask(const struct io_list *list)
+{
+	unsigned int events = 0;
+	struct io_file *io;
+	int i;
+
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = list->ios[i];
+
+		if (io == NULL)
+			continue;
+
+		if ((io->io.condition & IO_READ) != 0)
+			events |= IO_URING_INPUT;
+		if ((io->io.condition & IO_WRITE) != 0)
+			events |= IO_URING_OUTPUT;
+		if ((io->io.condition & IO_ERROR) != 0)
+			events |= IO_URING_ERROR;
+	}
+	return events;
+}
+
+static bool uring_list_is_empty(const struct io_list *list)
+{
+	int i;
+
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		if (list->ios[i] != NULL)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+uring_poll_add(struct ioloop_handler_context *ctx, struct uring_io_list *ulist,
+	       int fd)
+{
+	struct io_uring_sqe sqe;
+
+	i_assert(!ulist->armed);
+	if (uring_is_inherited(ctx))
+		return;
+
+	/* Use one-shot polls and re-arm them after the callbacks have been
+	   called. Multishot polls are edge-triggered, while all the I/O
+	   callbacks expect level-triggered behavior. A newly added poll
+	   request checks the current state of the fd, so the re-arming
+	   gives the level-triggered behavior without any extra syscalls. */
+	i_zero(&sqe);
+	sqe.opcode = IORING_OP_POLL_ADD;
+	sqe.fd = fd;
+	sqe.poll32_events = uring_poll_mask(&ulist->list);
+	sqe.user_data = IOLOOP_URING_USER_DATA(fd, ++ulist->generation);
+	uring_queue_sqe(ctx, &sqe);
+	ulist->armed = TRUE;
+}
+
+static void
+uring_poll_remove(struct ioloop_handler_context *ctx,
+		  struct uring_io_list *ulist, int fd)
+{
+	struct io_uring_sqe sqe;
+
+	i_assert(ulist->armed);
+	if (uring_is_inherited(ctx)) {
+		ulist->armed = FALSE;
+		return;
+	}
+
+	/* The poll request keeps a reference to the file, so it must be
+	   removed even if the fd was already closed. */
+	i_zero(&sqe);
+	sqe.opcode = IORING_OP_POLL_REMOVE;
+	sqe.fd = -1;
+	sqe.addr = IOLOOP_URING_USER_DATA(fd, ulist->generation);
+	sqe.user_data = IOLOOP_URING_USER_DATA_IGNORE;
+	uring_queue_sqe(ctx, &sqe);
+	ulist->armed = FALSE;
+}
+
+static void *
+uring_mmap(int ring_fd, size_t size, off_t offset, const char *name)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+	if (ptr == MAP_FAILED)
+		i_fatal("mmap(io_uring %s) failed: %m", name);
+	return ptr;
+}
+
+static int uring_setup(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_params params;
+	unsigned char *sq_ring, *cq_ring;
+
+	i_zero(&params);
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = IOLOOP_URING_CQ_ENTRIES;
+	ctx->ring_fd = syscall(__NR_io_uring_setup, IOLOOP_URING_SQ_ENTRIES,
+			       &params);
+	if (ctx->ring_fd < 0)
+		return -1;
+	if ((params.features & IOLOOP_URING_REQUIRED_FEATURES) !=
+	    IOLOOP_URING_REQUIRED_FEATURES) {
+		/* too old kernel */
+		i_close_fd(&ctx->ring_fd);
+		errno = ENOSYS;
+		return -1;
+	}
+	fd_close_on_exec(ctx->ring_fd, TRUE);
+
+	ctx->sq_ring_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	ctx->cq_ring_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		ctx->sq_ring_size = I_MAX(ctx->sq_ring_size, ctx->cq_ring_size);
+		ctx->sq_ring = uring_mmap(ctx->ring_fd, ctx->sq_ring_size,
+					  IORING_OFF_SQ_RING, "rings");
+		ctx->cq_ring = ctx->sq_ring;
+		ctx->cq_ring_size = 0;
+	} else {
+		ctx->sq_ring = uring_mmap(ctx->ring_fd, ctx->sq_ring_size,
+					  IORING_OFF_SQ_RING, "sq ring");
+		ctx->cq_ring = uring_mmap(ctx->ring_fd, ctx->cq_ring_size,
+					  IORING_OFF_CQ_RING, "cq ring");
+	}
+	ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sqes = uring_mmap(ctx->ring_fd, ctx->sqes_size,
+			       IORING_OFF_SQES, "sqes");
+
+	sq_ring = ctx->sq_ring;
+	cq_ring = ctx->cq_ring;
+	ctx->epoch = uring_get_process_epoch();
+	ctx->sq_entries = params.sq_entries;
+	ctx->sq_head = (void *)(sq_ring + params.sq_off.head);
+	ctx->sq_tail = (void *)(sq_ring + params.sq_off.tail);
+	ctx->sq_mask = (void *)(sq_ring + params.sq_off.ring_mask);
+	ctx->sq_array = (void *)(sq_ring + params.sq_off.array);
+	ctx->cq_head = (void *)(cq_ring + params.cq_off.head);
+	ctx->cq_tail = (void *)(cq_ring + params.cq_off.tail);
+	ctx->cq_mask = (void *)(cq_ring + params.cq_off.ring_mask);
+	ctx->cqes = (void *)(cq_ring + params.cq_off.cqes);
+	return 0;
+}
+
+void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
+{
+	struct ioloop_handler_context *ctx;
+
+	if (io_uring_supported == 0) {
+		io_loop_handler_epoll_init(ioloop, initial_fd_count);
+		return;
+	}
+
+	ctx = i_new(struct ioloop_handler_context, 1);
+	if (uring_setup(ctx) < 0) {
+		if (io_uring_supported == -1 &&
+		    (errno == ENOSYS || errno == EPERM || errno == EINVAL ||
+		     errno == EACCES)) {
+			/* io_uring isn't usable - fall back to epoll */
+			i_free(ctx);
+			io_uring_supported = 0;
+			io_loop_handler_epoll_init(ioloop, initial_fd_count);
+			return;
+		}
+		if (errno != EMFILE)
+			i_fatal("io_uring_setup(): %m");
+		else {
+			i_fatal("io_uring_setup(): %m (you may need to "
+				"increase the open files limit)");
+		}
+	}
+	io_uring_supported = 1;
+
+	ioloop->handler_context = ctx;
+	i_array_init(&ctx->fd_index, initial_fd_count);
+	i_array_init(&ctx->events, initial_fd_count);
+	i_array_init(&ctx->budget_lists, 8);
+	i_array_init(&ctx->order, 8);
+}
+
+void io_loop_handler_deinit(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct uring_io_list **list;
+	unsigned int i, count;
+
+	if (io_uring_supported == 0) {
+		io_loop_handler_epoll_deinit(ioloop);
+		return;
+	}
+
+	/* Closing the ring would cancel the pending requests, but it happens
+	   asynchronously. Remove the polls explicitly so the files they
+	   reference (e.g. listener sockets) are released immediately. */
+	list = array_get_modifiable(&ctx->fd_index, &count);
+	if (!uring_is_inherited(ctx)) {
+		for (i = 0; i < count; i++) {
+			if (list[i] != NULL && list[i]->armed)
+				uring_poll_remove(ctx, list[i], i);
+		}
+		uring_submit(ctx);
+	}
+	for (i = 0; i < count; i++)
+		i_free(list[i]);
+
+	if (munmap(ctx->sqes, ctx->sqes_size) < 0)
+		i_error("munmap(io_uring sqes) failed: %m");
+	if (ctx->cq_ring_size > 0 &&
+	    munmap(ctx->cq_ring, ctx->cq_ring_size) < 0)
+		i_error("munmap(io_uring cq ring) failed: %m");
+	if (munmap(ctx->sq_ring, ctx->sq_ring_size) < 0)
+		i_error("munmap(io_uring sq ring) failed: %m");
+	if (close(ctx->ring_fd) < 0)
+		i_error("close(io_uring) failed: %m");
+	array_free(&ctx->fd_index);
+	array_free(&ctx->events);
+	array_free(&ctx->budget_lists);
+	array_free(&ctx->order);
+	i_free(ioloop->handler_context);
+}
+
+void io_loop_handle_add(struct io_file *io)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct uring_io_list **listp, *ulist;
+	unsigned int old_mask = 0;
+
+	if (io_uring_supported == 0) {
+		io_loop_handle_epoll_add(io);
+		return;
+	}
+
+	listp = array_idx_get_space(&ctx->fd_index, io->fd);
+	if (*listp == NULL)
+		*listp = i_new(struct uring_io_list, 1);
+	ulist = *listp;
+
+	if (ulist->armed)
+		old_mask = uring_poll_mask(&ulist->list);
+	(void)ioloop_iolist_add(&ulist->list, io);
+	if (ulist->armed) {
+		if (uring_poll_mask(&ulist->list) == old_mask)
+			return;
+		uring_poll_remove(ctx, ulist, io->fd);
+	}
+	uring_poll_add(ctx, ulist, io->fd);
+}
+
+void io_loop_handle_remove(struct io_file *io, bool closed)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct uring_io_list *ulist;
+	unsigned int old_mask = 0;
+	bool last;
+
+	if (io_uring_supported == 0) {
+		io_loop_handle_epoll_remove(io, closed);
+		return;
+	}
+
+	ulist = array_idx_elem(&ctx->fd_index, io->fd);
+	if (ulist->armed)
+		old_mask = uring_poll_mask(&ulist->list);
+	last = ioloop_iolist_del(&ulist->list, io);
+	if (ulist->armed &&
+	    (last || closed || uring_poll_mask(&ulist->list) != old_mask)) {
+		uring_poll_remove(ctx, ulist, io->fd);
+		if (!last && !closed)
+			uring_poll_add(ctx, ulist, io->fd);
+	}
+	i_free(io);
+}
+
+static void uring_collect_events(struct ioloop_handler_context *ctx)
+{
+	const struct io_uring_cqe *cqe;
+	struct uring_io_list *ulist;
+	struct uring_event *event;
+	unsigned int head, tail;
+	int fd;
+
+	/* Copy the completions, so the CQ ring is freed for the requests
+	   that the callbacks add. */
+	array_clear(&ctx->events);
+	head = *ctx->cq_head;
+	tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &ctx->cqes[head & *ctx->cq_mask];
+		if (cqe->user_data == IOLOOP_URING_USER_DATA_IGNORE)
+			continue;
+
+		fd = (int)(cqe->user_data & 0xffffffff);
+		i_assert(fd >= 0 && (unsigned int)fd < array_count(&ctx->fd_index));
+		ulist = array_idx_elem(&ctx->fd_index, fd);
+		if (!ulist->armed ||
+		    ulist->generation != (uint32_t)(cqe->user_data >> 32)) {
+			/* completion for an already removed request */
+			continue;
+		}
+		ulist->armed = FALSE;
+
+		event = array_append_space(&ctx->events);
+		event->fd = fd;
+		event->generation = ulist->generation;
+		event->res = cqe->res;
+	}
+	__atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void
+uring_rearm(struct ioloop_handler_context *ctx, const struct uring_event *event)
+{
+	struct uring_io_list *ulist =
+		array_idx_elem(&ctx->fd_index, event->fd);
+
+	if (!ulist->armed && ulist->generation == event->generation &&
+	    !uring_list_is_empty(&ulist->list))
+		uring_poll_add(ctx, ulist, event->fd);
+}
+
+static void uring_rearm_events(struct ioloop_handler_context *ctx)
+{
+	const struct uring_event *event;
+
+	/* the already re-armed fds are skipped */
+	array_foreach(&ctx->events, event)
+		uring_rearm(ctx, event);
+}
+
+/* Returns NULL if the event is from an older poll request for the fd. */
+static struct io_list *
+uring_event_get_list(struct ioloop_handler_context *ctx, unsigned int i)
+{
+	const struct uring_event *event = array_idx(&ctx->events, i);
+	struct uring_io_list *ulist =
+		array_idx_elem(&ctx->fd_index, event->fd);
+
+	return ulist->generation != event->generation ? NULL : &ulist->list;
+}
+
+static bool uring_order_budget_events(struct ioloop_handler_context *ctx)
+{
+	struct io_list *list;
+	unsigned int i, j, idx, order_count, *order;
+	unsigned int count = array_count(&ctx->events);
+
+	array_clear(&ctx->order);
+	if (array_count(&ctx->budget_lists) > 0 && count > 0) {
+		/* The fds in the order set by the previous iteration.
+		   Use 1-based indexes, so the fds that haven't completed
+		   are left as 0 and can be removed. */
+		for (i = 0; i < count; i++) {
+			list = uring_event_get_list(ctx, i);
+			if (list != NULL && list->budget_pos > 0) {
+				idx = i + 1;
+				array_idx_set(&ctx->order,
+					      list->budget_pos - 1, &idx);
+			}
+		}
+		order = array_get_modifiable(&ctx->order, &order_count);
+		for (i = j = 0; i < order_count; i++) {
+			if (order[i] != 0)
+				order[j++] = order[i] - 1;
+		}
+		array_delete(&ctx->order, j, order_count - j);
+
+		for (i = 0; i < count; i++) {
+			list = uring_event_get_list(ctx, i);
+			if (list == NULL || list->budget_pos == 0)
+				array_push_back(&ctx->order, &i);
+		}
+	}
+	array_foreach_elem(&ctx->budget_lists, list)
+		list->budget_pos = 0;
+	array_clear(&ctx->budget_lists);
+	return array_count(&ctx->order) > 0;
+}
+
+static void
+uring_order_next_events(struct ioloop_handler_context *ctx, bool ordered,
+			unsigned int handled_count, unsigned int count)
+{
+	struct io_list *list;
+	unsigned int i, k;
+
+	for (i = 0; i < count; i++) {
+		k = (handled_count + i) % count;
+		list = uring_event_get_list(ctx, !ordered ? k :
+					    *array_idx(&ctx->order, k));
+		if (list != NULL && list->budget_pos == 0) {
+			array_push_back(&ctx->budget_lists, &list);
+			list->budget_pos = array_count(&ctx->budget_lists);
+		}
+	}
+}
+
+void io_loop_handler_run_internal(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	const struct uring_event *event;
+	struct uring_io_list *ulist;
+	struct io_file *io;
+	struct timeval tv;
+	unsigned int i, k, count, events;
+	int msecs, ret, j;
+	bool call, ordered;
+
+	if (io_uring_supported == 0) {
+		io_loop_handler_epoll_run_internal(ioloop);
+		return;
+	}
+
+	i_assert(ctx != NULL);
+	if (uring_is_inherited(ctx)) {
+		i_panic("io_uring ioloop can't be run in a child process "
+			"that inherited it - create a new ioloop");
+	}
+
+	/* get the time left for next timeout task */
+	msecs = io_loop_run_get_wait_time(ioloop, &tv);
+	if (ioloop->io_files == NULL) {
+		/* no I/Os, but we should have some timeouts.
+		   just wait for them. */
+		i_assert(msecs >= 0);
+	}
+
+	/* submit the poll changes and wait for events in the same syscall */
+	if (msecs != 0 || ctx->sq_pending > 0) {
+		ret = uring_enter(ctx, msecs == 0 ? 0 : 1, msecs);
+		if (ret < 0 && errno != EINTR && errno != ETIME &&
+		    errno != EAGAIN && errno != EBUSY)
+			i_fatal("io_uring_enter(): %m");
+	}
+	uring_collect_events(ctx);
+
+	/* execute timeout handlers */
+	io_loop_handle_timeouts(ioloop);
+
+	if (!ioloop->running) {
+		uring_rearm_events(ctx);
+		return;
+	}
+
+	count = array_count(&ctx->events);
+	ordered = uring_order_budget_events(ctx);
+	for (k = 0; k < count; k++) {
+		i = ordered ? *array_idx(&ctx->order, k) : k;
+		/* io_loop_handle_add() may cause events array reallocation,
+		   so we have use array_idx() */
+		event = array_idx(&ctx->events, i);
+		ulist = array_idx_elem(&ctx->fd_index, event->fd);
+		if (ulist->generation != event->generation) {
+			/* fd was re-added by an earlier callback */
+			continue;
+		}
+		events = event->res < 0 ? POLLERR : (unsigned int)event->res;
+
+		for (j = 0; j < IOLOOP_IOLIST_IOS_PER_FD; j++) {
+			io = ulist->list.ios[j];
+			if (io == NULL)
+				continue;
+
+			call = FALSE;
+			if ((events & (POLLHUP | POLLERR)) != 0)
+				call = TRUE;
+			else if ((io->io.condition & IO_READ) != 0)
+				call = (events & POLLIN) != 0;
+			else if ((io->io.condition & IO_WRITE) != 0)
+				call = (events & POLLOUT) != 0;
+			else if ((io->io.condition & IO_ERROR) != 0)
+				call = (events & IO_URING_ERROR) != 0;
+
+			if (call) {
+				io_loop_call_io(&io->io);
+				if (!ioloop->running) {
+					uring_rearm_events(ctx);
+					return;
+				}
+			}
+		}
+		uring_rearm(ctx, array_idx(&ctx->events, i));
+		if (io_loop_iteration_over_budget(ioloop)) {
+			/* the rest of the fds are polled again and they
+			   complete immediately in the next iteration */
+			uring_rearm_events(ctx);
+			uring_order_next_events(ctx, ordered, k + 1, count);
+			break;
+		}
+	}
+}
+
+#endif	/* IOLOOP_URING */
@@ -5,6 +5,7 @@
 #include "backtrace-string.h"
 #include "llist.h"
 #include "time-util.h"
+#include "stats-dist.h"
 #include "istream-private.h"
 #include "ioloop-private.h"
 
@@ -19,6 +20,26 @@
    logging many warnings about this, use a rather high value. */
 #define IOLOOP_TIME_MOVED_FORWARDS_MIN_USECS (100000)
 
+/* The ioloop_lag event has a histogram of the iteration lags with these
+   upper limits in microseconds. The last bucket has everything above. */
+static const unsigned int ioloop_lag_bucket_usecs[] = {
+	100, 1000, 10000, 100000, 1000000
+};
+#define IOLOOP_LAG_BUCKET_COUNT (N_ELEMENTS(ioloop_lag_bucket_usecs) + 1)
+
+struct ioloop_lag_stats {
+	struct event *event;
+	unsigned int interval_msecs;
+	struct timeval next_report;
+
+	struct stats_dist *lags;
+	unsigned int buckets[IOLOOP_LAG_BUCKET_COUNT];
+	/* Number of iterations where the iteration budget was exceeded */
+	unsigned int budget_exceeded_count;
+	/* Number of times io_loop_is_over_budget() returned TRUE */
+	unsigned int io_yield_count;
+};
+
 time_t ioloop_time = 0;
 struct timeval ioloop_timeval;
 struct ioloop *current_ioloop = NULL;
@@ -30,6 +51,8 @@ static bool panic_on_leak = FALSE, panic_on_leak_set = FALSE;
 
 static time_t data_stack_last_free_unused = 0;
 
+static void io_loop_coarse_timeouts_run(void *context);
+
 static void io_loop_initialize_handler(struct ioloop *ioloop)
 {
 	unsigned int initial_fd_count;
@@ -148,6 +171,8 @@ static void io_file_unlink(struct io_file *io)
 	   don't try to handle this one next. */
 	if (io->io.ioloop->next_io_file == io)
 		io->io.ioloop->next_io_file = io->next;
+	if (io->io.ioloop->next_pending_io_file == io)
+		io->io.ioloop->next_pending_io_file = io->next;
 }
 
 static void io_remove_full(struct io **_io, bool closed)
@@ -263,6 +288,7 @@ timeout_add_common(struct ioloop *ioloop, const char *source_filename,
 
 	timeout = i_new(struct timeout, 1);
 	timeout->item.idx = UINT_MAX;
+	timer_wheel_item_init(&timeout->wheel_item);
 	timeout->source_filename = source_filename;
 	timeout->source_linenum = source_linenum;
 	timeout->ioloop = ioloop;
@@ -365,6 +391,85 @@ timeout_add_absolute(const struct timeval *time,
 				       callback, context);
 }
 
+static void
+io_loop_coarse_timeouts_schedule(struct ioloop *ioloop, uint64_t tick)
+{
+	struct timeout *run_to = ioloop->coarse_timeouts_run_to;
+	time_t secs = tick + ioloop->coarse_timeouts_offset;
+
+	if (run_to->item.idx != UINT_MAX) {
+		if (run_to->next_run.tv_sec <= secs) {
+			/* already running early enough */
+			return;
+		}
+		priorityq_remove(ioloop->timeouts, &run_to->item);
+	}
+	run_to->next_run.tv_sec = secs;
+	run_to->next_run.tv_usec = 0;
+	priorityq_add(ioloop->timeouts, &run_to->item);
+}
+
+static void
+io_loop_coarse_timeouts_add(struct ioloop *ioloop, struct timeout *timeout,
+			    uint64_t expire)
+{
+	if (ioloop->coarse_timeouts == NULL) {
+		ioloop->coarse_timeouts =
+			timer_wheel_init(ioloop_time -
+					 ioloop->coarse_timeouts_offset);
+		/* this is an internal timeout, so don't attach it to any
+		   ioloop context */
+		ioloop->coarse_timeouts_run_to =
+			timeout_add_common(ioloop, __FILE__, __LINE__,
+					   io_loop_coarse_timeouts_run, ioloop);
+		if (ioloop->coarse_timeouts_run_to->ctx != NULL)
+			io_loop_context_unref(&ioloop->coarse_timeouts_run_to->ctx);
+		ioloop->coarse_timeouts_run_to->one_shot = TRUE;
+	}
+	timer_wheel_add(ioloop->coarse_timeouts, &timeout->wheel_item, expire);
+	io_loop_coarse_timeouts_schedule(ioloop, timeout->wheel_item.expire);
+}
+
+static uint64_t
+timeout_coarse_get_expire(struct timeout *timeout)
+{
+	struct timeval tv;
+
+	i_gettimeofday(&tv);
+	timeval_add_msecs(&tv, timeout->msecs);
+	/* round up to the next full second */
+	return tv.tv_sec + (tv.tv_usec > 0 ? 1 : 0) -
+		timeout->ioloop->coarse_timeouts_offset;
+}
+
+#undef timeout_add_coarse_to
+struct timeout *
+timeout_add_coarse_to(struct ioloop *ioloop, unsigned int msecs,
+		      const char *source_filename, unsigned int source_linenum,
+		      timeout_callback_t *callback, void *context)
+{
+	struct timeout *timeout;
+
+	timeout = timeout_add_common(ioloop, source_filename, source_linenum,
+				     callback, context);
+	timeout->msecs = msecs;
+	timeout->coarse = TRUE;
+	io_loop_coarse_timeouts_add(ioloop, timeout,
+				    timeout_coarse_get_expire(timeout));
+	return timeout;
+}
+
+#undef timeout_add_coarse
+struct timeout *
+timeout_add_coarse(unsigned int msecs, const char *source_filename,
+		   unsigned int source_linenum,
+		   timeout_callback_t *callback, void *context)
+{
+	return timeout_add_coarse_to(current_ioloop, msecs,
+				     source_filename, source_linenum,
+				     callback, context);
+}
+
 static struct timeout *
 timeout_copy(const struct timeout *old_to, struct ioloop *ioloop)
 {
@@ -376,8 +481,15 @@ timeout_copy(const struct timeout *old_to, struct ioloop *ioloop)
 	new_to->one_shot = old_to->one_shot;
 	new_to->msecs = old_to->msecs;
 	new_to->next_run = old_to->next_run;
-
-	if (old_to->item.idx != UINT_MAX)
+	new_to->coarse = old_to->coarse;
+
+	if (old_to->coarse) {
+		/* keep the same wall clock expiration time */
+		time_t secs = old_to->wheel_item.expire +
+			old_to->ioloop->coarse_timeouts_offset;
+		io_loop_coarse_timeouts_add(ioloop, new_to,
+			secs - ioloop->coarse_timeouts_offset);
+	} else if (old_to->item.idx != UINT_MAX)
 		priorityq_add(new_to->ioloop->timeouts, &new_to->item);
 	else if (!new_to->one_shot) {
 		i_assert(new_to->msecs > 0);
@@ -405,7 +517,16 @@ void timeout_remove(struct timeout **_timeout)
 	ioloop = timeout->ioloop;
 
 	*_timeout = NULL;
-	if (timeout->item.idx != UINT_MAX)
+	if (timeout->coarse) {
+		timer_wheel_remove(ioloop->coarse_timeouts,
+				   &timeout->wheel_item);
+		if (timer_wheel_count(ioloop->coarse_timeouts) == 0 &&
+		    ioloop->coarse_timeouts_run_to->item.idx != UINT_MAX) {
+			/* no need to wake up anymore */
+			priorityq_remove(ioloop->timeouts,
+				&ioloop->coarse_timeouts_run_to->item);
+		}
+	} else if (timeout->item.idx != UINT_MAX)
 		priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
 	else if (!timeout->one_shot && timeout->msecs > 0) {
 		struct timeout *const *to_idx;
@@ -447,6 +568,13 @@ timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 void timeout_reset(struct timeout *timeout)
 {
 	i_assert(!timeout->one_shot);
+	if (timeout->coarse) {
+		timer_wheel_remove(timeout->ioloop->coarse_timeouts,
+				   &timeout->wheel_item);
+		io_loop_coarse_timeouts_add(timeout->ioloop, timeout,
+					    timeout_coarse_get_expire(timeout));
+		return;
+	}
 	timeout_reset_timeval(timeout, NULL);
 }
 
@@ -597,6 +725,10 @@ static void io_loop_timeouts_update(struct ioloop *ioloop, long long diff_usecs)
 	struct priorityq_item *const *items;
 	unsigned int i, count;
 
+	/* Coarse timeouts are relative to the offset, so they can all be
+	   moved at once. */
+	ioloop->coarse_timeouts_offset += diff_usecs / 1000000;
+
 	count = priorityq_count(ioloop->timeouts);
 	items = priorityq_items(ioloop->timeouts);
 	for (i = 0; i < count; i++) {
@@ -635,12 +767,51 @@ static void ioloop_add_wait_time(struct ioloop *ioloop)
 		timer->usecs += diff;
 }
 
+static void timeout_call(struct ioloop *ioloop, struct timeout *timeout)
+{
+	data_stack_frame_t t_id;
+
+	if (timeout->ctx != NULL)
+		io_loop_context_activate(timeout->ctx);
+	t_id = t_push_named("ioloop timeout handler %p",
+			    (void *)timeout->callback);
+	timeout->callback(timeout->context);
+	if (!t_pop(&t_id)) {
+		i_panic("Leaked a t_pop() call in timeout handler %p",
+			(void *)timeout->callback);
+	}
+	if (ioloop->cur_ctx != NULL)
+		io_loop_context_deactivate(ioloop->cur_ctx);
+	i_assert(ioloop == current_ioloop);
+}
+
+static void io_loop_coarse_timeouts_run(void *context)
+{
+	struct ioloop *ioloop = context;
+	struct timer_wheel *wheel = ioloop->coarse_timeouts;
+	struct timer_wheel_item *item;
+	uint64_t next_tick;
+
+	while (ioloop->running &&
+	       (item = timer_wheel_pop(wheel, ioloop_time -
+				       ioloop->coarse_timeouts_offset)) != NULL) {
+		struct timeout *timeout =
+			container_of(item, struct timeout, wheel_item);
+
+		timer_wheel_add(wheel, item, timeout_coarse_get_expire(timeout));
+		timeout_call(ioloop, timeout);
+	}
+
+	next_tick = timer_wheel_get_next_tick(wheel);
+	if (next_tick != UINT64_MAX)
+		io_loop_coarse_timeouts_schedule(ioloop, next_tick);
+}
+
 static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 {
 	struct priorityq_item *item;
 	struct timeval tv_old, tv, tv_call;
 	long long diff_usecs;
-	data_stack_frame_t t_id;
 
 	tv_old = ioloop_timeval;
 	i_gettimeofday(&ioloop_timeval);
@@ -668,6 +839,8 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 
 	ioloop_time = ioloop_timeval.tv_sec;
 	tv_call = ioloop_timeval;
+	ioloop->iteration_started = ioloop_timeval;
+	ioloop->iteration_budget_exceeded = FALSE;
 
 	while (ioloop->running &&
 	       (item = priorityq_peek(ioloop->timeouts)) != NULL) {
@@ -685,19 +858,7 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 			/* update timeout's next_run and reposition it in the queue */
 			timeout_reset_timeval(timeout, &tv_call);
 		}
-
-		if (timeout->ctx != NULL)
-			io_loop_context_activate(timeout->ctx);
-		t_id = t_push_named("ioloop timeout handler %p",
-				    (void *)timeout->callback);
-		timeout->callback(timeout->context);
-		if (!t_pop(&t_id)) {
-			i_panic("Leaked a t_pop() call in timeout handler %p",
-				(void *)timeout->callback);
-		}
-		if (ioloop->cur_ctx != NULL)
-			io_loop_context_deactivate(ioloop->cur_ctx);
-		i_assert(ioloop == current_ioloop);
+		timeout_call(ioloop, timeout);
 	}
 }
 
@@ -730,6 +891,8 @@ void io_loop_call_io(struct io *io)
 		io->pending = FALSE;
 	}
 
+	if (ioloop->io_budget_usecs > 0)
+		i_gettimeofday(&ioloop->io_started);
 	if (io->ctx != NULL)
 		io_loop_context_activate(io->ctx);
 	t_id = t_push_named("ioloop handler %p",
@@ -763,10 +926,57 @@ void io_loop_run(struct ioloop *ioloop)
 	ioloop->iolooping = FALSE;
 }
 
+static void io_loop_call_pending_budget(struct ioloop *ioloop)
+{
+	struct io_file *io;
+	bool wrapped;
+
+	/* Call each pending IO at most once. If an IO sets itself pending
+	   again, it's called in the next iteration after the other events.
+	   If the budget runs out, the next iteration continues from the
+	   following IO, so the IOs at the beginning of the list can't starve
+	   the rest. next_pending_io_file is also the position where the
+	   wrapped around pass stops. */
+	io = ioloop->next_pending_io_file;
+	wrapped = io == NULL;
+	if (io == NULL)
+		io = ioloop->io_files;
+	while (ioloop->io_pending_count > 0) {
+		if (io == NULL) {
+			if (wrapped)
+				break;
+			wrapped = TRUE;
+			io = ioloop->io_files;
+			continue;
+		}
+		if (wrapped && io == ioloop->next_pending_io_file)
+			break;
+
+		ioloop->next_io_file = io->next;
+		if (io->io.pending) {
+			io_loop_call_io(&io->io);
+			if (!ioloop->running)
+				break;
+			if (io_loop_iteration_over_budget(ioloop)) {
+				ioloop->next_pending_io_file =
+					ioloop->next_io_file;
+				return;
+			}
+		}
+		io = ioloop->next_io_file;
+	}
+	ioloop->next_pending_io_file = NULL;
+}
+
 static void io_loop_call_pending(struct ioloop *ioloop)
 {
 	struct io_file *io;
 
+	if (ioloop->iteration_budget_usecs > 0) {
+		io_loop_call_pending_budget(ioloop);
+		return;
+	}
+
 	while (ioloop->io_pending_count > 0) {
 		io = ioloop->io_files;
 		do {
@@ -780,6 +990,146 @@ static void io_loop_call_pending(struct ioloop *ioloop)
 	}
 }
 
+bool io_loop_iteration_over_budget(struct ioloop *ioloop)
+{
+	struct timeval tv_now;
+
+	if (ioloop->iteration_budget_usecs == 0)
+		return FALSE;
+	if (ioloop->iteration_budget_exceeded)
+		return TRUE;
+
+	i_gettimeofday(&tv_now);
+	if (timeval_diff_usecs(&tv_now, &ioloop->iteration_started) <
+	    ioloop->iteration_budget_usecs)
+		return FALSE;
+	ioloop->iteration_budget_exceeded = TRUE;
+	if (ioloop->lag_stats != NULL)
+		ioloop->lag_stats->budget_exceeded_count++;
+	return TRUE;
+}
+
+bool io_loop_is_over_budget(struct ioloop *ioloop)
+{
+	struct timeval tv_now;
+
+	if (ioloop->io_budget_usecs == 0)
+		return FALSE;
+
+	i_gettimeofday(&tv_now);
+	if (timeval_diff_usecs(&tv_now, &ioloop->io_started) <
+	    ioloop->io_budget_usecs)
+		return FALSE;
+	if (ioloop->lag_stats != NULL)
+		ioloop->lag_stats->io_yield_count++;
+	return TRUE;
+}
+
+void io_loop_set_budget(struct ioloop *ioloop, unsigned int io_usecs,
+			unsigned int iteration_usecs)
+{
+	ioloop->io_budget_usecs = io_usecs;
+	ioloop->iteration_budget_usecs = iteration_usecs;
+	/* make sure io_started is valid if the budget is set by an IO
+	   callback */
+	i_gettimeofday(&ioloop->io_started);
+}
+
+static void io_loop_lag_stats_report(struct ioloop_lag_stats *stats)
+{
+	struct event_passthrough *e;
+	unsigned int i;
+
+	e = event_create_passthrough(stats->event)->
+		set_name("ioloop_lag")->
+		add_int("iterations", stats_dist_get_count(stats->lags))->
+		add_int("lag_min_usecs", stats_dist_get_min(stats->lags))->
+		add_int("lag_avg_usecs", stats_dist_get_avg(stats->lags))->
+		add_int("lag_p50_usecs", stats_dist_get_median(stats->lags))->
+		add_int("lag_p95_usecs", stats_dist_get_95th(stats->lags))->
+		add_int("lag_p99_usecs",
+			stats_dist_get_percentile(stats->lags, 0.99))->
+		add_int("lag_max_usecs", stats_dist_get_max(stats->lags))->
+		add_int("budget_exceeded", stats->budget_exceeded_count)->
+		add_int("io_yields", stats->io_yield_count);
+	for (i = 0; i < IOLOOP_LAG_BUCKET_COUNT; i++) {
+		e->add_int(i < N_ELEMENTS(ioloop_lag_bucket_usecs) ?
+			   t_strdup_printf("lag_le_%u_usecs",
+					   ioloop_lag_bucket_usecs[i]) :
+			   "lag_inf_usecs", stats->buckets[i]);
+	}
+	e_debug(e->event(), "ioloop lag: %u iterations, "
+		"avg %.0f usecs, p99 %"PRIu64" usecs, max %"PRIu64" usecs",
+		stats_dist_get_count(stats->lags),
+		stats_dist_get_avg(stats->lags),
+		stats_dist_get_percentile(stats->lags, 0.99),
+		stats_dist_get_max(stats->lags));
+
+	stats_dist_reset(stats->lags);
+	i_zero(&stats->buckets);
+	stats->budget_exceeded_count = 0;
+	stats->io_yield_count = 0;
+}
+
+static void io_loop_lag_stats_update(struct ioloop *ioloop)
+{
+	struct ioloop_lag_stats *stats = ioloop->lag_stats;
+	struct timeval tv_now;
+	long long lag;
+	unsigned int i;
+
+	i_gettimeofday(&tv_now);
+	lag = timeval_diff_usecs(&tv_now, &ioloop->iteration_started);
+	if (lag < 0) {
+		/* time moved backwards */
+		lag = 0;
+	}
+	stats_dist_add(stats->lags, lag);
+	for (i = 0; i < N_ELEMENTS(ioloop_lag_bucket_usecs); i++) {
+		if (lag <= ioloop_lag_bucket_usecs[i])
+			break;
+	}
+	stats->buckets[i]++;
+
+	if (timeval_cmp(&tv_now, &stats->next_report) >= 0) {
+		T_BEGIN {
+			io_loop_lag_stats_report(stats);
+		} T_END;
+		stats->next_report = tv_now;
+		timeval_add_msecs(&stats->next_report, stats->interval_msecs);
+	}
+}
+
+static void io_loop_lag_stats_free(struct ioloop_lag_stats **_stats)
+{
+	struct ioloop_lag_stats *stats = *_stats;
+
+	if (stats == NULL)
+		return;
+	*_stats = NULL;
+
+	stats_dist_deinit(&stats->lags);
+	event_unref(&stats->event);
+	i_free(stats);
+}
+
+void io_loop_set_lag_stats(struct ioloop *ioloop, struct event *event,
+			   unsigned int interval_msecs)
+{
+	struct ioloop_lag_stats *stats;
+
+	io_loop_lag_stats_free(&ioloop->lag_stats);
+	if (interval_msecs == 0)
+		return;
+
+	stats = ioloop->lag_stats = i_new(struct ioloop_lag_stats, 1);
+	stats->event = event_create(event);
+	stats->interval_msecs = interval_msecs;
+	stats->lags = stats_dist_init();
+	i_gettimeofday(&stats->next_report);
+	timeval_add_msecs(&stats->next_report, interval_msecs);
+}
+
 void io_loop_handler_run(struct ioloop *ioloop)
 {
 	i_assert(ioloop == current_ioloop);
@@ -788,6 +1138,8 @@ void io_loop_handler_run(struct ioloop *ioloop)
 	ioloop->wait_started = ioloop_timeval;
 	io_loop_handler_run_internal(ioloop);
 	io_loop_call_pending(ioloop);
+	if (ioloop->lag_stats != NULL)
+		io_loop_lag_stats_update(ioloop);
 	if (ioloop->stop_after_run_loop)
 		io_loop_stop(ioloop);
 
@@ -908,6 +1260,34 @@ void io_loop_destroy(struct ioloop **_ioloop)
 	}
 	array_free(&ioloop->timeouts_new);
 
+	if (ioloop->coarse_timeouts != NULL) {
+		struct timer_wheel_item *wheel_item;
+
+		if (ioloop->coarse_timeouts_run_to->item.idx != UINT_MAX) {
+			priorityq_remove(ioloop->timeouts,
+				&ioloop->coarse_timeouts_run_to->item);
+		}
+		timeout_free(ioloop->coarse_timeouts_run_to);
+		while ((wheel_item = timer_wheel_pop(ioloop->coarse_timeouts,
+						     UINT64_MAX)) != NULL) {
+			to = container_of(wheel_item, struct timeout,
+					  wheel_item);
+			const char *error = t_strdup_printf(
+				"Timeout leak: %p (%s:%u)",
+				(void *)to->callback,
+				to->source_filename,
+				to->source_linenum);
+
+			if (panic_on_leak)
+				i_panic("%s", error);
+			else
+				i_warning("%s", error);
+			timeout_free(to);
+			leaks = TRUE;
+		}
+		timer_wheel_deinit(&ioloop->coarse_timeouts);
+	}
+
 	while ((item = priorityq_pop(ioloop->timeouts)) != NULL) {
 		struct timeout *to = (struct timeout *)item;
 		const char *error = t_strdup_printf(
@@ -949,6 +1329,7 @@ void io_loop_destroy(struct ioloop **_ioloop)
 		io_loop_handler_deinit(ioloop);
 	if (ioloop->cur_ctx != NULL)
 		io_loop_context_unref(&ioloop->cur_ctx);
+	io_loop_lag_stats_free(&ioloop->lag_stats);
 	i_free(ioloop);
 }
 
@@ -174,6 +174,32 @@ timeout_add_absolute_to(struct ioloop *ioloop,
 		CALLBACK_TYPECHECK(callback, void (*)(typeof(context))), \
 		(io_callback_t *)callback, context)
 
+/* Like timeout_add(), but with a one second resolution. The timeout is
+   called at most one second later than requested. Coarse timeouts are kept
+   in a timer wheel, which makes adding, resetting and removing them O(1).
+   This is useful for idle and keepalive timeouts, which processes may have
+   hundreds of thousands of. */
+struct timeout *
+timeout_add_coarse(unsigned int msecs, const char *source_filename,
+		   unsigned int source_linenum,
+		   timeout_callback_t *callback, void *context) ATTR_NULL(4);
+#define timeout_add_coarse(msecs, callback, context) \
+	timeout_add_coarse(msecs, __FILE__, __LINE__ - \
+		CALLBACK_TYPECHECK(callback, void (*)(typeof(context))) - \
+		COMPILE_ERROR_IF_TRUE(__builtin_constant_p(msecs) && \
+				      ((msecs) < 1000)), \
+		(io_callback_t *)callback, context)
+struct timeout *
+timeout_add_coarse_to(struct ioloop *ioloop, unsigned int msecs,
+		      const char *source_filename, unsigned int source_linenum,
+		      timeout_callback_t *callback, void *context) ATTR_NULL(4);
+#define timeout_add_coarse_to(ioloop, msecs, callback, context) \
+	timeout_add_coarse_to(ioloop, msecs, __FILE__, __LINE__ - \
+		CALLBACK_TYPECHECK(callback, void (*)(typeof(context))) - \
+		COMPILE_ERROR_IF_TRUE(__builtin_constant_p(msecs) && \
+				      ((msecs) < 1000)), \
+		(io_callback_t *)callback, context)
+
 /* Remove timeout handler, and set timeout pointer to NULL. */
 void timeout_remove(struct timeout **timeout);
 /* Reset timeout so it's next run after now+msecs. */
@@ -201,6 +227,28 @@ void io_loop_set_max_fd_count(struct ioloop *ioloop, unsigned int max_fds);
 /* Destroy I/O loop and set ioloop pointer to NULL. */
 void io_loop_destroy(struct ioloop **ioloop);
 
+/* Limit how long the IO callbacks may run. io_usecs is the budget for a
+   single IO callback call. The callbacks are expected to check it with
+   io_loop_is_over_budget() and yield by calling io_set_pending() or
+   i_stream_set_input_pending() and returning. iteration_usecs is the budget
+   for all the IO callbacks in a single ioloop iteration. Once exceeded, the
+   rest of the ready IOs are called in the next iteration after handling the
+   timeouts and checking for new events. The iteration budget is enforced
+   only by the epoll and io_uring handlers, and for the pending IOs.
+   0 means unlimited, which is the default. */
+void io_loop_set_budget(struct ioloop *ioloop, unsigned int io_usecs,
+			unsigned int iteration_usecs);
+/* Returns TRUE if the currently running IO callback has exceeded the budget
+   set by io_loop_set_budget(). Always returns FALSE if there is no budget. */
+bool io_loop_is_over_budget(struct ioloop *ioloop);
+/* Track how long each ioloop iteration spends in calling the timeout and IO
+   callbacks, i.e. how much the handling of newly ready IOs can be delayed.
+   Every interval_msecs the statistics are sent as an "ioloop_lag" event
+   with the given parent event and reset. interval_msecs=0 disables the
+   tracking. */
+void io_loop_set_lag_stats(struct ioloop *ioloop, struct event *event,
+			   unsigned int interval_msecs);
+
 /* If time moves backwards or jumps forwards call the callback. */
 void io_loop_set_time_moved_callback(struct ioloop *ioloop,
 				     io_loop_time_moved_callback_t *callback);
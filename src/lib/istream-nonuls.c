@@ -29,8 +29,9 @@ static int i_stream_read_parent(struct istream_private *stream)
 static ssize_t i_stream_nonuls_read(struct istream_private *stream)
 {
 	struct nonuls_istream *nstream = (struct nonuls_istream *)stream;
-	const unsigned char *data, *p;
-	size_t i, size, avail_size;
+	const unsigned char *data;
+	unsigned char *dest, *p;
+	size_t size, avail_size;
 	int ret;
 
 	if ((ret = i_stream_read_parent(stream)) <= 0)
@@ -43,17 +44,13 @@ static ssize_t i_stream_nonuls_read(struct istream_private *stream)
 		size = avail_size;
 	i_assert(size > 0);
 
-	p = memchr(data, '\0', size);
-	if (p == NULL) {
-		/* no NULs in this block */
-		memcpy(stream->w_buffer+stream->pos, data, size);
-	} else {
-		i = p-data;
-		memcpy(stream->w_buffer+stream->pos, data, i);
-		for (; i < size; i++) {
-			stream->w_buffer[stream->pos+i] = data[i] == '\0' ?
-				nstream->replace_chr : data[i];
-		}
+	dest = stream->w_buffer + stream->pos;
+	memcpy(dest, data, size);
+	/* replace the NULs */
+	p = memchr(dest, '\0', size);
+	while (p != NULL) {
+		*p++ = nstream->replace_chr;
+		p = memchr(p, '\0', size - (p - dest));
 	}
 	stream->pos += size;
 	i_stream_skip(stream->parent, size);
@@ -8,7 +8,12 @@
 struct unix_istream {
 	struct file_istream fstream;
 	bool next_read_fd;
-	int read_fd;
+	/* Maximum number of fds to receive with the next read */
+	unsigned int max_read_fds;
+	/* Received fds that haven't been returned by
+	   i_stream_unix_get_read_fd() yet */
+	int read_fds[FDPASS_MAX_FDS];
+	unsigned int read_fds_pos, read_fds_count;
 };
 
 static void
@@ -18,7 +23,9 @@ i_stream_unix_close(struct iostream_private *stream, bool close_parent)
 		container_of(stream, struct unix_istream,
 			     fstream.istream.iostream);
 
-	i_close_fd(&ustream->read_fd);
+	for (; ustream->read_fds_pos < ustream->read_fds_count;
+	     ustream->read_fds_pos++)
+		i_close_fd(&ustream->read_fds[ustream->read_fds_pos]);
 	i_stream_file_close(stream, close_parent);
 }
 
@@ -32,14 +39,16 @@ static ssize_t i_stream_unix_read(struct istream_private *stream)
 	if (!ustream->next_read_fd)
 		return i_stream_file_read(stream);
 
-	i_assert(ustream->read_fd == -1);
+	i_assert(ustream->read_fds_pos == ustream->read_fds_count);
 	i_assert(ustream->fstream.skip_left == 0); /* not supported here.. */
 	if (!i_stream_try_alloc(stream, 1, &size))
 		return -2;
 
-	ret = fd_read(stream->fd, stream->w_buffer + stream->pos, size,
-		      &ustream->read_fd);
-	if (ustream->read_fd != -1)
+	ustream->read_fds_pos = 0;
+	ustream->read_fds_count = ustream->max_read_fds;
+	ret = fd_read_multi(stream->fd, stream->w_buffer + stream->pos, size,
+			    ustream->read_fds, &ustream->read_fds_count);
+	if (ustream->read_fds_count > 0)
 		ustream->next_read_fd = FALSE;
 
 	if (ret == 0) {
@@ -74,7 +83,6 @@ struct istream *i_stream_create_unix(int fd, size_t max_buffer_size)
 	i_assert(fd != -1);
 
 	ustream = i_new(struct unix_istream, 1);
-	ustream->read_fd = -1;
 	input = i_stream_create_file_common(&ustream->fstream, fd, NULL,
 					    max_buffer_size, FALSE);
 	input->real_stream->iostream.close = i_stream_unix_close;
@@ -83,12 +91,20 @@ struct istream *i_stream_create_unix(int fd, size_t max_buffer_size)
 }
 
 void i_stream_unix_set_read_fd(struct istream *input)
+{
+	i_stream_unix_set_read_fds(input, 1);
+}
+
+void i_stream_unix_set_read_fds(struct istream *input, unsigned int max_fds)
 {
 	struct unix_istream *ustream =
 		container_of(input->real_stream, struct unix_istream,
 			     fstream.istream);
 
+	i_assert(max_fds > 0 && max_fds <= FDPASS_MAX_FDS);
+
 	ustream->next_read_fd = TRUE;
+	ustream->max_read_fds = max_fds;
 }
 
 void i_stream_unix_unset_read_fd(struct istream *input)
@@ -105,9 +121,7 @@ int i_stream_unix_get_read_fd(struct istream *input)
 	struct unix_istream *ustream =
 		container_of(input->real_stream, struct unix_istream,
 			     fstream.istream);
-	int fd;
-
-	fd = ustream->read_fd;
-	ustream->read_fd = -1;
-	return fd;
+	if (ustream->read_fds_pos == ustream->read_fds_count)
+		return -1;
+	return ustream->read_fds[ustream->read_fds_pos++];
 }
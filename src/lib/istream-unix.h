@@ -4,12 +4,17 @@
 struct istream *i_stream_create_unix(int fd, size_t max_buffer_size);
 /* Start trying to read a file descriptor from the UNIX socket. */
 void i_stream_unix_set_read_fd(struct istream *input);
+/* Like i_stream_unix_set_read_fd(), but receive up to max_fds file
+   descriptors that were sent in the same message. They're returned by
+   i_stream_unix_get_read_fd() in the order they were sent. */
+void i_stream_unix_set_read_fds(struct istream *input, unsigned int max_fds);
 /* Stop trying to read a file descriptor from the UNIX socket. */
 void i_stream_unix_unset_read_fd(struct istream *input);
 /* Returns the fd that the last i_stream_read() received, or -1 if no fd
    was received. This function must be called before
    i_stream_unix_set_read_fd() is called again after successfully receiving
-   a file descriptor. */
+   a file descriptor. If multiple fds were received, each call returns the
+   next one. */
 int i_stream_unix_get_read_fd(struct istream *input);
 
 #endif
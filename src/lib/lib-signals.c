@@ -727,3 +727,26 @@ void lib_signals_deinit(void)
 		array_free(&pending_shadowed_signals);
 	i_assert(signal_ioloops == NULL);
 }
+
+void lib_signals_reset_forked(void)
+{
+	struct sigaction act;
+	int i;
+
+	i_zero(&act);
+	if (sigemptyset(&act.sa_mask) < 0)
+		i_fatal("sigemptyset(): %m");
+	act.sa_handler = SIG_DFL;
+	for (i = 0; i < MAX_SIGNAL_VALUE; i++) {
+		if (signal_handlers[i] != NULL &&
+		    sigaction(i, &act, NULL) < 0)
+			i_fatal("sigaction(%d): %m", i);
+	}
+	/* don't free the handlers: their IOs are in the parent's ioloops */
+	if (sig_pipe_fd[0] != -1) {
+		i_close_fd(&sig_pipe_fd[0]);
+		i_close_fd(&sig_pipe_fd[1]);
+	}
+	have_pending_signals = FALSE;
+	i_zero(&pending_signals);
+}
@@ -80,5 +80,11 @@ void lib_signal_delayed(const siginfo_t *si);
 
 void lib_signals_init(void);
 void lib_signals_deinit(void);
+/* Reset signal handling in a child process that was fork()ed without exec().
+   The signals that have handlers get their default action back and the
+   child's copies of the signal pipe fds are closed. The ioloops are shared
+   with the parent, so they aren't touched and lib_signals_deinit() must not
+   be called afterwards. */
+void lib_signals_reset_forked(void);
 
 #endif
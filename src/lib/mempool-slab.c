@@ -0,0 +1,658 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+#include "lib.h"
+#include "safe-memset.h"
+#include "mempool.h"
+#include "array.h"
+#include "bsearch-insert-pos.h"
+#include "llist.h"
+
+/*
+ * Slab pools are meant for long-lived pools that contain many objects of
+ * the same size, which are allocated and freed in any order. Instead of
+ * going to malloc() for each object, the objects are carved out of
+ * page-sized slabs.
+ *
+ * Implementation
+ * ==============
+ *
+ * Allocation sizes are rounded up to one of the size classes (16 .. 512
+ * bytes). Each size class has its own list of slabs. A slab is a
+ * POOL_SLAB_SIZE sized and aligned block of memory beginning with a
+ * struct slab header, followed by the objects:
+ *
+ * +------+--------+--------+--------+-----+--------+
+ * | slab | object | object | object | ... | object |
+ * +------+--------+--------+--------+-----+--------+
+ *
+ * Because the slabs are aligned, the slab that an object belongs to is
+ * found by masking the lowest bits of the object's address once it's known
+ * to be inside one of the pool's chunks (see below). So freeing doesn't need
+ * to know the allocation size and the objects don't need any per-object
+ * headers.
+ *
+ * Each slab has a free list of objects that were freed. Objects that have
+ * never been allocated aren't in the free list. Instead they're handed out
+ * from the end of the used area, so a new slab doesn't need to be touched
+ * until it's actually used.
+ *
+ * The slabs of a size class are kept in two lists: those that have free
+ * objects and those that are full. New objects are allocated from the first
+ * slab with free objects. When a slab becomes empty, it's kept as a spare
+ * for the size class, unless there already is one. Otherwise it's returned
+ * back to its chunk.
+ *
+ * Slabs are allocated from the system in SLAB_CHUNK_SIZE chunks. Allocating
+ * each slab separately with posix_memalign() would leave unusable holes in
+ * the malloc() heap between them, which could double the memory usage.
+ * The chunks are large enough for malloc() to mmap() them, so aligning them
+ * doesn't waste anything. A chunk is freed once all of its slabs are unused,
+ * so memory is returned back to the system.
+ *
+ * The chunks are also kept in an array sorted by their address. Freeing
+ * does a binary search on it to find out whether the memory belongs to a
+ * slab.
+ *
+ * Allocations larger than POOL_SLAB_MAX_ALLOC_SIZE are allocated with plain
+ * malloc(). They have a small struct slab_large header in front of them,
+ * which links them to the pool's list of large allocations. Memory that
+ * isn't inside any of the chunks is a large allocation.
+ */
+
+#define SLAB_CLASS_COUNT 16
+#define SIZEOF_SLAB 64
+/* Keeps the large allocations 16 byte aligned, like malloc() */
+#define SIZEOF_SLAB_LARGE 32
+#define SLAB_CHUNK_SLABS 64
+#define SLAB_CHUNK_SIZE (POOL_SLAB_SIZE * SLAB_CHUNK_SLABS)
+
+struct slab_chunk {
+	struct slab_chunk *prev, *next;
+	unsigned char *mem;
+
+	/* Slabs returned back to the chunk */
+	struct slab *free_slabs;
+	/* Number of slabs ever handed out from the end of the chunk */
+	unsigned int init_count;
+	unsigned int used_count;
+};
+
+struct slab {
+	struct slab *prev, *next;
+	struct slab_pool *pool;
+	struct slab_chunk *chunk;
+
+	/* Freed objects */
+	void *free_list;
+	/* Index to slab_class_sizes[] */
+	unsigned int class_idx;
+	/* Number of objects currently allocated from the slab */
+	unsigned int used_count;
+	/* Number of objects ever handed out from the end of the slab */
+	unsigned int init_count;
+};
+
+struct slab_large {
+	struct slab_large *prev, *next;
+	struct slab_pool *pool;
+	size_t size;
+};
+
+struct slab_class {
+	/* Slabs that have free objects */
+	struct slab *partial;
+	/* Slabs that have no free objects */
+	struct slab *full;
+	struct slab *spare;
+
+	unsigned int slab_count;
+	unsigned int used_count;
+};
+
+struct slab_pool {
+	struct pool pool;
+	int refcount;
+
+	struct slab_class classes[SLAB_CLASS_COUNT];
+	/* Chunks that have free slabs */
+	struct slab_chunk *chunks;
+	/* Chunks that have no free slabs */
+	struct slab_chunk *full_chunks;
+	/* Memory of all the chunks sorted by address */
+	ARRAY(unsigned char *) sorted_chunks;
+
+	struct slab_large *large;
+	unsigned int large_count;
+	size_t large_size;
+
+#ifdef DEBUG
+	char *name;
+#endif
+	bool clean_frees;
+};
+
+static const unsigned int slab_class_sizes[SLAB_CLASS_COUNT] = {
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256, 320, 384, 448, 512
+};
+
+/* Size class for each (size+15)/16 */
+static const uint8_t slab_size_classes[POOL_SLAB_MAX_ALLOC_SIZE/16 + 1] = {
+	0, 0, 1, 2, 3, 4, 5, 6, 7,
+	8, 8, 9, 9, 10, 10, 11, 11,
+	12, 12, 12, 12, 13, 13, 13, 13,
+	14, 14, 14, 14, 15, 15, 15, 15
+};
+
+#define SIZEOF_SLAB_POOL MEM_ALIGN(sizeof(struct slab_pool))
+#define SLAB_OBJECTS(slab) \
+	((unsigned char *)(slab) + SIZEOF_SLAB)
+#define SLAB_CAPACITY(class_idx) \
+	((POOL_SLAB_SIZE - SIZEOF_SLAB) / slab_class_sizes[class_idx])
+#define SLAB_LARGE_MEM(large) \
+	((unsigned char *)(large) + SIZEOF_SLAB_LARGE)
+
+static const char *pool_slab_get_name(pool_t pool);
+static void pool_slab_ref(pool_t pool);
+static void pool_slab_unref(pool_t *pool);
+static void *pool_slab_malloc(pool_t pool, size_t size);
+static void pool_slab_free(pool_t pool, void *mem);
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size);
+static void pool_slab_clear(pool_t pool);
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool);
+
+static const struct pool_vfuncs static_slab_pool_vfuncs = {
+	pool_slab_get_name,
+
+	pool_slab_ref,
+	pool_slab_unref,
+
+	pool_slab_malloc,
+	pool_slab_free,
+
+	pool_slab_realloc,
+
+	pool_slab_clear,
+	pool_slab_get_max_easy_alloc_size
+};
+
+static const struct pool static_slab_pool = {
+	.v = &static_slab_pool_vfuncs,
+
+	.alloconly_pool = FALSE,
+	.datastack_pool = FALSE
+};
+
+pool_t pool_slab_create(const char *name ATTR_UNUSED,
+			enum pool_slab_flags flags)
+{
+	struct slab_pool *pool;
+
+	(void)COMPILE_ERROR_IF_TRUE(sizeof(struct slab) > SIZEOF_SLAB);
+	(void)COMPILE_ERROR_IF_TRUE(sizeof(struct slab_large) >
+				    SIZEOF_SLAB_LARGE);
+	(void)COMPILE_ERROR_IF_TRUE(SIZEOF_SLAB_LARGE >
+				    (SSIZE_T_MAX - POOL_MAX_ALLOC_SIZE));
+
+	pool = calloc(1, SIZEOF_SLAB_POOL);
+	if (pool == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "calloc(1, %zu): Out of memory",
+			       SIZEOF_SLAB_POOL);
+#ifdef DEBUG
+	pool->name = strdup(name);
+#endif
+	pool->pool = static_slab_pool;
+	pool->refcount = 1;
+	pool->clean_frees = (flags & POOL_SLAB_FLAG_CLEAN) != 0;
+	return &pool->pool;
+}
+
+static void pool_slab_destroy(struct slab_pool *spool)
+{
+	pool_slab_clear(&spool->pool);
+	if (array_is_created(&spool->sorted_chunks))
+		array_free(&spool->sorted_chunks);
+	if (spool->clean_frees)
+		safe_memset(spool, 0, SIZEOF_SLAB_POOL);
+#ifdef DEBUG
+	free(spool->name);
+#endif
+	free(spool);
+}
+
+static const char *pool_slab_get_name(pool_t pool ATTR_UNUSED)
+{
+#ifdef DEBUG
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	return spool->name;
+#else
+	return "slab";
+#endif
+}
+
+static void pool_slab_ref(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	i_assert(spool->refcount > 0);
+
+	spool->refcount++;
+}
+
+static void pool_slab_unref(pool_t *_pool)
+{
+	pool_t pool = *_pool;
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	i_assert(spool->refcount > 0);
+
+	/* erase the pointer before freeing anything, as the pointer may
+	   exist inside the pool's memory area */
+	*_pool = NULL;
+
+	if (--spool->refcount > 0)
+		return;
+
+	pool_slab_destroy(spool);
+}
+
+static inline unsigned int slab_size_class(size_t size)
+{
+	return slab_size_classes[(size + 15) / 16];
+}
+
+static int
+slab_chunk_mem_cmp(const void *mem, unsigned char *const *chunk_memp)
+{
+	const unsigned char *chunk_mem = *chunk_memp;
+
+	if ((const unsigned char *)mem < chunk_mem)
+		return -1;
+	if ((const unsigned char *)mem >= chunk_mem + SLAB_CHUNK_SIZE)
+		return 1;
+	return 0;
+}
+
+/* Returns the slab that the memory belongs to, or NULL if it's a large
+   allocation. */
+static struct slab *slab_find(struct slab_pool *spool, void *mem)
+{
+	struct slab *slab;
+
+	if (!array_is_created(&spool->sorted_chunks) ||
+	    array_bsearch(&spool->sorted_chunks, mem,
+			  slab_chunk_mem_cmp) == NULL)
+		return NULL;
+
+	slab = (struct slab *)
+		((uintptr_t)mem & ~(uintptr_t)(POOL_SLAB_SIZE - 1));
+	i_assert(slab->pool == spool);
+	return slab;
+}
+
+static int
+slab_chunk_cmp(unsigned char *const *mem1, unsigned char *const *mem2)
+{
+	if (*mem1 < *mem2)
+		return -1;
+	return *mem1 > *mem2 ? 1 : 0;
+}
+
+static void slab_chunk_index_add(struct slab_pool *spool,
+				 struct slab_chunk *chunk)
+{
+	unsigned int idx;
+
+	if (!array_is_created(&spool->sorted_chunks))
+		i_array_init(&spool->sorted_chunks, 8);
+	if (array_bsearch_insert_pos(&spool->sorted_chunks, &chunk->mem,
+				     slab_chunk_cmp, &idx))
+		i_unreached();
+	array_insert(&spool->sorted_chunks, idx, &chunk->mem, 1);
+}
+
+static void slab_chunk_index_remove(struct slab_pool *spool,
+				    struct slab_chunk *chunk)
+{
+	unsigned int idx;
+
+	if (!array_bsearch_insert_pos(&spool->sorted_chunks, &chunk->mem,
+				      slab_chunk_cmp, &idx))
+		i_unreached();
+	array_delete(&spool->sorted_chunks, idx, 1);
+}
+
+static void
+slab_free_memory(struct slab_pool *spool, void *mem, size_t size)
+{
+	if (spool->clean_frees)
+		safe_memset(mem, 0, size);
+	free(mem);
+}
+
+static struct slab *slab_chunk_get_slab(struct slab_pool *spool)
+{
+	struct slab_chunk *chunk = spool->chunks;
+	struct slab *slab;
+	void *mem;
+
+	if (chunk == NULL) {
+		chunk = calloc(1, sizeof(*chunk));
+		if (chunk == NULL) {
+			i_fatal_status(FATAL_OUTOFMEM,
+				       "calloc(1, %zu): Out of memory",
+				       sizeof(*chunk));
+		}
+		if (posix_memalign(&mem, POOL_SLAB_SIZE, SLAB_CHUNK_SIZE) != 0) {
+			i_fatal_status(FATAL_OUTOFMEM,
+				"posix_memalign(%u, %u): Out of memory",
+				POOL_SLAB_SIZE, SLAB_CHUNK_SIZE);
+		}
+		chunk->mem = mem;
+		DLLIST_PREPEND(&spool->chunks, chunk);
+		slab_chunk_index_add(spool, chunk);
+	}
+
+	if (chunk->free_slabs != NULL) {
+		slab = chunk->free_slabs;
+		chunk->free_slabs = slab->next;
+	} else {
+		i_assert(chunk->init_count < SLAB_CHUNK_SLABS);
+		slab = (struct slab *)(chunk->mem +
+				       chunk->init_count * POOL_SLAB_SIZE);
+		chunk->init_count++;
+	}
+	chunk->used_count++;
+	if (chunk->free_slabs == NULL &&
+	    chunk->init_count == SLAB_CHUNK_SLABS) {
+		DLLIST_REMOVE(&spool->chunks, chunk);
+		DLLIST_PREPEND(&spool->full_chunks, chunk);
+	}
+	i_zero(slab);
+	slab->chunk = chunk;
+	return slab;
+}
+
+static void slab_chunk_put_slab(struct slab_pool *spool, struct slab *slab)
+{
+	struct slab_chunk *chunk = slab->chunk;
+
+	i_assert(chunk->used_count > 0);
+	if (chunk->free_slabs == NULL &&
+	    chunk->init_count == SLAB_CHUNK_SLABS) {
+		DLLIST_REMOVE(&spool->full_chunks, chunk);
+		DLLIST_PREPEND(&spool->chunks, chunk);
+	}
+	if (spool->clean_frees)
+		safe_memset(slab, 0, POOL_SLAB_SIZE);
+	slab->next = chunk->free_slabs;
+	chunk->free_slabs = slab;
+	chunk->used_count--;
+
+	if (chunk->used_count == 0) {
+		DLLIST_REMOVE(&spool->chunks, chunk);
+		slab_chunk_index_remove(spool, chunk);
+		free(chunk->mem);
+		free(chunk);
+	}
+}
+
+static struct slab *
+slab_class_add_slab(struct slab_pool *spool, unsigned int class_idx)
+{
+	struct slab_class *class = &spool->classes[class_idx];
+	struct slab *slab;
+
+	if (class->spare != NULL) {
+		slab = class->spare;
+		class->spare = NULL;
+	} else {
+		slab = slab_chunk_get_slab(spool);
+		slab->pool = spool;
+		slab->class_idx = class_idx;
+		class->slab_count++;
+	}
+	DLLIST_PREPEND(&class->partial, slab);
+	return slab;
+}
+
+/* Allocate an object from the size class. The object isn't zeroed. */
+static void *slab_class_alloc(struct slab_pool *spool, unsigned int class_idx)
+{
+	struct slab_class *class = &spool->classes[class_idx];
+	struct slab *slab = class->partial;
+	void *obj;
+
+	if (slab == NULL)
+		slab = slab_class_add_slab(spool, class_idx);
+
+	if (slab->free_list != NULL) {
+		obj = slab->free_list;
+		slab->free_list = *(void **)obj;
+	} else {
+		i_assert(slab->init_count < SLAB_CAPACITY(class_idx));
+		obj = SLAB_OBJECTS(slab) +
+			slab->init_count * slab_class_sizes[class_idx];
+		slab->init_count++;
+	}
+	slab->used_count++;
+	class->used_count++;
+
+	if (slab->free_list == NULL &&
+	    slab->init_count == SLAB_CAPACITY(class_idx)) {
+		DLLIST_REMOVE(&class->partial, slab);
+		DLLIST_PREPEND(&class->full, slab);
+	}
+	return obj;
+}
+
+static void
+slab_class_free(struct slab_pool *spool, struct slab *slab, void *obj)
+{
+	struct slab_class *class = &spool->classes[slab->class_idx];
+
+	i_assert(slab->used_count > 0);
+	i_assert(class->used_count > 0);
+
+	if (slab->free_list == NULL &&
+	    slab->init_count == SLAB_CAPACITY(slab->class_idx)) {
+		/* slab was full */
+		DLLIST_REMOVE(&class->full, slab);
+		DLLIST_PREPEND(&class->partial, slab);
+	}
+	*(void **)obj = slab->free_list;
+	slab->free_list = obj;
+	slab->used_count--;
+	class->used_count--;
+
+	if (slab->used_count == 0) {
+		DLLIST_REMOVE(&class->partial, slab);
+		slab->free_list = NULL;
+		slab->init_count = 0;
+		if (class->spare == NULL)
+			class->spare = slab;
+		else {
+			class->slab_count--;
+			slab_chunk_put_slab(spool, slab);
+		}
+	}
+}
+
+static void *slab_large_alloc(struct slab_pool *spool, size_t size)
+{
+	struct slab_large *large;
+
+	large = calloc(1, SIZEOF_SLAB_LARGE + size);
+	if (large == NULL) {
+		i_fatal_status(FATAL_OUTOFMEM, "calloc(1, %zu): Out of memory",
+			       SIZEOF_SLAB_LARGE + size);
+	}
+	large->pool = spool;
+	large->size = size;
+
+	DLLIST_PREPEND(&spool->large, large);
+	spool->large_count++;
+	spool->large_size += size;
+	return SLAB_LARGE_MEM(large);
+}
+
+static struct slab_large *slab_large_find(struct slab_pool *spool, void *mem)
+{
+	struct slab_large *large = (struct slab_large *)
+		((unsigned char *)mem - SIZEOF_SLAB_LARGE);
+
+	i_assert(large->pool == spool);
+	return large;
+}
+
+static void slab_large_free(struct slab_pool *spool, struct slab_large *large)
+{
+	i_assert(spool->large_count > 0);
+	DLLIST_REMOVE(&spool->large, large);
+	spool->large_count--;
+	spool->large_size -= large->size;
+
+	slab_free_memory(spool, large, SIZEOF_SLAB_LARGE + large->size);
+}
+
+static void *pool_slab_malloc(pool_t pool, size_t size)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	void *obj;
+
+	if (size > POOL_SLAB_MAX_ALLOC_SIZE)
+		return slab_large_alloc(spool, size);
+
+	obj = slab_class_alloc(spool, slab_size_class(size));
+	memset(obj, 0, size);
+	return obj;
+}
+
+static void pool_slab_free(pool_t pool, void *mem)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab *slab = slab_find(spool, mem);
+
+	if (slab == NULL) {
+		slab_large_free(spool, slab_large_find(spool, mem));
+		return;
+	}
+	if (spool->clean_frees)
+		safe_memset(mem, 0, slab_class_sizes[slab->class_idx]);
+	slab_class_free(spool, slab, mem);
+}
+
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab *slab = slab_find(spool, mem);
+	void *new_mem;
+
+	if (slab != NULL && new_size <= POOL_SLAB_MAX_ALLOC_SIZE &&
+	    slab_size_class(new_size) == slab->class_idx) {
+		/* fits in the same size class */
+		if (new_size > old_size)
+			memset(PTR_OFFSET(mem, old_size), 0, new_size - old_size);
+		return mem;
+	}
+
+	new_mem = pool_slab_malloc(pool, new_size);
+	memcpy(new_mem, mem, I_MIN(old_size, new_size));
+	pool_slab_free(pool, mem);
+	return new_mem;
+}
+
+static void
+slab_chunk_list_free(struct slab_pool *spool, struct slab_chunk *chunk)
+{
+	struct slab_chunk *next;
+
+	for (; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		slab_free_memory(spool, chunk->mem, SLAB_CHUNK_SIZE);
+		free(chunk);
+	}
+}
+
+static void pool_slab_clear(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_class *class;
+	struct slab_large *large, *next;
+	unsigned int i;
+
+	for (i = 0; i < SLAB_CLASS_COUNT; i++) {
+		class = &spool->classes[i];
+		i_zero(class);
+	}
+	slab_chunk_list_free(spool, spool->chunks);
+	slab_chunk_list_free(spool, spool->full_chunks);
+	spool->chunks = NULL;
+	spool->full_chunks = NULL;
+	if (array_is_created(&spool->sorted_chunks))
+		array_clear(&spool->sorted_chunks);
+	for (large = spool->large; large != NULL; large = next) {
+		next = large->next;
+		slab_free_memory(spool, large,
+				 SIZEOF_SLAB_LARGE + large->size);
+	}
+	spool->large = NULL;
+	spool->large_count = 0;
+	spool->large_size = 0;
+}
+
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool ATTR_UNUSED)
+{
+	return 0;
+}
+
+void pool_slab_get_stats(pool_t pool, struct pool_slab_stats *stats_r)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	const struct slab_class *class;
+	unsigned int i, size, chunk_count;
+
+	i_zero(stats_r);
+	for (i = 0; i < SLAB_CLASS_COUNT; i++) {
+		class = &spool->classes[i];
+		size = slab_class_sizes[i];
+		stats_r->slab_count += class->slab_count;
+		stats_r->object_count += class->used_count;
+		stats_r->used_size += (size_t)class->used_count * size;
+		stats_r->free_size += (size_t)class->slab_count *
+			SLAB_CAPACITY(i) * size -
+			(size_t)class->used_count * size;
+		stats_r->overhead_size += (size_t)class->slab_count *
+			(POOL_SLAB_SIZE - SLAB_CAPACITY(i) * size);
+	}
+	chunk_count = !array_is_created(&spool->sorted_chunks) ? 0 :
+		array_count(&spool->sorted_chunks);
+	/* slabs in the chunks that aren't used by any size class */
+	stats_r->free_size += (size_t)chunk_count * SLAB_CHUNK_SIZE -
+		stats_r->slab_count * POOL_SLAB_SIZE;
+	stats_r->large_count = spool->large_count;
+	stats_r->object_count += spool->large_count;
+	stats_r->used_size += spool->large_size;
+	stats_r->overhead_size +=
+		(size_t)spool->large_count * SIZEOF_SLAB_LARGE;
+	stats_r->system_size = (size_t)chunk_count * SLAB_CHUNK_SIZE +
+		spool->large_size +
+		(size_t)spool->large_count * SIZEOF_SLAB_LARGE;
+}
+
+size_t pool_slab_get_total_used_size(pool_t pool)
+{
+	struct pool_slab_stats stats;
+
+	pool_slab_get_stats(pool, &stats);
+	return stats.used_size;
+}
+
+size_t pool_slab_get_total_alloc_size(pool_t pool)
+{
+	struct pool_slab_stats stats;
+
+	pool_slab_get_stats(pool, &stats);
+	return stats.system_size + sizeof(struct slab_pool);
+}
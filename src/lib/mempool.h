@@ -81,6 +81,42 @@ pool_t pool_allocfree_create(const char *name);
    See pool_alloconly_create_clean. */
 pool_t pool_allocfree_create_clean(const char *name);
 
+/* Slab pools allocate memory in POOL_SLAB_SIZE sized slabs with separate free
+   lists for different allocation size classes. They're meant for long-lived
+   pools with many small objects that are allocated and freed in any order.
+   Allocations larger than POOL_SLAB_MAX_ALLOC_SIZE are done separately from
+   the slabs, so they're more expensive than with other pools. */
+#define POOL_SLAB_SIZE 4096
+#define POOL_SLAB_MAX_ALLOC_SIZE 512
+
+enum pool_slab_flags {
+	/* Clear all memory before freeing it.
+	   See pool_alloconly_create_clean(). */
+	POOL_SLAB_FLAG_CLEAN = 0x01,
+};
+
+struct pool_slab_stats {
+	/* Number of slabs allocated for the size classes */
+	size_t slab_count;
+	/* Number of allocations larger than POOL_SLAB_MAX_ALLOC_SIZE */
+	size_t large_count;
+	/* Number of allocations that haven't been freed */
+	size_t object_count;
+
+	/* Memory used by allocations, rounded up to their size class */
+	size_t used_size;
+	/* Free memory in slabs */
+	size_t free_size;
+	/* Memory used for slab headers and unusable slab tails */
+	size_t overhead_size;
+	/* Memory allocated from the system. This is the sum of the above
+	   sizes. */
+	size_t system_size;
+};
+
+/* Create a new slab pool. */
+pool_t pool_slab_create(const char *name, enum pool_slab_flags flags);
+
 /* Similar to nearest_power(), but try not to exceed buffer's easy
    allocation size. If you don't have any explicit minimum size, use
    old_size + 1. */
@@ -173,6 +209,15 @@ size_t pool_allocfree_get_total_used_size(pool_t pool);
 /* Returns how much system memory has been allocated for this pool. */
 size_t pool_allocfree_get_total_alloc_size(pool_t pool);
 
+/* Returns how much memory has been allocated from this pool. The sizes are
+   rounded up to the size classes. */
+size_t pool_slab_get_total_used_size(pool_t pool);
+/* Returns how much system memory has been allocated for this pool. */
+size_t pool_slab_get_total_alloc_size(pool_t pool);
+/* Returns statistics of the pool's memory usage. The amount of memory wasted
+   by fragmentation is free_size + overhead_size. */
+void pool_slab_get_stats(pool_t pool, struct pool_slab_stats *stats_r);
+
 /* private: */
 void pool_system_free(pool_t pool, void *mem);
 
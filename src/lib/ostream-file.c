@@ -2,13 +2,15 @@
 
 /* @UNSAFE: whole file */
 
+#define _GNU_SOURCE /* splice() */
 #include "lib.h"
 #include "ioloop.h"
 #include "write-full.h"
 #include "net.h"
+#include "fd-util.h"
 #include "sendfile-util.h"
 #include "istream.h"
-#include "istream-private.h"
+#include "istream-file-private.h"
 #include "ostream-file-private.h"
 
 #include <unistd.h>
@@ -22,6 +24,9 @@
    128k as optimal size. */
 #define DEFAULT_OPTIMAL_BLOCK_SIZE IO_BLOCK_SIZE
 #define MAX_OPTIMAL_BLOCK_SIZE (128*1024)
+/* How much data to move at once with splice(). This matches the default
+   Linux pipe capacity, so the pipe never needs to be grown. */
+#define SPLICE_BLOCK_SIZE (64*1024)
 
 #define IS_STREAM_EMPTY(fstream) \
 	((fstream)->head == (fstream)->tail && !(fstream)->full)
@@ -33,9 +38,19 @@ static void stream_send_io(struct file_ostream *fstream);
 static struct ostream * o_stream_create_fd_common(int fd,
 		size_t max_buffer_size, bool autoclose_fd);
 
+static void o_stream_file_splice_close(struct file_ostream *fstream)
+{
+	if (fstream->splice_pipe[0] != -1) {
+		i_close_fd(&fstream->splice_pipe[0]);
+		i_close_fd(&fstream->splice_pipe[1]);
+	}
+	fstream->splice_pipe_used = 0;
+}
+
 static void stream_closed(struct file_ostream *fstream)
 {
 	io_remove(&fstream->io);
+	o_stream_file_splice_close(fstream);
 
 	if (fstream->autoclose_fd && fstream->fd != -1) {
 		/* Ignore ECONNRESET because we don't really care about it here,
@@ -65,6 +80,7 @@ static void o_stream_file_destroy(struct iostream_private *stream)
 	struct file_ostream *fstream =
 		container_of(stream, struct file_ostream, ostream.iostream);
 
+	o_stream_file_splice_close(fstream);
 	i_free(fstream->buffer);
 }
 
@@ -332,12 +348,54 @@ static int o_stream_fill_iovec(struct file_ostream *fstream,
 	}
 }
 
+#ifdef HAVE_LINUX_SPLICE
+static int o_stream_file_splice_flush(struct file_ostream *fstream)
+{
+	ssize_t ret;
+
+	o_stream_socket_cork(fstream);
+	while (fstream->splice_pipe_used > 0) {
+		ret = splice(fstream->splice_pipe[0], NULL, fstream->fd, NULL,
+			     fstream->splice_pipe_used,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 0;
+			io_stream_set_error(&fstream->ostream.iostream,
+					    "splice() failed: %m");
+			fstream->ostream.ostream.stream_errno = errno;
+			stream_closed(fstream);
+			return -1;
+		}
+		i_assert(ret > 0);
+		fstream->splice_pipe_used -= ret;
+		fstream->real_offset += ret;
+		fstream->buffer_offset += ret;
+	}
+	return 1;
+}
+#else
+static int o_stream_file_splice_flush(struct file_ostream *fstream ATTR_UNUSED)
+{
+	i_unreached();
+}
+#endif
+
 static int buffer_flush(struct file_ostream *fstream)
 {
 	struct const_iovec iov[2];
 	int iov_len;
 	ssize_t ret;
 
+	if (fstream->splice_pipe_used > 0) {
+		/* the spliced data was sent before anything that is
+		   currently in the buffer */
+		if ((ret = o_stream_file_splice_flush(fstream)) <= 0)
+			return ret;
+	}
+
 	iov_len = o_stream_fill_iovec(fstream, iov);
 	if (iov_len > 0) {
 		ret = o_stream_file_writev_full(fstream, iov, iov_len);
@@ -461,7 +519,8 @@ o_stream_file_get_buffer_used_size(const struct ostream_private *stream)
 	const struct file_ostream *fstream =
 		container_of(stream, const struct file_ostream, ostream);
 
-	return fstream->buffer_size - get_unused_space(fstream);
+	return fstream->buffer_size - get_unused_space(fstream) +
+		fstream->splice_pipe_used;
 }
 
 static int o_stream_file_seek(struct ostream_private *stream, uoff_t offset)
@@ -546,7 +605,8 @@ static void stream_send_io(struct file_ostream *fstream)
 	if (ret == 0)
 		fstream->flush_pending = TRUE;
 
-	if (!fstream->flush_pending && IS_STREAM_EMPTY(fstream)) {
+	if (!fstream->flush_pending && IS_STREAM_EMPTY(fstream) &&
+	    fstream->splice_pipe_used == 0) {
 		io_remove(&fstream->io);
 	} else if (!fstream->ostream.ostream.closed) {
 		/* Add the IO handler if it's not there already. Callback
@@ -618,14 +678,15 @@ ssize_t o_stream_file_sendv(struct ostream_private *stream,
 		size += iov[i].iov_len;
 	total_size = size;
 
-	if (size > get_unused_space(fstream) && !IS_STREAM_EMPTY(fstream)) {
+	if ((size > get_unused_space(fstream) && !IS_STREAM_EMPTY(fstream)) ||
+	    fstream->splice_pipe_used > 0) {
 		if (o_stream_file_flush(stream) < 0)
 			return -1;
 	}
 
 	optimal_size = I_MIN(fstream->optimal_block_size,
 			     fstream->ostream.max_buffer_size);
-	if (IS_STREAM_EMPTY(fstream) &&
+	if (IS_STREAM_EMPTY(fstream) && fstream->splice_pipe_used == 0 &&
 	    (!stream->corked || size >= optimal_size)) {
 		/* send immediately */
 		ret = o_stream_file_writev_full(fstream, iov, iov_count);
@@ -856,6 +917,111 @@ io_stream_sendfile(struct ostream_private *outstream,
 	return TRUE;
 }
 
+#ifdef HAVE_LINUX_SPLICE
+static bool
+o_stream_file_splice_init(struct file_ostream *fstream)
+{
+	if (fstream->splice_pipe[0] != -1)
+		return TRUE;
+
+	if (pipe(fstream->splice_pipe) < 0) {
+		/* most likely out of fds - just fallback to copying */
+		fstream->splice_pipe[0] = fstream->splice_pipe[1] = -1;
+		return FALSE;
+	}
+	fd_set_nonblock(fstream->splice_pipe[0], TRUE);
+	fd_set_nonblock(fstream->splice_pipe[1], TRUE);
+	fd_close_on_exec(fstream->splice_pipe[0], TRUE);
+	fd_close_on_exec(fstream->splice_pipe[1], TRUE);
+	return TRUE;
+}
+
+static bool
+io_stream_splice(struct ostream_private *outstream,
+		 struct istream *instream, int in_fd,
+		 enum ostream_send_istream_result *res_r)
+{
+	struct file_ostream *foutstream =
+		container_of(outstream, struct file_ostream, ostream);
+	ssize_t ret;
+	int ret2;
+
+	if (!o_stream_file_splice_init(foutstream))
+		return FALSE;
+
+	/* flush out any data in buffer */
+	if ((ret2 = buffer_flush(foutstream)) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		return TRUE;
+	} else if (ret2 == 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+		return TRUE;
+	}
+
+	for (;;) {
+		i_assert(foutstream->splice_pipe_used == 0);
+		ret = splice(in_fd, NULL, foutstream->splice_pipe[1], NULL,
+			     SPLICE_BLOCK_SIZE,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret == 0) {
+			instream->eof = TRUE;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+			return TRUE;
+		}
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT;
+				return TRUE;
+			}
+			if (errno == EINVAL) {
+				/* splice() isn't supported with this fd */
+				return FALSE;
+			}
+			io_stream_set_error(&instream->real_stream->iostream,
+					    "splice() failed: %m");
+			instream->stream_errno = errno;
+			instream->eof = TRUE;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT;
+			return TRUE;
+		}
+
+		instream->v_offset += ret;
+		instream->real_stream->last_read_timeval = ioloop_timeval;
+		foutstream->splice_pipe_used += ret;
+		outstream->ostream.offset += ret;
+
+		if ((ret2 = o_stream_file_splice_flush(foutstream)) < 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+			return TRUE;
+		} else if (ret2 == 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+			return TRUE;
+		}
+	}
+}
+
+static bool
+io_stream_can_splice(struct file_ostream *foutstream,
+		     struct istream *instream, int in_fd)
+{
+	struct file_istream *finstream;
+
+	if (!foutstream->ostream.splice_allowed || foutstream->no_splice ||
+	    foutstream->file || in_fd == -1 || in_fd == foutstream->fd)
+		return FALSE;
+	/* only plain non-seekable fd istreams with nothing buffered */
+	if (instream->seekable || instream->eof ||
+	    instream->real_stream->read != i_stream_file_read ||
+	    i_stream_get_data_size(instream) > 0)
+		return FALSE;
+	finstream = container_of(instream->real_stream,
+				 struct file_istream, istream);
+	return finstream->skip_left == 0 && !finstream->seen_eof;
+}
+#endif
+
 static enum ostream_send_istream_result
 io_stream_copy_backwards(struct ostream_private *outstream,
 			 struct istream *instream, uoff_t in_size)
@@ -997,6 +1163,16 @@ o_stream_file_send_istream(struct ostream_private *outstream,
 		   regular sending. */
 		foutstream->no_sendfile = TRUE;
 	}
+#ifdef HAVE_LINUX_SPLICE
+	if (io_stream_can_splice(foutstream, instream, in_fd)) {
+		if (io_stream_splice(outstream, instream, in_fd, &res))
+			return res;
+
+		/* splice() not supported (with this fd), fallback to
+		   regular sending. */
+		foutstream->no_splice = TRUE;
+	}
+#endif
 
 	same_stream = i_stream_get_fd(instream) == foutstream->fd &&
 		foutstream->fd != -1;
@@ -1024,6 +1200,7 @@ o_stream_create_file_common(struct file_ostream *fstream,
 	fstream->fd = fd;
 	fstream->autoclose_fd = autoclose_fd;
 	fstream->optimal_block_size = DEFAULT_OPTIMAL_BLOCK_SIZE;
+	fstream->splice_pipe[0] = fstream->splice_pipe[1] = -1;
 
 	fstream->ostream.iostream.close = o_stream_file_close;
 	fstream->ostream.iostream.destroy = o_stream_file_destroy;
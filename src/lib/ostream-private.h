@@ -49,6 +49,7 @@ struct ostream_private {
 	bool noverflow:1;
 	bool finish_also_parent:1;
 	bool finish_via_child:1;
+	bool splice_allowed:1;
 };
 
 struct ostream *
@@ -230,6 +230,14 @@ void o_stream_abort(struct ostream *stream);
    When creating wrapper streams, they copy this behavior from the parent
    stream. */
 void o_stream_set_no_error_handling(struct ostream *stream, bool set);
+/* Allow o_stream_send_istream() to move data from a socket istream directly
+   to this socket ostream using splice(), without copying it via userspace
+   buffers. This is done only when the istream is a non-seekable fd istream
+   without any parent streams or buffered data, so e.g. SSL and rawlog streams
+   always fall back to regular copying. The data moved through the kernel
+   pipe isn't limited by the max_buffer_size. Stream offsets and the last
+   read/write timestamps are updated the same way as with regular copying. */
+void o_stream_set_splice(struct ostream *stream, bool set);
 /* Send all of the instream to outstream.
 
    On non-failure instream is skips over all data written to outstream.
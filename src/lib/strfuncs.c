@@ -11,6 +11,9 @@
 #include <stdio.h>
 #include <limits.h>
 #include <ctype.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 /* Disable our memcpy() safety wrapper. This file is very performance sensitive
    and it's been checked to work correctly with memcpy(). */
@@ -686,6 +689,39 @@ size_t i_memspn(const void *data, size_t data_len,
 	return pos;
 }
 
+#ifdef __SSE2__
+static size_t
+i_memcspn_sse2(const unsigned char *data, size_t data_len,
+	       const unsigned char *reject, size_t reject_len)
+{
+	__m128i r[4], v, eq;
+	size_t i, pos = 0;
+	unsigned int mask;
+
+	i_assert(reject_len > 0 && reject_len <= N_ELEMENTS(r));
+	/* unused slots repeat the first reject byte */
+	for (i = 0; i < N_ELEMENTS(r); i++)
+		r[i] = _mm_set1_epi8(reject[i < reject_len ? i : 0]);
+
+	for (; data_len - pos >= 16; pos += 16) {
+		v = _mm_loadu_si128((const __m128i *)(data + pos));
+		eq = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, r[0]),
+				     _mm_cmpeq_epi8(v, r[1])),
+			_mm_or_si128(_mm_cmpeq_epi8(v, r[2]),
+				     _mm_cmpeq_epi8(v, r[3])));
+		mask = _mm_movemask_epi8(eq);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	for (; pos < data_len; pos++) {
+		if (memchr(reject, data[pos], reject_len) != NULL)
+			break;
+	}
+	return pos;
+}
+#endif
+
 size_t i_memcspn(const void *data, size_t data_len,
 		 const void *reject, size_t reject_len)
 {
@@ -697,13 +733,24 @@ size_t i_memcspn(const void *data, size_t data_len,
 	/* nothing to reject */
 	if (reject_len == 0 || data_len == 0)
 		return data_len;
+	if (reject_len == 1) {
+		ptr = memchr(start, r[0], data_len);
+		return ptr == NULL ? data_len : (size_t)(ptr - start);
+	}
+#ifdef __SSE2__
+	/* Scan for a few bytes at the same time. This is commonly used
+	   for finding e.g. CR and LF from large message bodies. */
+	if (reject_len <= 4)
+		return i_memcspn_sse2(start, data_len, r, reject_len);
+#endif
 	/* Doing repeated memchr's over the data is faster than
 	   going over it once byte by byte, as long as reject
-	   is reasonably short. */
-	for (size_t i = 0; i < reject_len; i++) {
+	   is reasonably short. Each memchr() only needs to scan up to
+	   the earliest match found so far. */
+	for (size_t i = 0; i < reject_len && ptr > start; i++) {
 		const unsigned char *kand =
-			memchr(start, r[i], data_len);
-		if (kand != NULL && kand < ptr)
+			memchr(start, r[i], ptr - start);
+		if (kand != NULL)
 			ptr = kand;
 	}
 	return ptr - start;
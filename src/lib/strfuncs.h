@@ -140,7 +140,8 @@ size_t i_memspn(const void *data, size_t data_len,
 /* Get length of a prefix segment.
 
   Calculates the length of the initial segment of s which consists entirely of
-  bytes not in reject.
+  bytes not in reject. This is optimized for large data and short reject
+  lists, e.g. for finding the next CR or LF.
 */
 size_t i_memcspn(const void *data, size_t data_len,
 		 const void *reject, size_t reject_len);
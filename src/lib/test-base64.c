@@ -3,6 +3,8 @@
 #include "test-lib.h"
 #include "str.h"
 #include "base64.h"
+#include "base64-simd.h"
+#include "randgen.h"
 
 static void test_base64_encode(void)
 {
@@ -1302,6 +1304,117 @@ static void test_base64_encode_lines(void)
 	test_end();
 }
 
+static void
+test_base64_simd_encode(const struct base64_scheme *b64,
+			enum base64_simd_level level,
+			enum base64_encode_flags flags, size_t max_line_len,
+			const unsigned char *data, size_t size,
+			buffer_t *dest)
+{
+	struct base64_encoder enc;
+
+	(void)base64_simd_set_level(level);
+	base64_encode_init(&enc, b64, flags, max_line_len);
+	test_assert(base64_encode_more(&enc, data, size, NULL, dest));
+	test_assert(base64_encode_finish(&enc, dest));
+}
+
+static int
+test_base64_simd_decode(const struct base64_scheme *b64,
+			enum base64_simd_level level,
+			enum base64_decode_flags flags,
+			const unsigned char *data, size_t size,
+			size_t *src_pos_r, buffer_t *dest)
+{
+	struct base64_decoder dec;
+	int ret;
+
+	(void)base64_simd_set_level(level);
+	base64_decode_init(&dec, b64, flags);
+	ret = base64_decode_more(&dec, data, size, src_pos_r, dest);
+	if (ret > 0 && *src_pos_r == size)
+		ret = base64_decode_finish(&dec);
+	return ret;
+}
+
+static void test_base64_simd(void)
+{
+	static const enum base64_decode_flags dec_flags[] = {
+		0, BASE64_DECODE_FLAG_NO_WHITESPACE,
+		BASE64_DECODE_FLAG_EXPECT_BOUNDARY,
+	};
+	static const char garbage[] = " \r\n\t=!-_+/\x80\xff";
+	enum base64_simd_level level, max_level = base64_simd_get_level();
+	const struct base64_scheme *b64;
+	enum base64_encode_flags enc_flags;
+	enum base64_decode_flags flags;
+	unsigned char data[600], out_data1[500], out_data2[500];
+	buffer_t *enc1, *enc2, *dec1, *dec2, out1, out2;
+	size_t i, j, size, max_line_len, dest_size = 0, pos1, pos2;
+	int ret1, ret2;
+
+	enc1 = t_buffer_create(1024);
+	enc2 = t_buffer_create(1024);
+	dec1 = t_buffer_create(1024);
+	dec2 = t_buffer_create(1024);
+
+	/* compare the SIMD results against the scalar code */
+	test_begin("base64 simd");
+	for (i = 0; max_level > BASE64_SIMD_NONE && i < 4000; i++) {
+		/* alternate between all the supported levels */
+		level = BASE64_SIMD_SSSE3 + i % max_level;
+		b64 = i_rand_limit(2) == 0 ? &base64_scheme : &base64url_scheme;
+		size = i_rand_limit(sizeof(data));
+		random_fill(data, size);
+		enc_flags = i_rand_limit(2) == 0 ? 0 : BASE64_ENCODE_FLAG_CRLF;
+		max_line_len = i_rand_limit(3) == 0 ? 0 :
+			(i_rand_limit(2) == 0 ? 76 : i_rand_minmax(1, 100));
+
+		buffer_set_used_size(enc1, 0);
+		buffer_set_used_size(enc2, 0);
+		test_base64_simd_encode(b64, BASE64_SIMD_NONE, enc_flags,
+					max_line_len, data, size, enc1);
+		test_base64_simd_encode(b64, level, enc_flags,
+					max_line_len, data, size, enc2);
+		test_assert_idx(buffer_cmp(enc1, enc2), i);
+
+		/* corrupt some of the encoded data */
+		if (enc1->used > 0 && i_rand_limit(2) == 0) {
+			unsigned char *p = buffer_get_modifiable_data(enc1, NULL);
+
+			for (j = i_rand_limit(3); j > 0; j--) {
+				p[i_rand_limit(enc1->used)] =
+					garbage[i_rand_limit(sizeof(garbage) - 1)];
+			}
+		}
+		/* sometimes decode into a small fixed size buffer */
+		flags = dec_flags[i_rand_limit(N_ELEMENTS(dec_flags))];
+		if (i_rand_limit(2) == 0) {
+			dest_size = i_rand_limit(sizeof(out_data1));
+			buffer_create_from_data(&out1, out_data1, dest_size);
+			buffer_create_from_data(&out2, out_data2, dest_size);
+		} else {
+			buffer_set_used_size(dec1, 0);
+			buffer_set_used_size(dec2, 0);
+		}
+		ret1 = test_base64_simd_decode(b64, BASE64_SIMD_NONE, flags,
+					       enc1->data, enc1->used, &pos1,
+					       dest_size > 0 ? &out1 : dec1);
+		ret2 = test_base64_simd_decode(b64, level, flags,
+					       enc1->data, enc1->used, &pos2,
+					       dest_size > 0 ? &out2 : dec2);
+		test_assert_idx(ret1 == ret2, i);
+		test_assert_idx(pos1 == pos2, i);
+		if (dest_size > 0)
+			test_assert_idx(buffer_cmp(&out1, &out2), i);
+		else
+			test_assert_idx(buffer_cmp(dec1, dec2), i);
+		dest_size = 0;
+	}
+	(void)base64_simd_set_level(max_level);
+	test_end();
+}
+
 void test_base64(void)
 {
 	test_base64_encode();
@@ -1314,4 +1427,5 @@ void test_base64(void)
 	test_base64_decode_lowlevel();
 	test_base64_random_lowlevel();
 	test_base64_encode_lines();
+	test_base64_simd();
 }
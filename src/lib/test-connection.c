@@ -502,9 +502,28 @@ static void test_connection_handshake_failed_destroy(struct connection *conn)
 	test_connection_simple_destroy(conn);
 }
 
+static void
+test_connection_handshake_failed_version_connected(struct connection *conn ATTR_UNUSED,
+						   bool success)
+{
+	test_assert(success);
+}
+
+static void
+test_connection_handshake_failed_version_ready(struct connection *conn)
+{
+	/* Send QUIT only after the handshake. If it was sent immediately,
+	   whether the server sees it before the client notices the version
+	   mismatch would depend on the order in which the ioloop handles
+	   the two ready fds. */
+	if (conn->list->set.client)
+		o_stream_nsend_str(conn->output, "QUIT\n");
+}
+
 static const struct connection_vfuncs handshake_failed_version_v =
 {
-	.client_connected = test_connection_simple_client_connected,
+	.client_connected = test_connection_handshake_failed_version_connected,
+	.handshake_ready = test_connection_handshake_failed_version_ready,
 	.input_args = test_connection_simple_input_args,
 	.destroy = test_connection_handshake_failed_destroy,
 };
@@ -297,6 +297,147 @@ static void test_ds_recursive(void)
 	test_end();
 }
 
+static int ds_profile_event_count = 0;
+
+static bool
+test_ds_profile_event_callback(struct event *event,
+			       enum event_callback_type type,
+			       struct failure_context *ctx ATTR_UNUSED,
+			       const char *fmt ATTR_UNUSED,
+			       va_list args ATTR_UNUSED)
+{
+	const struct event_field *field;
+
+	if (type != EVENT_CALLBACK_TYPE_SEND ||
+	    null_strcmp(event->sending_name, "data_stack_frame_peak") != 0)
+		return TRUE;
+
+	ds_profile_event_count++;
+	field = event_find_field_nonrecursive(event, "peak_bytes");
+	test_assert(field != NULL &&
+		    field->value_type == EVENT_FIELD_VALUE_TYPE_INTMAX &&
+		    field->value.intmax >= 10000);
+	field = event_find_field_nonrecursive(event, "frame_marker");
+	test_assert(field != NULL &&
+		    field->value_type == EVENT_FIELD_VALUE_TYPE_STR &&
+		    str_begins_with(field->value.str, "test profile "));
+	return TRUE;
+}
+
+static const struct data_stack_frame_profile *
+test_ds_profile_find(const struct data_stack_frame_profile *profiles,
+		     unsigned int count, const char *marker)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		if (strcmp(profiles[i].marker, marker) == 0)
+			return &profiles[i];
+	}
+	return NULL;
+}
+
+static void test_ds_profile(void)
+{
+	const struct data_stack_frame_profile *profiles, *outer, *inner;
+	data_stack_frame_t outer_id, inner_id;
+	unsigned int i, count;
+	const char *error;
+
+	test_begin("data-stack profile");
+	event_register_callback(test_ds_profile_event_callback);
+	struct event_filter *filter = event_filter_create();
+	test_assert(event_filter_parse("event=data_stack_frame_peak",
+				       filter, &error) == 0);
+	event_set_global_debug_log_filter(filter);
+	event_filter_unref(&filter);
+
+	data_stack_profile_start(10000);
+	for (i = 0; i < 3; i++) {
+		outer_id = t_push("test profile outer");
+		(void)t_malloc_no0(1000);
+		inner_id = t_push("test profile inner");
+		(void)t_malloc_no0(5000 * (i + 1));
+		(void)t_malloc_no0(10);
+		test_assert(t_pop(&inner_id));
+		(void)t_malloc_no0(100);
+		test_assert(t_pop(&outer_id));
+	}
+	data_stack_profile_stop();
+	/* frames popped after stopping aren't profiled */
+	T_BEGIN {
+		(void)t_malloc_no0(20000);
+	} T_END;
+
+	/* inner: 5010, 10010 and 15010 bytes, outer: 6110, 11110, 16110 */
+	test_assert(ds_profile_event_count == 4);
+	event_unset_global_debug_log_filter();
+	event_unregister_callback(test_ds_profile_event_callback);
+
+	/* data stack growth may also have profiled its own event frame */
+	profiles = data_stack_profile_get(&count);
+	test_assert(count >= 2);
+	inner = test_ds_profile_find(profiles, count, "test profile inner");
+	outer = test_ds_profile_find(profiles, count, "test profile outer");
+	test_assert(inner != NULL && outer != NULL);
+	if (inner != NULL && outer != NULL) {
+		test_assert(inner->push_count == 3);
+		test_assert(inner->peak_bytes >= 15010 &&
+			    inner->peak_bytes < 15010 + 1024);
+		test_assert(inner->alloc_bytes >= 30060);
+		test_assert(inner->alloc_count >= 6);
+		test_assert(outer->push_count == 3);
+		test_assert(outer->peak_bytes >= 1000 + inner->peak_bytes);
+		test_assert(outer->alloc_count >= 6);
+		test_assert(outer->alloc_bytes >= 3300 &&
+			    outer->alloc_bytes < inner->alloc_bytes);
+		for (i = 1; i < count; i++) {
+			test_assert(profiles[i-1].peak_bytes >=
+				    profiles[i].peak_bytes);
+		}
+	}
+	data_stack_profile_reset();
+	(void)data_stack_profile_get(&count);
+	test_assert(count == 0);
+	test_end();
+}
+
+static void test_ds_trim(void)
+{
+	const char *error;
+
+	test_begin("data-stack trim");
+	event_register_callback(test_ds_grow_event_callback);
+	struct event_filter *filter = event_filter_create();
+	test_assert(event_filter_parse("event=data_stack_grow", filter, &error) == 0);
+	event_set_global_debug_log_filter(filter);
+	event_filter_unref(&filter);
+
+	/* the large block is freed immediately */
+	data_stack_set_trim_size(64*1024);
+	T_BEGIN {
+		(void)t_malloc0(1024*200);
+	} T_END;
+	test_assert(ds_grow_event_count == 1);
+	T_BEGIN {
+		(void)t_malloc0(1024*200);
+	} T_END;
+	test_assert(ds_grow_event_count == 2);
+
+	/* without trimming the block is reused */
+	data_stack_set_trim_size(0);
+	T_BEGIN {
+		(void)t_malloc0(1024*200);
+	} T_END;
+	test_assert(ds_grow_event_count == 3);
+	T_BEGIN {
+		(void)t_malloc0(1024*200);
+	} T_END;
+	test_assert(ds_grow_event_count == 3);
+
+	event_unset_global_debug_log_filter();
+	event_unregister_callback(test_ds_grow_event_callback);
+	test_end();
+}
+
 static void test_ds_pass_str(void)
 {
 	data_stack_frame_t frames[32*2 + 1]; /* BLOCK_FRAME_COUNT*2 + 1 */
@@ -354,6 +495,8 @@ void test_data_stack(void)
 		test_ds_realloc,
 		test_ds_recursive,
 		test_ds_pass_str,
+		test_ds_profile,
+		test_ds_trim,
 	};
 	for (unsigned int i = 0; i < N_ELEMENTS(tests); i++) {
 		ds_grow_event_count = 0;
@@ -2,9 +2,12 @@
 
 #include "test-lib.h"
 #include "hash.h"
+#include "randgen.h"
 
+#include <ctype.h>
 
-static void test_hash_random_pool(pool_t pool)
+
+static void test_hash_random_pool(pool_t pool, bool open)
 {
 #define KEYMAX 100000
 	HASH_TABLE(void *, void *) hash;
@@ -12,7 +15,10 @@ static void test_hash_random_pool(pool_t pool)
 	unsigned int i, key, keyidx, delidx;
 
 	keys = i_new(unsigned int, KEYMAX); keyidx = 0;
-	hash_table_create_direct(&hash, pool, 0);
+	if (open)
+		hash_table_create_open_direct(&hash, pool, 0);
+	else
+		hash_table_create_direct(&hash, pool, 0);
 	for (i = 0; i < KEYMAX; i++) {
 		key = (i_rand_limit(KEYMAX)) + 1;
 		if (i_rand_limit(5) > 0) {
@@ -29,19 +35,284 @@ static void test_hash_random_pool(pool_t pool)
 			keyidx--;
 		}
 	}
+	test_assert(hash_table_count(hash) == keyidx);
 	for (i = 0; i < keyidx; i++)
 		hash_table_remove(hash, POINTER_CAST(keys[i]));
+	test_assert(hash_table_count(hash) == 0);
 	hash_table_destroy(&hash);
 	i_free(keys);
 }
 
+static void test_hash_open_strings(void)
+{
+#define STRKEY_COUNT 5000
+	HASH_TABLE(const char *, void *) hash;
+	struct hash_iterate_context *iter;
+	pool_t pool;
+	const char *keys[STRKEY_COUNT], *key, *orig_key, *dup_key;
+	void *value;
+	unsigned int i, count;
+
+	test_begin("hash open strings");
+	pool = pool_alloconly_create("test hash open", 1024);
+	hash_table_create_open(&hash, default_pool, 0, str_hash, strcmp);
+	for (i = 0; i < STRKEY_COUNT; i++) {
+		keys[i] = p_strdup_printf(pool, "key%u", i);
+		hash_table_insert(hash, keys[i], POINTER_CAST(i + 1));
+	}
+	test_assert(hash_table_count(hash) == STRKEY_COUNT);
+
+	/* lookups with a different pointer */
+	for (i = 0; i < STRKEY_COUNT; i++) {
+		const char *lookup_key = t_strdup_printf("key%u", i);
+
+		test_assert_idx(hash_table_lookup_full(hash, lookup_key,
+						       &orig_key, &value), i);
+		test_assert_idx(orig_key == keys[i], i);
+		test_assert_idx(value == POINTER_CAST(i + 1), i);
+	}
+	dup_key = "nonexistent";
+	test_assert(hash_table_lookup(hash, dup_key) == NULL);
+
+	/* update keeps the original key */
+	dup_key = t_strdup("key0");
+	hash_table_update(hash, dup_key, POINTER_CAST(1000000));
+	test_assert(hash_table_lookup_full(hash, dup_key, &orig_key, &value));
+	test_assert(orig_key == keys[0] && value == POINTER_CAST(1000000));
+
+	/* remove every other node while iterating */
+	count = 0;
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		if (count++ % 2 == 0)
+			hash_table_remove(hash, key);
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(count == STRKEY_COUNT);
+	test_assert(hash_table_count(hash) == STRKEY_COUNT / 2);
+
+	/* the rest can still be found */
+	count = 0;
+	for (i = 0; i < STRKEY_COUNT; i++) {
+		if (hash_table_lookup(hash, keys[i]) != NULL)
+			count++;
+	}
+	test_assert(count == STRKEY_COUNT / 2);
+
+	/* shrinks back after removing everything */
+	for (i = 0; i < STRKEY_COUNT; i++)
+		(void)hash_table_try_remove(hash, keys[i]);
+	test_assert(hash_table_count(hash) == 0);
+	hash_table_insert(hash, keys[0], POINTER_CAST(1));
+	hash_table_clear(hash, TRUE);
+	test_assert(hash_table_count(hash) == 0);
+	test_assert(hash_table_lookup(hash, keys[0]) == NULL);
+
+	hash_table_destroy(&hash);
+	pool_unref(&pool);
+	test_end();
+}
+
+static void test_hash_open_insert_frozen(void)
+{
+#define FROZEN_KEY_COUNT 1000
+	HASH_TABLE(void *, void *) hash;
+	struct hash_iterate_context *iter;
+	void *key, *value;
+	unsigned int i, count;
+
+	test_begin("hash open insert while iterating");
+	hash_table_create_open_direct(&hash, default_pool, 0);
+	for (i = 1; i <= 10; i++)
+		hash_table_insert(hash, POINTER_CAST(i), POINTER_CAST(i));
+
+	/* grows way past the initial size while iterating */
+	count = 0;
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		test_assert(key == value);
+		if (count++ == 0) {
+			for (i = 11; i <= FROZEN_KEY_COUNT; i++) {
+				hash_table_insert(hash, POINTER_CAST(i),
+						  POINTER_CAST(i));
+			}
+			hash_table_update(hash, POINTER_CAST(500),
+					  POINTER_CAST(500));
+			hash_table_remove(hash, POINTER_CAST(FROZEN_KEY_COUNT));
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(count >= 10 && count <= FROZEN_KEY_COUNT - 1);
+	test_assert(hash_table_count(hash) == FROZEN_KEY_COUNT - 1);
+
+	/* a new iteration inside an outer freeze sees all of them */
+	hash_table_freeze(hash);
+	for (i = FROZEN_KEY_COUNT; i < FROZEN_KEY_COUNT * 2; i++)
+		hash_table_insert(hash, POINTER_CAST(i), POINTER_CAST(i));
+	count = 0;
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		test_assert(key == value);
+		count++;
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(count == FROZEN_KEY_COUNT * 2 - 1);
+	hash_table_thaw(hash);
+
+	/* everything is found after merging the overflow tables */
+	for (i = 1; i < FROZEN_KEY_COUNT * 2; i++)
+		test_assert_idx(hash_table_lookup(hash, POINTER_CAST(i)) ==
+				POINTER_CAST(i), i);
+	test_assert(hash_table_count(hash) == FROZEN_KEY_COUNT * 2 - 1);
+	hash_table_destroy(&hash);
+	test_end();
+}
+
+static void test_str_hash_case(void)
+{
+	unsigned char buf[300], upper[300];
+	unsigned int i, len;
+
+	test_begin("str_hash() case");
+	/* all byte values, so the bytes around a-z and 8bit bytes get
+	   tested as well */
+	for (i = 0; i < 255; i++) {
+		buf[i] = i + 1;
+		upper[i] = i_toupper(buf[i]);
+	}
+	buf[255] = upper[255] = '\0';
+	for (len = 0; len <= 255; len++) {
+		char tmp = buf[len];
+
+		buf[len] = upper[len] = '\0';
+		test_assert_idx(str_hash((const char *)buf) ==
+				mem_hash(buf, len), len);
+		test_assert_idx(strcase_hash((const char *)buf) ==
+				str_hash((const char *)upper), len);
+		test_assert_idx(strcase_hash((const char *)buf) ==
+				strcase_hash((const char *)upper), len);
+		buf[len] = tmp;
+		upper[len] = i_toupper(tmp);
+	}
+
+	/* random strings of all lengths, with random letters' case flipped */
+	for (len = 0; len < 100; len++) {
+		for (i = 0; i < len; i++) {
+			buf[i] = 'a' + i_rand_limit(26);
+			upper[i] = i_rand_limit(2) == 0 ? buf[i] :
+				i_toupper(buf[i]);
+		}
+		buf[len] = upper[len] = '\0';
+		test_assert_idx(strcase_hash((const char *)buf) ==
+				strcase_hash((const char *)upper), len);
+	}
+	test_end();
+}
+
+#define TEST_HASH_KEY_COUNT 65536
+#define TEST_HASH_BUCKETS 1024
+static bool test_hash_buckets_ok(const unsigned int *hashes, unsigned int shift)
+{
+	unsigned int buckets[TEST_HASH_BUCKETS];
+	double expected = (double)TEST_HASH_KEY_COUNT / TEST_HASH_BUCKETS;
+	double chi2 = 0;
+	unsigned int i;
+
+	memset(buckets, 0, sizeof(buckets));
+	for (i = 0; i < TEST_HASH_KEY_COUNT; i++)
+		buckets[(hashes[i] >> shift) % TEST_HASH_BUCKETS]++;
+	for (i = 0; i < TEST_HASH_BUCKETS; i++) {
+		double diff = buckets[i] - expected;
+		chi2 += diff * diff / expected;
+	}
+	/* The chi-squared value has mean 1023 and standard deviation ~45
+	   with uniformly distributed hashes. Allow 7 deviations. */
+	return chi2 < TEST_HASH_BUCKETS - 1 + 7 * 45;
+}
+
+static void test_str_hash_distribution(void)
+{
+	static const struct {
+		const char *prefix, *suffix;
+	} formats[] = {
+		{ "", "" },
+		{ "user", "@example.com" },
+		{ "USER", "@EXAMPLE.COM" },
+		{ "INBOX/some/long/folder/path/shared/by/all/the/keys/", "" },
+		{ "", "/some/long/folder/path/shared/by/all/the/keys/INBOX" },
+	};
+	unsigned int *hashes, *case_hashes, i, j;
+
+	test_begin("str_hash() distribution");
+	hashes = i_new(unsigned int, TEST_HASH_KEY_COUNT);
+	case_hashes = i_new(unsigned int, TEST_HASH_KEY_COUNT);
+	for (i = 0; i < N_ELEMENTS(formats); i++) T_BEGIN {
+		for (j = 0; j < TEST_HASH_KEY_COUNT; j++) {
+			const char *key = t_strdup_printf("%s%u%s",
+				formats[i].prefix, j, formats[i].suffix);
+
+			hashes[j] = str_hash(key);
+			case_hashes[j] = strcase_hash(key);
+		}
+		/* both the lowest and highest bits are used by tables */
+		test_assert_idx(test_hash_buckets_ok(hashes, 0), i);
+		test_assert_idx(test_hash_buckets_ok(hashes, 22), i);
+		test_assert_idx(test_hash_buckets_ok(case_hashes, 0), i);
+		test_assert_idx(test_hash_buckets_ok(case_hashes, 22), i);
+	} T_END;
+	i_free(hashes);
+	i_free(case_hashes);
+	test_end();
+}
+
+static void test_str_hash_avalanche(void)
+{
+	static const unsigned int lengths[] = { 3, 8, 16, 40 };
+	unsigned char buf[40];
+	unsigned int i, j, n, bit, hash, flips = 0, tests = 0;
+
+	test_begin("str_hash() avalanche");
+	for (i = 0; i < N_ELEMENTS(lengths); i++) {
+		for (n = 0; n < 100; n++) {
+			random_fill(buf, lengths[i]);
+			hash = mem_hash(buf, lengths[i]);
+			for (j = 0; j < lengths[i] * 8; j++) {
+				buf[j / 8] ^= 1 << (j % 8);
+				bit = mem_hash(buf, lengths[i]) ^ hash;
+				for (; bit != 0; bit &= bit - 1)
+					flips++;
+				tests++;
+				buf[j / 8] ^= 1 << (j % 8);
+			}
+		}
+	}
+	/* a single flipped input bit should flip half of the output bits */
+	test_assert((double)flips / tests > 15.5 &&
+		    (double)flips / tests < 16.5);
+	test_end();
+}
+
 void test_hash(void)
 {
 	pool_t pool;
 
-	test_hash_random_pool(default_pool);
+	test_begin("hash random");
+	test_hash_random_pool(default_pool, FALSE);
+	pool = pool_alloconly_create("test hash", 1024);
+	test_hash_random_pool(pool, FALSE);
+	pool_unref(&pool);
+	test_end();
 
+	test_begin("hash open random");
+	test_hash_random_pool(default_pool, TRUE);
 	pool = pool_alloconly_create("test hash", 1024);
-	test_hash_random_pool(pool);
+	test_hash_random_pool(pool, TRUE);
 	pool_unref(&pool);
+	test_end();
+
+	test_hash_open_strings();
+	test_hash_open_insert_frozen();
+	test_str_hash_case();
+	test_str_hash_distribution();
+	test_str_hash_avalanche();
 }
@@ -132,6 +132,45 @@ static void test_ioloop_timeout(void)
 	test_end();
 }
 
+static void test_ioloop_coarse_timeout(void)
+{
+	struct ioloop *ioloop, *ioloop2;
+	struct timeout *to, *to2;
+	struct timeval tv_start, tv_callback;
+
+	test_begin("ioloop coarse timeout");
+
+	ioloop = io_loop_create();
+	ioloop2 = io_loop_create();
+	to2 = timeout_add_coarse(1000, timeout_callback, &tv_callback);
+	test_assert(io_loop_is_empty(ioloop));
+	test_assert(!io_loop_is_empty(ioloop2));
+	io_loop_set_current(ioloop);
+	to2 = io_loop_move_timeout(&to2);
+	test_assert(!io_loop_is_empty(ioloop));
+	test_assert(io_loop_is_empty(ioloop2));
+	io_loop_set_current(ioloop2);
+	io_loop_destroy(&ioloop2);
+
+	/* add & remove immediately */
+	to = timeout_add_coarse(1000, timeout_callback, &tv_callback);
+	timeout_remove(&to);
+
+	i_gettimeofday(&tv_start);
+	to = timeout_add_coarse(1000, timeout_callback, &tv_callback);
+	timeout_reset(to2);
+	io_loop_run(ioloop);
+	test_assert(timeval_diff_msecs(&tv_callback, &tv_start) >= 1000);
+	test_assert(timeval_diff_msecs(&tv_callback, &tv_start) < 2500);
+	timeout_remove(&to);
+	test_assert(!io_loop_is_empty(ioloop));
+	timeout_remove(&to2);
+	test_assert(io_loop_is_empty(ioloop));
+	io_loop_destroy(&ioloop);
+
+	test_end();
+}
+
 static void zero_timeout_callback(unsigned int *counter)
 {
 	*counter += 1;
@@ -296,6 +335,121 @@ static void test_ioloop_pending_io(void)
 	test_end();
 }
 
+struct test_budget_io {
+	struct istream *input;
+	struct io *io;
+	unsigned int calls;
+};
+
+static struct test_budget_io test_budget_ios[3];
+
+static void test_ioloop_budget_callback(struct test_budget_io *bio)
+{
+	unsigned int i, min_calls = UINT_MAX, max_calls = 0;
+
+	/* do work until the budget runs out and then yield */
+	while (!io_loop_is_over_budget(current_ioloop)) ;
+	bio->calls++;
+
+	/* none of the IOs can get ahead of the others by more than one
+	   call */
+	for (i = 0; i < N_ELEMENTS(test_budget_ios); i++) {
+		min_calls = I_MIN(min_calls, test_budget_ios[i].calls);
+		max_calls = I_MAX(max_calls, test_budget_ios[i].calls);
+	}
+	test_assert(max_calls - min_calls <= 1);
+	if (min_calls == 10 || max_calls == 30)
+		io_loop_stop(current_ioloop);
+	else
+		io_set_pending(bio->io);
+}
+
+static void test_ioloop_budget(void)
+{
+	struct event *event = event_create(NULL);
+	struct ioloop *ioloop;
+	unsigned int i;
+
+	test_begin("ioloop budget");
+	ioloop = io_loop_create();
+	test_assert(!io_loop_is_over_budget(ioloop));
+	io_loop_set_budget(ioloop, 1000, 1500);
+	io_loop_set_lag_stats(ioloop, event, 1);
+	i_zero(&test_budget_ios);
+	for (i = 0; i < N_ELEMENTS(test_budget_ios); i++) {
+		test_budget_ios[i].input = i_stream_create_from_data("data", 4);
+		test_budget_ios[i].io =
+			io_add_istream(test_budget_ios[i].input,
+				       test_ioloop_budget_callback,
+				       &test_budget_ios[i]);
+		io_set_pending(test_budget_ios[i].io);
+	}
+	io_loop_run(ioloop);
+
+	for (i = 0; i < N_ELEMENTS(test_budget_ios); i++) {
+		test_assert_idx(test_budget_ios[i].calls >= 10, i);
+		io_remove(&test_budget_ios[i].io);
+		i_stream_unref(&test_budget_ios[i].input);
+	}
+	io_loop_destroy(&ioloop);
+	event_unref(&event);
+	test_end();
+}
+
+#define TEST_BUDGET_FD_COUNT 5
+static unsigned int test_budget_fd_calls[TEST_BUDGET_FD_COUNT];
+
+static void test_ioloop_budget_fd_callback(unsigned int *calls)
+{
+	unsigned int i, min_calls = UINT_MAX, max_calls = 0;
+
+	while (!io_loop_is_over_budget(current_ioloop)) ;
+	(*calls)++;
+
+	/* the fds that weren't handled because the iteration ran out of
+	   budget are handled first in the next one */
+	for (i = 0; i < TEST_BUDGET_FD_COUNT; i++) {
+		min_calls = I_MIN(min_calls, test_budget_fd_calls[i]);
+		max_calls = I_MAX(max_calls, test_budget_fd_calls[i]);
+	}
+	test_assert(max_calls - min_calls <= 1);
+	if (min_calls == 5 || max_calls == 15)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_budget_fds(void)
+{
+	struct ioloop *ioloop;
+	struct io *ios[TEST_BUDGET_FD_COUNT];
+	int fds[TEST_BUDGET_FD_COUNT][2];
+	unsigned int i;
+
+	test_begin("ioloop budget fds");
+	ioloop = io_loop_create();
+	io_loop_set_budget(ioloop, 1000, 1500);
+	i_zero(&test_budget_fd_calls);
+	for (i = 0; i < TEST_BUDGET_FD_COUNT; i++) {
+		if (pipe(fds[i]) < 0)
+			i_fatal("pipe() failed: %m");
+		/* the data is never read, so the fds stay readable */
+		if (write(fds[i][1], "x", 1) != 1)
+			i_fatal("write() failed: %m");
+		ios[i] = io_add(fds[i][0], IO_READ,
+				test_ioloop_budget_fd_callback,
+				&test_budget_fd_calls[i]);
+	}
+	io_loop_run(ioloop);
+
+	for (i = 0; i < TEST_BUDGET_FD_COUNT; i++) {
+		test_assert_idx(test_budget_fd_calls[i] >= 5, i);
+		io_remove(&ios[i]);
+		i_close_fd(&fds[i][0]);
+		i_close_fd(&fds[i][1]);
+	}
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 static void test_ioloop_context_callback(struct ioloop_context *ctx)
 {
 	test_assert(io_loop_get_current_context(current_ioloop) == ctx);
@@ -394,10 +548,13 @@ static void test_ioloop_context_events(void)
 void test_ioloop(void)
 {
 	test_ioloop_timeout();
+	test_ioloop_coarse_timeout();
 	test_ioloop_zero_timeout();
 	test_ioloop_zero_timeout_recreate();
 	test_ioloop_find_fd_conditions();
 	test_ioloop_pending_io();
+	test_ioloop_budget();
+	test_ioloop_budget_fds();
 	test_ioloop_fd();
 	test_ioloop_context();
 	test_ioloop_context_events();
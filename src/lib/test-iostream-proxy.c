@@ -21,11 +21,12 @@ void completed(enum iostream_proxy_side side ATTR_UNUSED,
 }
 
 static
-void test_iostream_proxy_simple(void)
+void test_iostream_proxy_simple(bool splice)
 {
 	size_t bytes;
 
-	test_begin("iostream_proxy");
+	test_begin(t_strdup_printf("iostream_proxy (splice=%s)",
+				   splice ? "yes" : "no"));
 	int sfdl[2];
 	int sfdr[2];
 
@@ -47,6 +48,9 @@ void test_iostream_proxy_simple(void)
 	struct istream *right_in = i_stream_create_fd(sfdr[1], IO_BLOCK_SIZE);
 	struct ostream *right_out = o_stream_create_fd(sfdr[1], IO_BLOCK_SIZE);
 
+	o_stream_set_splice(left_out, splice);
+	o_stream_set_splice(right_out, splice);
+
 	struct iostream_proxy *proxy;
 
 	proxy = iostream_proxy_create(left_in, left_out, right_in, right_out);
@@ -108,6 +112,7 @@ void test_iostream_proxy_simple(void)
 void test_iostream_proxy(void)
 {
 	T_BEGIN {
-		test_iostream_proxy_simple();
+		test_iostream_proxy_simple(FALSE);
+		test_iostream_proxy_simple(TRUE);
 	} T_END;
 }
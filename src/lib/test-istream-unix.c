@@ -108,12 +108,29 @@ static void test_istream_unix_server(int fd)
 	test_server_read_fd(input, send_fd2, 10);
 	write_one(fd);
 
+	/* 11-12) two fds were sent in the same message, and we'll get them
+	   both with a single read */
+	i_stream_unix_set_read_fds(input, 2);
+	test_server_read_fd(input, send_fd, 11);
+	test_assert(i_stream_unix_get_read_fd(input) != -1);
+	test_assert(i_stream_unix_get_read_fd(input) == -1);
+	write_one(fd);
+
+	/* 13) two fds were sent in the same message, but we'll get only the
+	   first one */
+	i_stream_unix_set_read_fd(input);
+	test_server_read_fd(input, send_fd, 13);
+	test_assert(i_stream_unix_get_read_fd(input) == -1);
+	write_one(fd);
+
 	i_stream_destroy(&input);
 	i_close_fd(&fd);
 }
 
 static void test_istream_unix_client(int fd)
 {
+	int send_fds[2] = { send_fd, send_fd2 };
+
 	/* 1) */
 	write_one(fd);
 	read_one(fd);
@@ -155,6 +172,16 @@ static void test_istream_unix_client(int fd)
 		i_fatal("fd_send() failed: %m");
 	read_one(fd);
 
+	/* 11-12) */
+	if (fd_send_multi(fd, send_fds, 2, "1", 1) < 0)
+		i_fatal("fd_send_multi() failed: %m");
+	read_one(fd);
+
+	/* 13) */
+	if (fd_send_multi(fd, send_fds, 2, "1", 1) < 0)
+		i_fatal("fd_send_multi() failed: %m");
+	read_one(fd);
+
 	i_close_fd(&fd);
 }
 
@@ -7,6 +7,7 @@
 
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 struct test_context_delayed {
 	bool timed_out:1;
@@ -236,10 +237,50 @@ test_lib_signals_delayed_no_ioloop_automove(void)
 	test_end();
 }
 
+static void
+signal_handler_forked(const siginfo_t *si ATTR_UNUSED,
+		      void *context ATTR_UNUSED)
+{
+	_exit(0);
+}
+
+static void test_lib_signals_reset_forked(void)
+{
+	struct ioloop *ioloop;
+	pid_t pid;
+	int status;
+
+	test_begin("lib-signals reset forked");
+
+	ioloop = io_loop_create();
+	lib_signals_init();
+	lib_signals_set_handler(SIGUSR1, 0, signal_handler_forked, NULL);
+	lib_signals_set_handler(SIGALRM, LIBSIG_FLAGS_SAFE,
+				signal_handler_delayed, NULL);
+
+	if ((pid = fork()) < 0)
+		i_fatal("fork() failed: %m");
+	if (pid == 0) {
+		/* the child must get the default action instead of the
+		   handler it inherited */
+		lib_signals_reset_forked();
+		if (kill(getpid(), SIGUSR1) < 0)
+			i_fatal("kill() failed: %m");
+		_exit(1);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		i_fatal("waitpid() failed: %m");
+	test_assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGUSR1);
+
+	lib_signals_deinit();
+	io_loop_destroy(&ioloop);
+	test_end();
+}
 
 void test_lib_signals(void)
 {
 	test_lib_signals_delayed();
 	test_lib_signals_delayed_nested_ioloop();
 	test_lib_signals_delayed_no_ioloop_automove();
+	test_lib_signals_reset_forked();
 }
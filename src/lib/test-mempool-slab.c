@@ -0,0 +1,216 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+
+#define TEST_OBJECT_COUNT 2000
+
+static bool mem_has_bytes(const void *mem, size_t size, uint8_t b)
+{
+	const uint8_t *bytes = mem;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (bytes[i] != b)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void test_mempool_slab_random(enum pool_slab_flags flags)
+{
+	struct {
+		unsigned char *mem;
+		size_t size;
+	} objs[TEST_OBJECT_COUNT];
+	struct pool_slab_stats stats;
+	size_t new_size, large_size;
+	unsigned int i, j;
+	pool_t pool;
+
+	pool = pool_slab_create("test", flags);
+	i_zero(&objs);
+	for (i = 0; i < TEST_OBJECT_COUNT * 20; i++) {
+		j = i_rand_limit(TEST_OBJECT_COUNT);
+		if (objs[j].mem != NULL) {
+			test_assert_idx(mem_has_bytes(objs[j].mem, objs[j].size,
+						      j & 0xff), i);
+		}
+		switch (i_rand_limit(3)) {
+		case 0:
+			p_free(pool, objs[j].mem);
+			objs[j].size = 0;
+			break;
+		case 1:
+			/* mostly small allocations, some large ones */
+			new_size = i_rand_limit(10) == 0 ?
+				i_rand_minmax(1, POOL_SLAB_MAX_ALLOC_SIZE * 3) :
+				i_rand_minmax(1, 200);
+			objs[j].mem = p_realloc(pool, objs[j].mem,
+						objs[j].size, new_size);
+			test_assert_idx(mem_has_bytes(objs[j].mem,
+				I_MIN(objs[j].size, new_size), j & 0xff), i);
+			test_assert_idx(mem_has_bytes(objs[j].mem + objs[j].size,
+				new_size > objs[j].size ?
+				new_size - objs[j].size : 0, 0), i);
+			memset(objs[j].mem, j & 0xff, new_size);
+			objs[j].size = new_size;
+			break;
+		case 2:
+			p_free(pool, objs[j].mem);
+			objs[j].size = i_rand_minmax(1, 128);
+			objs[j].mem = p_malloc(pool, objs[j].size);
+			test_assert_idx(mem_has_bytes(objs[j].mem,
+						      objs[j].size, 0), i);
+			memset(objs[j].mem, j & 0xff, objs[j].size);
+			break;
+		}
+	}
+
+	pool_slab_get_stats(pool, &stats);
+	for (i = j = 0, large_size = 0; i < TEST_OBJECT_COUNT; i++) {
+		if (objs[i].mem == NULL)
+			continue;
+		j++;
+		if (objs[i].size > POOL_SLAB_MAX_ALLOC_SIZE)
+			large_size += objs[i].size;
+	}
+	test_assert(stats.object_count == j);
+	test_assert(stats.used_size == pool_slab_get_total_used_size(pool));
+	test_assert(stats.used_size + stats.free_size + stats.overhead_size ==
+		    stats.system_size);
+	test_assert(stats.system_size >=
+		    stats.slab_count * POOL_SLAB_SIZE + large_size);
+
+	/* free everything - only the spare slabs are left */
+	for (i = 0; i < TEST_OBJECT_COUNT; i++)
+		p_free(pool, objs[i].mem);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.object_count == 0);
+	test_assert(stats.used_size == 0);
+	test_assert(stats.large_count == 0);
+	test_assert(stats.slab_count <= 16);
+
+	p_clear(pool);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.slab_count == 0);
+	test_assert(stats.system_size == 0);
+	pool_unref(&pool);
+}
+
+static void test_mempool_slab_stats(void)
+{
+	struct pool_slab_stats stats;
+	void *objs[1000];
+	unsigned int i;
+	pool_t pool;
+
+	pool = pool_slab_create("test", 0);
+	for (i = 0; i < N_ELEMENTS(objs); i++)
+		objs[i] = p_malloc(pool, 100);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.object_count == N_ELEMENTS(objs));
+	test_assert(stats.used_size == N_ELEMENTS(objs) * 112);
+	test_assert(stats.slab_count ==
+		    (N_ELEMENTS(objs) + (POOL_SLAB_SIZE - 64) / 112 - 1) /
+		    ((POOL_SLAB_SIZE - 64) / 112));
+	test_assert(stats.used_size + stats.free_size + stats.overhead_size ==
+		    stats.system_size);
+	test_assert(pool_slab_get_total_alloc_size(pool) > stats.system_size);
+
+	/* freeing every other object doesn't release any slabs */
+	for (i = 0; i < N_ELEMENTS(objs); i += 2)
+		p_free(pool, objs[i]);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.object_count == N_ELEMENTS(objs) / 2);
+	test_assert(stats.used_size + stats.free_size + stats.overhead_size ==
+		    stats.system_size);
+	test_assert(stats.free_size >= stats.used_size);
+
+	/* the freed objects are reused */
+	for (i = 0; i < N_ELEMENTS(objs); i += 2)
+		objs[i] = p_malloc(pool, 97);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.object_count == N_ELEMENTS(objs));
+	test_assert(stats.used_size == N_ELEMENTS(objs) * 112);
+
+	/* freeing everything leaves only a single spare slab */
+	for (i = 0; i < N_ELEMENTS(objs); i++)
+		p_free(pool, objs[i]);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.slab_count == 1);
+	test_assert(stats.used_size == 0);
+	test_assert(stats.free_size + stats.overhead_size == stats.system_size);
+
+	objs[0] = p_malloc(pool, POOL_SLAB_MAX_ALLOC_SIZE + 1);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.large_count == 1);
+	test_assert(stats.used_size == POOL_SLAB_MAX_ALLOC_SIZE + 1);
+	pool_unref(&pool);
+}
+
+static void test_mempool_slab_clean(void)
+{
+	unsigned char *mem;
+	pool_t pool;
+
+	pool = pool_slab_create("test", POOL_SLAB_FLAG_CLEAN);
+	mem = p_malloc(pool, 100);
+	memset(mem, 0xaa, 100);
+	/* keep the slab alive so the freed memory can be checked */
+	(void)p_malloc(pool, 100);
+	p_free_internal(pool, mem);
+	/* the first word is used by the free list */
+	test_assert(mem_has_bytes(mem + sizeof(void *),
+				  100 - sizeof(void *), 0));
+	pool_unref(&pool);
+}
+
+void test_mempool_slab(void)
+{
+	test_begin("mempool_slab");
+	test_mempool_slab_random(0);
+	test_mempool_slab_random(POOL_SLAB_FLAG_CLEAN);
+	test_end();
+
+	test_begin("mempool_slab stats");
+	test_mempool_slab_stats();
+	test_end();
+
+	test_begin("mempool_slab clean");
+	test_mempool_slab_clean();
+	test_end();
+}
+
+enum fatal_test_state fatal_mempool_slab(unsigned int stage)
+{
+	static pool_t pool;
+
+	if (pool == NULL && stage != 0)
+		return FATAL_TEST_FAILURE;
+
+	switch(stage) {
+	case 0: /* forbidden size */
+		test_begin("fatal_mempool_slab");
+		pool = pool_slab_create("fatal", 0);
+		test_expect_fatal_string("Trying to allocate 0 bytes");
+		(void)p_malloc(pool, 0);
+		return FATAL_TEST_FAILURE;
+
+	case 1: /* logically impossible size */
+		test_expect_fatal_string("Trying to allocate");
+		(void)p_malloc(pool, POOL_MAX_ALLOC_SIZE + 1ULL);
+		return FATAL_TEST_FAILURE;
+
+#if SIZEOF_SIZE_T > 4 /* malloc(POOL_MAX_ALLOC_SIZE) may succeed with 32bit */
+	case 2: /* physically impossible size */
+		test_expect_fatal_string("Out of memory");
+		(void)p_malloc(pool, POOL_MAX_ALLOC_SIZE);
+		return FATAL_TEST_FAILURE;
+#endif
+	}
+
+	/* Either our tests have finished, or the test suite has got confused. */
+	pool_unref(&pool);
+	test_end();
+	return FATAL_TEST_FINISHED;
+}
@@ -181,9 +181,60 @@ static void test_ostream_file_send_istream_sendfile(void)
 	test_end();
 }
 
+static void test_ostream_file_send_istream_splice(void)
+{
+	struct istream *input;
+	struct ostream *output;
+	char buf[32];
+	int in_fd[2], out_fd[2];
+
+	test_begin("ostream file send istream splice()");
+
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, in_fd) == 0);
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, out_fd) == 0);
+	fd_set_nonblock(in_fd[1], TRUE);
+	fd_set_nonblock(out_fd[0], TRUE);
+
+	input = i_stream_create_fd(in_fd[1], 1024);
+	output = o_stream_create_fd(out_fd[0], 0);
+	o_stream_set_splice(output, TRUE);
+
+	/* data that is already buffered in the istream is copied */
+	test_assert(write(in_fd[0], "abc", 3) == 3);
+	test_assert(i_stream_read(input) == 3);
+	test_assert(o_stream_send_istream(output, input) == OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT);
+	test_assert(output->offset == 3 && input->v_offset == 3);
+
+	/* the rest is moved directly between the sockets */
+	test_assert(write(in_fd[0], "defghij", 7) == 7);
+	test_assert(o_stream_send_istream(output, input) == OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT);
+	test_assert(output->offset == 10 && input->v_offset == 10);
+	test_assert(o_stream_get_buffer_used_size(output) == 0);
+	test_assert(read(out_fd[1], buf, sizeof(buf)) == 10 &&
+		    memcmp(buf, "abcdefghij", 10) == 0);
+
+	/* EOF */
+	test_assert(write(in_fd[0], "klm", 3) == 3);
+	test_assert(shutdown(in_fd[0], SHUT_WR) == 0);
+	test_assert(o_stream_send_istream(output, input) == OSTREAM_SEND_ISTREAM_RESULT_FINISHED);
+	test_assert(output->offset == 13 && input->v_offset == 13);
+	test_assert(input->eof);
+	test_assert(read(out_fd[1], buf, sizeof(buf)) == 3 &&
+		    memcmp(buf, "klm", 3) == 0);
+
+	i_stream_unref(&input);
+	o_stream_destroy(&output);
+	i_close_fd(&in_fd[0]);
+	i_close_fd(&in_fd[1]);
+	i_close_fd(&out_fd[0]);
+	i_close_fd(&out_fd[1]);
+	test_end();
+}
+
 void test_ostream_file(void)
 {
 	test_ostream_file_random();
 	test_ostream_file_send_istream_file();
 	test_ostream_file_send_istream_sendfile();
+	test_ostream_file_send_istream_splice();
 }
@@ -718,6 +718,29 @@ static void test_memcspn(void)
 		test_assert_ucmp_idx(a, ==, b, i);
 	}
 
+	/* random input with a small alphabet, so that matches are found at
+	   all positions of the vectorized blocks */
+	unsigned char input[100], reject[6];
+	for (unsigned int i = 0; i < 10000; i++) {
+		size_t input_len = i_rand_limit(sizeof(input) + 1);
+		size_t reject_len = i_rand_minmax(1, sizeof(reject));
+		size_t offset = i_rand_limit(16), expected;
+
+		if (offset > input_len)
+			offset = input_len;
+		for (size_t j = 0; j < input_len; j++)
+			input[j] = i_rand_limit(64) + '\r';
+		for (size_t j = 0; j < reject_len; j++)
+			reject[j] = i_rand_limit(64) + '\r';
+		for (expected = offset; expected < input_len; expected++) {
+			if (memchr(reject, input[expected], reject_len) != NULL)
+				break;
+		}
+		size_t a = i_memcspn(input + offset, input_len - offset,
+				     reject, reject_len);
+		test_assert_ucmp_idx(a, ==, expected - offset, i);
+	}
+
 	test_end();
 }
 
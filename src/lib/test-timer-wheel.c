@@ -0,0 +1,144 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "timer-wheel.h"
+
+struct tw_test_item {
+	struct timer_wheel_item item;
+	bool expired;
+	bool removed;
+};
+
+static void test_timer_wheel_basic(void)
+{
+	struct tw_test_item items[4];
+	struct timer_wheel *wheel;
+	struct timer_wheel_item *item;
+
+	test_begin("timer wheel basic");
+	wheel = timer_wheel_init(1000);
+	for (unsigned int i = 0; i < N_ELEMENTS(items); i++)
+		timer_wheel_item_init(&items[i].item);
+
+	timer_wheel_add(wheel, &items[0].item, 1005);
+	timer_wheel_add(wheel, &items[1].item, 1005 + 256);
+	timer_wheel_add(wheel, &items[2].item, 1000 + 70000);
+	/* expiration in the past is returned immediately */
+	timer_wheel_add(wheel, &items[3].item, 10);
+	test_assert(timer_wheel_count(wheel) == 4);
+	test_assert(timer_wheel_get_next_tick(wheel) == 1000);
+
+	test_assert(timer_wheel_pop(wheel, 1000) == &items[3].item);
+	test_assert(!timer_wheel_item_is_added(&items[3].item));
+	test_assert(timer_wheel_pop(wheel, 1004) == NULL);
+	test_assert(timer_wheel_get_now(wheel) == 1004);
+	test_assert(timer_wheel_get_next_tick(wheel) == 1005);
+	test_assert(timer_wheel_pop(wheel, 2000) == &items[0].item);
+	test_assert(timer_wheel_get_now(wheel) == 1005);
+	test_assert(timer_wheel_pop(wheel, 2000) == &items[1].item);
+	test_assert(timer_wheel_get_now(wheel) == 1005 + 256);
+	test_assert(timer_wheel_pop(wheel, 2000) == NULL);
+
+	/* removing */
+	timer_wheel_remove(wheel, &items[0].item);
+	timer_wheel_add(wheel, &items[0].item, 2100);
+	timer_wheel_remove(wheel, &items[0].item);
+	test_assert(timer_wheel_count(wheel) == 1);
+
+	/* item added while popping with the current tick */
+	item = timer_wheel_pop(wheel, 1000 + 70000);
+	test_assert(item == &items[2].item);
+	test_assert(item->expire == 1000 + 70000);
+	timer_wheel_add(wheel, item, 0);
+	test_assert(timer_wheel_pop(wheel, 1000 + 70000) == item);
+	test_assert(timer_wheel_pop(wheel, 1000 + 70000) == NULL);
+	test_assert(timer_wheel_count(wheel) == 0);
+	test_assert(timer_wheel_get_next_tick(wheel) == UINT64_MAX);
+
+	/* jumping forward with an empty wheel */
+	test_assert(timer_wheel_pop(wheel, 1ULL << 40) == NULL);
+	test_assert(timer_wheel_get_now(wheel) == 1ULL << 40);
+	timer_wheel_deinit(&wheel);
+	test_end();
+}
+
+static void test_timer_wheel_random(void)
+{
+#define TW_TEST_ITEM_COUNT 2000
+	struct tw_test_item *items;
+	struct timer_wheel *wheel;
+	struct timer_wheel_item *item;
+	uint64_t start = 123456789, now, next_tick, min_expire;
+	unsigned int i, count = TW_TEST_ITEM_COUNT;
+
+	test_begin("timer wheel random");
+	items = i_new(struct tw_test_item, TW_TEST_ITEM_COUNT);
+	wheel = timer_wheel_init(start);
+	for (i = 0; i < TW_TEST_ITEM_COUNT; i++) {
+		uint64_t delta;
+
+		switch (i % 4) {
+		case 0:
+			delta = i_rand_limit(256);
+			break;
+		case 1:
+			delta = i_rand_limit(65536);
+			break;
+		case 2:
+			delta = i_rand_limit(1 << 24);
+			break;
+		default:
+			delta = i_rand_limit(1 << 30);
+			break;
+		}
+		timer_wheel_item_init(&items[i].item);
+		timer_wheel_add(wheel, &items[i].item, start + delta);
+	}
+	/* remove some of them */
+	for (i = 0; i < TW_TEST_ITEM_COUNT; i += 7) {
+		timer_wheel_remove(wheel, &items[i].item);
+		items[i].removed = TRUE;
+		count--;
+	}
+	test_assert(timer_wheel_count(wheel) == count);
+
+	/* advance the wheel in random steps */
+	now = start;
+	while (timer_wheel_count(wheel) > 0) {
+		min_expire = UINT64_MAX;
+		for (i = 0; i < TW_TEST_ITEM_COUNT; i++) {
+			if (!items[i].expired && !items[i].removed &&
+			    items[i].item.expire < min_expire)
+				min_expire = items[i].item.expire;
+		}
+		next_tick = timer_wheel_get_next_tick(wheel);
+		test_assert(next_tick <= min_expire);
+
+		now += i_rand_limit(1 << (i_rand_limit(4) * 8));
+		while ((item = timer_wheel_pop(wheel, now)) != NULL) {
+			struct tw_test_item *titem =
+				(struct tw_test_item *)item;
+
+			test_assert(!titem->expired && !titem->removed);
+			test_assert(item->expire <= now);
+			test_assert(item->expire == timer_wheel_get_now(wheel));
+			titem->expired = TRUE;
+		}
+		/* all the items expiring before now must have been popped */
+		for (i = 0; i < TW_TEST_ITEM_COUNT; i++) {
+			if (!items[i].expired && !items[i].removed)
+				test_assert_idx(items[i].item.expire > now, i);
+		}
+	}
+	for (i = 0; i < TW_TEST_ITEM_COUNT; i++)
+		test_assert_idx(items[i].expired != items[i].removed, i);
+	timer_wheel_deinit(&wheel);
+	i_free(items);
+	test_end();
+}
+
+void test_timer_wheel(void)
+{
+	test_timer_wheel_basic();
+	test_timer_wheel_random();
+}
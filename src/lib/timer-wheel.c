@@ -0,0 +1,197 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "llist.h"
+#include "timer-wheel.h"
+
+/* Each level has 256 slots. Level 0 slots are one tick each, level 1 slots
+   are 256 ticks each, etc. When the level 0 wheel has gone through all of
+   its slots, the next level 1 slot is cascaded into the lower levels. */
+#define TIMER_WHEEL_LEVEL_BITS 8
+#define TIMER_WHEEL_LEVEL_SIZE (1U << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVEL_MASK (TIMER_WHEEL_LEVEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_MAX_DELTA \
+	((1ULL << (TIMER_WHEEL_LEVEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+struct timer_wheel {
+	uint64_t now;
+	unsigned int count;
+	unsigned int level_counts[TIMER_WHEEL_LEVELS];
+
+	struct timer_wheel_item *slots[TIMER_WHEEL_LEVELS *
+				       TIMER_WHEEL_LEVEL_SIZE];
+};
+
+struct timer_wheel *timer_wheel_init(uint64_t now)
+{
+	struct timer_wheel *wheel;
+
+	wheel = i_new(struct timer_wheel, 1);
+	wheel->now = now;
+	return wheel;
+}
+
+void timer_wheel_deinit(struct timer_wheel **_wheel)
+{
+	struct timer_wheel *wheel = *_wheel;
+
+	*_wheel = NULL;
+	i_free(wheel);
+}
+
+unsigned int timer_wheel_count(const struct timer_wheel *wheel)
+{
+	return wheel->count;
+}
+
+uint64_t timer_wheel_get_now(const struct timer_wheel *wheel)
+{
+	return wheel->now;
+}
+
+void timer_wheel_item_init(struct timer_wheel_item *item)
+{
+	item->prev = item->next = NULL;
+	item->slot = UINT_MAX;
+}
+
+static void
+timer_wheel_link(struct timer_wheel *wheel, struct timer_wheel_item *item)
+{
+	uint64_t delta = item->expire - wheel->now;
+	unsigned int level, idx;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		if (delta < (1ULL << (TIMER_WHEEL_LEVEL_BITS * (level + 1))))
+			break;
+	}
+	idx = (item->expire >> (TIMER_WHEEL_LEVEL_BITS * level)) &
+		TIMER_WHEEL_LEVEL_MASK;
+	item->slot = level * TIMER_WHEEL_LEVEL_SIZE + idx;
+	DLLIST_PREPEND(&wheel->slots[item->slot], item);
+	wheel->level_counts[level]++;
+}
+
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_wheel_item *item,
+		     uint64_t expire)
+{
+	i_assert(!timer_wheel_item_is_added(item));
+
+	if (expire < wheel->now)
+		expire = wheel->now;
+	else if (expire - wheel->now > TIMER_WHEEL_MAX_DELTA)
+		expire = wheel->now + TIMER_WHEEL_MAX_DELTA;
+	item->expire = expire;
+	timer_wheel_link(wheel, item);
+	wheel->count++;
+}
+
+void timer_wheel_remove(struct timer_wheel *wheel,
+			struct timer_wheel_item *item)
+{
+	if (!timer_wheel_item_is_added(item))
+		return;
+
+	DLLIST_REMOVE(&wheel->slots[item->slot], item);
+	i_assert(wheel->level_counts[item->slot / TIMER_WHEEL_LEVEL_SIZE] > 0);
+	wheel->level_counts[item->slot / TIMER_WHEEL_LEVEL_SIZE]--;
+	i_assert(wheel->count > 0);
+	wheel->count--;
+	item->slot = UINT_MAX;
+}
+
+static void timer_wheel_cascade(struct timer_wheel *wheel)
+{
+	struct timer_wheel_item *item, *next;
+	unsigned int level, idx, slot;
+
+	i_assert((wheel->now & TIMER_WHEEL_LEVEL_MASK) == 0);
+
+	for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		idx = (wheel->now >> (TIMER_WHEEL_LEVEL_BITS * level)) &
+			TIMER_WHEEL_LEVEL_MASK;
+		slot = level * TIMER_WHEEL_LEVEL_SIZE + idx;
+
+		/* move the items to the lower levels */
+		item = wheel->slots[slot];
+		wheel->slots[slot] = NULL;
+		for (; item != NULL; item = next) {
+			next = item->next;
+			i_assert(wheel->level_counts[level] > 0);
+			wheel->level_counts[level]--;
+			item->prev = item->next = NULL;
+			timer_wheel_link(wheel, item);
+		}
+		if (idx != 0)
+			break;
+	}
+}
+
+static unsigned int timer_wheel_lowest_level(const struct timer_wheel *wheel)
+{
+	unsigned int level;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		if (wheel->level_counts[level] > 0)
+			return level;
+	}
+	i_unreached();
+}
+
+struct timer_wheel_item *
+timer_wheel_pop(struct timer_wheel *wheel, uint64_t now)
+{
+	struct timer_wheel_item *item;
+	unsigned int level;
+	uint64_t next;
+
+	for (;;) {
+		item = wheel->slots[wheel->now & TIMER_WHEEL_LEVEL_MASK];
+		if (item != NULL) {
+			i_assert(item->expire <= wheel->now);
+			timer_wheel_remove(wheel, item);
+			return item;
+		}
+		if (wheel->now >= now)
+			return NULL;
+		if (wheel->count == 0) {
+			wheel->now = now;
+			return NULL;
+		}
+
+		/* Skip directly over the levels that have no items */
+		level = timer_wheel_lowest_level(wheel);
+		next = ((wheel->now >> (TIMER_WHEEL_LEVEL_BITS * level)) + 1) <<
+			(TIMER_WHEEL_LEVEL_BITS * level);
+		if (next > now) {
+			wheel->now = now;
+			return NULL;
+		}
+		wheel->now = next;
+		if ((wheel->now & TIMER_WHEEL_LEVEL_MASK) == 0)
+			timer_wheel_cascade(wheel);
+	}
+}
+
+uint64_t timer_wheel_get_next_tick(const struct timer_wheel *wheel)
+{
+	uint64_t tick, next_cascade;
+
+	if (wheel->count == 0)
+		return UINT64_MAX;
+
+	next_cascade = (wheel->now | TIMER_WHEEL_LEVEL_MASK) + 1;
+	if (wheel->level_counts[0] == 0) {
+		/* Wait until the next cascade. This could be optimized for
+		   higher levels, but it's just one wakeup per 256 ticks. */
+		return next_cascade;
+	}
+	/* Level 0 items all expire within the next 256 ticks. The items
+	   cascaded from higher levels can't expire before next_cascade. */
+	for (tick = wheel->now; tick < next_cascade; tick++) {
+		if (wheel->slots[tick & TIMER_WHEEL_LEVEL_MASK] != NULL)
+			return tick;
+	}
+	return next_cascade;
+}
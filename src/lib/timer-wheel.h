@@ -0,0 +1,60 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+/* Hierarchical timer wheel. Adding, removing and expiring items are O(1)
+   operations (expiring is amortized over the cascading of higher levels).
+   The time unit is a "tick", which is up to the caller to decide. The wheel
+   doesn't allocate anything per item: embed a struct timer_wheel_item
+   anywhere in your own struct and use container_of() to get back to it from
+   the item returned by timer_wheel_pop(). The item must stay at the same
+   address while it's in the wheel. */
+
+struct timer_wheel_item {
+	/* Internal linked list of the wheel slot */
+	struct timer_wheel_item *prev, *next;
+	/* Tick when the item expires */
+	uint64_t expire;
+	/* Internal slot index, UINT_MAX if the item isn't in the wheel. */
+	unsigned int slot;
+};
+
+/* Create a new timer wheel, which starts at the given tick. */
+struct timer_wheel *timer_wheel_init(uint64_t now);
+void timer_wheel_deinit(struct timer_wheel **wheel);
+
+/* Return number of items in the wheel. */
+unsigned int timer_wheel_count(const struct timer_wheel *wheel) ATTR_PURE;
+/* Returns the tick up to which the wheel has been processed. */
+uint64_t timer_wheel_get_now(const struct timer_wheel *wheel) ATTR_PURE;
+
+/* Initialize the item so it can be safely given to timer_wheel_remove()
+   even if it was never added. */
+void timer_wheel_item_init(struct timer_wheel_item *item);
+/* Returns TRUE if the item is in the wheel. */
+static inline bool timer_wheel_item_is_added(const struct timer_wheel_item *item)
+{
+	return item->slot != UINT_MAX;
+}
+
+/* Add the item to expire at the given tick. If the tick is already in the
+   past, the item expires at the next timer_wheel_pop() call. Ticks too far
+   in the future (2^32 ticks) are truncated. */
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_wheel_item *item,
+		     uint64_t expire);
+/* Remove the item from the wheel. Does nothing if the item isn't added. */
+void timer_wheel_remove(struct timer_wheel *wheel,
+			struct timer_wheel_item *item);
+
+/* Advance the wheel up to the given tick and return the next expired item,
+   or NULL if there are no more items expiring at or before the tick. The
+   returned item is removed from the wheel. Items added with the current
+   tick while popping are returned by the same pop loop. */
+struct timer_wheel_item *
+timer_wheel_pop(struct timer_wheel *wheel, uint64_t now);
+/* Returns the tick when timer_wheel_pop() should be called next. This may be
+   earlier than the actual next expiration, because the items in the higher
+   levels get moved to lower levels only while advancing the wheel. Returns
+   UINT64_MAX if the wheel is empty. */
+uint64_t timer_wheel_get_next_tick(const struct timer_wheel *wheel);
+
+#endif
@@ -70,9 +70,28 @@ m_str_reverse(const char *str, struct var_expand_context *ctx ATTR_UNUSED)
 	return rev;
 }
 
+/* The original str_hash(). It's used for %H, which is commonly used to
+   build directory paths, so its output must never change. */
+static unsigned int ATTR_NO_SANITIZE_INTEGER
+var_expand_str_hash(const char *p)
+{
+	const unsigned char *s = (const unsigned char *)p;
+	unsigned int g, h = 0;
+
+	while (*s != '\0') {
+		h = (h << 4) + *s;
+		if ((g = h & 0xf0000000UL) != 0) {
+			h = h ^ (g >> 24);
+			h = h ^ g;
+		}
+		s++;
+	}
+	return h;
+}
+
 static const char *m_str_hash(const char *str, struct var_expand_context *ctx)
 {
-	unsigned int value = str_hash(str);
+	unsigned int value = var_expand_str_hash(str);
 	string_t *hash = t_str_new(20);
 
 	if (ctx->width != 0) {
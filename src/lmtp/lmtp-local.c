@@ -16,6 +16,7 @@
 #include "mail-namespace.h"
 #include "mail-deliver.h"
 #include "mail-autoexpunge.h"
+#include "mail-transaction-log.h"
 #include "index/raw/raw-storage.h"
 #include "smtp-common.h"
 #include "smtp-params.h"
@@ -46,6 +47,11 @@ struct lmtp_local {
 	struct mail *raw_mail, *first_saved_mail;
 	struct mail_user *rcpt_user;
 
+	struct mail_transaction_log_fsync_batch *fsync_batch;
+	/* Recipients whose delivery succeeded, but that aren't replied to
+	   until fsync_batch has been synced */
+	ARRAY(struct lmtp_local_recipient *) fsync_batch_rcpts;
+
 	struct smtp_server_stats stats;
 };
 
@@ -75,6 +81,8 @@ void lmtp_local_deinit(struct lmtp_local **_local)
 
 	if (array_is_created(&local->rcpt_to))
 		array_free(&local->rcpt_to);
+	if (array_is_created(&local->fsync_batch_rcpts))
+		array_free(&local->fsync_batch_rcpts);
 
 	if (local->raw_mail != NULL) {
 		struct mailbox_transaction_context *raw_trans =
@@ -512,8 +520,13 @@ lmtp_local_default_do_deliver(struct lmtp_local *local,
 			i_assert(local->first_saved_mail == NULL);
 			local->first_saved_mail = dctx->dest_mail;
 		}
-		smtp_server_recipient_reply(rcpt, 250, "2.0.0", "%s Saved",
-					    lldctx->session_id);
+		if (local->fsync_batch != NULL)
+			array_push_back(&local->fsync_batch_rcpts, &llrcpt);
+		else {
+			smtp_server_recipient_reply(rcpt, 250, "2.0.0",
+						    "%s Saved",
+						    lldctx->session_id);
+		}
 		return 0;
 	}
 
@@ -674,6 +687,50 @@ lmtp_local_deliver_to_rcpts(struct lmtp_local *local,
 	return first_uid;
 }
 
+static void lmtp_local_fsync_batch_begin(struct lmtp_local *local)
+{
+	const char *mode = local->client->lmtp_set->lmtp_fsync_batch;
+	enum mail_transaction_log_fsync_batch_flags flags = 0;
+
+	if (strcmp(mode, "no") == 0)
+		return;
+	if (strcmp(mode, "syncfs") == 0)
+		flags |= MAIL_TRANSACTION_LOG_FSYNC_BATCH_FLAG_SYNCFS;
+	local->fsync_batch = mail_transaction_log_fsync_batch_begin(flags);
+	if (!array_is_created(&local->fsync_batch_rcpts))
+		i_array_init(&local->fsync_batch_rcpts, 8);
+}
+
+static void lmtp_local_fsync_batch_end(struct lmtp_local *local)
+{
+	struct lmtp_local_recipient *llrcpt;
+	const char *error;
+	int ret;
+
+	if (local->fsync_batch == NULL)
+		return;
+
+	ret = mail_transaction_log_fsync_batch_end(&local->fsync_batch,
+						   &error);
+	if (ret < 0) {
+		e_error(local->client->event,
+			"Failed to sync delivered mails: %s", error);
+	}
+	array_foreach_elem(&local->fsync_batch_rcpts, llrcpt) {
+		struct smtp_server_recipient *rcpt = llrcpt->rcpt->rcpt;
+
+		if (ret < 0) {
+			smtp_server_recipient_reply(rcpt, 451, "4.3.0",
+						    "Temporary internal error");
+		} else {
+			smtp_server_recipient_reply(rcpt, 250, "2.0.0",
+						    "%s Saved",
+						    llrcpt->rcpt->session_id);
+		}
+	}
+	array_clear(&local->fsync_batch_rcpts);
+}
+
 static int
 lmtp_local_open_raw_mail(struct lmtp_local *local,
 			 struct smtp_server_transaction *trans,
@@ -723,7 +780,9 @@ void lmtp_local_data(struct client *client,
 
 	session = mail_deliver_session_init();
 	old_uid = geteuid();
+	lmtp_local_fsync_batch_begin(local);
 	first_uid = lmtp_local_deliver_to_rcpts(local, cmd, trans, session);
+	lmtp_local_fsync_batch_end(local);
 	mail_deliver_session_deinit(&session);
 
 	if (local->first_saved_mail != NULL) {
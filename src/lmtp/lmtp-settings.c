@@ -71,6 +71,7 @@ static const struct setting_define lmtp_setting_defines[] = {
 	DEF(BOOL, lmtp_verbose_replies),
 	DEF(UINT, lmtp_user_concurrency_limit),
 	DEF(ENUM, lmtp_hdr_delivery_address),
+	DEF(ENUM, lmtp_fsync_batch),
 	DEF(STR_VARS, lmtp_rawlog_dir),
 	DEF(STR_VARS, lmtp_proxy_rawlog_dir),
 
@@ -93,6 +94,7 @@ static const struct lmtp_settings lmtp_default_settings = {
 	.lmtp_verbose_replies = FALSE,
 	.lmtp_user_concurrency_limit = 0,
 	.lmtp_hdr_delivery_address = "final:none:original",
+	.lmtp_fsync_batch = "no:yes:syncfs",
 	.lmtp_rawlog_dir = "",
 	.lmtp_proxy_rawlog_dir = "",
 
@@ -26,6 +26,7 @@ struct lmtp_settings {
 	bool lmtp_verbose_replies;
 	unsigned int lmtp_user_concurrency_limit;
 	const char *lmtp_hdr_delivery_address;
+	const char *lmtp_fsync_batch;
 	const char *lmtp_rawlog_dir;
 	const char *lmtp_proxy_rawlog_dir;
 
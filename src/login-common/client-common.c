@@ -294,8 +294,8 @@ void client_init(struct client *client, void **other_sets)
 	clients_count++;
 
 	client->to_disconnect =
-		timeout_add(CLIENT_LOGIN_TIMEOUT_MSECS,
-			    client_idle_disconnect_timeout, client);
+		timeout_add_coarse(CLIENT_LOGIN_TIMEOUT_MSECS,
+				   client_idle_disconnect_timeout, client);
 
 	hook_login_client_allocated(client);
 	client->v.create(client, other_sets);
@@ -984,6 +984,12 @@ void login_proxy_detach(struct login_proxy *proxy)
 	proxy->client_output = client->output;
 
 	o_stream_set_max_buffer_size(client->output, PROXY_MAX_OUTBUF_SIZE);
+	if (client->set->login_proxy_splice) {
+		/* Move data between plaintext sockets with splice(). This is
+		   silently skipped for SSL and rawlog streams. */
+		o_stream_set_splice(proxy->client_output, TRUE);
+		o_stream_set_splice(proxy->server_output, TRUE);
+	}
 	client->input = NULL;
 	client->output = NULL;
 
@@ -997,8 +1003,8 @@ void login_proxy_detach(struct login_proxy *proxy)
 
 	if (proxy->notify_refresh_secs != 0) {
 		proxy->to_notify =
-			timeout_add(proxy->notify_refresh_secs * 1000,
-				    login_proxy_notify, proxy);
+			timeout_add_coarse(proxy->notify_refresh_secs * 1000,
+					   login_proxy_notify, proxy);
 	}
 
 	proxy->input_callback = NULL;
@@ -33,6 +33,8 @@ static const struct setting_define login_setting_defines[] = {
 	DEF(STR, login_proxy_rawlog_dir),
 	DEF(STR, login_socket_path),
 
+	DEF(BOOL, login_proxy_splice),
+
 	DEF(BOOL, auth_ssl_require_client_cert),
 	DEF(BOOL, auth_ssl_username_from_cert),
 
@@ -63,6 +65,8 @@ static const struct login_settings login_default_settings = {
 	.login_proxy_rawlog_dir = "",
 	.login_socket_path = "",
 
+	.login_proxy_splice = FALSE,
+
 	.auth_ssl_require_client_cert = FALSE,
 	.auth_ssl_username_from_cert = FALSE,
 
@@ -20,6 +20,7 @@
 #include "askpass.h"
 #include "capabilities.h"
 #include "master-client.h"
+#include "master-ssl-shared.h"
 #include "service.h"
 #include "service-anvil.h"
 #include "service-listen.h"
@@ -461,6 +462,7 @@ sig_settings_reload(const siginfo_t *si ATTR_UNUSED,
 			service_process_destroy(service->idle_processes_head);
 	}
 	services_destroy(services, FALSE);
+	master_ssl_shared_settings_changed(set);
 
 	services = new_services;
         services_monitor_start(services);
@@ -590,6 +592,7 @@ static void main_init(const struct master_settings *set)
 	create_config_symlink(set);
 	instance_update(set);
 	master_clients_init();
+	master_ssl_shared_init(set);
 
 	services_monitor_start(services);
 	i_sd_notifyf(0, "READY=1\nSTATUS=v" DOVECOT_VERSION_FULL " running\n"
@@ -617,6 +620,7 @@ static void main_deinit(void)
 	/* kill services and wait for them to die before unlinking pid file */
 	global_dead_pipe_close();
 	services_destroy(services, TRUE);
+	master_ssl_shared_deinit();
 
 	i_unlink(pidfile_path);
 	i_free(pidfile_path);
@@ -698,7 +702,9 @@ static void print_help(void)
 static void print_build_options(void)
 {
 	printf("Build options:"
-#ifdef IOLOOP_EPOLL
+#ifdef IOLOOP_URING
+		" ioloop=uring"
+#elif defined(IOLOOP_EPOLL)
 		" ioloop=epoll"
 #endif
 #ifdef IOLOOP_KQUEUE
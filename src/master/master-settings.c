@@ -184,6 +184,8 @@ static const struct setting_define master_setting_defines[] = {
 	DEF(STR, protocols),
 	DEF(STR, listen),
 	DEF(ENUM, ssl),
+	DEF(TIME, ssl_session_ticket_key_rotation),
+	DEF(UINT, ssl_session_cache_size),
 	DEF(STR, default_internal_user),
 	DEF(STR, default_internal_group),
 	DEF(STR, default_login_user),
@@ -212,6 +214,8 @@ static const struct master_settings master_default_settings = {
 	.protocols = "imap pop3 lmtp",
 	.listen = "*, ::",
 	.ssl = "yes:no:required",
+	.ssl_session_ticket_key_rotation = 60*60,
+	.ssl_session_cache_size = 0,
 	.default_internal_user = "dovecot",
 	.default_internal_group = "dovecot",
 	.default_login_user = "dovenull",
@@ -11,6 +11,8 @@ struct master_settings {
 	const char *protocols;
 	const char *listen;
 	const char *ssl;
+	unsigned int ssl_session_ticket_key_rotation;
+	unsigned int ssl_session_cache_size;
 	const char *default_internal_user;
 	const char *default_internal_group;
 	const char *default_login_user;
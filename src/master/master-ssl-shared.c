@@ -0,0 +1,72 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "common.h"
+#include "ioloop.h"
+#include "fd-util.h"
+#include "iostream-ssl-shared.h"
+#include "master-ssl-shared.h"
+
+struct ssl_iostream_shared *master_ssl_shared = NULL;
+
+static struct timeout *to_ticket_key_rotation = NULL;
+static unsigned int ticket_key_rotation_secs;
+
+static void master_ssl_shared_rotate(void *context ATTR_UNUSED)
+{
+	ssl_iostream_shared_rotate_ticket_keys(master_ssl_shared);
+}
+
+static void master_ssl_shared_set_rotation(unsigned int secs)
+{
+	if (to_ticket_key_rotation != NULL &&
+	    ticket_key_rotation_secs == secs)
+		return;
+
+	timeout_remove(&to_ticket_key_rotation);
+	ticket_key_rotation_secs = secs;
+	if (secs > 0) {
+		to_ticket_key_rotation =
+			timeout_add(secs * 1000, master_ssl_shared_rotate, NULL);
+	}
+}
+
+void master_ssl_shared_init(const struct master_settings *set)
+{
+	const char *error;
+	int keys_fd, sessions_fd;
+
+	if (strcmp(set->ssl, "no") == 0)
+		return;
+
+	if (ssl_iostream_shared_create(
+			t_strconcat(set->base_dir, "/ssl-shared.", NULL),
+			set->ssl_session_cache_size,
+			&master_ssl_shared, &error) < 0) {
+		/* TLS still works, but sessions can be resumed only by
+		   the process that created them */
+		i_error("Failed to create shared TLS session state: %s", error);
+		return;
+	}
+	ssl_iostream_shared_get_fds(master_ssl_shared, &keys_fd, &sessions_fd);
+	fd_close_on_exec(keys_fd, TRUE);
+	if (sessions_fd != -1)
+		fd_close_on_exec(sessions_fd, TRUE);
+	master_ssl_shared_set_rotation(set->ssl_session_ticket_key_rotation);
+}
+
+void master_ssl_shared_settings_changed(const struct master_settings *set)
+{
+	if (master_ssl_shared == NULL) {
+		master_ssl_shared_init(set);
+		return;
+	}
+	/* the existing session cache is kept - changing its size requires
+	   a restart */
+	master_ssl_shared_set_rotation(set->ssl_session_ticket_key_rotation);
+}
+
+void master_ssl_shared_deinit(void)
+{
+	timeout_remove(&to_ticket_key_rotation);
+	ssl_iostream_shared_free(&master_ssl_shared);
+}
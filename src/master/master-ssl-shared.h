@@ -0,0 +1,13 @@
+#ifndef MASTER_SSL_SHARED_H
+#define MASTER_SSL_SHARED_H
+
+/* TLS session ticket keys and session cache shared by the login processes.
+   NULL if SSL is disabled. */
+extern struct ssl_iostream_shared *master_ssl_shared;
+
+void master_ssl_shared_init(const struct master_settings *set);
+/* Configuration was reloaded. */
+void master_ssl_shared_settings_changed(const struct master_settings *set);
+void master_ssl_shared_deinit(void);
+
+#endif
@@ -21,6 +21,8 @@
 #include "master-service.h"
 #include "master-service-settings.h"
 #include "dup2-array.h"
+#include "iostream-ssl-shared.h"
+#include "master-ssl-shared.h"
 #include "service.h"
 #include "service-anvil.h"
 #include "service-listen.h"
@@ -228,6 +230,24 @@ service_dup_fds(struct service *service)
 		dup2_append(&dups, global_config_fd, MASTER_CONFIG_FD);
 		env_put(DOVECOT_CONFIG_FD_ENV, dec2str(MASTER_CONFIG_FD));
 	}
+	if (service->type == SERVICE_TYPE_LOGIN && master_ssl_shared != NULL) {
+		/* Only login processes get the TLS session state. It
+		   contains the ticket keys, so it must not be accessible
+		   to the user processes. The keys fd is read-only, so login
+		   processes can't modify the keys. The fds are placed after
+		   the listener fds. */
+		int ssl_fd = fd, keys_fd, sessions_fd;
+
+		ssl_iostream_shared_get_fds(master_ssl_shared,
+					    &keys_fd, &sessions_fd);
+		dup2_append(&dups, keys_fd, ssl_fd);
+		env_put(MASTER_SSL_SHARED_KEYS_FD_ENV, dec2str(ssl_fd++));
+		if (sessions_fd != -1) {
+			dup2_append(&dups, sessions_fd, ssl_fd);
+			env_put(MASTER_SSL_SHARED_SESSIONS_FD_ENV,
+				dec2str(ssl_fd++));
+		}
+	}
 
 	/* Switch log writing back to stderr before the log fds are closed.
 	   There's no guarantee that writing to stderr is visible anywhere, but
@@ -410,8 +410,8 @@ struct client *client_create(int fd_in, int fd_out,
 
 	p_array_init(&client->module_contexts, client->pool, 5);
         client->last_input = ioloop_time;
-	client->to_idle = timeout_add(CLIENT_IDLE_TIMEOUT_MSECS,
-				      client_idle_timeout, client);
+	client->to_idle = timeout_add_coarse(CLIENT_IDLE_TIMEOUT_MSECS,
+					     client_idle_timeout, client);
 	client->to_commit = timeout_add(CLIENT_COMMIT_TIMEOUT_MSECS,
 					client_commit_timeout, client);
 